@@ -0,0 +1,179 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <new>
+#include <atomic>
+#include <string>
+#include <sstream>
+#include <iostream>
+
+#include <Core/Buffer.h>
+#include <Core/ByteSlice.h>
+#include <Core/ProtoBuf.h>
+
+#include <RPC/RpcRequestMessage.h>
+#include <Protocol/gen-cpp/MonitorTask.pb.h>
+
+// 统计服务端接收一个上报请求时的内存分配次数
+//
+//   copy:  原来的处理路径，消息体在 Message、RpcInstance、RpcRequestMessage 之间逐层拷贝
+//   slice: 消息体从接收缓冲区取出一次，之后通过 ByteSlice 共享，直接在原始内存上反序列化
+
+using namespace tzrpc;
+
+static std::atomic<uint64_t> alloc_count(0);
+static std::atomic<uint64_t> alloc_bytes(0);
+
+void* operator new(size_t sz) {
+    ++ alloc_count;
+    alloc_bytes += sz;
+    void* ptr = ::malloc(sz ? sz : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    ::free(ptr);
+}
+
+extern char * program_invocation_short_name;
+static void usage() {
+    std::stringstream ss;
+
+    ss << program_invocation_short_name << " [data_per_report] [loop] " << std::endl;
+    ss << std::endl;
+
+    std::cerr << ss.str();
+}
+
+static int64_t now_us() {
+    struct timeval tv {};
+    ::gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+// 构造网络上收到的完整消息: Header + RpcRequestHeader + payload
+static std::string make_wire(int data_num) {
+
+    MonitorTask::MonitorWriteOps::Request request;
+    auto report = request.mutable_report();
+    report->set_version("1.0.0");
+    report->set_timestamp(::time(NULL));
+    report->set_service("alloc_bench");
+    report->set_entity_idx("1");
+    for (int i=0; i<data_num; ++i) {
+        auto data = report->add_data();
+        data->set_msgid(i);
+        data->set_metric("metric_" + std::to_string(i % 16));
+        data->set_value(1000 + i);
+        data->set_tag("T");
+    }
+
+    std::string payload;
+    ProtoBuf::marshalling_to_string(request, &payload);
+
+    RpcRequestMessage rpc_request_message(0x01, 0x02, payload);
+    Message msg(rpc_request_message.net_str());
+
+    Buffer buffer(msg);
+    std::string wire;
+    buffer.consume(wire, buffer.get_length());
+    return wire;
+}
+
+static bool copy_path(Buffer& recv, uint32_t length) {
+
+    // TcpConnAsync::parse_msg_body
+    std::string msg_str;
+    recv.consume(msg_str, length);
+    Message msg;
+    msg.payload_ = msg_str;
+
+    // RpcInstance 构造以及 validate_request
+    Buffer request(msg.payload_);
+    std::string head_str;
+    RpcRequestHeader header;
+    request.consume(head_str, sizeof(RpcRequestHeader));
+    ::memcpy(reinterpret_cast<char*>(&header), head_str.c_str(), sizeof(RpcRequestHeader));
+
+    std::string body_str;
+    request.consume(body_str, length - sizeof(RpcRequestHeader));
+    RpcRequestMessage rpc_request_message;
+    rpc_request_message.header_ = header;
+    rpc_request_message.payload_ = body_str;
+
+    MonitorTask::MonitorWriteOps::Request req;
+    return ProtoBuf::unmarshalling_from_string(rpc_request_message.payload_, &req);
+}
+
+static bool slice_path(Buffer& recv, uint32_t length) {
+
+    std::string msg_str;
+    recv.consume(msg_str, length);
+    ByteSlice body = ByteSlice::take(msg_str);
+
+    RpcRequestHeader header;
+    body.copy_to(reinterpret_cast<char*>(&header), sizeof(RpcRequestHeader));
+    ByteSlice payload = body.sub(sizeof(RpcRequestHeader));
+
+    MonitorTask::MonitorWriteOps::Request req;
+    return ProtoBuf::unmarshalling_from_array(payload.data(), payload.size(), &req);
+}
+
+static void bench(const char* name, bool (*func)(Buffer&, uint32_t), const std::string& wire, int loop) {
+
+    uint32_t length = wire.size() - sizeof(Header);
+    Buffer recv;
+
+    uint64_t count = alloc_count;
+    uint64_t bytes = alloc_bytes;
+    int64_t start = now_us();
+
+    for (int i=0; i<loop; ++i) {
+        recv.append_internal(wire.data() + sizeof(Header), length);
+        if (!func(recv, length)) {
+            std::cerr << name << " parse failed." << std::endl;
+            return;
+        }
+    }
+
+    int64_t cost = now_us() - start;
+    count = alloc_count - count;
+    bytes = alloc_bytes - bytes;
+
+    std::cout << name << ": " << loop << " requests in " << cost / 1000 << " ms, "
+              << "alloc " << static_cast<double>(count) / loop << " times/req, "
+              << bytes / loop << " bytes/req" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+
+    int data_num = 20;
+    int loop = 100000;
+
+    if (argc > 1 && (data_num = ::atoi(argv[1])) <= 0) {
+        usage();
+        return 0;
+    }
+
+    if (argc > 2 && (loop = ::atoi(argv[2])) <= 0) {
+        usage();
+        return 0;
+    }
+
+    std::string wire = make_wire(data_num);
+    std::cout << "report with " << data_num << " data, message size " << wire.size() << std::endl;
+
+    bench("copy ", copy_path,  wire, loop);
+    bench("slice", slice_path, wire, loop);
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <syslog.h>
+
+#include <Client/RpcClient.h>
+#include <Client/MonitorRpcClientHelper.h>
+
+// 网络层吞吐量测试
+//
+// 每个客户端线程使用一个独立的连接同步地发送小的上报请求，依次使用不同的连接数目，
+// 输出每个连接数目下的 tps。服务端分别使用共享io_service和独立io_service
+// (rpc.network.io_service_per_thread / reuse_port / cpu_affinity)的配置运行，
+// 比较吞吐量随IO线程数目的变化。地址使用 unix:///path 的时候比较本机 AF_UNIX 套接字和 TCP 回环的差别。
+
+using namespace heracles_client;
+
+extern char * program_invocation_short_name;
+static void usage() {
+    std::stringstream ss;
+
+    ss << program_invocation_short_name << " <addr> <port> <seconds> <conn_num> [conn_num ...] " << std::endl;
+    ss << "  e.g. " << program_invocation_short_name << " 127.0.0.1 8435 10 1 2 4 8 16" << std::endl;
+    ss << "       " << program_invocation_short_name << " unix:///var/run/heracles.sock 0 10 1 2 4 8 16" << std::endl;
+    ss << std::endl;
+
+    std::cerr << ss.str();
+}
+
+static int64_t now_us() {
+    struct timeval tv {};
+    ::gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+static std::atomic<bool>     start(false);
+static std::atomic<bool>     stop(false);
+static std::atomic<uint64_t> success(0);
+static std::atomic<uint64_t> failed(0);
+
+static void bench_run(const std::string& addr, uint16_t port, int idx) {
+
+    MonitorRpcClientHelper helper(addr, port);
+
+    // 单条数据的小报文，主要测试网络层和RPC分发的开销
+    event_report_t report {};
+    report.version    = "1.0.0";
+    report.service    = "io_bench";
+    report.entity_idx = std::to_string(idx);
+
+    event_data_t data {};
+    data.metric = "io_bench_metric";
+    data.tag    = "T";
+    report.data.push_back(data);
+
+    while (!start) {
+        ::usleep(1000);
+    }
+
+    int64_t msgid = 0;
+    while (!stop) {
+        report.timestamp      = ::time(NULL);
+        report.data[0].msgid  = ++ msgid;
+        report.data[0].value  = msgid % 1000;
+
+        if (helper.rpc_event_submit(report) == 0) {
+            ++ success;
+        } else {
+            ++ failed;
+        }
+    }
+}
+
+static void bench(const std::string& addr, uint16_t port, int seconds, int conn_num) {
+
+    start = false;
+    stop  = false;
+    success = 0;
+    failed  = 0;
+
+    std::vector<std::thread> threads;
+    for (int i=0; i<conn_num; ++i) {
+        threads.emplace_back(bench_run, addr, port, i);
+    }
+
+    ::sleep(1);
+    int64_t start_us = now_us();
+    start = true;
+
+    ::sleep(seconds);
+    stop = true;
+    int64_t cost_us = now_us() - start_us;
+
+    for (size_t i=0; i<threads.size(); ++i) {
+        threads[i].join();
+    }
+
+    std::cout << "conn " << conn_num << ": "
+              << success * 1000000 / cost_us << " tps, "
+              << "success " << success << ", failed " << failed << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+
+    int seconds = 0;
+    if (argc < 5 || (seconds = ::atoi(argv[3])) <= 0) {
+        usage();
+        return 0;
+    }
+
+    std::string addr = argv[1];
+    uint16_t    port = static_cast<uint16_t>(::atoi(argv[2]));
+
+    for (int i=4; i<argc; ++i) {
+        int conn_num = ::atoi(argv[i]);
+        if (conn_num <= 0) {
+            usage();
+            return 0;
+        }
+
+        bench(addr, port, seconds, conn_num);
+    }
+
+    return 0;
+}
@@ -0,0 +1,178 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <syslog.h>
+
+#include <Utils/Log.h>
+#include <Utils/Timer.h>
+#include <Scaffold/ConfHelper.h>
+
+#include <Connect/SqlConn.h>
+#include <Business/StoreIf.h>
+
+// mysql 写入方式的对比，需要本地有可以访问的 mysqld
+//
+//   text:     每行一条 INSERT ... SET 语句，服务端每次都重新解析
+//   prepared: 每行一次执行，使用连接上缓存的预处理语句
+//   batch:    INSERT ... VALUES (...),(...) 多行写入
+
+using namespace tzrpc;
+
+extern char * program_invocation_short_name;
+static void usage() {
+    std::stringstream ss;
+
+    ss << program_invocation_short_name << " [rows] " << std::endl;
+    ss << std::endl;
+
+    std::cerr << ss.str();
+}
+
+static int64_t now_us() {
+    struct timeval tv {};
+    ::gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+static std::string table_suffix(time_t time_sec) {
+    struct tm now_time;
+    localtime_r(&time_sec, &now_time);
+
+    char buff[20] = {0, };
+    sprintf(buff, "%04d%02d", now_time.tm_year + 1900, now_time.tm_mon + 1);
+    return buff;
+}
+
+static void make_rows(const std::string& service, int rows, time_t start, std::vector<event_insert_t>& stats) {
+
+    ::srandom(1);
+    for (int i=0; i<rows; ++i) {
+
+        event_insert_t stat {};
+        stat.service    = service;
+        stat.entity_idx = "1";
+        stat.timestamp  = start + i / 64;
+        stat.step       = 1;
+        stat.metric     = "metric_" + std::to_string(i % 8);
+        stat.tag        = "tag_" + std::to_string(i % 64 / 8);
+        stat.count      = 100 + random() % 10;
+        stat.value_sum  = stat.count * (2000 + random() % 100);
+        stat.value_avg  = stat.value_sum / stat.count;
+        stat.value_min  = 20 + random() % 5;
+        stat.value_max  = 4000 + random() % 50;
+        stat.value_p10  = 300 + random() % 20;
+        stat.value_p50  = 2000 + random() % 50;
+        stat.value_p90  = 3600 + random() % 50;
+
+        stats.push_back(stat);
+    }
+}
+
+static void report(const char* mode, size_t rows, int64_t elapse_us) {
+    std::cout << mode << ": insert " << rows << " rows in " << elapse_us / 1000 << " ms, "
+              << elapse_us / (rows ? rows : 1) << " us/row, "
+              << rows * 1000000L / (elapse_us + 1) << " rows/s" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+
+    int rows = 0;
+    if (argc < 2 || (rows = ::atoi(argv[1])) <= 0) {
+        usage();
+        return 0;
+    }
+
+    std::string cfgFile = "../heracles_example.conf";
+    if (!ConfHelper::instance().init(cfgFile)) {
+        std::cerr << "init ConfHelper with " << cfgFile << " failed." << std::endl;
+        return -1;
+    }
+
+    tzrpc::set_checkpoint_log_store_func(syslog);
+    tzrpc::log_init(4);
+    Timer::instance().init();
+
+    auto conf_ptr = ConfHelper::instance().get_conf();
+
+    std::string host, user, passwd, database, prefix;
+    int port = 0;
+    conf_ptr->lookupValue("rpc.business.mysql.host_addr", host);
+    conf_ptr->lookupValue("rpc.business.mysql.host_port", port);
+    conf_ptr->lookupValue("rpc.business.mysql.username", user);
+    conf_ptr->lookupValue("rpc.business.mysql.passwd", passwd);
+    conf_ptr->lookupValue("rpc.business.mysql.database", database);
+    conf_ptr->lookupValue("rpc.business.mysql.table_prefix", prefix);
+
+    auto store = StoreFactory("mysql");
+    if (!store) {
+        std::cerr << "create mysql store failed." << std::endl;
+        return -1;
+    }
+
+    SqlConnPoolHelper helper(host, port, user, passwd, database);
+    auto pool = std::make_shared<ConnPool<SqlConn, SqlConnPoolHelper>>("BenchPool", 1, helper);
+    if (!pool->init()) {
+        std::cerr << "init sql pool failed." << std::endl;
+        return -1;
+    }
+
+    // 每种方式写入不同的服务，先各写一行保证分表已经创建
+    time_t start = ::time(NULL) - 3600;
+    const char* modes[3] = { "text", "prepared", "batch" };
+    std::vector<event_insert_t> stats[3];
+    for (int i=0; i<3; ++i) {
+        make_rows(std::string("sql_bench_") + modes[i], rows, start, stats[i]);
+        store->insert_ev_stat(stats[i].front());
+    }
+
+    // text
+    {
+        sql_conn_ptr conn;
+        pool->request_scoped_conn(conn);
+
+        int64_t start_us = now_us();
+        for (size_t i=0; i<stats[0].size(); ++i) {
+            const event_insert_t& stat = stats[0][i];
+            std::string sql = va_format(
+                   " INSERT INTO %s.%s__%s__events_%s "
+                   " SET F_entity_idx = '%s', F_timestamp = %ld, "
+                   " F_metric = '%s', F_tag = '%s', F_step = %d, "
+                   " F_count = %d, F_value_sum = %ld, F_value_avg = %d, "
+                   " F_value_min = %d, F_value_max = %d, F_value_p10 = %d, F_value_p50 = %d, F_value_p90 = %d; ",
+                   database.c_str(), prefix.c_str(), stat.service.c_str(), table_suffix(stat.timestamp).c_str(),
+                   stat.entity_idx.c_str(), stat.timestamp,
+                   stat.metric.c_str(), stat.tag.c_str(), stat.step,
+                   stat.count, stat.value_sum, stat.value_avg,
+                   stat.value_min, stat.value_max, stat.value_p10, stat.value_p50, stat.value_p90);
+            conn->sqlconn_execute_update(sql);
+        }
+        report(modes[0], stats[0].size(), now_us() - start_us);
+    }
+
+    // prepared
+    {
+        int64_t start_us = now_us();
+        for (size_t i=0; i<stats[1].size(); ++i) {
+            store->insert_ev_stat(stats[1][i]);
+        }
+        report(modes[1], stats[1].size(), now_us() - start_us);
+    }
+
+    // batch
+    {
+        int64_t start_us = now_us();
+        store->insert_ev_stats(stats[2]);
+        report(modes[2], stats[2].size(), now_us() - start_us);
+    }
+
+    return 0;
+}
@@ -0,0 +1,79 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <syslog.h>
+
+#include <Utils/Log.h>
+#include <Utils/Timer.h>
+#include <Scaffold/ConfHelper.h>
+
+#include <Business/StoreSql.h>
+
+// mysql 分表结构 v2 的迁移和查询计划检查工具
+//
+//   dry-run:  输出 v1 分表迁移需要执行的 DDL
+//   migrate:  在线迁移所有 v1 分表
+//   explain:  对各种分组方式的查询执行 EXPLAIN
+
+using namespace tzrpc;
+
+extern char * program_invocation_short_name;
+static void usage() {
+    std::stringstream ss;
+
+    ss << program_invocation_short_name << " dry-run | migrate | explain <service> <metric> " << std::endl;
+    ss << std::endl;
+
+    std::cerr << ss.str();
+}
+
+int main(int argc, char* argv[]) {
+
+    if (argc < 2) {
+        usage();
+        return 0;
+    }
+
+    std::string cmd = argv[1];
+    if (cmd != "dry-run" && cmd != "migrate" && (cmd != "explain" || argc < 4)) {
+        usage();
+        return 0;
+    }
+
+    std::string cfgFile = "../heracles_example.conf";
+    if (!ConfHelper::instance().init(cfgFile)) {
+        std::cerr << "init ConfHelper with " << cfgFile << " failed." << std::endl;
+        return -1;
+    }
+
+    tzrpc::set_checkpoint_log_store_func(syslog);
+    tzrpc::log_init(4);
+    Timer::instance().init();
+
+    auto store = std::dynamic_pointer_cast<StoreSql>(StoreFactory("mysql"));
+    if (!store) {
+        std::cerr << "create mysql store failed." << std::endl;
+        return -1;
+    }
+
+    int ret = 0;
+    std::vector<std::string> output;
+    if (cmd == "explain") {
+        ret = store->explain_select(argv[2], argv[3], output);
+    } else {
+        ret = store->migrate_tables(cmd == "dry-run", output);
+    }
+
+    for (size_t i=0; i<output.size(); ++i) {
+        std::cout << output[i] << std::endl;
+    }
+
+    std::cout << cmd << (ret == 0 ? " OK" : " FAILED") << std::endl;
+    return ret;
+}
@@ -0,0 +1,165 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <syslog.h>
+
+#include <Utils/Log.h>
+#include <Utils/Timer.h>
+#include <Scaffold/ConfHelper.h>
+
+#include <Business/StoreIf.h>
+
+// 使用相同的合成数据，比较 leveldb、tsdb 和 redis 存储的写入、查询和磁盘占用
+// redis 需要本地有可以访问的 redis-server
+
+using namespace tzrpc;
+
+extern char * program_invocation_short_name;
+static void usage() {
+    std::stringstream ss;
+
+    ss << program_invocation_short_name << " [series_num] [points_per_series] " << std::endl;
+    ss << std::endl;
+
+    std::cerr << ss.str();
+}
+
+static int64_t now_us() {
+    struct timeval tv {};
+    ::gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+static const char* kService = "store_bench";
+static const int   kStep    = 3;
+
+static void make_points(int series_num, int points, time_t start, std::vector<event_insert_t>& stats) {
+
+    ::srandom(1);
+    for (int p=0; p<points; ++p) {
+        for (int s=0; s<series_num; ++s) {
+
+            event_insert_t stat {};
+            stat.service    = kService;
+            stat.entity_idx = "1";
+            stat.timestamp  = start + p * kStep;
+            stat.step       = kStep;
+            stat.metric     = "metric_" + std::to_string(s / 8);
+            stat.tag        = "tag_" + std::to_string(s % 8);
+            stat.count      = 100 + random() % 10;
+            stat.value_sum  = stat.count * (2000 + random() % 100);
+            stat.value_avg  = stat.value_sum / stat.count;
+            stat.value_min  = 20 + random() % 5;
+            stat.value_max  = 4000 + random() % 50;
+            stat.value_p10  = 300 + random() % 20;
+            stat.value_p50  = 2000 + random() % 50;
+            stat.value_p90  = 3600 + random() % 50;
+
+            stats.push_back(stat);
+        }
+    }
+}
+
+static void bench_store(const std::string& type, const std::string& filepath,
+                        const std::vector<event_insert_t>& stats, time_t end) {
+
+    auto store = StoreFactory(type);
+    if (!store) {
+        std::cerr << "create store " << type << " failed." << std::endl;
+        return;
+    }
+
+    // 同服务端一样，按照时间片整批写入
+    int64_t start_us = now_us();
+    for (size_t i=0; i<stats.size(); ) {
+        size_t j = i;
+        while (j < stats.size() && stats[j].timestamp == stats[i].timestamp) {
+            ++ j;
+        }
+        store->insert_ev_stats(std::vector<event_insert_t>(stats.begin() + i, stats.begin() + j));
+        i = j;
+    }
+    int64_t insert_us = now_us() - start_us;
+
+    // 等待tsdb的head落盘
+    if (type == "tsdb") {
+        ::sleep(6);
+    }
+
+    event_cond_t cond {};
+    cond.version  = "1.0.0";
+    cond.service  = kService;
+    cond.metric   = "metric_0";
+    cond.tm_start = end;
+    cond.tm_interval = end - stats.front().timestamp;
+
+    int64_t select_us[3] {};
+    GroupType groups[3] = { GroupType::kGroupNone, GroupType::kGroupbyTimestamp, GroupType::kGroupbyTag };
+    for (int i=0; i<3; ++i) {
+        cond.groupby = groups[i];
+        event_select_t stat {};
+        start_us = now_us();
+        store->select_ev_stat(cond, stat, 0);
+        select_us[i] = now_us() - start_us;
+        std::cout << "\t" << type << " groupby " << static_cast<int>(groups[i])
+                  << ", summary count " << stat.summary.count << ", info " << stat.info.size() << std::endl;
+    }
+
+    std::cout << type << ": insert " << stats.size() << " items in " << insert_us / 1000 << " ms ("
+              << stats.size() * 1000000L / (insert_us + 1) << " ops), select none/timestamp/tag "
+              << select_us[0] << "/" << select_us[1] << "/" << select_us[2] << " us" << std::endl;
+
+    if (!filepath.empty()) {
+        std::string cmd = "du -sh " + filepath;
+        ::system(cmd.c_str());
+    }
+}
+
+int main(int argc, char* argv[]) {
+
+    int series_num = 0;
+    int points = 0;
+    if (argc < 3 || (series_num = ::atoi(argv[1])) <= 0 || (points = ::atoi(argv[2])) <= 0) {
+        usage();
+        return 0;
+    }
+
+    std::string cfgFile = "../heracles_example.conf";
+    if (!ConfHelper::instance().init(cfgFile)) {
+        std::cerr << "init ConfHelper with " << cfgFile << " failed." << std::endl;
+        return -1;
+    }
+
+    tzrpc::set_checkpoint_log_store_func(syslog);
+    tzrpc::log_init(4);
+    Timer::instance().init();
+
+    std::string leveldb_path;
+    std::string tsdb_path;
+    auto conf_ptr = ConfHelper::instance().get_conf();
+    conf_ptr->lookupValue("rpc.business.leveldb.filepath", leveldb_path);
+    conf_ptr->lookupValue("rpc.business.tsdb.filepath", tsdb_path);
+
+    // 数据全部落在已经过去的时间段，tsdb可以立即落盘
+    time_t end   = ::time(NULL) - 3 * 3600;
+    time_t start = end - static_cast<time_t>(points) * kStep;
+
+    std::vector<event_insert_t> stats;
+    make_points(series_num, points, start, stats);
+    std::cout << "generated " << stats.size() << " items for " << series_num << " series" << std::endl;
+
+    bench_store("leveldb", leveldb_path, stats, end);
+    bench_store("tsdb", tsdb_path, stats, end);
+    bench_store("redis", "", stats, end);
+
+    return 0;
+}
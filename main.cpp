@@ -85,6 +85,13 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // SIGTERM/SIGINT 由主线程同步等待，之后创建的线程都继承这个屏蔽
+    sigset_t stop_set;
+    ::sigemptyset(&stop_set);
+    ::sigaddset(&stop_set, SIGTERM);
+    ::sigaddset(&stop_set, SIGINT);
+    ::pthread_sigmask(SIG_BLOCK, &stop_set, NULL);
+
     (void)tzrpc::Captain::instance(); // create object first!
 
     create_process_pid();
@@ -106,9 +113,17 @@ int main(int argc, char* argv[]) {
     tzrpc::log_info("service started at %s", mbstr);
 
     tzrpc::log_notice("whole service initialized ok!");
+
+    int stop_signal = 0;
+    ::sigwait(&stop_set, &stop_signal);
+    tzrpc::log_notice("signal %d received, stop service gracefully ...", stop_signal);
+
+    // 停止接入之后把写入阶段中的数据写完再退出
+    tzrpc::Captain::instance().service_graceful();
     tzrpc::Captain::instance().service_joinall();
 
     tzrpc::Ssl_thread_clean();
+    tzrpc::Captain::instance().service_terminate();
 
     return 0;
 }
@@ -0,0 +1,415 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <boost/algorithm/string.hpp>
+
+#include <Utils/Log.h>
+#include <Utils/Timer.h>
+
+#include <Scaffold/Status.h>
+
+#include <Business/EventCatalog.h>
+
+using namespace tzrpc;
+
+EventCatalog& EventCatalog::instance() {
+    static EventCatalog catalog {};
+    return catalog;
+}
+
+bool EventCatalog::init(const libconfig::Config& conf) {
+
+    if (!conf.lookupValue("rpc.business.catalog.filename", filename_) || filename_.empty()) {
+        log_err("Error, get rpc.business.catalog.filename failed.");
+        return false;
+    }
+
+    conf.lookupValue("rpc.business.catalog.persist_interval", persist_interval_);
+    if (persist_interval_ <= 0) {
+        log_err("Invalid catalog persist_interval: %d", persist_interval_);
+        return false;
+    }
+
+    if (load_catalog() != 0) {
+        log_err("load catalog from %s failed.", filename_.c_str());
+        return false;
+    }
+
+    if (!Timer::instance().add_timer(std::bind(&EventCatalog::persist_run, this), persist_interval_ * 1000, true)) {
+        log_err("add catalog persist_run failed.");
+        return false;
+    }
+
+    Status::instance().register_status_callback(
+                "EventCatalog",
+                std::bind(&EventCatalog::module_status, this,
+                          std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+
+    return true;
+}
+
+
+void EventCatalog::touch(const std::string& store, const std::vector<event_insert_t>& stats) {
+
+    if (stats.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(lock_);
+
+    for (auto iter = stats.begin(); iter != stats.end(); ++iter) {
+
+        auto& tags = catalog_[iter->service][iter->metric];
+        auto tag_iter = tags.find(iter->tag);
+        if (tag_iter == tags.end()) {
+            log_debug("new series for %s: %s#%s", iter->service.c_str(), iter->metric.c_str(), iter->tag.c_str());
+            catalog_tag_t item {};
+            item.first_seen_ = iter->timestamp;
+            item.last_seen_  = iter->timestamp;
+            item.stores_[store] = iter->timestamp;
+            tags[iter->tag] = item;
+            dirty_ = true;
+            continue;
+        }
+
+        auto store_iter = tag_iter->second.stores_.find(store);
+        if (store_iter == tag_iter->second.stores_.end()) {
+            tag_iter->second.stores_[store] = iter->timestamp;
+            dirty_ = true;
+        } else if (iter->timestamp > store_iter->second) {
+            store_iter->second = iter->timestamp;
+            dirty_ = true;
+        }
+
+        if (iter->timestamp > tag_iter->second.last_seen_) {
+            tag_iter->second.last_seen_ = iter->timestamp;
+            dirty_ = true;
+        }
+
+        if (iter->timestamp < tag_iter->second.first_seen_) {
+            tag_iter->second.first_seen_ = iter->timestamp;
+            dirty_ = true;
+        }
+    }
+}
+
+void EventCatalog::seed(const std::string& service, const std::vector<std::string>& metrics) {
+
+    std::lock_guard<std::mutex> lock(lock_);
+
+    auto& service_metrics = catalog_[service];
+    for (auto iter = metrics.begin(); iter != metrics.end(); ++iter) {
+        if (service_metrics.find(*iter) == service_metrics.end()) {
+            service_metrics[*iter] = catalog_tags_t();
+            dirty_ = true;
+        }
+    }
+}
+
+void EventCatalog::prune(const std::string& store, const std::string& service, time_t before) {
+
+    std::lock_guard<std::mutex> lock(lock_);
+
+    auto iter = catalog_.find(service);
+    if (iter == catalog_.end()) {
+        return;
+    }
+
+    for (auto it = iter->second.begin(); it != iter->second.end(); ) {
+
+        // 冷启动填充的指标没有时间信息，无法判断，保留
+        if (it->second.empty()) {
+            ++ it;
+            continue;
+        }
+
+        for (auto tag = it->second.begin(); tag != it->second.end(); ) {
+
+            // 只处理写入过这个存储的序列
+            auto& stores = tag->second.stores_;
+            auto store_iter = stores.find(store);
+            if (store_iter == stores.end()) {
+                ++ tag;
+                continue;
+            }
+
+            if (store_iter->second < before) {
+                stores.erase(store_iter);
+                dirty_ = true;
+
+                // 其他存储中还有数据
+                if (stores.empty()) {
+                    log_debug("prune series %s: %s#%s", service.c_str(), it->first.c_str(), tag->first.c_str());
+                    tag = it->second.erase(tag);
+                    continue;
+                }
+            } else if (stores.size() == 1 && tag->second.first_seen_ < before) {
+                tag->second.first_seen_ = before;
+                dirty_ = true;
+            }
+            ++ tag;
+        }
+
+        if (it->second.empty()) {
+            it = iter->second.erase(it);
+        } else {
+            ++ it;
+        }
+    }
+
+    if (iter->second.empty()) {
+        catalog_.erase(iter);
+    }
+}
+
+int EventCatalog::get_services(std::vector<std::string>& services) {
+
+    std::lock_guard<std::mutex> lock(lock_);
+
+    services.clear();
+    for (auto iter = catalog_.begin(); iter != catalog_.end(); ++iter) {
+        services.emplace_back(iter->first);
+    }
+
+    return 0;
+}
+
+int EventCatalog::get_metrics(const std::string& service, std::vector<std::string>& metrics) {
+
+    std::lock_guard<std::mutex> lock(lock_);
+
+    metrics.clear();
+    auto iter = catalog_.find(service);
+    if (iter == catalog_.end()) {
+        return -1;
+    }
+
+    for (auto it = iter->second.begin(); it != iter->second.end(); ++it) {
+        metrics.emplace_back(it->first);
+    }
+
+    return 0;
+}
+
+int EventCatalog::get_tags(const std::string& service, const std::string& metric,
+                           std::map<std::string, catalog_tag_t>& tags) {
+
+    std::lock_guard<std::mutex> lock(lock_);
+
+    tags.clear();
+    auto iter = catalog_.find(service);
+    if (iter == catalog_.end()) {
+        return -1;
+    }
+
+    auto it = iter->second.find(metric);
+    if (it == iter->second.end()) {
+        return -1;
+    }
+
+    tags = it->second;
+    return 0;
+}
+
+
+// 文件格式，每行一条记录，\t 分割
+//     service metric
+//     service metric tag first_seen last_seen [store:last_seen,store:last_seen...]
+// 字段中的 \\ \t \n \r 转义之后写入，旧版本没有最后的存储字段
+
+static std::string escape_field(const std::string& field) {
+
+    std::string result;
+    result.reserve(field.size());
+    for (size_t i=0; i<field.size(); ++i) {
+        switch (field[i]) {
+            case '\\': result += "\\\\"; break;
+            case '\t': result += "\\t"; break;
+            case '\n': result += "\\n"; break;
+            case '\r': result += "\\r"; break;
+            default:   result += field[i];
+        }
+    }
+
+    return result;
+}
+
+static std::string unescape_field(const std::string& field) {
+
+    std::string result;
+    result.reserve(field.size());
+    for (size_t i=0; i<field.size(); ++i) {
+        if (field[i] != '\\' || i + 1 == field.size()) {
+            result += field[i];
+            continue;
+        }
+
+        switch (field[++i]) {
+            case 't': result += '\t'; break;
+            case 'n': result += '\n'; break;
+            case 'r': result += '\r'; break;
+            default:  result += field[i];
+        }
+    }
+
+    return result;
+}
+
+int EventCatalog::load_catalog() {
+
+    std::ifstream ifs(filename_);
+    if (!ifs.is_open()) {
+        log_notice("catalog file %s not exist, start with empty catalog.", filename_.c_str());
+        return 0;
+    }
+
+    catalog_services_t catalog;
+    std::string line;
+    std::vector<std::string> vec {};
+    int line_no = 0;
+
+    while (std::getline(ifs, line)) {
+
+        ++ line_no;
+        if (line.empty()) {
+            continue;
+        }
+
+        boost::split(vec, line, boost::is_any_of("\t"));
+        for (size_t i=0; i<vec.size() && i<3; ++i) {
+            vec[i] = unescape_field(vec[i]);
+        }
+
+        if (vec.size() == 2 && !vec[0].empty() && !vec[1].empty()) {
+            catalog[vec[0]][vec[1]];
+        } else if ((vec.size() == 5 || vec.size() == 6) && !vec[0].empty() && !vec[1].empty()) {
+            catalog_tag_t item {};
+            item.first_seen_ = ::atoll(vec[3].c_str());
+            item.last_seen_  = ::atoll(vec[4].c_str());
+
+            if (vec.size() == 6 && !vec[5].empty()) {
+                std::vector<std::string> stores {};
+                boost::split(stores, vec[5], boost::is_any_of(","));
+                for (size_t i=0; i<stores.size(); ++i) {
+                    size_t pos = stores[i].rfind(':');
+                    if (pos == std::string::npos || pos == 0) {
+                        log_err("invalid catalog store %s at line %d", stores[i].c_str(), line_no);
+                        continue;
+                    }
+                    item.stores_[stores[i].substr(0, pos)] = ::atoll(stores[i].c_str() + pos + 1);
+                }
+            }
+
+            catalog[vec[0]][vec[1]][vec[2]] = item;
+        } else {
+            log_err("invalid catalog line %d: %s", line_no, line.c_str());
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(lock_);
+    catalog_.swap(catalog);
+    dirty_ = false;
+
+    log_notice("load catalog from %s with %d services", filename_.c_str(), static_cast<int>(catalog_.size()));
+    return 0;
+}
+
+int EventCatalog::persist_catalog() {
+
+    catalog_services_t catalog;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if (!dirty_) {
+            return 0;
+        }
+
+        catalog = catalog_;
+        dirty_ = false;
+    }
+
+    // 先写临时文件再rename，保证文件内容的完整
+    std::string tmp_file = filename_ + ".tmp";
+    std::ofstream ofs(tmp_file, std::ios::out | std::ios::trunc);
+    if (!ofs.is_open()) {
+        log_err("open catalog tmp file %s failed.", tmp_file.c_str());
+        std::lock_guard<std::mutex> lock(lock_);
+        dirty_ = true;
+        return -1;
+    }
+
+    for (auto iter = catalog.begin(); iter != catalog.end(); ++iter) {
+        for (auto it = iter->second.begin(); it != iter->second.end(); ++it) {
+            if (it->second.empty()) {
+                ofs << escape_field(iter->first) << "\t" << escape_field(it->first) << "\n";
+                continue;
+            }
+
+            for (auto tag = it->second.begin(); tag != it->second.end(); ++tag) {
+                ofs << escape_field(iter->first) << "\t" << escape_field(it->first) << "\t"
+                    << escape_field(tag->first) << "\t"
+                    << tag->second.first_seen_ << "\t" << tag->second.last_seen_;
+
+                // 存储类型是配置中的固定名字，不包含分隔符
+                const char* sep = "\t";
+                for (auto store = tag->second.stores_.begin(); store != tag->second.stores_.end(); ++store) {
+                    ofs << sep << store->first << ":" << store->second;
+                    sep = ",";
+                }
+                ofs << "\n";
+            }
+        }
+    }
+
+    ofs.close();
+    if (!ofs || ::rename(tmp_file.c_str(), filename_.c_str()) != 0) {
+        log_err("persist catalog to %s failed.", filename_.c_str());
+        std::lock_guard<std::mutex> lock(lock_);
+        dirty_ = true;
+        return -1;
+    }
+
+    log_debug("persist catalog to %s success.", filename_.c_str());
+    return 0;
+}
+
+void EventCatalog::persist_run() {
+    persist_catalog();
+}
+
+
+int EventCatalog::module_status(std::string& module, std::string& name, std::string& val) {
+
+    module = "heracles";
+    name   = "EventCatalog";
+
+    std::stringstream ss;
+
+    std::lock_guard<std::mutex> lock(lock_);
+
+    // 指标和序列的基数统计
+    size_t total_series = 0;
+    ss << "\t" << "services: " << catalog_.size() << std::endl;
+    for (auto iter = catalog_.begin(); iter != catalog_.end(); ++iter) {
+
+        size_t series = 0;
+        for (auto it = iter->second.begin(); it != iter->second.end(); ++it) {
+            series += it->second.size();
+        }
+        total_series += series;
+
+        ss << "\t\t" << iter->first << ": metrics " << iter->second.size()
+           << ", series " << series << std::endl;
+    }
+    ss << "\t" << "total_series: " << total_series << std::endl;
+
+    val = ss.str();
+    return 0;
+}
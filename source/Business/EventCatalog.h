@@ -0,0 +1,102 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+
+#ifndef __BUSINESS_EVENT_CATALOG_H__
+#define __BUSINESS_EVENT_CATALOG_H__
+
+#include <libconfig.h++>
+
+#include <mutex>
+#include <map>
+#include <vector>
+#include <string>
+
+#include <Business/EventItem.h>
+
+// 服务、指标目录
+//     service -> metric -> tag -> (first_seen, last_seen, store -> last_seen)
+//
+// 同一个序列可能写入多个存储(或者迁移到其他存储)，按照存储记录最后出现的时间，
+// 某个存储按照保留期限删除数据之后只清除这个存储的记录，所有存储都没有的序列才从目录中删除
+//
+// 在事件入库(flush)的时候增量维护，定期持久化到本地文件，启动时加载，
+// 这样查询服务和指标列表的时候不需要去扫描存储层
+
+struct catalog_tag_t {
+    time_t first_seen_;
+    time_t last_seen_;
+    // key: store type，旧版本的目录文件没有这个信息，为空的序列不会被清除
+    std::map<std::string, time_t> stores_;
+};
+
+typedef std::map<std::string, catalog_tag_t>     catalog_tags_t;     // key: tag
+typedef std::map<std::string, catalog_tags_t>    catalog_metrics_t;  // key: metric
+typedef std::map<std::string, catalog_metrics_t> catalog_services_t; // key: service
+
+class EventCatalog {
+
+public:
+    static EventCatalog& instance();
+
+    bool init(const libconfig::Config& conf);
+
+    // 事件成功写入 store 之后调用
+    void touch(const std::string& store, const std::vector<event_insert_t>& stats);
+
+    // 从存储层获取到的结果(没有tag信息)，用于冷启动填充
+    void seed(const std::string& service, const std::vector<std::string>& metrics);
+
+    // 存储 store 按照保留期限删除 before 之前的数据之后调用，
+    // 清除这个存储中 before 之前就不再出现的序列记录
+    void prune(const std::string& store, const std::string& service, time_t before);
+
+    int get_services(std::vector<std::string>& services);
+    int get_metrics(const std::string& service, std::vector<std::string>& metrics);
+    int get_tags(const std::string& service, const std::string& metric,
+                 std::map<std::string, catalog_tag_t>& tags);
+
+    bool empty() {
+        std::lock_guard<std::mutex> lock(lock_);
+        return catalog_.empty();
+    }
+
+    int module_status(std::string& module, std::string& name, std::string& val);
+
+private:
+
+    int load_catalog();
+    int persist_catalog();
+
+    // 定时持久化
+    void persist_run();
+
+    std::mutex lock_;
+    catalog_services_t catalog_;
+    bool dirty_;
+
+    std::string filename_;
+    int persist_interval_;
+
+private:
+    EventCatalog():
+        lock_(),
+        catalog_(),
+        dirty_(false),
+        filename_(),
+        persist_interval_(10) {
+    }
+
+    ~EventCatalog() {
+    }
+
+    // 禁止拷贝
+    EventCatalog(const EventCatalog&) = delete;
+    EventCatalog& operator=(const EventCatalog&) = delete;
+};
+
+#endif // __BUSINESS_EVENT_CATALOG_H__
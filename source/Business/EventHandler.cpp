@@ -68,7 +68,8 @@ bool EventHandler::init() {
 
                 std::string store_type;
                 handler_conf.lookupValue("store_type", store_type);
-                if (store_type == "mysql" || store_type == "redis" || store_type == "leveldb") {
+                if (store_type == "mysql" || store_type == "redis" || store_type == "leveldb" ||
+                    store_type == "tsdb") {
                     conf_.store_type_ = store_type;
                 }
 
@@ -98,6 +99,13 @@ bool EventHandler::init() {
         return false;
     }
 
+    writer_ = StoreWriterFactory(conf_.store_type_);
+    if (!writer_) {
+        log_err("store writer %s for %s not OK!",
+                conf_.store_type_.c_str(), service_.c_str());
+        return false;
+    }
+
     thread_ptr_.reset(new boost::thread(std::bind(&EventHandler::run, shared_from_this())));
     if (!thread_ptr_){
         log_err("create work thread failed! ");
@@ -265,6 +273,17 @@ int EventHandler::get_event(const event_cond_t& cond, event_select_t& stat) {
     return store_->select_ev_stat(cond, stat, conf_.event_linger_);
 }
 
+int EventHandler::get_event_stream(const event_cond_t& cond, event_select_t& stat,
+                                   size_t chunk_rows, const select_chunk_handler_t& sink) {
+
+    if (!store_) {
+        log_err("store not initialized with storetype: %s", conf_.store_type_.c_str());
+        return -1;
+    }
+
+    return store_->select_ev_stat_stream(cond, stat, conf_.event_linger_, chunk_rows, sink);
+}
+
 void EventHandler::run_once_task(std::vector<events_by_time_ptr_t> events) {
 
     log_debug("MonitorEventHandler run_once_task thread %#lx begin to run ...", (long)pthread_self());
@@ -441,6 +460,7 @@ void calc_event_info_each_metric(std::vector<event_data_t>& data,
 int EventHandler::do_process_event(events_by_time_ptr_t event, event_insert_t copy_stat) {
 
     auto& event_slot = event->data_;
+    std::vector<event_insert_t> stats {};
 
     // process event
     for (auto iter = event_slot.begin(); iter != event_slot.end(); ++iter) {
@@ -470,18 +490,27 @@ int EventHandler::do_process_event(events_by_time_ptr_t event, event_insert_t co
             copy_stat.value_p50 = tag_info[it->first].value_p50;
             copy_stat.value_p90 = tag_info[it->first].value_p90;
 
-            if (!store_ || store_->insert_ev_stat(copy_stat) != 0) {
-                log_err("store for (%s, %s) - %ld name:%s, flag:%s failed!",
-                        copy_stat.service.c_str(), copy_stat.entity_idx.c_str(),
-                        copy_stat.timestamp, copy_stat.metric.c_str(), copy_stat.tag.c_str());
-            } else {
-                log_debug("store for (%s, %s) - %ld name:%s, flag:%s ok!",
-                          copy_stat.service.c_str(), copy_stat.entity_idx.c_str(),
-                          copy_stat.timestamp, copy_stat.metric.c_str(), copy_stat.tag.c_str());
-            }
+            stats.push_back(copy_stat);
         }
     }
 
+    if (stats.empty()) {
+        return 0;
+    }
+
+    // 同一时间片的数据整批提交给写入阶段，写入队列满的时候这里会阻塞，
+    // 聚合线程不再处理新的时间片，从而形成反压
+    if (!writer_ || writer_->submit(stats) != 0) {
+        log_err("submit for (%s, %s) - %ld with %d items failed!",
+                copy_stat.service.c_str(), copy_stat.entity_idx.c_str(),
+                copy_stat.timestamp, static_cast<int>(stats.size()));
+        return -1;
+    }
+
+    log_debug("submit for (%s, %s) - %ld with %d items ok!",
+              copy_stat.service.c_str(), copy_stat.entity_idx.c_str(),
+              copy_stat.timestamp, static_cast<int>(stats.size()));
+
     return 0;
 
 }
@@ -20,6 +20,7 @@
 #include <Utils/Log.h>
 
 #include <Business/StoreIf.h>
+#include <Business/StoreWriter.h>
 #include <Business/EventItem.h>
 
 // INTEL Guaranteed Atomic Operations
@@ -66,7 +67,8 @@ public:
         conf_(),
         lock_(),
         events_(),
-        store_() {
+        store_(),
+        writer_() {
     }
 
     ~EventHandler() {
@@ -87,6 +89,8 @@ public:
     // 添加记录事件
     int add_event(const event_report_t& evs);
     int get_event(const event_cond_t& cond, event_select_t& stat);
+    int get_event_stream(const event_cond_t& cond, event_select_t& stat,
+                         size_t chunk_rows, const select_chunk_handler_t& sink);
     int get_handler_conf(EventHandlerConf& handler_conf) {
         handler_conf = conf_;
         return 0;
@@ -128,6 +132,9 @@ private:
 
     std::shared_ptr<StoreIf> store_;
 
+    // 聚合结果提交给存储的写入阶段，由其负责真正的写入
+    std::shared_ptr<StoreWriter> writer_;
+
 
 };
 
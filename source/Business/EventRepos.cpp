@@ -15,6 +15,8 @@
 
 #include <Business/EventHandler.h>
 #include <Business/StoreIf.h>
+#include <Business/EventCatalog.h>
+#include <Business/SelectExecutor.h>
 
 
 #include <Business/EventRepos.h>
@@ -98,7 +100,8 @@ bool EventRepos::init() {
 
                 std::string store_type;
                 handler_conf.lookupValue("store_type", store_type);
-                if (store_type != "mysql" && store_type != "redis" && store_type != "leveldb") {
+                if (store_type != "mysql" && store_type != "redis" && store_type != "leveldb" &&
+                    store_type != "tsdb") {
                     log_err("Invalid store_type: %s ", store_type.c_str());
                     return false;
                 }
@@ -136,6 +139,28 @@ bool EventRepos::init() {
     }
 
 
+    if (!EventCatalog::instance().init(*conf_ptr)) {
+        log_err("init EventCatalog failed.");
+        return false;
+    }
+
+    if (!SelectExecutor::instance().init(*conf_ptr)) {
+        log_err("init SelectExecutor failed.");
+        return false;
+    }
+
+    // 冷启动(或者升级)的时候目录为空，从存储层扫描一次进行填充
+    if (EventCatalog::instance().empty()) {
+        std::vector<std::string> services;
+        std::vector<std::string> metrics;
+        scan_services(services);
+        for (size_t i=0; i<services.size(); ++i) {
+            scan_metrics(services[i], metrics);
+            EventCatalog::instance().seed(services[i], metrics);
+        }
+        log_notice("seed EventCatalog with %d services from store.", static_cast<int>(services.size()));
+    }
+
     // 注册配置动态更新的回调函数
     ConfHelper::instance().register_runtime_callback(
             "EventRepos",
@@ -200,6 +225,38 @@ int EventRepos::get_event(const event_cond_t& cond, event_select_t& stat) {
     return handler->get_event(cond, stat);
 }
 
+int EventRepos::get_event_stream(const event_cond_t& cond, event_select_t& stat,
+                                 size_t chunk_rows, const select_chunk_handler_t& sink) {
+
+    if (cond.version != "1.0.0" ||
+        cond.service.empty() || cond.tm_interval < 0 || cond.metric.empty() || chunk_rows == 0) {
+        log_err("get_event_stream param check failed!");
+        return -1;
+    }
+
+    std::shared_ptr<EventHandler> handler;
+    if (find_create_event_handler(cond.service, cond.entity_idx, handler) != 0) {
+        log_err("find_or_create_event_handler for %s,%s failed.",
+                cond.service.c_str(), cond.entity_idx.c_str());
+        return -1;
+    }
+
+    SAFE_ASSERT(handler);
+    return handler->get_event_stream(cond, stat, chunk_rows, sink);
+}
+
+// 批量查询，各个查询并行执行，单个查询的结果通过 rets 返回
+int EventRepos::get_events(const std::vector<event_cond_t>& conds,
+                           std::vector<event_select_t>& stats, std::vector<int>& rets) {
+
+    if (conds.empty()) {
+        log_err("get_events param check failed!");
+        return -1;
+    }
+
+    return SelectExecutor::instance().select_batch(conds, stats, rets);
+}
+
 int EventRepos::get_metrics(const std::string& version,
                             const std::string& service, std::vector<std::string>& metric_stat) {
 
@@ -207,6 +264,35 @@ int EventRepos::get_metrics(const std::string& version,
         return -1;
     }
 
+    // 目录中不存在则返回空，不再去扫描存储层
+    if (EventCatalog::instance().get_metrics(service, metric_stat) != 0) {
+        log_debug("service %s not found in catalog.", service.c_str());
+        metric_stat.clear();
+    }
+
+    return 0;
+}
+
+
+
+int EventRepos::get_services(const std::string& version,
+                             std::vector<std::string>& service_stat) {
+
+    if (version != "1.0.0") {
+        return -1;
+    }
+
+    return EventCatalog::instance().get_services(service_stat);
+}
+
+
+// 遍历所有存储实现，只在目录冷启动的时候使用
+int EventRepos::scan_metrics(const std::string& service, std::vector<std::string>& metric_stat) {
+
+    if (service.empty()) {
+        return -1;
+    }
+
     std::set<std::string> unique_store;
     std::vector<std::string> tmp_store;
 
@@ -234,6 +320,14 @@ int EventRepos::get_metrics(const std::string& version,
         unique_store.insert(tmp_store.cbegin(), tmp_store.cend());
     }
 
+    store = StoreFactory("tsdb");
+    tmp_store.clear();
+    if (!store || store->select_metrics(service, tmp_store) != 0) {
+        log_notice("get tsdb store failed.");
+    } else {
+        unique_store.insert(tmp_store.cbegin(), tmp_store.cend());
+    }
+
     metric_stat.clear();
     metric_stat.assign(unique_store.cbegin(), unique_store.cend());
 
@@ -242,12 +336,7 @@ int EventRepos::get_metrics(const std::string& version,
 
 
 
-int EventRepos::get_services(const std::string& version,
-                             std::vector<std::string>& service_stat) {
-
-    if (version != "1.0.0") {
-        return -1;
-    }
+int EventRepos::scan_services(std::vector<std::string>& service_stat) {
 
     std::set<std::string> unique_store;
     std::vector<std::string> tmp_store;
@@ -279,6 +368,15 @@ int EventRepos::get_services(const std::string& version,
         unique_store.insert(tmp_store.cbegin(), tmp_store.cend());
     }
 
+    store = StoreFactory("tsdb");
+    tmp_store.clear();
+    if (!store || store->select_services(tmp_store) != 0) {
+        log_notice("get tsdb store failed.");
+    } else {
+        log_debug("tsdb return service %d item", static_cast<int>(tmp_store.size()));
+        unique_store.insert(tmp_store.cbegin(), tmp_store.cend());
+    }
+
     service_stat.clear();
     service_stat.assign(unique_store.cbegin(), unique_store.cend());
 
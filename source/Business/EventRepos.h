@@ -46,6 +46,11 @@ public:
     // forward request to specified handlers
     int add_event(const event_report_t& evs);
     int get_event(const event_cond_t& cond, event_select_t& stat);
+    // 分组结果通过 sink 分块交出，stat 只返回汇总信息
+    int get_event_stream(const event_cond_t& cond, event_select_t& stat,
+                         size_t chunk_rows, const select_chunk_handler_t& sink);
+    int get_events(const std::vector<event_cond_t>& conds,
+                   std::vector<event_select_t>& stats, std::vector<int>& rets);
 
     // key:service
     int get_metrics(const std::string& version, const std::string& service,
@@ -72,6 +77,10 @@ private:
     int find_create_event_handler(const std::string& service, const std::string& entity_idx,
                                   std::shared_ptr<EventHandler>& handler);
 
+    // 直接扫描存储层，用于填充EventCatalog
+    int scan_metrics(const std::string& service, std::vector<std::string>& metric_stat);
+    int scan_services(std::vector<std::string>& service_stat);
+
     // 额外处理线程组，用于辅助增强处理能力
     int support_process_task_size_;  // 目前不支持动态
     std::shared_ptr<tzrpc::TinyTask> support_task_helper_;
@@ -10,6 +10,7 @@
 #define __BUSINESS_EVENT_TYPES_H__
 
 #include <memory>
+#include <functional>
 #include <vector>
 #include <string>
 
@@ -46,10 +47,39 @@ enum class GroupType : uint8_t {
     kGroupNone = 0,
     kGroupbyTimestamp,
     kGroupbyTag,
+    kGroupbyEntity,
+
+    // 多个维度的组合分组
+    kGroupbyTimestampTag,
+    kGroupbyTimestampEntity,
+    kGroupbyTagEntity,
+    kGroupbyTimestampTagEntity,
 
     kGroupbyBoundary,
 };
 
+// 分组方式是否包含对应的维度
+inline bool groupby_has_timestamp(enum GroupType groupby) {
+    return groupby == GroupType::kGroupbyTimestamp ||
+           groupby == GroupType::kGroupbyTimestampTag ||
+           groupby == GroupType::kGroupbyTimestampEntity ||
+           groupby == GroupType::kGroupbyTimestampTagEntity;
+}
+
+inline bool groupby_has_tag(enum GroupType groupby) {
+    return groupby == GroupType::kGroupbyTag ||
+           groupby == GroupType::kGroupbyTimestampTag ||
+           groupby == GroupType::kGroupbyTagEntity ||
+           groupby == GroupType::kGroupbyTimestampTagEntity;
+}
+
+inline bool groupby_has_entity(enum GroupType groupby) {
+    return groupby == GroupType::kGroupbyEntity ||
+           groupby == GroupType::kGroupbyTimestampEntity ||
+           groupby == GroupType::kGroupbyTagEntity ||
+           groupby == GroupType::kGroupbyTimestampTagEntity;
+}
+
 enum class OrderByType : uint8_t {
     kOrderByNone = 0,
     kOrderByTimestamp = 1,
@@ -96,6 +126,17 @@ struct event_cond_t {
     enum OrderType   orders;  // desc[default], asc
     int32_t          limit;   // 限制返回排序后记录的条数
 
+    // 按照时间分组的时候，把时间戳合并到 bucket_seconds 对齐的桶中，0表示不合并
+    // 长时间范围的查询返回的条目数由 范围/bucket_seconds 决定，而不是存储的粒度
+    int32_t          bucket_seconds;
+
+    time_t bucket_of(time_t timestamp) const {
+        if (bucket_seconds <= 0) {
+            return timestamp;
+        }
+        return timestamp - timestamp % bucket_seconds;
+    }
+
     event_cond_t() :
         version("1.0.0"),
         tm_interval(0),
@@ -105,7 +146,8 @@ struct event_cond_t {
         groupby(GroupType::kGroupNone),
         orderby(OrderByType::kOrderByNone),
         orders(OrderType::kOrderDesc),
-        limit(0) {
+        limit(0),
+        bucket_seconds(0) {
     }
 
     std::string str() {
@@ -121,7 +163,8 @@ struct event_cond_t {
             << " ,groupby: " << static_cast<uint8_t>(groupby)
             << " ,orderby: " << static_cast<uint8_t>(orderby)
             << " ,orders: " << static_cast<uint8_t>(orders) 
-            << " ,limit: " << limit;
+            << " ,limit: " << limit
+            << " ,bucket_seconds: " << bucket_seconds;
             
         return ss.str();
     }
@@ -134,6 +177,7 @@ struct event_info_t {
     // groupby的时候会返回对应group信息
     time_t      timestamp;
     std::string tag;
+    std::string entity_idx;
 
     int32_t     count;
     int64_t     value_sum;
@@ -149,6 +193,7 @@ struct event_info_t {
         std::stringstream ss;
         ss  << "timestamp: " << timestamp 
             << " ,tag: " << tag 
+            << " ,entity_idx: " << entity_idx
             << " ,count: " << count 
             << " ,value_sum: " << value_sum 
             << " ,value_avg: " << value_avg 
@@ -198,6 +243,9 @@ struct event_select_t {
     }
 };
 
+// 流式查询的结果处理，每收到一块结果调用一次，返回false放弃后续的结果
+typedef std::function<bool(const std::vector<event_info_t>& rows)> select_chunk_handler_t;
+
 struct event_handler_conf_t {
     int event_linger_;
     int event_step_;
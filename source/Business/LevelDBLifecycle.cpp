@@ -0,0 +1,473 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <cstdlib>
+#include <sstream>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <dirent.h>
+
+#include <Utils/Log.h>
+#include <Utils/Timer.h>
+
+#include <Scaffold/Status.h>
+
+#include <Business/EventCatalog.h>
+#include <Business/LevelDBLifecycle.h>
+
+using namespace tzrpc;
+
+static const size_t kPartitionSuffixLen = 15; // "__events_YYYYMM"
+
+std::string LevelDBLifecycle::get_table_suffix(time_t time_sec) {
+
+    struct tm now_time;
+    localtime_r(&time_sec, &now_time);
+
+    char buff[20] = {0, };
+    sprintf(buff, "%04d%02d", now_time.tm_year + 1900, now_time.tm_mon + 1);
+
+    return buff;
+}
+
+bool LevelDBLifecycle::init(const libconfig::Config& conf) {
+
+    conf.lookupValue("rpc.business.leveldb.max_open_handles", max_open_handles_);
+    conf.lookupValue("rpc.business.leveldb.max_open_files", max_open_files_);
+    conf.lookupValue("rpc.business.leveldb.retention_months", default_retention_months_);
+    conf.lookupValue("rpc.business.leveldb.compact_hour_begin", compact_hour_begin_);
+    conf.lookupValue("rpc.business.leveldb.compact_hour_end", compact_hour_end_);
+    conf.lookupValue("rpc.business.leveldb.lifecycle_check_interval", lifecycle_check_sec_);
+
+    if (max_open_handles_ <= 0 || max_open_files_ <= 0 || default_retention_months_ < 0 ||
+        compact_hour_begin_ < 0 || compact_hour_begin_ > 23 ||
+        compact_hour_end_ < 0 || compact_hour_end_ > 23 || lifecycle_check_sec_ <= 0) {
+        log_err("invalid leveldb lifecycle conf: handles %d, files %d, retention %d, compact %d-%d, interval %d",
+                max_open_handles_, max_open_files_, default_retention_months_,
+                compact_hour_begin_, compact_hour_end_, lifecycle_check_sec_);
+        return false;
+    }
+
+    try {
+
+        if (conf.exists("rpc.business.leveldb.retention")) {
+
+            const libconfig::Setting& retentions = conf.lookup("rpc.business.leveldb.retention");
+            for(int i = 0; i < retentions.getLength(); ++i) {
+
+                const libconfig::Setting& item = retentions[i];
+                std::string service;
+                int months = 0;
+
+                if (!item.lookupValue("service_name", service) || !item.lookupValue("months", months) ||
+                    service.empty() || months < 0) {
+                    log_err("invalid leveldb retention item at %d", i);
+                    return false;
+                }
+
+                retention_months_[service] = months;
+                log_notice("leveldb retention for service %s: %d months", service.c_str(), months);
+            }
+        }
+
+    } catch (const libconfig::SettingNotFoundException &nfex) {
+        log_err("rpc.business.leveldb.retention not found!");
+        return false;
+    } catch (std::exception& e) {
+        log_err("execptions catched for %s",  e.what());
+        return false;
+    }
+
+    if (!Timer::instance().add_timer(std::bind(&LevelDBLifecycle::lifecycle_run, shared_from_this()),
+                                     lifecycle_check_sec_ * 1000, true)) {
+        log_err("add lifecycle_run failed.");
+        return false;
+    }
+
+    if (!compact_threads_.init_threads(
+            std::bind(&LevelDBLifecycle::compact_run, this, std::placeholders::_1), 1)) {
+        log_err("compact_run init task failed!");
+        return false;
+    }
+    compact_threads_.start_threads();
+
+    Status::instance().register_status_callback(
+                "LevelDBLifecycle",
+                std::bind(&LevelDBLifecycle::module_status, shared_from_this(),
+                          std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+
+    log_notice("leveldb lifecycle initialized, max_open_handles %d, max_open_files %d, "
+               "retention_months %d, compact window %d-%d",
+               max_open_handles_, max_open_files_, default_retention_months_,
+               compact_hour_begin_, compact_hour_end_);
+    return true;
+}
+
+
+std::shared_ptr<leveldb::DB> LevelDBLifecycle::get_handler(const std::string& service, const std::string& suffix,
+                                                           bool create_if_missing) {
+    return open_handler(partition_path(service, suffix), create_if_missing, false);
+}
+
+std::shared_ptr<leveldb::DB> LevelDBLifecycle::open_handler(const std::string& path, bool create_if_missing,
+                                                            bool cold) {
+
+    // 被淘汰的句柄在锁外关闭，关闭的时候可能需要等待后台的压缩完成
+    std::vector<std::shared_ptr<leveldb::DB>> victims;
+
+    std::unique_lock<std::mutex> lock(lock_);
+
+    while (true) {
+
+        auto iter = lru_handlers_.find(path);
+        if (iter != lru_handlers_.end()) {
+            if (!cold) {
+                lru_list_.splice(lru_list_.begin(), lru_list_, iter->second.second);
+            }
+            return iter->second.first;
+        }
+
+        if (opening_.find(path) == opening_.end()) {
+            break;
+        }
+
+        open_notify_.wait(lock);
+    }
+
+    // DB::Open 需要读取日志恢复数据，不能阻塞其他分区的获取
+    opening_.insert(path);
+    lock.unlock();
+
+    leveldb::Options options;
+    options.create_if_missing = create_if_missing;
+    options.max_open_files = max_open_files_;
+    leveldb::DB* db = NULL;
+    leveldb::Status status = leveldb::DB::Open(options, path, &db);
+
+    lock.lock();
+    opening_.erase(path);
+    open_notify_.notify_all();
+
+    if (!status.ok()) {
+        log_err("Open levelDB %s failed: %s", path.c_str(), status.ToString().c_str());
+        return std::shared_ptr<leveldb::DB>();
+    }
+
+    std::shared_ptr<leveldb::DB> handler(db);
+    if (cold) {
+        lru_list_.push_back(path);
+        lru_handlers_[path] = lru_entry_t(handler, std::prev(lru_list_.end()));
+    } else {
+        lru_list_.push_front(path);
+        lru_handlers_[path] = lru_entry_t(handler, lru_list_.begin());
+    }
+    ++ opened_count_;
+
+    // 超过容量，从最久未使用的句柄开始淘汰，还被调用者持有的句柄跳过，
+    // 否则同一个分区再次打开的时候会因为旧的句柄还持有 LOCK 文件而失败
+    auto victim = lru_list_.end();
+    while (!cold && lru_handlers_.size() > static_cast<size_t>(max_open_handles_) &&
+           victim != lru_list_.begin()) {
+
+        -- victim;
+        auto entry = lru_handlers_.find(*victim);
+        if (entry->second.first.use_count() > 1) {
+            continue;
+        }
+
+        log_debug("evict leveldb handler %s", victim->c_str());
+        victims.push_back(entry->second.first);
+        lru_handlers_.erase(entry);
+        victim = lru_list_.erase(victim);
+        ++ evicted_count_;
+    }
+
+    log_notice("success open leveldb %s", path.c_str());
+    lock.unlock();
+
+    return handler;
+}
+
+
+bool LevelDBLifecycle::evict_handler(const std::string& path) {
+
+    std::lock_guard<std::mutex> lock(lock_);
+
+    auto iter = lru_handlers_.find(path);
+    if (iter == lru_handlers_.end()) {
+        return false;
+    }
+
+    bool in_use = iter->second.first.use_count() > 1;
+    if (!in_use) {
+        lru_list_.erase(iter->second.second);
+        lru_handlers_.erase(iter);
+    }
+
+    return in_use;
+}
+
+
+int LevelDBLifecycle::list_partitions(std::map<std::string, std::set<std::string>>& partitions) {
+
+    DIR *d = NULL;
+    struct dirent* d_item = NULL;
+    struct stat sb;
+
+    if (!(d = opendir(filepath_.c_str()))) {
+        log_err("opendir for %s failed.",  filepath_.c_str());
+        return -1;
+    }
+
+    partitions.clear();
+    std::string prefix = table_prefix_ + "__";
+
+    while ( (d_item = readdir(d)) != NULL ) {
+
+        // 跳过隐藏目录
+        if (::strncmp(d_item->d_name, ".", 1) == 0) {
+            continue;
+        }
+
+        std::string t_name = d_item->d_name;
+        std::string fullfile = filepath_ + "/" + t_name;
+        if (stat(fullfile.c_str(), &sb) != 0 || !S_ISDIR(sb.st_mode)) {
+            continue;
+        }
+
+        if (t_name.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+
+        if (t_name.size() <= prefix.size() + kPartitionSuffixLen ||
+            t_name.compare(t_name.size() - kPartitionSuffixLen, 9, "__events_") != 0) {
+            log_err("invalid table_name: %s", t_name.c_str());
+            continue;
+        }
+
+        std::string service = t_name.substr(prefix.size(), t_name.size() - prefix.size() - kPartitionSuffixLen);
+        std::string suffix  = t_name.substr(t_name.size() - 6);
+        partitions[service].insert(suffix);
+    }
+
+    closedir(d);
+    return 0;
+}
+
+
+int LevelDBLifecycle::retention_months_of(const std::string& service) const {
+
+    auto iter = retention_months_.find(service);
+    if (iter != retention_months_.end()) {
+        return iter->second;
+    }
+
+    return default_retention_months_;
+}
+
+bool LevelDBLifecycle::in_compact_window(time_t now) const {
+
+    if (compact_hour_begin_ == compact_hour_end_) {
+        return false;
+    }
+
+    struct tm now_time;
+    localtime_r(&now, &now_time);
+    int hour = now_time.tm_hour;
+
+    // 支持跨越零点的时段，比如 22-4
+    if (compact_hour_begin_ < compact_hour_end_) {
+        return hour >= compact_hour_begin_ && hour < compact_hour_end_;
+    }
+
+    return hour >= compact_hour_begin_ || hour < compact_hour_end_;
+}
+
+
+int LevelDBLifecycle::drop_expired_partitions(const std::map<std::string, std::set<std::string>>& partitions) {
+
+    time_t now = ::time(NULL);
+    struct tm now_time;
+    localtime_r(&now, &now_time);
+    int now_months = (now_time.tm_year + 1900) * 12 + now_time.tm_mon;
+
+    int dropped = 0;
+    for (auto iter = partitions.begin(); iter != partitions.end(); ++iter) {
+
+        int months = retention_months_of(iter->first);
+        if (months <= 0) {
+            continue;
+        }
+
+        // 保留包括当月在内的 months 个分区
+        int cutoff = now_months - (months - 1);
+        char cutoff_suffix[20] = {0, };
+        snprintf(cutoff_suffix, sizeof(cutoff_suffix), "%04d%02d", cutoff / 12, cutoff % 12 + 1);
+
+        // 过期的分区全部删除之后才能清理目录
+        bool all_dropped = true;
+        for (auto it = iter->second.begin(); it != iter->second.end(); ++it) {
+
+            if (*it >= cutoff_suffix) {
+                break; // set有序
+            }
+
+            std::string path = partition_path(iter->first, *it);
+            if (evict_handler(path)) {
+                log_notice("partition %s still in use, delay drop.", path.c_str());
+                all_dropped = false;
+                continue;
+            }
+
+            leveldb::Status status = leveldb::DestroyDB(path, leveldb::Options());
+            if (!status.ok()) {
+                log_err("drop expired partition %s failed: %s", path.c_str(), status.ToString().c_str());
+                all_dropped = false;
+                continue;
+            }
+
+            log_notice("drop expired partition %s, retention %d months", path.c_str(), months);
+            ++ dropped;
+        }
+
+        if (!all_dropped) {
+            continue;
+        }
+
+        // leveldb 中只剩下保留期限内的序列，其他存储中的记录不受影响
+        struct tm cutoff_time {};
+        cutoff_time.tm_year = cutoff / 12 - 1900;
+        cutoff_time.tm_mon  = cutoff % 12;
+        cutoff_time.tm_mday = 1;
+        cutoff_time.tm_isdst = -1;
+        EventCatalog::instance().prune("leveldb", iter->first, ::mktime(&cutoff_time));
+    }
+
+    std::lock_guard<std::mutex> lock(lock_);
+    dropped_count_ += dropped;
+    return dropped;
+}
+
+
+int LevelDBLifecycle::compact_closed_partition(const std::map<std::string, std::set<std::string>>& partitions) {
+
+    std::string now_suffix = get_table_suffix(::time(NULL));
+
+    // 每次只压缩一个分区，避免低峰期的IO突发
+    for (auto iter = partitions.begin(); iter != partitions.end(); ++iter) {
+        for (auto it = iter->second.begin(); it != iter->second.end(); ++it) {
+
+            if (*it >= now_suffix) {
+                break;
+            }
+
+            std::string path = partition_path(iter->first, *it);
+            if (compacted_.find(path) != compacted_.end()) {
+                continue;
+            }
+
+            // 压缩的分区放在LRU的尾部，不会挤掉正在写入和查询的句柄
+            auto handler = open_handler(path, false, true);
+            if (!handler) {
+                log_err("get handler for partition %s failed.", path.c_str());
+                compacted_.insert(path);
+                continue;
+            }
+
+            log_notice("begin compact closed partition %s", path.c_str());
+            handler->CompactRange(NULL, NULL);
+            log_notice("finish compact closed partition %s", path.c_str());
+
+            compacted_.insert(path);
+
+            std::lock_guard<std::mutex> lock(lock_);
+            ++ compacted_count_;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+void LevelDBLifecycle::lifecycle_run() {
+
+    std::map<std::string, std::set<std::string>> partitions;
+    if (list_partitions(partitions) != 0) {
+        log_err("list leveldb partitions failed.");
+        return;
+    }
+
+    drop_expired_partitions(partitions);
+}
+
+void LevelDBLifecycle::compact_run(ThreadObjPtr ptr) {
+
+    log_alert("leveldb compact thread %#lx about to loop ...", (long)pthread_self());
+
+    time_t last_check = ::time(NULL);
+
+    while (true) {
+
+        if (unlikely(ptr->status_ == ThreadStatus::kTerminating)) {
+            log_err("thread %#lx is about to terminating...", (long)pthread_self());
+            break;
+        }
+
+        // 线程启动
+        if (unlikely(ptr->status_ == ThreadStatus::kSuspend)) {
+            ::usleep(1*1000*1000);
+            continue;
+        }
+
+        // 每秒检查一次线程状态
+        ::sleep(1);
+
+        time_t now = ::time(NULL);
+        if (now < last_check + lifecycle_check_sec_) {
+            continue;
+        }
+        last_check = now;
+
+        std::map<std::string, std::set<std::string>> partitions;
+        if (in_compact_window(now) && list_partitions(partitions) == 0) {
+            compact_closed_partition(partitions);
+        }
+    }
+
+    ptr->status_ = ThreadStatus::kDead;
+    log_info("leveldb compact thread %#lx is about to terminate ... ", (long)pthread_self());
+}
+
+
+int LevelDBLifecycle::module_status(std::string& module, std::string& name, std::string& val) {
+
+    module = "heracles";
+    name   = "LevelDBLifecycle";
+
+    std::stringstream ss;
+
+    std::lock_guard<std::mutex> lock(lock_);
+
+    ss << "\t" << "open_handles: " << lru_handlers_.size() << "/" << max_open_handles_ << std::endl;
+    ss << "\t" << "max_open_files: " << max_open_files_ << std::endl;
+    ss << "\t" << "retention_months: " << default_retention_months_ << std::endl;
+    for (auto iter = retention_months_.begin(); iter != retention_months_.end(); ++iter) {
+        ss << "\t\t" << iter->first << ": " << iter->second << std::endl;
+    }
+    ss << "\t" << "compact_window: " << compact_hour_begin_ << "-" << compact_hour_end_ << std::endl;
+    ss << "\t" << "opened: " << opened_count_ << std::endl;
+    ss << "\t" << "evicted: " << evicted_count_ << std::endl;
+    ss << "\t" << "dropped: " << dropped_count_ << std::endl;
+    ss << "\t" << "compacted: " << compacted_count_ << std::endl;
+
+    val = ss.str();
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+
+#ifndef __BUSINESS_LEVELDB_LIFECYCLE_H__
+#define __BUSINESS_LEVELDB_LIFECYCLE_H__
+
+#include <xtra_rhel.h>
+
+#include <libconfig.h++>
+
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <leveldb/db.h>
+
+#include <Utils/ThreadPool.h>
+
+
+// leveldb 分区生命周期管理
+// 每个 service 每个月一个独立的 leveldb 目录(分区)
+//     filepath/table_prefix__service__events_YYYYMM
+//
+// 1. 打开的分区句柄通过 LRU 进行缓存，限制同时打开的句柄数和文件描述符，
+//    还在被使用的句柄不会被淘汰，否则再次打开同一个分区会因为 LOCK 文件而失败
+// 2. 按照 service 的保留月数，整个分区目录直接删除，避免逐行删除
+// 3. 已经关闭(非当月)的分区，在配置的低峰时间段由独立的线程执行 CompactRange
+
+class LevelDBLifecycle: public std::enable_shared_from_this<LevelDBLifecycle> {
+
+public:
+    LevelDBLifecycle(const std::string& filepath, const std::string& table_prefix):
+        filepath_(filepath),
+        table_prefix_(table_prefix),
+        lock_(),
+        lru_list_(),
+        lru_handlers_(),
+        open_notify_(),
+        opening_(),
+        max_open_handles_(64),
+        max_open_files_(256),
+        default_retention_months_(0),
+        retention_months_(),
+        compact_hour_begin_(0),
+        compact_hour_end_(0),
+        lifecycle_check_sec_(600),
+        compacted_(),
+        compact_threads_(),
+        opened_count_(0),
+        evicted_count_(0),
+        dropped_count_(0),
+        compacted_count_(0) {
+    }
+
+    ~LevelDBLifecycle() {
+        // 压缩线程会使用下面的成员，需要先于成员析构停止
+        compact_threads_.graceful_stop_threads();
+    }
+
+    // 禁止拷贝
+    LevelDBLifecycle(const LevelDBLifecycle&) = delete;
+    LevelDBLifecycle& operator=(const LevelDBLifecycle&) = delete;
+
+    bool init(const libconfig::Config& conf);
+
+    // 获取 service 某个分区的句柄，只有当前写入的分区才允许自动创建
+    std::shared_ptr<leveldb::DB> get_handler(const std::string& service, const std::string& suffix,
+                                             bool create_if_missing);
+
+    // 遍历存储目录，返回 service -> 所有分区后缀
+    int list_partitions(std::map<std::string, std::set<std::string>>& partitions);
+
+    int module_status(std::string& module, std::string& name, std::string& val);
+
+    static std::string get_table_suffix(time_t time_sec);
+
+private:
+
+    std::string partition_path(const std::string& service, const std::string& suffix) const {
+        return filepath_ + "/" + table_prefix_ + "__" + service + "__events_" + suffix;
+    }
+
+    // cold 表示只是临时使用的分区(压缩)，放在LRU的尾部并且不触发其他句柄的淘汰
+    std::shared_ptr<leveldb::DB> open_handler(const std::string& path, bool create_if_missing, bool cold);
+
+    // 定时任务: 过期分区删除
+    void lifecycle_run();
+
+    // 独立线程: 低峰期压缩，CompactRange 可能持续数分钟，不能占用 Timer 线程
+    void compact_run(tzrpc::ThreadObjPtr ptr);
+
+    int  drop_expired_partitions(const std::map<std::string, std::set<std::string>>& partitions);
+    int  compact_closed_partition(const std::map<std::string, std::set<std::string>>& partitions);
+
+    bool in_compact_window(time_t now) const;
+    int  retention_months_of(const std::string& service) const;
+
+    // 从LRU中移除，返回是否还有外部引用
+    bool evict_handler(const std::string& path);
+
+    const std::string filepath_;
+    const std::string table_prefix_;
+
+    // LRU: 链表头部为最近使用
+    std::mutex lock_;
+    typedef std::pair<std::shared_ptr<leveldb::DB>, std::list<std::string>::iterator> lru_entry_t;
+    std::list<std::string> lru_list_;
+    std::map<std::string, lru_entry_t> lru_handlers_;
+
+    // 正在打开的分区，DB::Open 在锁外执行，相同分区的其他请求等待其完成
+    std::condition_variable open_notify_;
+    std::set<std::string> opening_;
+
+    int max_open_handles_;  // 同时打开的分区句柄数目
+    int max_open_files_;    // 每个分区 leveldb 的 max_open_files
+
+    int default_retention_months_;   // 0 表示永久保存
+    std::map<std::string, int> retention_months_;
+
+    // 低峰期压缩时段 [begin, end)，小时，相等表示禁用
+    int compact_hour_begin_;
+    int compact_hour_end_;
+    int lifecycle_check_sec_;
+
+    // 已经压缩过的分区，只在压缩线程中访问
+    std::set<std::string> compacted_;
+    tzrpc::ThreadPool compact_threads_;
+
+    // 统计信息，受 lock_ 保护
+    uint64_t opened_count_;
+    uint64_t evicted_count_;
+    uint64_t dropped_count_;
+    uint64_t compacted_count_;
+};
+
+#endif // __BUSINESS_LEVELDB_LIFECYCLE_H__
@@ -0,0 +1,229 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <sstream>
+#include <map>
+
+#include <Utils/Log.h>
+
+#include <Scaffold/Status.h>
+
+#include <Business/EventRepos.h>
+#include <Business/SelectExecutor.h>
+
+using namespace tzrpc;
+
+// 查询条件的完整描述，用于批次内去重
+static std::string cond_key(const event_cond_t& cond) {
+
+    std::stringstream ss;
+    ss << cond.version << '\1' << cond.service << '\1' << cond.metric << '\1'
+       << cond.tm_interval << '\1' << cond.tm_start << '\1'
+       << cond.entity_idx << '\1' << cond.tag << '\1'
+       << static_cast<int32_t>(cond.groupby) << '\1' << static_cast<int32_t>(cond.orderby) << '\1'
+       << static_cast<int32_t>(cond.orders) << '\1' << cond.limit << '\1' << cond.bucket_seconds;
+
+    return ss.str();
+}
+
+
+SelectExecutor& SelectExecutor::instance() {
+    static SelectExecutor executor {};
+    return executor;
+}
+
+
+bool SelectExecutor::init(const libconfig::Config& conf) {
+
+    int value_i = 0;
+    if (conf.lookupValue("rpc.business.select.thread_number", value_i) && value_i > 0) {
+        thread_number_ = value_i;
+    }
+
+    if (conf.lookupValue("rpc.business.select.max_batch_size", value_i) && value_i > 0) {
+        max_batch_size_ = value_i;
+    }
+
+    log_info("select executor thread_number %d, max_batch_size %lu", thread_number_, max_batch_size_);
+
+    if (!select_threads_.init_threads(
+            std::bind(&SelectExecutor::select_run, this, std::placeholders::_1), thread_number_)) {
+        log_err("select_run init task failed!");
+        return false;
+    }
+    select_threads_.start_threads();
+
+    Status::instance().register_status_callback(
+                "SelectExecutor",
+                std::bind(&SelectExecutor::module_status, this,
+                          std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+
+    return true;
+}
+
+
+int SelectExecutor::select_batch(const std::vector<event_cond_t>& conds,
+                                 std::vector<event_select_t>& stats, std::vector<int>& rets) {
+
+    if (conds.empty() || conds.size() > max_batch_size_) {
+        log_err("invalid batch size %lu, max_batch_size %lu", conds.size(), max_batch_size_);
+        return -1;
+    }
+
+    auto ctx = std::make_shared<batch_ctx_t>();
+    if (!ctx) {
+        log_err("create batch_ctx_t failed.");
+        return -1;
+    }
+
+    // slot[i] 为第i个请求对应的去重后查询位置
+    std::vector<size_t> slot(conds.size());
+    std::map<std::string, size_t> unique;
+    for (size_t i=0; i<conds.size(); ++i) {
+        auto iter = unique.find(cond_key(conds[i]));
+        if (iter != unique.end()) {
+            slot[i] = iter->second;
+            ++ select_dedup_;
+            continue;
+        }
+
+        slot[i] = ctx->conds_.size();
+        unique[cond_key(conds[i])] = slot[i];
+        ctx->conds_.push_back(&conds[i]);
+    }
+
+    size_t total = ctx->conds_.size();
+    ctx->stats_.resize(total);
+    ctx->rets_.assign(total, -1);
+    ctx->next_ = 0;
+    ctx->done_ = 0;
+
+    ++ batch_count_;
+    select_count_ += total;
+
+    // 只有一个查询的时候直接在当前线程执行
+    if (total > 1) {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            queue_.push_back(ctx);
+        }
+        item_notify_.notify_all();
+    }
+
+    while (run_one(ctx)) {
+        ++ select_by_caller_;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(ctx->lock_);
+        while (ctx->done_ < total) {
+            ctx->done_notify_.wait(lock);
+        }
+    }
+
+    stats.resize(conds.size());
+    rets.resize(conds.size());
+    for (size_t i=0; i<conds.size(); ++i) {
+        stats[i] = ctx->stats_[slot[i]];
+        rets[i]  = ctx->rets_[slot[i]];
+        if (rets[i] != 0) {
+            ++ select_failed_;
+        }
+    }
+
+    return 0;
+}
+
+
+bool SelectExecutor::run_one(batch_ctx_ptr ctx) {
+
+    size_t idx = ctx->next_++;
+    if (idx >= ctx->conds_.size()) {
+        return false;
+    }
+
+    ctx->rets_[idx] = EventRepos::instance().get_event(*ctx->conds_[idx], ctx->stats_[idx]);
+
+    {
+        std::lock_guard<std::mutex> lock(ctx->lock_);
+        ++ ctx->done_;
+    }
+    ctx->done_notify_.notify_all();
+
+    return true;
+}
+
+
+void SelectExecutor::select_run(ThreadObjPtr ptr) {
+
+    log_alert("select executor thread %#lx about to loop ...", (long)pthread_self());
+
+    while (true) {
+
+        if (unlikely(ptr->status_ == ThreadStatus::kTerminating)) {
+            log_err("thread %#lx is about to terminating...", (long)pthread_self());
+            break;
+        }
+
+        // 线程启动
+        if (unlikely(ptr->status_ == ThreadStatus::kSuspend)) {
+            ::usleep(1*1000*1000);
+            continue;
+        }
+
+        batch_ctx_ptr ctx;
+
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+
+            // 已经被领取完的批次直接出队
+            while (!queue_.empty() && queue_.front()->next_ >= queue_.front()->conds_.size()) {
+                queue_.pop_front();
+            }
+
+            // 超时返回以便检查线程状态
+            if (queue_.empty()) {
+                item_notify_.wait_for(lock, std::chrono::seconds(1));
+                continue;
+            }
+
+            ctx = queue_.front();
+        }
+
+        run_one(ctx);
+    }
+
+    ptr->status_ = ThreadStatus::kDead;
+    log_info("select executor thread %#lx is about to terminate ... ", (long)pthread_self());
+
+    return;
+}
+
+
+int SelectExecutor::module_status(std::string& module, std::string& name, std::string& val) {
+
+    module = "heracles";
+    name   = "SelectExecutor";
+
+    std::stringstream ss;
+
+    ss << "\t" << "thread_number: " << select_threads_.get_pool_size() << std::endl;
+    ss << "\t" << "max_batch_size: " << max_batch_size_ << std::endl;
+    ss << "\t" << "batch_count: " << batch_count_ << std::endl;
+    ss << "\t" << "select_count: " << select_count_
+       << ", dedup " << select_dedup_
+       << ", by_caller " << select_by_caller_
+       << ", failed " << select_failed_ << std::endl;
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        ss << "\t" << "pending_batch: " << queue_.size() << std::endl;
+    }
+
+    val = ss.str();
+    return 0;
+}
@@ -0,0 +1,107 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+
+#ifndef __BUSINESS_SELECT_EXECUTOR_H__
+#define __BUSINESS_SELECT_EXECUTOR_H__
+
+#include <xtra_rhel.h>
+
+#include <libconfig.h++>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+#include <Utils/ThreadPool.h>
+
+#include <Business/EventTypes.h>
+
+// 批量查询执行
+//
+// 一个批量请求中的多个查询分发到查询线程组并行执行，发起请求的线程也参与执行
+// 自己批次中的查询，全部完成之后一次性返回。
+// 批次中条件完全相同的查询只执行一次，结果复制给其他的请求位置。
+
+class SelectExecutor {
+
+public:
+    static SelectExecutor& instance();
+
+    bool init(const libconfig::Config& conf);
+
+    // stats 和 rets 与 conds 一一对应，单个查询失败不影响其他查询
+    int select_batch(const std::vector<event_cond_t>& conds,
+                     std::vector<event_select_t>& stats, std::vector<int>& rets);
+
+    size_t max_batch_size() const {
+        return max_batch_size_;
+    }
+
+    int module_status(std::string& module, std::string& name, std::string& val);
+
+private:
+
+    struct batch_ctx_t {
+        std::vector<const event_cond_t*> conds_;   // 去重之后的查询
+        std::vector<event_select_t> stats_;
+        std::vector<int> rets_;
+
+        std::atomic<size_t> next_;      // 下一个待领取的查询
+        size_t done_;
+        std::mutex lock_;
+        std::condition_variable done_notify_;
+    };
+    typedef std::shared_ptr<batch_ctx_t> batch_ctx_ptr;
+
+    // 领取并执行批次中的一个查询，没有可以领取的返回false
+    bool run_one(batch_ctx_ptr ctx);
+    void select_run(tzrpc::ThreadObjPtr ptr);
+
+    int thread_number_;
+    size_t max_batch_size_;
+
+    std::mutex lock_;
+    std::condition_variable item_notify_;
+    std::deque<batch_ctx_ptr> queue_;
+
+    tzrpc::ThreadPool select_threads_;
+
+    // 统计信息
+    std::atomic<uint64_t> batch_count_;
+    std::atomic<uint64_t> select_count_;
+    std::atomic<uint64_t> select_dedup_;
+    std::atomic<uint64_t> select_by_caller_;
+    std::atomic<uint64_t> select_failed_;
+
+private:
+    SelectExecutor():
+        thread_number_(4),
+        max_batch_size_(64),
+        lock_(),
+        item_notify_(),
+        queue_(),
+        select_threads_(),
+        batch_count_(0),
+        select_count_(0),
+        select_dedup_(0),
+        select_by_caller_(0),
+        select_failed_(0) {
+    }
+
+    ~SelectExecutor() {
+        select_threads_.graceful_stop_threads();
+    }
+
+    // 禁止拷贝
+    SelectExecutor(const SelectExecutor&) = delete;
+    SelectExecutor& operator=(const SelectExecutor&) = delete;
+};
+
+
+#endif // __BUSINESS_SELECT_EXECUTOR_H__
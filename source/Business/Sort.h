@@ -10,186 +10,269 @@
 #define __BUSINESS_SORT_H__
 
 #include <iostream>
+#include <algorithm>
 #include <Business/EventTypes.h>
 
 
+// 排序字段的提取，每个 OrderByType 在编译期对应一个特化
+// key_t 为排序时抽取出来的键，tag 只保存指针避免拷贝字符串
+
+template <enum OrderByType BTP>
+struct OrderKey;
+
+#define ORDER_KEY_NUMERIC(btp, field)                                           \
+template <>                                                                     \
+struct OrderKey<btp> {                                                          \
+    typedef int64_t key_t;                                                      \
+    static key_t get(const event_info_t& info) { return info.field; }           \
+    static bool less(key_t lhs, key_t rhs) { return lhs < rhs; }                \
+};
+
+ORDER_KEY_NUMERIC(OrderByType::kOrderByTimestamp, timestamp)
+ORDER_KEY_NUMERIC(OrderByType::kOrderByCount,     count)
+ORDER_KEY_NUMERIC(OrderByType::kOrderBySum,       value_sum)
+ORDER_KEY_NUMERIC(OrderByType::kOrderByAvg,       value_avg)
+ORDER_KEY_NUMERIC(OrderByType::kOrderByMin,       value_min)
+ORDER_KEY_NUMERIC(OrderByType::kOrderByMax,       value_max)
+ORDER_KEY_NUMERIC(OrderByType::kOrderByP10,       value_p10)
+ORDER_KEY_NUMERIC(OrderByType::kOrderByP50,       value_p50)
+ORDER_KEY_NUMERIC(OrderByType::kOrderByP90,       value_p90)
+
+#undef ORDER_KEY_NUMERIC
+
+template <>
+struct OrderKey<OrderByType::kOrderByTag> {
+    typedef const std::string* key_t;
+    static key_t get(const event_info_t& info) { return &info.tag; }
+    static bool less(key_t lhs, key_t rhs) { return *lhs < *rhs; }
+};
+
+
 class Sort {
 
 public:
 
-    static void do_sort(std::vector<event_info_t>& info, const enum OrderByType& btp, const enum OrderType& tp) {
+    // 进行结果排序，limit > 0 的时候只保留排序最靠前的 limit 条
+    //
+    // 先把排序键和下标抽取成紧凑的数组，只对这个数组排序，
+    // 最后按照顺序一次性移动需要返回的 event_info_t，而不是在排序中反复交换整个结构
+    static void do_sort(std::vector<event_info_t>& info, const enum OrderByType& btp, const enum OrderType& tp,
+                        size_t limit = 0) {
+
+        bool desc = (tp == OrderType::kOrderDesc);
 
-        // 进行结果排序
         switch (btp) {
             case OrderByType::kOrderByTimestamp:
-                if (tp == OrderType::kOrderDesc)
-                    std::sort(info.begin(), info.end(), Sort::sort_by_timestamp_desc);
-                else
-                    std::sort(info.begin(), info.end(), Sort::sort_by_timestamp);
+                sort_impl<OrderByType::kOrderByTimestamp>(info, desc, limit);
                 break;
 
             case OrderByType::kOrderByTag:
-                if (tp == OrderType::kOrderDesc)
-                    std::sort(info.begin(), info.end(), Sort::sort_by_tag_desc);
-                else
-                    std::sort(info.begin(), info.end(), Sort::sort_by_tag);
+                sort_impl<OrderByType::kOrderByTag>(info, desc, limit);
                 break;
 
             case OrderByType::kOrderByCount:
-                if (tp == OrderType::kOrderDesc)
-                    std::sort(info.begin(), info.end(), Sort::sort_by_count_desc);
-                else
-                    std::sort(info.begin(), info.end(), Sort::sort_by_count);
+                sort_impl<OrderByType::kOrderByCount>(info, desc, limit);
                 break;
 
-
             case OrderByType::kOrderBySum:
-                if (tp == OrderType::kOrderDesc)
-                    std::sort(info.begin(), info.end(), Sort::sort_by_sum_desc);
-                else
-                    std::sort(info.begin(), info.end(), Sort::sort_by_sum);
+                sort_impl<OrderByType::kOrderBySum>(info, desc, limit);
                 break;
 
-
             case OrderByType::kOrderByAvg:
-                if (tp == OrderType::kOrderDesc)
-                    std::sort(info.begin(), info.end(), Sort::sort_by_avg_desc);
-                else
-                    std::sort(info.begin(), info.end(), Sort::sort_by_avg);
+                sort_impl<OrderByType::kOrderByAvg>(info, desc, limit);
                 break;
 
-
             case OrderByType::kOrderByMin:
-                if (tp == OrderType::kOrderDesc)
-                    std::sort(info.begin(), info.end(), Sort::sort_by_min_desc);
-                else
-                    std::sort(info.begin(), info.end(), Sort::sort_by_min);
+                sort_impl<OrderByType::kOrderByMin>(info, desc, limit);
                 break;
 
             case OrderByType::kOrderByMax:
-                if (tp == OrderType::kOrderDesc)
-                    std::sort(info.begin(), info.end(), Sort::sort_by_max_desc);
-                else
-                    std::sort(info.begin(), info.end(), Sort::sort_by_max);
+                sort_impl<OrderByType::kOrderByMax>(info, desc, limit);
                 break;
 
-
             case OrderByType::kOrderByP10:
-                if (tp == OrderType::kOrderDesc)
-                    std::sort(info.begin(), info.end(), Sort::sort_by_p10_desc);
-                else
-                    std::sort(info.begin(), info.end(), Sort::sort_by_p10);
+                sort_impl<OrderByType::kOrderByP10>(info, desc, limit);
                 break;
 
             case OrderByType::kOrderByP50:
-                if (tp == OrderType::kOrderDesc)
-                    std::sort(info.begin(), info.end(), Sort::sort_by_p50_desc);
-                else
-                    std::sort(info.begin(), info.end(), Sort::sort_by_p50);
+                sort_impl<OrderByType::kOrderByP50>(info, desc, limit);
                 break;
 
             case OrderByType::kOrderByP90:
-                if (tp == OrderType::kOrderDesc)
-                    std::sort(info.begin(), info.end(), Sort::sort_by_p90_desc);
-                else
-                    std::sort(info.begin(), info.end(), Sort::sort_by_p90);
+                sort_impl<OrderByType::kOrderByP90>(info, desc, limit);
                 break;
 
             default:
                 std::cerr << "unknown orderby: "  << static_cast<int32_t>(btp) << std::endl;
+                if (limit > 0 && info.size() > limit) {
+                    info.erase(info.begin() + limit, info.end());
+                }
                 break;
         }
 
         return;
     }
 
-private:
-    // asc
+    typedef bool (*comparator_t)(const event_info_t& lhs, const event_info_t& rhs);
 
-    static bool sort_by_timestamp(const event_info_t& lhs, const event_info_t& rhs)  {
-        return lhs.timestamp < rhs.timestamp;
-    }
+    // 返回升序比较函数，不支持的排序字段返回NULL
+    static comparator_t asc_comparator(const enum OrderByType& btp) {
 
-    static bool sort_by_tag(const event_info_t& lhs, const event_info_t& rhs)  {
-        return lhs.tag < rhs.tag;
+        switch (btp) {
+            case OrderByType::kOrderByTimestamp: return Sort::compare_asc<OrderByType::kOrderByTimestamp>;
+            case OrderByType::kOrderByTag:       return Sort::compare_asc<OrderByType::kOrderByTag>;
+            case OrderByType::kOrderByCount:     return Sort::compare_asc<OrderByType::kOrderByCount>;
+            case OrderByType::kOrderBySum:       return Sort::compare_asc<OrderByType::kOrderBySum>;
+            case OrderByType::kOrderByAvg:       return Sort::compare_asc<OrderByType::kOrderByAvg>;
+            case OrderByType::kOrderByMin:       return Sort::compare_asc<OrderByType::kOrderByMin>;
+            case OrderByType::kOrderByMax:       return Sort::compare_asc<OrderByType::kOrderByMax>;
+            case OrderByType::kOrderByP10:       return Sort::compare_asc<OrderByType::kOrderByP10>;
+            case OrderByType::kOrderByP50:       return Sort::compare_asc<OrderByType::kOrderByP50>;
+            case OrderByType::kOrderByP90:       return Sort::compare_asc<OrderByType::kOrderByP90>;
+            default:
+                return NULL;
+        }
     }
 
-    static bool sort_by_count(const event_info_t& lhs, const event_info_t& rhs)  {
-        return lhs.count < rhs.count;
-    }
+private:
 
-    static bool sort_by_sum(const event_info_t& lhs, const event_info_t& rhs)  {
-        return lhs.value_sum < rhs.value_sum;
+    template <enum OrderByType BTP>
+    static bool compare_asc(const event_info_t& lhs, const event_info_t& rhs) {
+        return OrderKey<BTP>::less(OrderKey<BTP>::get(lhs), OrderKey<BTP>::get(rhs));
     }
 
-    static bool sort_by_avg(const event_info_t& lhs, const event_info_t& rhs)  {
-        return lhs.value_avg < rhs.value_avg;
+    template <typename K>
+    struct sort_entry_t {
+        K        key_;
+        uint32_t idx_;
+    };
+
+    // 降序只交换键的比较方向，键相同的时候按照原始位置，
+    // 保证是严格弱序，而且结果是稳定的
+    template <enum OrderByType BTP, bool Desc>
+    struct EntryCompare {
+        typedef sort_entry_t<typename OrderKey<BTP>::key_t> entry_t;
+        bool operator()(const entry_t& lhs, const entry_t& rhs) const {
+            if (OrderKey<BTP>::less(lhs.key_, rhs.key_)) {
+                return !Desc;
+            }
+            if (OrderKey<BTP>::less(rhs.key_, lhs.key_)) {
+                return Desc;
+            }
+            return lhs.idx_ < rhs.idx_;
+        }
+    };
+
+    // limit 比较小的时候 partial_sort(堆) 更合适，否则先 nth_element 分区再排序前面部分
+    template <typename Iter, typename Compare>
+    static void select_sort(Iter first, Iter last, size_t limit, Compare cmp) {
+
+        size_t total = last - first;
+        if (limit == 0 || limit >= total) {
+            std::sort(first, last, cmp);
+        } else if (limit <= 1024) {
+            std::partial_sort(first, first + limit, last, cmp);
+        } else {
+            std::nth_element(first, first + limit, last, cmp);
+            std::sort(first, first + limit, cmp);
+        }
     }
 
-    static bool sort_by_min(const event_info_t& lhs, const event_info_t& rhs)  {
-        return lhs.value_min < rhs.value_min;
-    }
+    template <enum OrderByType BTP>
+    static void sort_impl(std::vector<event_info_t>& info, bool desc, size_t limit) {
 
-    static bool sort_by_max(const event_info_t& lhs, const event_info_t& rhs)  {
-        return lhs.value_max < rhs.value_max;
-    }
+        typedef sort_entry_t<typename OrderKey<BTP>::key_t> entry_t;
 
-    static bool sort_by_p10(const event_info_t& lhs, const event_info_t& rhs)  {
-        return lhs.value_p10 < rhs.value_p10;
-    }
+        std::vector<entry_t> entries(info.size());
+        for (size_t i=0; i<info.size(); ++i) {
+            entries[i].key_ = OrderKey<BTP>::get(info[i]);
+            entries[i].idx_ = static_cast<uint32_t>(i);
+        }
 
-    static bool sort_by_p50(const event_info_t& lhs, const event_info_t& rhs)  {
-        return lhs.value_p50 < rhs.value_p50;
-    }
+        if (desc) {
+            select_sort(entries.begin(), entries.end(), limit, EntryCompare<BTP, true>());
+        } else {
+            select_sort(entries.begin(), entries.end(), limit, EntryCompare<BTP, false>());
+        }
+
+        size_t count = (limit > 0 && limit < entries.size()) ? limit : entries.size();
 
-    static bool sort_by_p90(const event_info_t& lhs, const event_info_t& rhs)  {
-        return lhs.value_p90 < rhs.value_p90;
+        // tag 的键指向 info 中的字符串，需要排序完成之后再移动
+        std::vector<event_info_t> sorted;
+        sorted.reserve(count);
+        for (size_t i=0; i<count; ++i) {
+            sorted.emplace_back(std::move(info[entries[i].idx_]));
+        }
+
+        info.swap(sorted);
     }
+};
 
 
-    // desc
+// 有界的 top-K 累加器
+//
+// 扫描过程中逐个加入分组结果，只保留排序最靠前的 limit 个，
+// 内存和最后排序的开销都是 O(limit) 而不是 O(分组数目)。
+// 内部维护一个以"排序最靠后"为堆顶的堆，新元素只需要和堆顶比较。
+class TopK {
 
-    static bool sort_by_timestamp_desc( const event_info_t& lhs, const event_info_t& rhs)  {
-        return !(sort_by_timestamp(lhs, rhs));
+public:
+    TopK(const enum OrderByType& btp, const enum OrderType& tp, size_t limit):
+        cmp_(Sort::asc_comparator(btp)),
+        desc_(tp == OrderType::kOrderDesc),
+        limit_(limit),
+        heap_() {
     }
 
-    static bool sort_by_tag_desc(const event_info_t& lhs, const event_info_t& rhs)  {
-        return !(sort_by_tag(lhs, rhs));
+    bool valid() const {
+        return cmp_ != NULL && limit_ > 0;
     }
 
-    static bool sort_by_count_desc(const event_info_t& lhs, const event_info_t& rhs)  {
-        return !(sort_by_count(lhs, rhs));
-    }
+    void push(const event_info_t& item) {
 
-    static bool sort_by_sum_desc(const event_info_t& lhs, const event_info_t& rhs)  {
-        return !(sort_by_sum(lhs, rhs));
-    }
+        if (heap_.size() < limit_) {
+            heap_.push_back(item);
+            std::push_heap(heap_.begin(), heap_.end(), Less(this));
+            return;
+        }
 
-    static bool sort_by_avg_desc(const event_info_t& lhs, const event_info_t& rhs)  {
-        return !(sort_by_avg(lhs, rhs));
-    }
+        // 比堆顶(当前保留的最后一名)靠前才替换
+        if (!less(item, heap_.front())) {
+            return;
+        }
 
-    static bool sort_by_min_desc(const event_info_t& lhs, const event_info_t& rhs)  {
-        return !(sort_by_min(lhs, rhs));
+        std::pop_heap(heap_.begin(), heap_.end(), Less(this));
+        heap_.back() = item;
+        std::push_heap(heap_.begin(), heap_.end(), Less(this));
     }
 
-    static bool sort_by_max_desc(const event_info_t& lhs, const event_info_t& rhs)  {
-        return !(sort_by_max(lhs, rhs));
+    // 按照排序顺序输出，调用之后累加器被清空
+    void collect(std::vector<event_info_t>& info) {
+        std::sort_heap(heap_.begin(), heap_.end(), Less(this));
+        info.swap(heap_);
+        heap_.clear();
     }
 
-    static bool sort_by_p10_desc(const event_info_t& lhs, const event_info_t& rhs)  {
-        return !(sort_by_p10(lhs, rhs));
-    }
+private:
 
-    static bool sort_by_p50_desc(const event_info_t& lhs, const event_info_t& rhs)  {
-        return !(sort_by_p50(lhs, rhs));
+    // 降序直接交换参数，保证严格弱序
+    bool less(const event_info_t& lhs, const event_info_t& rhs) const {
+        return desc_ ? cmp_(rhs, lhs) : cmp_(lhs, rhs);
     }
 
-    static bool sort_by_p90_desc(const event_info_t& lhs, const event_info_t& rhs)  {
-        return !(sort_by_p90(lhs, rhs));
-    }
-};
+    struct Less {
+        explicit Less(const TopK* topk): topk_(topk) {}
+        bool operator()(const event_info_t& lhs, const event_info_t& rhs) const {
+            return topk_->less(lhs, rhs);
+        }
+        const TopK* topk_;
+    };
 
+    Sort::comparator_t cmp_;
+    bool desc_;
+    size_t limit_;
+    std::vector<event_info_t> heap_;
+};
 
 
 #endif // __BUSINESS_SORT_H__
@@ -14,7 +14,9 @@
 
 #include <Business/StoreIf.h>
 #include <Business/StoreSql.h>
+#include <Business/StoreRedis.h>
 #include <Business/StoreLevelDB.h>
+#include <Business/StoreTSDB.h>
 
 using namespace tzrpc;
 
@@ -25,6 +27,7 @@ std::shared_ptr<StoreIf> StoreFactory(const std::string& storeType) {
     static std::shared_ptr<StoreIf> mysql_ {};
     static std::shared_ptr<StoreIf> redis_ {};
     static std::shared_ptr<StoreIf> leveldb_ {};
+    static std::shared_ptr<StoreIf> tsdb_ {};
 
     static std::shared_ptr<StoreIf> NULLPTR {};
 
@@ -55,7 +58,28 @@ std::shared_ptr<StoreIf> StoreFactory(const std::string& storeType) {
 
     } else if (storeType == "redis") {
 
-        log_err("redis store not implemented yet!");
+        if (redis_) {
+            return redis_;
+        }
+
+        std::lock_guard<std::mutex> lock(init_lock_);
+        if (redis_) {
+            return redis_;
+        }
+
+        // 初始化
+        auto conf_ptr = ConfHelper::instance().get_conf();
+        if (!conf_ptr) {
+            log_err("ConfHelper not initialized, please check your initialize order.");
+            return NULLPTR;
+        }
+        std::shared_ptr<StoreIf> redis = std::make_shared<StoreRedis>();
+        if (redis && redis->init(*conf_ptr)) {
+            log_debug("create and initialized StoreRedis OK!");
+            redis_.swap(redis);
+            return redis_;
+        }
+
         return NULLPTR;
 
     } else if (storeType == "leveldb") {
@@ -84,6 +108,32 @@ std::shared_ptr<StoreIf> StoreFactory(const std::string& storeType) {
 
         return NULLPTR;
 
+    } else if (storeType == "tsdb") {
+
+        if (tsdb_) {
+            return tsdb_;
+        }
+
+        std::lock_guard<std::mutex> lock(init_lock_);
+        if (tsdb_) {
+            return tsdb_;
+        }
+
+        // 初始化
+        auto conf_ptr = ConfHelper::instance().get_conf();
+        if (!conf_ptr) {
+            log_err("ConfHelper not initialized, please check your initialize order.");
+            return NULLPTR;
+        }
+        std::shared_ptr<StoreIf> tsdb = std::make_shared<StoreTSDB>();
+        if (tsdb && tsdb->init(*conf_ptr)) {
+            log_debug("create and initialized StoreTSDB OK!");
+            tsdb_.swap(tsdb);
+            return tsdb_;
+        }
+
+        return NULLPTR;
+
     } else {
         log_err("Invalid storeType: %s", storeType.c_str());
         return NULLPTR;
@@ -11,6 +11,8 @@
 
 #include <xtra_rhel.h>
 
+#include <algorithm>
+
 #include <libconfig.h++>
 #include <Business/EventItem.h>
 
@@ -24,11 +26,53 @@ public:
     // 插入事件
     virtual int insert_ev_stat(const event_insert_t& stat) = 0;
 
+    // 批量插入事件，默认逐条插入，存储引擎可以覆盖实现更高效的批量写入
+    // 全部成功返回0
+    virtual int insert_ev_stats(const std::vector<event_insert_t>& stats) {
+        int ret = 0;
+        for (size_t i=0; i<stats.size(); ++i) {
+            if (insert_ev_stat(stats[i]) != 0) {
+                ret = -1;
+            }
+        }
+        return ret;
+    }
+
     // 查询事件
     // 因为linger会有一部分事件肯定是在途的，所以查询的时候将这部分时间优化掉
     virtual int select_ev_stat(const event_cond_t& cond, event_select_t& stat,
                                time_t linger_hint) = 0;
 
+    // 流式查询，分组结果每积累 chunk_rows 条就交给 sink，stat.info 不保存结果，
+    // 查询完成之后 stat 中只有汇总信息，sink 返回false的时候终止查询并返回-1
+    // 默认实现先完整查询再分块交出，存储引擎可以覆盖在扫描的过程中产生结果
+    virtual int select_ev_stat_stream(const event_cond_t& cond, event_select_t& stat, time_t linger_hint,
+                                      size_t chunk_rows, const select_chunk_handler_t& sink) {
+
+        int ret = select_ev_stat(cond, stat, linger_hint);
+        if (ret != 0) {
+            return ret;
+        }
+
+        std::vector<event_info_t> info {};
+        info.swap(stat.info);
+
+        chunk_rows = std::max<size_t>(chunk_rows, 1);
+        for (size_t begin = 0; begin < info.size(); begin += chunk_rows) {
+            std::vector<event_info_t> rows(info.begin() + begin,
+                                           info.begin() + std::min(begin + chunk_rows, info.size()));
+            if (!sink(rows)) {
+                return -1;
+            }
+        }
+
+        return 0;
+    }
+
+    // 进程退出之前调用，这时候已经没有写入，只在内存中的数据需要在这里持久化
+    virtual void stop_graceful() {
+    }
+
     // 获取所有的metrics列表
     virtual int select_metrics(const std::string& service, std::vector<std::string>& metrics) = 0;
     virtual int select_services(std::vector<std::string>& services) = 0;
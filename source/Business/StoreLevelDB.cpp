@@ -12,8 +12,6 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
-#include <dirent.h>
-
 #include <leveldb/comparator.h>
 
 #include <Utils/Log.h>
@@ -25,6 +23,53 @@ using namespace tzrpc;
 
 static std::shared_ptr<leveldb::DB> NULLPTR_HANDLER;
 
+// 分组的累加信息，扫描的时候增量计算，不再保存分组内的每一条记录
+struct group_acc_t {
+
+    event_info_t collect_;
+    int items_;
+
+    group_acc_t():
+        collect_(),
+        items_(0) {
+        collect_.value_min = std::numeric_limits<int32_t>::max();
+        collect_.value_max = std::numeric_limits<int32_t>::min();
+    }
+
+    void add(const event_info_t& item) {
+        collect_.count     += item.count;
+        collect_.value_sum += item.value_sum;
+        collect_.value_p10 += item.value_p10;
+        collect_.value_p50 += item.value_p50;
+        collect_.value_p90 += item.value_p90;
+
+        if (item.value_min < collect_.value_min) {
+            collect_.value_min = item.value_min;
+        }
+
+        if (item.value_max > collect_.value_max) {
+            collect_.value_max = item.value_max;
+        }
+
+        ++ items_;
+    }
+
+    void finish(event_info_t& collect) const {
+
+        collect = collect_;
+        if (collect.count > 0 && items_ > 0) {
+            collect.value_avg = collect.value_sum / collect.count;
+            collect.value_p10 = collect.value_p10 / items_;
+            collect.value_p50 = collect.value_p50 / items_;
+            collect.value_p90 = collect.value_p90 / items_;
+        } else {
+            // avoid display confusing value.
+            collect.value_min = 0;
+            collect.value_max = 0;
+        }
+    }
+};
+
 bool StoreLevelDB::init(const libconfig::Config& conf) {
 
     if (!conf.lookupValue("rpc.business.leveldb.filepath", filepath_) ||
@@ -41,9 +86,9 @@ bool StoreLevelDB::init(const libconfig::Config& conf) {
         return false;
     }
 
-    levelDBs_.reset(new leveldb_handlers_t());
-    if (!levelDBs_) {
-        log_err("create empty levelDBs_ failed.");
+    lifecycle_ = std::make_shared<LevelDBLifecycle>(filepath_, table_prefix_);
+    if (!lifecycle_ || !lifecycle_->init(conf)) {
+        log_err("create and init leveldb lifecycle failed.");
         return false;
     }
 
@@ -57,81 +102,13 @@ bool StoreLevelDB::init(const libconfig::Config& conf) {
 
 std::shared_ptr<leveldb::DB> StoreLevelDB::get_leveldb_handler(const std::string& service) {
 
-
     if (service.empty()) {
         log_err("service can not be empty!");
         return NULLPTR_HANDLER;
     }
 
-    std::shared_ptr<leveldb_handlers_t> handlers;
-    {
-        std::lock_guard<std::mutex> lock(lock_);
-        handlers = levelDBs_;
-    }
-
-    time_t now = ::time(NULL);
-    std::string now_suffix = get_table_suffix(now);
-
-    auto handler = handlers->find(service);
-    if (handler != handlers->end()) {
-        if (now_suffix == handler->second->current_suffix_ &&
-            handler->second->handler_) {
-            return handler->second->handler_;
-        } else {
-            log_err("suffix and handler check failed, hold %s, now %s",
-                    handler->second->current_suffix_.c_str(), now_suffix.c_str());
-        }
-    } else {
-        log_err("service %s not created.", service.c_str());
-    }
-
-// do_create:
-
-    std::lock_guard<std::mutex> lock(lock_);
-
-    // check again
-    handler = levelDBs_->find(service);
-    if (handler != levelDBs_->end()) {
-        if (now_suffix == handler->second->current_suffix_ &&
-            handler->second->handler_) {
-            log_notice("good, hit for service %s with suffix %s",
-                       service.c_str(), handler->second->current_suffix_.c_str());
-            return handler->second->handler_;
-        }
-    }
-
-    // do create
-
-    char fullpath[PATH_MAX] {};
-    snprintf(fullpath, PATH_MAX, "%s/%s__%s__events_%s",
-             filepath_.c_str(), table_prefix_.c_str(), service.c_str(), now_suffix.c_str());
-
-    leveldb::Options options;
-    options.create_if_missing = true;
-    // options.block_cache = leveldb::NewLRUCache(100 * 1048576);  // 100MB cache
-    leveldb::DB* db;
-    leveldb::Status status = leveldb::DB::Open(options, fullpath, &db);
-
-    if (!status.ok()) {
-        log_err("Open levelDB %s failed.", fullpath);
-        return NULLPTR_HANDLER;
-    }
-
-    std::shared_ptr<leveldb_handler_t> new_handler = std::make_shared<leveldb_handler_t>();
-    if (!new_handler) {
-        log_err("create new handler for %s failed.", fullpath);
-        return NULLPTR_HANDLER;
-    }
-
-    new_handler->current_suffix_ = now_suffix;
-    new_handler->handler_.reset(db);
-
-    // do add
-    (*levelDBs_)[service] = new_handler;
-
-    log_notice("success add for service %s with suffix %s, fullpath: %s",
-               service.c_str(), now_suffix.c_str(), fullpath);
-    return new_handler->handler_;
+    std::string now_suffix = LevelDBLifecycle::get_table_suffix(::time(NULL));
+    return lifecycle_->get_handler(service, now_suffix, true);
 }
 
 
@@ -187,7 +164,8 @@ int StoreLevelDB::insert_ev_stat(const event_insert_t& stat) {
     return 0;
 }
 
-int StoreLevelDB::select_ev_stat_by_timestamp(const event_cond_t& cond, event_select_t& stat, time_t linger_hint) {
+int StoreLevelDB::select_ev_stat_by_timestamp(const event_cond_t& cond, event_select_t& stat, time_t linger_hint,
+                                              size_t chunk_rows, const select_chunk_handler_t* sink) {
 
     auto handler = get_leveldb_handler(cond.service);
     if (!handler) {
@@ -209,7 +187,75 @@ int StoreLevelDB::select_ev_stat_by_timestamp(const event_cond_t& cond, event_se
     std::unique_ptr<leveldb::Iterator> it(handler->NewIterator(leveldb::ReadOptions()));
 
     // 聚合信息
-    std::map<time_t, std::vector<event_info_t>> infos_by_timestamp {};
+    // key中的时间戳是倒序的，同一个时间戳的记录在扫描中是连续的，
+    // 所以只需要保存当前时间戳下正在聚合的分组，时间戳变化的时候这些分组就已经完整了
+    // 组合分组的时候按照 (tag, entity_idx) 进一步区分，不参与分组的维度为空
+    bool by_tag = groupby_has_tag(cond.groupby);
+    bool by_entity = groupby_has_entity(cond.groupby);
+
+    time_t current_timestamp = 0;
+    std::map<std::pair<std::string, std::string>, group_acc_t> current_groups {};
+
+    // 有排序和limit的时候只保留前limit个分组
+    TopK topk(cond.orderby, cond.orders, cond.limit > 0 ? cond.limit : 0);
+    int ck_iterat_count = 0;
+
+    // 流式返回的时候按照扫描的顺序(时间戳降序)交出，不需要排序截断
+    bool streaming = sink != NULL && !topk.valid();
+    std::vector<event_info_t> pending {};
+    bool aborted = false;
+
+    auto emit_pending = [&](bool all) {
+        while (!aborted && !pending.empty() && (all || pending.size() >= chunk_rows)) {
+            size_t n = std::min(pending.size(), chunk_rows);
+            std::vector<event_info_t> rows(pending.begin(), pending.begin() + n);
+            pending.erase(pending.begin(), pending.begin() + n);
+            if (!(*sink)(rows)) {
+                aborted = true;
+            }
+        }
+    };
+
+    auto flush_group = [&]() {
+
+        if (streaming) {
+            for (auto iter = current_groups.begin(); iter != current_groups.end(); ++iter) {
+
+                event_info_t collect {};
+                iter->second.finish(collect);
+                collect.timestamp = current_timestamp;
+                collect.tag = iter->first.first;
+                collect.entity_idx = iter->first.second;
+                pending.emplace_back(collect);
+
+                ck_iterat_count += iter->second.items_;
+            }
+
+            current_groups.clear();
+            emit_pending(false);
+            return;
+        }
+
+        // 逆序加入，最后整体翻转之后时间和 (tag, entity_idx) 都是升序
+        for (auto iter = current_groups.rbegin(); iter != current_groups.rend(); ++iter) {
+
+            event_info_t collect {};
+            iter->second.finish(collect);
+            collect.timestamp = current_timestamp;
+            collect.tag = iter->first.first;
+            collect.entity_idx = iter->first.second;
+
+            if (topk.valid()) {
+                topk.push(collect);
+            } else {
+                stat.info.emplace_back(collect);
+            }
+
+            ck_iterat_count += iter->second.items_;
+        }
+
+        current_groups.clear();
+    };
 
     stat.summary = {}; // default to well initialized.
     stat.summary.value_min = std::numeric_limits<int32_t>::max();
@@ -266,16 +312,19 @@ int StoreLevelDB::select_ev_stat_by_timestamp(const event_cond_t& cond, event_se
         item.value_p90 = data.p90;
 
 
-        item.timestamp = timestamp_exchange(::atoll(vec[1].c_str()));
+        // 降采样的时间桶在倒序扫描中同样是连续的
+        item.timestamp = cond.bucket_of(timestamp_exchange(::atoll(vec[1].c_str())));
+        if (item.timestamp != current_timestamp) {
+            flush_group();
+            current_timestamp = item.timestamp;
 
-        auto iter = infos_by_timestamp.find(item.timestamp);
-        if (iter == infos_by_timestamp.end()) {
-            infos_by_timestamp[item.timestamp] = std::vector<event_info_t>();
-            iter = infos_by_timestamp.find(item.timestamp);
+            if (aborted) {
+                log_notice("stream select %s aborted by sink.", cond.metric.c_str());
+                return -1;
+            }
         }
-
-        SAFE_ASSERT(iter != infos_by_timestamp.end());
-        iter->second.push_back(item);
+        current_groups[std::make_pair(by_tag ? vec[2] : std::string(),
+                                      by_entity ? vec[3] : std::string())].add(item);
 
         stat.summary.count     += item.count;
         stat.summary.value_sum += item.value_sum;
@@ -295,44 +344,19 @@ int StoreLevelDB::select_ev_stat_by_timestamp(const event_cond_t& cond, event_se
         
     }  // end for
 
-    int ck_iterat_count = 0;
-    for (auto iter = infos_by_timestamp.begin(); iter != infos_by_timestamp.end(); ++iter) {
-
-        event_info_t collect {};
-        collect.timestamp = iter->first;
-
-        collect.value_min = std::numeric_limits<int32_t>::max();
-        collect.value_max = std::numeric_limits<int32_t>::min();
-
-        for (size_t i=0; i<iter->second.size(); ++i) {
-            collect.count     += iter->second[i].count;
-            collect.value_sum += iter->second[i].value_sum;
-            collect.value_p10 += iter->second[i].value_p10;
-            collect.value_p50 += iter->second[i].value_p50;
-            collect.value_p90 += iter->second[i].value_p90;
+    flush_group();
 
-            if (iter->second[i].value_min < collect.value_min) {
-                collect.value_min = iter->second[i].value_min;
-            }
-
-            if (iter->second[i].value_max > collect.value_max) {
-                collect.value_max = iter->second[i].value_max;
-            }
-        }
-
-        if (collect.count > 0) {
-            collect.value_avg = collect.value_sum / collect.count;
-            collect.value_p10 = collect.value_p10 / iter->second.size();
-            collect.value_p50 = collect.value_p50 / iter->second.size();
-            collect.value_p90 = collect.value_p90 / iter->second.size();
-        } else {
-            // avoid display confusing value.
-            collect.value_min = 0;
-            collect.value_max = 0;
+    if (streaming) {
+        emit_pending(true);
+        if (aborted) {
+            log_notice("stream select %s aborted by sink.", cond.metric.c_str());
+            return -1;
         }
-
-        stat.info.emplace_back(collect);
-        ck_iterat_count += iter->second.size();
+    } else if (topk.valid()) {
+        topk.collect(stat.info);
+    } else {
+        // 保持按照时间升序返回
+        std::reverse(stat.info.begin(), stat.info.end());
     }
 
     SAFE_ASSERT(iterat_count == ck_iterat_count);
@@ -354,7 +378,7 @@ int StoreLevelDB::select_ev_stat_by_timestamp(const event_cond_t& cond, event_se
     return 0;
 }
 
-int StoreLevelDB::select_ev_stat_by_tag(const event_cond_t& cond, event_select_t& stat, time_t linger_hint) {
+int StoreLevelDB::select_ev_stat_by_tag_entity(const event_cond_t& cond, event_select_t& stat, time_t linger_hint) {
 
     auto handler = get_leveldb_handler(cond.service);
     if (!handler) {
@@ -375,8 +399,10 @@ int StoreLevelDB::select_ev_stat_by_tag(const event_cond_t& cond, event_select_t
     leveldb::Options options;
     std::unique_ptr<leveldb::Iterator> it(handler->NewIterator(leveldb::ReadOptions()));
 
-    // 聚合信息
-    std::map<std::string, std::vector<event_info_t>> infos_by_tag {};
+    // 聚合信息，不参与分组的维度为空
+    bool by_tag = groupby_has_tag(cond.groupby);
+    bool by_entity = groupby_has_entity(cond.groupby);
+    std::map<std::pair<std::string, std::string>, group_acc_t> infos_by_group {};
 
     stat.summary = {}; // default to well initialized.
     stat.summary.value_min = std::numeric_limits<int32_t>::max();
@@ -432,16 +458,8 @@ int StoreLevelDB::select_ev_stat_by_tag(const event_cond_t& cond, event_select_t
         item.value_p50 = data.p50;
         item.value_p90 = data.p90;
 
-        item.tag = vec[2];
-
-        auto iter = infos_by_tag.find(item.tag);
-        if (iter == infos_by_tag.end()) {
-            infos_by_tag[item.tag] = std::vector<event_info_t>();
-            iter = infos_by_tag.find(item.tag);
-        }
-
-        SAFE_ASSERT(iter != infos_by_tag.end());
-        iter->second.push_back(item);
+        infos_by_group[std::make_pair(by_tag ? vec[2] : std::string(),
+                                    by_entity ? vec[3] : std::string())].add(item);
 
         stat.summary.count     += item.count;
         stat.summary.value_sum += item.value_sum;
@@ -462,47 +480,30 @@ int StoreLevelDB::select_ev_stat_by_tag(const event_cond_t& cond, event_select_t
     } // end for
 
 
+    // 有排序和limit的时候只保留前limit个分组
+    TopK topk(cond.orderby, cond.orders, cond.limit > 0 ? cond.limit : 0);
+
     int ck_iterat_count = 0;
-    for (auto iter = infos_by_tag.begin(); iter != infos_by_tag.end(); ++iter) {
+    for (auto iter = infos_by_group.begin(); iter != infos_by_group.end(); ++iter) {
 
         event_info_t collect {};
-        collect.tag = iter->first;
-
-        collect.value_min = std::numeric_limits<int32_t>::max();
-        collect.value_max = std::numeric_limits<int32_t>::min();
-
-        for (size_t i=0; i<iter->second.size(); ++i) {
-            collect.count     += iter->second[i].count;
-            collect.value_sum += iter->second[i].value_sum;
-            collect.value_p10 += iter->second[i].value_p10;
-            collect.value_p50 += iter->second[i].value_p50;
-            collect.value_p90 += iter->second[i].value_p90;
+        iter->second.finish(collect);
+        collect.tag = iter->first.first;
+        collect.entity_idx = iter->first.second;
 
-            if (iter->second[i].value_min < collect.value_min) {
-                collect.value_min = iter->second[i].value_min;
-            }
-
-            if (iter->second[i].value_max > collect.value_max) {
-                collect.value_max = iter->second[i].value_max;
-            }
-        }
-
-        if (collect.count > 0) {
-            collect.value_avg = collect.value_sum / collect.count;
-            collect.value_p10 = collect.value_p10 / iter->second.size();
-            collect.value_p50 = collect.value_p50 / iter->second.size();
-            collect.value_p90 = collect.value_p90 / iter->second.size();
+        if (topk.valid()) {
+            topk.push(collect);
         } else {
-            // avoid display confusing value.
-            collect.value_min = 0;
-            collect.value_max = 0;
+            stat.info.emplace_back(collect);
         }
 
-        stat.info.emplace_back(collect);
-        
-        ck_iterat_count += iter->second.size();
+        ck_iterat_count += iter->second.items_;
     }
-    
+
+    if (topk.valid()) {
+        topk.collect(stat.info);
+    }
+
     SAFE_ASSERT(iterat_count == ck_iterat_count);
     if(iterat_count != ck_iterat_count) {
         log_err("iterat_cnt check failed: %d - %d, total detail item %d", iterat_count, ck_iterat_count, stat.summary.count);
@@ -631,13 +632,7 @@ int StoreLevelDB::select_ev_stat_by_none(const event_cond_t& cond, event_select_
 }
 
 
-// group summary
-int StoreLevelDB::select_ev_stat(const event_cond_t& cond, event_select_t& stat, time_t linger_hint) {
-
-    if (cond.service.empty()) {
-        log_err("error check error!");
-        return -1;
-    }
+void StoreLevelDB::prepare_select(const event_cond_t& cond, event_select_t& stat, time_t linger_hint) {
 
     stat.timestamp = ::time(NULL);
     if (cond.tm_start > 0) {
@@ -652,36 +647,55 @@ int StoreLevelDB::select_ev_stat(const event_cond_t& cond, event_select_t& stat,
     stat.metric = cond.metric;
     stat.entity_idx = cond.entity_idx;
     stat.tag = cond.tag;
+}
+
+// group summary
+int StoreLevelDB::select_ev_stat(const event_cond_t& cond, event_select_t& stat, time_t linger_hint) {
+
+    if (cond.service.empty()) {
+        log_err("error check error!");
+        return -1;
+    }
+
+    prepare_select(cond, stat, linger_hint);
 
     int ret = 0;
-    if (cond.groupby == GroupType::kGroupbyTimestamp) {
+    // 所有的分组方式都是一次扫描完成
+    if (groupby_has_timestamp(cond.groupby)) {
         ret = select_ev_stat_by_timestamp(cond, stat, linger_hint);
     }
-    else if (cond.groupby == GroupType::kGroupbyTag) {
-        ret = select_ev_stat_by_tag(cond, stat, linger_hint);
+    else if (cond.groupby != GroupType::kGroupNone) {
+        ret = select_ev_stat_by_tag_entity(cond, stat, linger_hint);
     }
     else {
         return select_ev_stat_by_none(cond, stat, linger_hint);
     }
 
-    // 是否对结果进行排序
-    if (cond.orderby == OrderByType::kOrderByNone || cond.limit == 0) {
-        log_debug("order by %d, orders %d, limit %d, will not sort in server side",
-                  static_cast<int32_t>(cond.orderby), static_cast<int32_t>(cond.orders), cond.limit);
-        return ret;
-    }
+    // 排序和limit已经在扫描聚合的时候通过 TopK 完成了
+    log_debug("order by %d, orders %d, limit %d, return %d groups",
+              static_cast<int32_t>(cond.orderby), static_cast<int32_t>(cond.orders), cond.limit,
+              static_cast<int32_t>(stat.info.size()));
 
-    if (stat.info.empty()) {
-        log_debug("detail info empty, do not need to sort.");
-        return ret;
+    return ret;
+}
+
+int StoreLevelDB::select_ev_stat_stream(const event_cond_t& cond, event_select_t& stat, time_t linger_hint,
+                                        size_t chunk_rows, const select_chunk_handler_t& sink) {
+
+    // 按照时间分组的扫描中分组是逐个完整的，可以边扫描边交出；
+    // 其他的分组要扫描结束才能确定，需要排序截断的也要等到全部结果，使用默认实现
+    if (!groupby_has_timestamp(cond.groupby) ||
+        (cond.orderby != OrderByType::kOrderByNone && cond.limit > 0)) {
+        return StoreIf::select_ev_stat_stream(cond, stat, linger_hint, chunk_rows, sink);
     }
 
-    Sort::do_sort(stat.info, cond.orderby, cond.orders);
-    if (stat.info.size() > cond.limit) {
-        stat.info.erase(stat.info.begin() + cond.limit, stat.info.end());
+    if (cond.service.empty() || chunk_rows == 0) {
+        log_err("error check error!");
+        return -1;
     }
 
-    return ret;
+    prepare_select(cond, stat, linger_hint);
+    return select_ev_stat_by_timestamp(cond, stat, linger_hint, chunk_rows, &sink);
 }
 
 
@@ -738,51 +752,16 @@ int StoreLevelDB::select_metrics(const std::string& service, std::vector<std::st
 
 int StoreLevelDB::select_services(std::vector<std::string>& services) {
 
-
     // 遍历目录，获取所有服务
-
-    DIR *d = NULL;
-    struct dirent* d_item = NULL;
-    struct stat sb;
-
-    if (!(d = opendir(filepath_.c_str()))) {
-        log_err("opendir for %s failed.",  filepath_.c_str());
+    std::map<std::string, std::set<std::string>> partitions;
+    if (lifecycle_->list_partitions(partitions) != 0) {
+        log_err("list partitions for %s failed.",  filepath_.c_str());
         return -1;
     }
 
-
-    log_debug("we will travel dir %s for service detect.", filepath_.c_str());
-
-    std::vector<std::string> leveldb_files {};
-
-    while ( (d_item = readdir(d)) != NULL ) {
-
-        // 跳过隐藏目录
-        if (::strncmp(d_item->d_name, ".", 1) == 0) {
-            continue;
-        }
-
-        std::string fullfile = filepath_ + "/" + std::string(d_item->d_name);
-        if (stat(fullfile.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode)) {
-            // 满足前缀匹配
-            if (::strncmp(d_item->d_name, table_prefix_.c_str(), table_prefix_.size()) == 0) {
-                leveldb_files.push_back(d_item->d_name);
-            }
-        }
-    }
-
     services.clear();
-    for (size_t i=0; i<leveldb_files.size(); ++i) {
-
-        std::string t_name = leveldb_files[i];
-
-        if (t_name.size() > table_prefix_.size() + 2 + 15) {
-            t_name = t_name.substr(table_prefix_.size() + 2);
-            t_name = t_name.substr(0, t_name.size() - 15 /*"__events_xxxxxx"*/);
-            services.emplace_back(t_name);
-        } else {
-            log_err("invalid table_name: %s", t_name.c_str());
-        }
+    for (auto iter = partitions.begin(); iter != partitions.end(); ++iter) {
+        services.emplace_back(iter->first);
     }
 
     return 0;
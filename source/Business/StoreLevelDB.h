@@ -15,6 +15,8 @@
 #include <memory>
 #include <leveldb/db.h>
 
+#include <Business/LevelDBLifecycle.h>
+
 #include <Utils/StrUtil.h>
 
 // leveldb 存储表设计思路
@@ -75,8 +77,7 @@ class StoreLevelDB: public StoreIf {
 
 public:
     StoreLevelDB():
-        lock_(),
-        levelDBs_(),
+        lifecycle_(),
         filepath_(),
         table_prefix_() {
     }
@@ -87,14 +88,20 @@ public:
 
     int insert_ev_stat(const event_insert_t& stat) override;
     int select_ev_stat(const event_cond_t& cond, event_select_t& stat, time_t linger_hint) override;
+    int select_ev_stat_stream(const event_cond_t& cond, event_select_t& stat, time_t linger_hint,
+                              size_t chunk_rows, const select_chunk_handler_t& sink) override;
 
     int select_metrics(const std::string& service, std::vector<std::string>& metrics) override;
     int select_services(std::vector<std::string>& services) override;
 
 private:
 
-    int select_ev_stat_by_timestamp(const event_cond_t& cond, event_select_t& stat, time_t linger_hint);
-    int select_ev_stat_by_tag(const event_cond_t& cond, event_select_t& stat, time_t linger_hint);
+    void prepare_select(const event_cond_t& cond, event_select_t& stat, time_t linger_hint);
+
+    // sink 不为空的时候，完整的时间分组在扫描过程中分块交出，不保存在 stat.info 中
+    int select_ev_stat_by_timestamp(const event_cond_t& cond, event_select_t& stat, time_t linger_hint,
+                                    size_t chunk_rows = 0, const select_chunk_handler_t* sink = NULL);
+    int select_ev_stat_by_tag_entity(const event_cond_t& cond, event_select_t& stat, time_t linger_hint);
     int select_ev_stat_by_none(const event_cond_t& cond, event_select_t& stat, time_t linger_hint);
 
     time_t timestamp_exchange(time_t t) {
@@ -106,31 +113,11 @@ private:
         return tzrpc::StrUtil::convert_to_string(n);
     }
 
-    std::string get_table_suffix(time_t time_sec) {
-
-        struct tm now_time;
-        localtime_r(&time_sec, &now_time);
-
-        char buff[20] = {0, };
-        sprintf(buff, "%04d%02d", now_time.tm_year + 1900, now_time.tm_mon + 1);
-
-        return buff;
-    }
-
     std::shared_ptr<leveldb::DB> get_leveldb_handler(const std::string& service);
 
-
-    std::mutex lock_;
-
+    // 分区句柄的缓存、过期删除和压缩
     // leveldb::DB 指针可以被多线程使用，内部保证了线程安全
-    // key: service
-    struct leveldb_handler_t {
-        std::string current_suffix_;
-        std::shared_ptr<leveldb::DB> handler_;
-    };
-
-    typedef std::map<std::string, std::shared_ptr<leveldb_handler_t>> leveldb_handlers_t;
-    std::shared_ptr<leveldb_handlers_t> levelDBs_;
+    std::shared_ptr<LevelDBLifecycle> lifecycle_;
 
     std::string filepath_;
     std::string table_prefix_;
@@ -0,0 +1,507 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <set>
+#include <tuple>
+
+#include <Utils/Log.h>
+
+#include <Business/Sort.h>
+#include <Business/StoreRedis.h>
+
+using namespace tzrpc;
+
+// 服务端聚合脚本
+//
+// KEYS: 查询范围内的时间桶，单次调用最多 max_buckets 个
+// ARGV: lower upper tag entity_idx groupby(参与分组的维度，逗号分隔: timestamp,tag,entity) bucket_seconds max_buckets
+// 返回: { {timestamp, tag, entity_idx, count, sum_hi, sum_lo, min, max, p10_sum, p50_sum, p90_sum, items}, ... }
+//       不参与分组的维度返回 "0" 或者空串
+//
+// Lua 的数字是 double，超过 2^53 的累加会丢失精度，所以 value_sum 按照十进制
+// 拆成高位和低7位分别累加，由调用者还原成 sum_hi * 10^7 + sum_lo
+// 分位数无法合并，同其他存储一样取各个数据点的平均值，所以返回累加值和数据点数目
+static const char* kAggregateScript =
+    "if #KEYS > tonumber(ARGV[7]) then "
+    "  return redis.error_reply('too many buckets: ' .. #KEYS) "
+    "end "
+    "local function split(n) "
+    "  local neg = string.sub(n, 1, 1) == '-' "
+    "  if neg then n = string.sub(n, 2) end "
+    "  local hi, lo = 0, tonumber(n) "
+    "  if #n > 7 then hi = tonumber(string.sub(n, 1, -8)); lo = tonumber(string.sub(n, -7)) end "
+    "  if neg then return -hi, -lo end "
+    "  return hi, lo "
+    "end "
+    "local lower = tonumber(ARGV[1]) "
+    "local upper = tonumber(ARGV[2]) "
+    "local tag = ARGV[3] "
+    "local entity = ARGV[4] "
+    "local by_ts = string.find(ARGV[5], 'timestamp', 1, true) "
+    "local by_tag = string.find(ARGV[5], 'tag', 1, true) "
+    "local by_entity = string.find(ARGV[5], 'entity', 1, true) "
+    "local bucket = tonumber(ARGV[6]) "
+    "local groups = {} "
+    "local result = {} "
+    "for _, key in ipairs(KEYS) do "
+    "  local kv = redis.call('HGETALL', key) "
+    "  for i = 1, #kv, 2 do "
+    "    local ts, t, e = string.match(kv[i], '^(%d+)#(.*)#(.*)$') "
+    "    ts = tonumber(ts) "
+    "    if ts and ts >= lower and ts <= upper and "
+    "       (tag == '' or t == tag) and (entity == '' or e == entity) then "
+    "      local s, v = {}, {} "
+    "      for n in string.gmatch(kv[i + 1], '[^,]+') do s[#s + 1] = n; v[#v + 1] = tonumber(n) end "
+    "      local hi, lo = split(s[2]) "
+    "      local gts = '0' "
+    "      if by_ts then "
+    "        if bucket > 0 then gts = tostring(ts - ts % bucket) else gts = tostring(ts) end "
+    "      end "
+    "      local gt = by_tag and t or '' "
+    "      local ge = by_entity and e or '' "
+    "      local g = gts .. '\\1' .. gt .. '\\1' .. ge "
+    "      local a = groups[g] "
+    "      if not a then "
+    "        a = { gts, gt, ge, 0, 0, 0, v[4], v[5], 0, 0, 0, 0 } "
+    "        groups[g] = a "
+    "        result[#result + 1] = a "
+    "      end "
+    "      a[4] = a[4] + v[1] "
+    "      a[5] = a[5] + hi "
+    "      a[6] = a[6] + lo "
+    "      if v[4] < a[7] then a[7] = v[4] end "
+    "      if v[5] > a[8] then a[8] = v[5] end "
+    "      a[9] = a[9] + v[6] "
+    "      a[10] = a[10] + v[7] "
+    "      a[11] = a[11] + v[8] "
+    "      a[12] = a[12] + 1 "
+    "    end "
+    "  end "
+    "end "
+    "return result ";
+
+// 多次脚本调用的结果在本地按照分组合并
+struct redis_agg_t {
+    int64_t count;
+    int64_t value_sum;
+    int64_t value_min;
+    int64_t value_max;
+    int64_t p10_sum;
+    int64_t p50_sum;
+    int64_t p90_sum;
+    int64_t items;
+};
+
+
+bool StoreRedis::init(const libconfig::Config& conf) {
+
+    std::string redis_hostname;
+    int redis_port = 0;
+    std::string redis_passwd;
+    int redis_db_idx = 0;
+    if (!conf.lookupValue("rpc.business.redis.host_addr", redis_hostname) ||
+        !conf.lookupValue("rpc.business.redis.host_port", redis_port) )
+    {
+        log_err("Error, get redis config value error");
+        return false;
+    }
+
+    conf.lookupValue("rpc.business.redis.passwd", redis_passwd);
+    conf.lookupValue("rpc.business.redis.db_idx", redis_db_idx);
+    conf.lookupValue("rpc.business.redis.key_prefix", key_prefix_);
+    conf.lookupValue("rpc.business.redis.bucket_span", bucket_span_);
+    conf.lookupValue("rpc.business.redis.ttl", ttl_);
+    conf.lookupValue("rpc.business.redis.max_buckets_per_eval", max_buckets_per_eval_);
+
+    if (key_prefix_.empty() || bucket_span_ <= 0 || ttl_ <= 0) {
+        log_err("invalid redis store conf, key_prefix %s, bucket_span %d, ttl %d",
+                key_prefix_.c_str(), bucket_span_, ttl_);
+        return false;
+    }
+
+    // 脚本执行期间 redis 不处理其他请求，单次调用访问的桶不能太多
+    if (max_buckets_per_eval_ <= 0 || max_buckets_per_eval_ > 64) {
+        log_notice("invalid max_buckets_per_eval %d, reset to 12.", max_buckets_per_eval_);
+        max_buckets_per_eval_ = 12;
+    }
+
+    int conn_pool_size = 0;
+    if (!conf.lookupValue("rpc.business.redis.conn_pool_size", conn_pool_size)) {
+        conn_pool_size = 10;
+        log_info("Using default conn_pool size: 10");
+    }
+
+    // 获取连接的最长等待时间，0表示一直等待
+    int acquire_timeout_ms = 0;
+    conf.lookupValue("rpc.business.redis.conn_acquire_timeout_ms", acquire_timeout_ms);
+
+    RedisConnPoolHelper helper(redis_hostname, redis_port, redis_passwd, redis_db_idx);
+    redis_pool_ptr_.reset(new ConnPool<RedisConn, RedisConnPoolHelper>("RedisPool", conn_pool_size, helper, 0, acquire_timeout_ms));
+    if (!redis_pool_ptr_ || !redis_pool_ptr_->init()) {
+        log_err("Init RedisConnPool failed!");
+        return false;
+    }
+
+    redis_conn_ptr conn;
+    redis_pool_ptr_->request_scoped_conn(conn);
+    if (!conn || conn->LoadScript(kAggregateScript, script_sha_) != 0) {
+        log_err("load redis aggregate script failed!");
+        return false;
+    }
+
+    log_info("redis store init ok, bucket_span %d, ttl %d, max_buckets_per_eval %d, script sha %s",
+             bucket_span_, ttl_, max_buckets_per_eval_, script_sha_.c_str());
+    return true;
+}
+
+
+std::string StoreRedis::bucket_key(const std::string& service, const std::string& metric, time_t bucket) const {
+    std::stringstream ss;
+    ss << key_prefix_ << ":" << service << ":" << metric << ":" << bucket;
+    return ss.str();
+}
+
+
+int StoreRedis::insert_ev_stat(const event_insert_t& stat) {
+    return insert_ev_stats(std::vector<event_insert_t>{ stat });
+}
+
+int StoreRedis::insert_ev_stats(const std::vector<event_insert_t>& stats) {
+
+    if (stats.empty()) {
+        return 0;
+    }
+
+    std::vector<std::vector<std::string>> cmds;
+    std::set<std::string> bucket_keys;
+    std::set<std::string> services;
+    std::set<std::pair<std::string, std::string>> metrics;
+
+    std::string str_ttl = std::to_string(ttl_);
+
+    for (auto iter = stats.begin(); iter != stats.end(); ++iter) {
+
+        if (iter->service.empty() || iter->metric.empty() || iter->timestamp == 0) {
+            log_err("error check error!");
+            return -1;
+        }
+
+        std::string tag = iter->tag;
+        if (tag.empty()) {
+            tag = "T";
+        }
+
+        time_t bucket = iter->timestamp - iter->timestamp % bucket_span_;
+        std::string key = bucket_key(iter->service, iter->metric, bucket);
+
+        std::stringstream field;
+        field << iter->timestamp << "#" << tag << "#" << iter->entity_idx;
+
+        std::stringstream value;
+        value << iter->count << "," << iter->value_sum << "," << iter->value_avg << ","
+              << iter->value_min << "," << iter->value_max << ","
+              << iter->value_p10 << "," << iter->value_p50 << "," << iter->value_p90;
+
+        // HSET 覆盖写，重复提交是幂等的
+        cmds.push_back(std::vector<std::string>{ "HSET", key, field.str(), value.str() });
+
+        bucket_keys.insert(key);
+        services.insert(iter->service);
+        metrics.insert(std::make_pair(iter->service, iter->metric));
+    }
+
+    for (auto iter = bucket_keys.begin(); iter != bucket_keys.end(); ++iter) {
+        cmds.push_back(std::vector<std::string>{ "EXPIRE", *iter, str_ttl });
+    }
+
+    // 索引集合同数据一起过期，长期不上报的服务指标会自动消失
+    std::string services_key = key_prefix_ + ":services";
+    for (auto iter = services.begin(); iter != services.end(); ++iter) {
+        cmds.push_back(std::vector<std::string>{ "SADD", services_key, *iter });
+    }
+    cmds.push_back(std::vector<std::string>{ "EXPIRE", services_key, str_ttl });
+
+    for (auto iter = metrics.begin(); iter != metrics.end(); ++iter) {
+        std::string metrics_key = key_prefix_ + ":" + iter->first + ":metrics";
+        cmds.push_back(std::vector<std::string>{ "SADD", metrics_key, iter->second });
+        cmds.push_back(std::vector<std::string>{ "EXPIRE", metrics_key, str_ttl });
+    }
+
+    redis_conn_ptr conn;
+    redis_pool_ptr_->request_scoped_conn(conn);
+    if (!conn) {
+        log_err("request redis conn failed!");
+        return -1;
+    }
+
+    std::vector<redisReply_ptr> replies;
+    if (!conn->Pipeline(cmds, replies)) {
+        log_err("pipeline insert %lu stats with %lu cmds failed.", stats.size(), cmds.size());
+        return -1;
+    }
+
+    log_debug("pipeline insert %lu stats with %lu cmds ok.", stats.size(), cmds.size());
+    return 0;
+}
+
+
+redisReply_ptr StoreRedis::eval_aggregate(redis_conn_ptr& conn,
+                                          const std::vector<std::string>& keys,
+                                          const std::vector<std::string>& args) {
+
+    bool noscript = false;
+    redisReply_ptr reply = conn->EvalSha(script_sha_, keys, args, &noscript);
+    if (reply || !noscript) {
+        return reply;
+    }
+
+    // 只有脚本缓存丢失才回退，EVAL 会重新在服务端缓存脚本，下次 EVALSHA 可以成功
+    return conn->Eval(kAggregateScript, keys, args);
+}
+
+int StoreRedis::select_ev_stat(const event_cond_t& cond, event_select_t& stat, time_t linger_hint) {
+
+    if (cond.service.empty() || cond.metric.empty()) {
+        log_err("error check error!");
+        return -1;
+    }
+
+    time_t now = ::time(NULL);
+    if (cond.tm_start > 0) {
+        stat.timestamp = std::min(now - linger_hint, cond.tm_start);
+    } else {
+        stat.timestamp = now - linger_hint;
+    }
+
+    stat.service = cond.service;
+    stat.tm_interval = cond.tm_interval;
+    stat.metric = cond.metric;
+    stat.entity_idx = cond.entity_idx;
+    stat.tag = cond.tag;
+
+    // 超过ttl的数据已经过期，不需要再访问那些桶
+    time_t upper = stat.timestamp;
+    time_t lower = now - ttl_;
+    if (stat.tm_interval > 0) {
+        lower = std::max(lower, stat.timestamp - cond.tm_interval);
+    }
+
+    std::vector<std::string> keys;
+    for (time_t bucket = lower - lower % bucket_span_; bucket <= upper; bucket += bucket_span_) {
+        keys.push_back(bucket_key(cond.service, cond.metric, bucket));
+    }
+
+    std::string groupby = "none";
+    if (cond.groupby != GroupType::kGroupNone) {
+        groupby.clear();
+        if (groupby_has_timestamp(cond.groupby)) {
+            groupby += "timestamp,";
+        }
+        if (groupby_has_tag(cond.groupby)) {
+            groupby += "tag,";
+        }
+        if (groupby_has_entity(cond.groupby)) {
+            groupby += "entity,";
+        }
+    }
+
+    std::vector<std::string> args {
+        std::to_string(lower), std::to_string(upper), cond.tag, cond.entity_idx, groupby,
+        std::to_string(cond.bucket_seconds), std::to_string(max_buckets_per_eval_)
+    };
+
+    redis_conn_ptr conn;
+    redis_pool_ptr_->request_scoped_conn(conn);
+    if (!conn) {
+        log_err("request redis conn failed!");
+        return -1;
+    }
+
+    // 分组结果，按照 (timestamp, tag, entity_idx) 有序，不分组的时候只有一个
+    std::map<std::tuple<time_t, std::string, std::string>, redis_agg_t> aggs_by_group {};
+
+    // 时间桶分批交给脚本聚合，每次只阻塞 redis 很短的时间
+    const size_t chunk = static_cast<size_t>(max_buckets_per_eval_);
+    for (size_t start = 0; start < keys.size(); start += chunk) {
+
+        std::vector<std::string> chunk_keys(keys.begin() + start,
+                                            keys.begin() + std::min(start + chunk, keys.size()));
+
+        redisReply_ptr reply = eval_aggregate(conn, chunk_keys, args);
+        if (!reply || reply->type != REDIS_REPLY_ARRAY) {
+            log_err("aggregate %s %s with %lu buckets failed.",
+                    cond.service.c_str(), cond.metric.c_str(), chunk_keys.size());
+            return -1;
+        }
+
+        for (size_t i=0; i<reply->elements; ++i) {
+
+            const redisReply* group = reply->element[i];
+            if (!group || group->type != REDIS_REPLY_ARRAY || group->elements != 12 ||
+                group->element[0]->type != REDIS_REPLY_STRING ||
+                group->element[1]->type != REDIS_REPLY_STRING ||
+                group->element[2]->type != REDIS_REPLY_STRING) {
+                log_err("invalid aggregate group reply at %lu", i);
+                return -1;
+            }
+
+            int64_t vals[9] {};
+            for (size_t j=0; j<9; ++j) {
+                vals[j] = group->element[j + 3]->integer;
+            }
+
+            if (vals[8] <= 0 || vals[0] <= 0) {
+                continue;
+            }
+
+            time_t timestamp = ::atoll(std::string(group->element[0]->str, group->element[0]->len).c_str());
+            std::string tag(group->element[1]->str, group->element[1]->len);
+            std::string entity_idx(group->element[2]->str, group->element[2]->len);
+
+            auto key = std::make_tuple(timestamp, tag, entity_idx);
+            auto iter = aggs_by_group.find(key);
+            if (iter == aggs_by_group.end()) {
+                redis_agg_t agg {};
+                agg.value_min = vals[3];
+                agg.value_max = vals[4];
+                iter = aggs_by_group.emplace(key, agg).first;
+            }
+
+            redis_agg_t& agg = iter->second;
+            agg.count     += vals[0];
+            agg.value_sum += vals[1] * 10000000LL + vals[2];
+            agg.value_min  = std::min(agg.value_min, vals[3]);
+            agg.value_max  = std::max(agg.value_max, vals[4]);
+            agg.p10_sum   += vals[5];
+            agg.p50_sum   += vals[6];
+            agg.p90_sum   += vals[7];
+            agg.items     += vals[8];
+        }
+    }
+
+    stat.summary = {};
+    int64_t p10_sum = 0, p50_sum = 0, p90_sum = 0, items = 0;
+
+    for (auto iter = aggs_by_group.begin(); iter != aggs_by_group.end(); ++iter) {
+
+        const redis_agg_t& agg = iter->second;
+
+        event_info_t info {};
+        info.count     = static_cast<int32_t>(agg.count);
+        info.value_sum = agg.value_sum;
+        info.value_avg = static_cast<int32_t>(agg.value_sum / agg.count);
+        info.value_min = static_cast<int32_t>(agg.value_min);
+        info.value_max = static_cast<int32_t>(agg.value_max);
+        info.value_p10 = static_cast<int32_t>(agg.p10_sum / agg.items);
+        info.value_p50 = static_cast<int32_t>(agg.p50_sum / agg.items);
+        info.value_p90 = static_cast<int32_t>(agg.p90_sum / agg.items);
+
+        if (items == 0 || info.value_min < stat.summary.value_min) {
+            stat.summary.value_min = info.value_min;
+        }
+        if (items == 0 || info.value_max > stat.summary.value_max) {
+            stat.summary.value_max = info.value_max;
+        }
+        stat.summary.count     += info.count;
+        stat.summary.value_sum += info.value_sum;
+        p10_sum += agg.p10_sum;
+        p50_sum += agg.p50_sum;
+        p90_sum += agg.p90_sum;
+        items   += agg.items;
+
+        if (cond.groupby != GroupType::kGroupNone) {
+            info.timestamp  = std::get<0>(iter->first);
+            info.tag        = std::get<1>(iter->first);
+            info.entity_idx = std::get<2>(iter->first);
+            stat.info.emplace_back(info);
+        }
+    }
+
+    if (stat.summary.count > 0) {
+        stat.summary.value_avg = stat.summary.value_sum / stat.summary.count;
+        stat.summary.value_p10 = p10_sum / items;
+        stat.summary.value_p50 = p50_sum / items;
+        stat.summary.value_p90 = p90_sum / items;
+    }
+
+    if (cond.groupby == GroupType::kGroupNone) {
+        return 0;
+    }
+
+    // 是否对结果进行排序
+    if (cond.orderby == OrderByType::kOrderByNone || cond.limit == 0) {
+        log_debug("order by %d, orders %d, limit %d, will not sort in server side",
+                  static_cast<int32_t>(cond.orderby), static_cast<int32_t>(cond.orders), cond.limit);
+        return 0;
+    }
+
+    if (stat.info.empty()) {
+        log_debug("detail info empty, do not need to sort.");
+        return 0;
+    }
+
+    Sort::do_sort(stat.info, cond.orderby, cond.orders, cond.limit);
+
+    return 0;
+}
+
+
+int StoreRedis::select_metrics(const std::string& service, std::vector<std::string>& metrics) {
+
+    if (service.empty()) {
+        log_err("select_metrics, service can not be empty!");
+        return -1;
+    }
+
+    metrics.clear();
+
+    redis_conn_ptr conn;
+    redis_pool_ptr_->request_scoped_conn(conn);
+    if (!conn) {
+        log_err("request redis conn failed!");
+        return -1;
+    }
+
+    redisReply_ptr reply = conn->ExecV(std::vector<std::string>{ "SMEMBERS", key_prefix_ + ":" + service + ":metrics" });
+    if (!reply || reply->type != REDIS_REPLY_ARRAY) {
+        log_err("select metrics for %s failed.", service.c_str());
+        return -1;
+    }
+
+    for (size_t i=0; i<reply->elements; ++i) {
+        metrics.emplace_back(reply->element[i]->str, reply->element[i]->len);
+    }
+
+    return 0;
+}
+
+int StoreRedis::select_services(std::vector<std::string>& services) {
+
+    services.clear();
+
+    redis_conn_ptr conn;
+    redis_pool_ptr_->request_scoped_conn(conn);
+    if (!conn) {
+        log_err("request redis conn failed!");
+        return -1;
+    }
+
+    redisReply_ptr reply = conn->ExecV(std::vector<std::string>{ "SMEMBERS", key_prefix_ + ":services" });
+    if (!reply || reply->type != REDIS_REPLY_ARRAY) {
+        log_err("select services failed.");
+        return -1;
+    }
+
+    for (size_t i=0; i<reply->elements; ++i) {
+        services.emplace_back(reply->element[i]->str, reply->element[i]->len);
+    }
+
+    return 0;
+}
@@ -0,0 +1,74 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+
+#ifndef __BUSINESS_STORE_REDIS_H__
+#define __BUSINESS_STORE_REDIS_H__
+
+#include <Connect/RedisConn.h>
+
+#include <Business/StoreIf.h>
+
+// redis 存储设计思路
+//
+// 只保存最近 ttl 时间内的数据，提供低延迟的近期查询
+// 按照 bucket_span 对时间分桶，每个 (service, metric, bucket) 一个hash
+//
+//     key_prefix:service:metric:<bucket_start>
+//         field: timestamp#tag#entity_idx
+//         value: count,sum,avg,min,max,p10,p50,p90
+//
+//     key_prefix:services           所有的 service 集合
+//     key_prefix:service:metrics    service 下的 metric 集合
+//
+// 写入的时候整批数据通过管道一次发送，查询的时候由Lua脚本在服务端完成聚合，
+// 只把分组的聚合结果返回回来。查询范围的时间桶分批执行脚本，避免长时间阻塞redis，
+// 各批的结果再在本地合并
+
+class StoreRedis: public StoreIf {
+
+public:
+    StoreRedis():
+        redis_pool_ptr_(),
+        key_prefix_("heracles"),
+        bucket_span_(300),
+        ttl_(3 * 24 * 3600),
+        max_buckets_per_eval_(12),
+        script_sha_() {
+    }
+
+public:
+
+    bool init(const libconfig::Config& conf) override;
+
+    int insert_ev_stat(const event_insert_t& stat) override;
+    int insert_ev_stats(const std::vector<event_insert_t>& stats) override;
+    int select_ev_stat(const event_cond_t& cond, event_select_t& stat, time_t linger_hint) override;
+
+    int select_metrics(const std::string& service, std::vector<std::string>& metrics) override;
+    int select_services(std::vector<std::string>& services) override;
+
+private:
+
+    std::string bucket_key(const std::string& service, const std::string& metric, time_t bucket) const;
+
+    // 执行服务端的聚合脚本，优先 EVALSHA
+    tzrpc::redisReply_ptr eval_aggregate(tzrpc::redis_conn_ptr& conn,
+                                         const std::vector<std::string>& keys,
+                                         const std::vector<std::string>& args);
+
+    std::shared_ptr<tzrpc::ConnPool<tzrpc::RedisConn, tzrpc::RedisConnPoolHelper>> redis_pool_ptr_;
+
+    std::string key_prefix_;
+    int bucket_span_;
+    int ttl_;
+    int max_buckets_per_eval_;  // 单次脚本调用最多聚合的时间桶
+
+    std::string script_sha_;
+};
+
+#endif // __BUSINESS_STORE_REDIS_H__
@@ -6,8 +6,10 @@
  */
 
 #include <sstream>
+#include <map>
 
 #include <Utils/Log.h>
+#include <Utils/Timer.h>
 
 #include <Business/Sort.h>
 #include <Business/StoreSql.h>
@@ -35,21 +37,49 @@ bool StoreSql::init(const libconfig::Config& conf) {
 
     database_ = mysql_database;
 
+    int value_i = 0;
+    if (conf.lookupValue("rpc.business.mysql.batch_max_rows", value_i) && value_i > 0) {
+        batch_max_rows_ = value_i;
+    }
+    if (conf.lookupValue("rpc.business.mysql.batch_max_bytes", value_i) && value_i > 0) {
+        batch_max_bytes_ = value_i;
+    }
+    if (conf.lookupValue("rpc.business.mysql.table_precreate_days", value_i) && value_i >= 0) {
+        precreate_days_ = value_i;
+    }
+
     int conn_pool_size = 0;
     if (!conf.lookupValue("rpc.business.mysql.conn_pool_size", conn_pool_size)) {
         conn_pool_size = 20;
         log_info("Using default conn_pool size: 20");
     }
 
+    // 获取连接的最长等待时间，0表示一直等待
+    int acquire_timeout_ms = 0;
+    conf.lookupValue("rpc.business.mysql.conn_acquire_timeout_ms", acquire_timeout_ms);
+
 //    mysql_passwd = Security::DecryptSelfParam(mysql_passwd.c_str());
     SqlConnPoolHelper helper(mysql_hostname, mysql_port,
                              mysql_username, mysql_passwd, mysql_database);
-    sql_pool_ptr_.reset(new ConnPool<SqlConn, SqlConnPoolHelper>("MySQLPool", conn_pool_size, helper));
+    sql_pool_ptr_.reset(new ConnPool<SqlConn, SqlConnPoolHelper>("MySQLPool", conn_pool_size, helper, 0, acquire_timeout_ms));
     if (!sql_pool_ptr_ || !sql_pool_ptr_->init()) {
         log_err("Init SqlConnPool failed!");
         return false;
     }
 
+    sql_conn_ptr conn;
+    sql_pool_ptr_->request_scoped_conn(conn);
+    if (!conn || load_known_tables(conn) != 0) {
+        log_err("load known tables failed!");
+        return false;
+    }
+
+    // 启动的时候执行一次，之后每小时检查
+    precreate_run();
+    if (!Timer::instance().add_timer(std::bind(&StoreSql::precreate_run, this), 3600 * 1000, true)) {
+        log_err("add precreate_run failed.");
+        return false;
+    }
 
     return true;
 }
@@ -65,6 +95,9 @@ std::string StoreSql::get_table_suffix(time_t time_sec) {
 }
 
 // 自动创建分表
+// 表结构 v2: 聚簇主键以 (F_metric, F_timestamp) 开头，和所有查询的过滤条件一致，
+// 查询按主键范围扫描，聚合字段直接在聚簇索引中读取，不再需要回表；
+// F_increment_id 放在主键最后保证唯一，允许同一时刻的重复上报
 int StoreSql::create_table(sql_conn_ptr& conn,
                            const std::string& database, const std::string& prefix,
                            const std::string& service, const std::string& suffix) {
@@ -97,16 +130,134 @@ int StoreSql::create_table(sql_conn_ptr& conn,
         "  `F_value_p50` int(10) NOT NULL COMMENT 'P50', "
         "  `F_value_p90` int(10) NOT NULL COMMENT 'P90', "
         "  `F_update_time` timestamp NOT NULL DEFAULT CURRENT_TIMESTAMP ON UPDATE CURRENT_TIMESTAMP, "
-        "  PRIMARY KEY (`F_increment_id`), "
-        "  KEY `F_index` (`F_timestamp`, `F_metric`, `F_tag`) "
+        "  PRIMARY KEY (`F_metric`, `F_timestamp`, `F_tag`, `F_entity_idx`, `F_increment_id`), "
+        "  KEY `F_increment` (`F_increment_id`) "
         ") ENGINE=InnoDB AUTO_INCREMENT=1 DEFAULT CHARSET=utf8; ",
         database.c_str(), prefix.c_str(), service.c_str(), suffix.c_str()
         );
 
-    conn->sqlconn_execute_update(sql);
+    if (conn->sqlconn_execute_update(sql) < 0) {
+        log_err("create table %s.%s__%s__events_%s failed.",
+                database.c_str(), prefix.c_str(), service.c_str(), suffix.c_str());
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int StoreSql::load_known_tables(sql_conn_ptr& conn) {
+
+    std::string sql = va_format(
+               " SELECT table_name FROM information_schema.tables WHERE "
+               " table_schema='%s' AND table_type = 'base table' AND table_name LIKE '%s\\_\\_%%\\_\\_events\\_%%'; ",
+               database_.c_str(), table_prefix_.c_str());
+
+    std::vector<std::string> names;
+    shared_result_ptr result;
+    result.reset(conn->sqlconn_execute_query(sql));
+    if (!result) {
+        log_err("Failed to query info: %s", sql.c_str());
+        return -1;
+    }
+
+    std::set<std::pair<std::string, std::string>> tables;
+    std::string head = table_prefix_ + "__";
+    std::string tail = "__events_";
+    while (result->next()) {
+
+        std::string t_name;
+        if(!cast_raw_value(result, 1, t_name)) {
+            log_err("raw cast failed...");
+            continue;
+        }
+
+        // prefix__service__events_yyyymm
+        size_t pos = t_name.rfind(tail);
+        if (t_name.compare(0, head.size(), head) != 0 || pos == std::string::npos || pos <= head.size()) {
+            continue;
+        }
+
+        tables.insert(std::make_pair(t_name.substr(head.size(), pos - head.size()),
+                                     t_name.substr(pos + tail.size())));
+    }
+
+    std::lock_guard<std::mutex> lock(table_lock_);
+    known_tables_.swap(tables);
+    log_notice("load %d known tables from %s", static_cast<int>(known_tables_.size()), database_.c_str());
     return 0;
 }
 
+bool StoreSql::is_table_known(const std::string& service, const std::string& suffix) {
+    std::lock_guard<std::mutex> lock(table_lock_);
+    return known_tables_.find(std::make_pair(service, suffix)) != known_tables_.end();
+}
+
+void StoreSql::forget_table(const std::string& service, const std::string& suffix) {
+    std::lock_guard<std::mutex> lock(table_lock_);
+    known_tables_.erase(std::make_pair(service, suffix));
+}
+
+int StoreSql::ensure_table(sql_conn_ptr& conn, const std::string& service, const std::string& suffix) {
+
+    if (is_table_known(service, suffix)) {
+        return 0;
+    }
+
+    // 只有一个写入者执行建表，其余的等待之后直接命中缓存
+    std::lock_guard<std::mutex> lock(create_lock_);
+    if (is_table_known(service, suffix)) {
+        return 0;
+    }
+
+    if (create_table(conn, database_, table_prefix_, service, suffix) != 0) {
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> table_lock(table_lock_);
+    known_tables_.insert(std::make_pair(service, suffix));
+    return 0;
+}
+
+void StoreSql::precreate_run() {
+
+    time_t now = ::time(NULL);
+    std::string curr_suffix = get_table_suffix(now);
+    std::string next_suffix = get_table_suffix(now + precreate_days_ * 24 * 3600);
+    if (next_suffix == curr_suffix) {
+        return;
+    }
+
+    // 本月有分表的服务，提前创建下个月的
+    std::set<std::string> services;
+    {
+        std::lock_guard<std::mutex> lock(table_lock_);
+        for (auto iter = known_tables_.begin(); iter != known_tables_.end(); ++iter) {
+            if (iter->second == curr_suffix) {
+                services.insert(iter->first);
+            }
+        }
+    }
+
+    if (services.empty()) {
+        return;
+    }
+
+    sql_conn_ptr conn;
+    sql_pool_ptr_->request_scoped_conn(conn);
+    if (!conn) {
+        log_err("request sql conn failed!");
+        return;
+    }
+
+    for (auto iter = services.begin(); iter != services.end(); ++iter) {
+        if (!is_table_known(*iter, next_suffix)) {
+            log_notice("precreate table for %s, suffix %s", iter->c_str(), next_suffix.c_str());
+            ensure_table(conn, *iter, next_suffix);
+        }
+    }
+}
+
 int StoreSql::insert_ev_stat(const event_insert_t& stat) {
 
     sql_conn_ptr conn;
@@ -120,6 +271,14 @@ int StoreSql::insert_ev_stat(const event_insert_t& stat) {
 }
 
 
+std::string StoreSql::table_name(const std::string& service, const std::string& suffix) const {
+    return database_ + "." + table_prefix_ + "__" + service + "__events_" + suffix;
+}
+
+static const char* kInsertColumns =
+    " (F_entity_idx, F_timestamp, F_metric, F_tag, F_step, "
+    "  F_count, F_value_sum, F_value_avg, F_value_min, F_value_max, F_value_p10, F_value_p50, F_value_p90) ";
+
 int StoreSql::insert_ev_stat(sql_conn_ptr& conn, const event_insert_t& stat) {
 
     if (!conn) {
@@ -137,32 +296,216 @@ int StoreSql::insert_ev_stat(sql_conn_ptr& conn, const event_insert_t& stat) {
         tag = "T";
     }
 
+    // 同一个分表的语句文本不变，连接上缓存的预处理语句可以直接复用
     std::string table_suffix = get_table_suffix(stat.timestamp);
-    std::string sql = va_format(
-                   " INSERT INTO %s.%s__%s__events_%s "
-                   " SET F_entity_idx = '%s', F_timestamp = %ld, "
-                   " F_metric = '%s', F_tag = '%s', F_step = %d, "
-                   " F_count = %d, F_value_sum = %ld, F_value_avg = %d, "
-                   " F_value_min = %d, F_value_max = %d, F_value_p10 = %d, F_value_p50 = %d, F_value_p90 = %d; ",
-                   database_.c_str(), table_prefix_.c_str(), stat.service.c_str(), table_suffix.c_str(),
-                   stat.entity_idx.c_str(), stat.timestamp,
-                   stat.metric.c_str(), tag.c_str(), stat.step,
-                   stat.count, stat.value_sum, stat.value_avg,
-                   stat.value_min, stat.value_max, stat.value_p10, stat.value_p50, stat.value_p90);
-
-    int nAffected = conn->sqlconn_execute_update(sql);
+    std::string sql = " INSERT INTO " + table_name(stat.service, table_suffix) + kInsertColumns +
+                      " VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?) ";
+
+    auto binder = [&](sql::PreparedStatement& stmt) {
+        stmt.setString(1, stat.entity_idx);
+        stmt.setInt64(2, stat.timestamp);
+        stmt.setString(3, stat.metric);
+        stmt.setString(4, tag);
+        stmt.setInt(5, stat.step);
+        stmt.setInt(6, stat.count);
+        stmt.setInt64(7, stat.value_sum);
+        stmt.setInt(8, stat.value_avg);
+        stmt.setInt(9, stat.value_min);
+        stmt.setInt(10, stat.value_max);
+        stmt.setInt(11, stat.value_p10);
+        stmt.setInt(12, stat.value_p50);
+        stmt.setInt(13, stat.value_p90);
+    };
+
+    if (ensure_table(conn, stat.service, table_suffix) != 0) {
+        return -1;
+    }
+
+    int nAffected = conn->sqlconn_execute_prepared_update(sql, binder);
     if (nAffected == 1) {
         return 0;
     }
 
-    log_notice("try create table and try again!");
-    create_table(conn, database_, table_prefix_, stat.service, table_suffix.c_str());
+    // 分表可能被外部删除了，缓存失效之后重建一次
+    log_notice("insert failed, check table and try again!");
+    forget_table(stat.service, table_suffix);
+    if (ensure_table(conn, stat.service, table_suffix) != 0) {
+        return -1;
+    }
 
-    nAffected = conn->sqlconn_execute_update(sql);
+    nAffected = conn->sqlconn_execute_prepared_update(sql, binder);
     return nAffected == 1 ? 0 : -1;
 }
 
 
+int StoreSql::insert_ev_stats(const std::vector<event_insert_t>& stats) {
+
+    if (stats.empty()) {
+        return 0;
+    }
+
+    // 按照分表归类
+    std::map<std::pair<std::string, std::string>, std::vector<const event_insert_t*>> tables;
+    for (auto iter = stats.begin(); iter != stats.end(); ++iter) {
+
+        if (iter->service.empty() || iter->metric.empty() || iter->timestamp == 0) {
+            log_err("error check error!");
+            return -1;
+        }
+
+        tables[std::make_pair(iter->service, get_table_suffix(iter->timestamp))].push_back(&*iter);
+    }
+
+    sql_conn_ptr conn;
+    sql_pool_ptr_->request_scoped_conn(conn);
+    if (!conn) {
+        log_err("request sql conn failed!");
+        return -1;
+    }
+
+    int ret = 0;
+    for (auto iter = tables.begin(); iter != tables.end(); ++iter) {
+        if (insert_ev_rows(conn, iter->first.first, iter->first.second, iter->second) != 0) {
+            log_err("batch insert %d rows into %s failed.", static_cast<int>(iter->second.size()),
+                    table_name(iter->first.first, iter->first.second).c_str());
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+int StoreSql::insert_ev_rows(sql_conn_ptr& conn,
+                             const std::string& service, const std::string& suffix,
+                             const std::vector<const event_insert_t*>& rows) {
+
+    std::string prefix = " INSERT INTO " + table_name(service, suffix) + kInsertColumns + " VALUES ";
+    bool table_checked = false;
+
+    if (ensure_table(conn, service, suffix) != 0) {
+        return -1;
+    }
+
+    size_t idx = 0;
+    while (idx < rows.size()) {
+
+        // 按照行数和长度切分成多条语句
+        std::stringstream ss;
+        ss << prefix;
+
+        size_t count = 0;
+        for (; idx < rows.size() && count < batch_max_rows_; ++idx, ++count) {
+
+            if (count > 0 && static_cast<size_t>(ss.tellp()) >= batch_max_bytes_) {
+                break;
+            }
+
+            const event_insert_t& stat = *rows[idx];
+            const std::string& tag = stat.tag.empty() ? std::string("T") : stat.tag;
+
+            // 拼接在sql文本中的字符串需要按照连接的字符集转义
+            std::string entity_idx, metric, escaped_tag;
+            if (!conn->sqlconn_escape_string(stat.entity_idx, entity_idx) ||
+                !conn->sqlconn_escape_string(stat.metric, metric) ||
+                !conn->sqlconn_escape_string(tag, escaped_tag)) {
+                log_err("escape row %s:%s failed.", stat.metric.c_str(), tag.c_str());
+                return -1;
+            }
+
+            ss << (count ? ", (" : "(")
+               << "'" << entity_idx << "', " << stat.timestamp << ", "
+               << "'" << metric << "', '" << escaped_tag << "', "
+               << static_cast<int>(stat.step) << ", " << stat.count << ", " << stat.value_sum << ", "
+               << stat.value_avg << ", " << stat.value_min << ", " << stat.value_max << ", "
+               << stat.value_p10 << ", " << stat.value_p50 << ", " << stat.value_p90 << ")";
+        }
+
+        std::string sql = ss.str();
+        int nAffected = conn->sqlconn_execute_update(sql);
+        if (nAffected != static_cast<int>(count) && !table_checked) {
+            log_notice("insert failed, check table and try again!");
+            forget_table(service, suffix);
+            table_checked = true;
+            if (ensure_table(conn, service, suffix) == 0) {
+                nAffected = conn->sqlconn_execute_update(sql);
+            }
+        }
+
+        if (nAffected != static_cast<int>(count)) {
+            log_err("batch insert %d rows failed, affected %d", static_cast<int>(count), nAffected);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+// 按时间分组的列，有 bucket_seconds 的时候合并到对齐的时间桶
+static std::string timestamp_column(const event_cond_t& cond) {
+    if (cond.bucket_seconds > 0) {
+        return va_format("(F_timestamp - F_timestamp %% %d)", cond.bucket_seconds);
+    }
+    return "F_timestamp";
+}
+
+// 排序字段对应的SQL表达式，需要和 cast_raw_value 之后的计算方式保持一致
+// 不能在SQL中排序的组合返回空，由服务端排序
+static std::string order_expression(const event_cond_t& cond) {
+
+    switch (cond.orderby) {
+        case OrderByType::kOrderByTimestamp:
+            return groupby_has_timestamp(cond.groupby) ? timestamp_column(cond) : "";
+        case OrderByType::kOrderByTag:
+            return groupby_has_tag(cond.groupby) ? "F_tag" : "";
+        case OrderByType::kOrderByCount:
+            return "SUM(F_count)";
+        case OrderByType::kOrderBySum:
+            return "SUM(F_value_sum)";
+        case OrderByType::kOrderByAvg:
+            return "SUM(F_value_sum) / SUM(F_count)";
+        case OrderByType::kOrderByMin:
+            return "MIN(F_value_min)";
+        case OrderByType::kOrderByMax:
+            return "MAX(F_value_max)";
+        case OrderByType::kOrderByP10:
+            return "AVG(F_value_p10)";
+        case OrderByType::kOrderByP50:
+            return "AVG(F_value_p50)";
+        case OrderByType::kOrderByP90:
+            return "AVG(F_value_p90)";
+        default:
+            return "";
+    }
+}
+
+// 有分组、排序和limit的时候，ORDER BY ... LIMIT 下推到mysql执行，
+// 只需要传输和处理limit条分组结果
+static bool order_push_down(const event_cond_t& cond) {
+    return cond.groupby != GroupType::kGroupNone && cond.limit > 0 &&
+           !order_expression(cond).empty();
+}
+
+// 参与分组的列，顺序和查询结果中聚合字段之后的列一致
+static std::string group_columns(const event_cond_t& cond) {
+
+    std::string columns;
+    if (groupby_has_timestamp(cond.groupby)) {
+        columns += timestamp_column(cond) + ", ";
+    }
+    if (groupby_has_tag(cond.groupby)) {
+        columns += "F_tag, ";
+    }
+    if (groupby_has_entity(cond.groupby)) {
+        columns += "F_entity_idx, ";
+    }
+
+    if (!columns.empty()) {
+        columns.erase(columns.size() - 2);
+    }
+    return columns;
+}
+
 std::string StoreSql::build_sql(const event_cond_t& cond, time_t linger_hint, time_t& real_start_time) {
 
     std::stringstream ss;
@@ -173,19 +516,14 @@ std::string StoreSql::build_sql(const event_cond_t& cond, time_t linger_hint, ti
         real_start_time = ::time(NULL) - linger_hint;
     }
 
-    if (cond.groupby == GroupType::kGroupbyTimestamp) {
-        ss << "SELECT IFNULL(SUM(F_count), 0), IFNULL(SUM(F_value_sum), 0), "
-                    " IFNULL(MIN(F_value_min), 0), IFNULL(MAX(F_value_max), 0), IFNULL(AVG(F_value_p10), 0), IFNULL(AVG(F_value_p50), 0), IFNULL(AVG(F_value_p90), 0), "
-                    " F_timestamp FROM ";
-    } else if (cond.groupby == GroupType::kGroupbyTag) {
-        ss << "SELECT IFNULL(SUM(F_count), 0), IFNULL(SUM(F_value_sum), 0), "
-                    " IFNULL(MIN(F_value_min), 0), IFNULL(MAX(F_value_max), 0), IFNULL(AVG(F_value_p10), 0), IFNULL(AVG(F_value_p50), 0), IFNULL(AVG(F_value_p90), 0), "
-                    " F_tag FROM ";
-    } else {
-        ss << "SELECT IFNULL(SUM(F_count), 0), IFNULL(SUM(F_value_sum), 0), "
-                    " IFNULL(MIN(F_value_min), 0), IFNULL(MAX(F_value_max), 0), IFNULL(AVG(F_value_p10), 0), IFNULL(AVG(F_value_p50), 0), IFNULL(AVG(F_value_p90), 0), "
-                    " FROM ";
+    std::string columns = group_columns(cond);
+
+    ss << "SELECT IFNULL(SUM(F_count), 0), IFNULL(SUM(F_value_sum), 0), "
+                " IFNULL(MIN(F_value_min), 0), IFNULL(MAX(F_value_max), 0), IFNULL(AVG(F_value_p10), 0), IFNULL(AVG(F_value_p50), 0), IFNULL(AVG(F_value_p90), 0) ";
+    if (!columns.empty()) {
+        ss << ", " << columns;
     }
+    ss << " FROM ";
 
     ss << database_ << "." << table_prefix_ << "__" << cond.service << "__events_" << get_table_suffix(real_start_time) ;
     ss << " WHERE F_timestamp <= " << real_start_time <<" AND F_timestamp > " << real_start_time - cond.tm_interval;
@@ -199,12 +537,20 @@ std::string StoreSql::build_sql(const event_cond_t& cond, time_t linger_hint, ti
         ss << " AND F_tag = '" << cond.tag << "'";
     }
 
-    if (cond.groupby == GroupType::kGroupbyTimestamp) {
-        ss << " GROUP BY F_timestamp ORDER BY F_timestamp DESC; ";
-    } else if (cond.groupby == GroupType::kGroupbyTag) {
-        ss << " GROUP BY F_tag; ";
+    if (!columns.empty()) {
+        ss << " GROUP BY " << columns;
     }
 
+    if (order_push_down(cond)) {
+        ss << " ORDER BY " << order_expression(cond)
+           << (cond.orders == OrderType::kOrderAsc ? " ASC" : " DESC")
+           << " LIMIT " << cond.limit;
+    } else if (groupby_has_timestamp(cond.groupby)) {
+        ss << " ORDER BY " << timestamp_column(cond) << " DESC";
+    }
+
+    ss << "; ";
+
     std::string sql = ss.str();
     log_debug("built query str: %s", sql.c_str());
 
@@ -264,18 +610,19 @@ int StoreSql::select_ev_stat(sql_conn_ptr& conn, const event_cond_t& cond, event
 
         event_info_t item {};
 
-        bool success = false;
-        if (cond.groupby == GroupType::kGroupbyTimestamp) {
-            success = cast_raw_value(result, 1, item.count, item.value_sum,
-                                     item.value_min, item.value_max, item.value_p10, item.value_p50, item.value_p90,
-                                     item.timestamp);
-        } else if (cond.groupby == GroupType::kGroupbyTag) {
-            success = cast_raw_value(result, 1, item.count, item.value_sum,
-                                     item.value_min, item.value_max, item.value_p10, item.value_p50, item.value_p90,
-                                     item.tag);
-        } else {
-            success = cast_raw_value(result, 1, item.count, item.value_sum,
-                                     item.value_min, item.value_max, item.value_p10, item.value_p50, item.value_p90);
+        bool success = cast_raw_value(result, 1, item.count, item.value_sum,
+                                      item.value_min, item.value_max, item.value_p10, item.value_p50, item.value_p90);
+
+        // 分组的列按照 group_columns 的顺序跟在聚合字段之后
+        uint32_t idx = 8;
+        if (success && groupby_has_timestamp(cond.groupby)) {
+            success = cast_raw_value(result, idx++, item.timestamp);
+        }
+        if (success && groupby_has_tag(cond.groupby)) {
+            success = cast_raw_value(result, idx++, item.tag);
+        }
+        if (success && groupby_has_entity(cond.groupby)) {
+            success = cast_raw_value(result, idx++, item.entity_idx);
         }
 
         if (!success) {
@@ -323,17 +670,37 @@ int StoreSql::select_ev_stat(sql_conn_ptr& conn, const event_cond_t& cond, event
         return 0;
     }
 
-    if (cond.orderby == OrderByType::kOrderByNone || cond.limit != 0) {
-        log_debug("order by %d, orders %d, limit %d, we will not sort in server side",
+    if (order_push_down(cond)) {
+
+        // 分组结果被LIMIT截断了，summary 需要单独对整个时间段查询
+        // tm_start 固定为本次查询的时间点，保证两次查询的范围一致
+        event_cond_t summary_cond = cond;
+        summary_cond.tm_start = real_start_time;
+        summary_cond.groupby = GroupType::kGroupNone;
+        summary_cond.orderby = OrderByType::kOrderByNone;
+        summary_cond.limit = 0;
+
+        event_select_t summary_stat {};
+        if (select_ev_stat(conn, summary_cond, summary_stat, linger_hint) != 0) {
+            log_err("query summary for %s:%s failed.", cond.service.c_str(), cond.metric.c_str());
+            return -1;
+        }
+
+        stat.summary = summary_stat.summary;
+
+        log_debug("order by %d, orders %d, limit %d, sorted by mysql",
                   static_cast<int32_t>(cond.orderby), static_cast<int32_t>(cond.orders), cond.limit);
         return 0;
     }
 
-    Sort::do_sort(stat.info, cond.orderby, cond.orders);
-    if (stat.info.size() > cond.limit) {
-        stat.info.erase(stat.info.begin() + cond.limit, stat.info.end());
+    if (cond.orderby == OrderByType::kOrderByNone || cond.limit == 0) {
+        log_debug("order by %d, orders %d, limit %d, we will not sort in server side",
+                  static_cast<int32_t>(cond.orderby), static_cast<int32_t>(cond.orders), cond.limit);
+        return 0;
     }
 
+    Sort::do_sort(stat.info, cond.orderby, cond.orders, cond.limit);
+
     return 0;
 }
 
@@ -434,3 +801,158 @@ int StoreSql::select_services(std::vector<std::string>& services) {
 
     return 0;
 }
+
+
+// 根据主键的第一个字段判断分表的结构版本
+int StoreSql::table_schema_version(sql_conn_ptr& conn, const std::string& service, const std::string& suffix) {
+
+    std::string sql = va_format(
+               " SELECT COLUMN_NAME FROM information_schema.statistics WHERE "
+               " table_schema='%s' AND table_name='%s__%s__events_%s' AND index_name='PRIMARY' "
+               " ORDER BY seq_in_index LIMIT 1; ",
+               database_.c_str(), table_prefix_.c_str(), service.c_str(), suffix.c_str());
+
+    std::string column;
+    if (!conn->sqlconn_execute_query_value(sql, column)) {
+        log_err("query primary key of %s failed.", table_name(service, suffix).c_str());
+        return -1;
+    }
+
+    return column == "F_metric" ? 2 : 1;
+}
+
+
+int StoreSql::migrate_tables(bool dry_run, std::vector<std::string>& output) {
+
+    sql_conn_ptr conn;
+    sql_pool_ptr_->request_scoped_conn(conn);
+    if (!conn) {
+        log_err("request sql conn failed!");
+        return -1;
+    }
+
+    if (load_known_tables(conn) != 0) {
+        log_err("load known tables failed.");
+        return -1;
+    }
+
+    std::set<std::pair<std::string, std::string>> tables;
+    {
+        std::lock_guard<std::mutex> lock(table_lock_);
+        tables = known_tables_;
+    }
+
+    int failed = 0;
+    for (auto iter = tables.begin(); iter != tables.end(); ++iter) {
+
+        std::string name = table_name(iter->first, iter->second);
+        int version = table_schema_version(conn, iter->first, iter->second);
+        if (version < 0) {
+            output.push_back("check " + name + " failed");
+            ++ failed;
+            continue;
+        }
+
+        if (version == 2) {
+            output.push_back("skip " + name + ", already v2");
+            continue;
+        }
+
+        // InnoDB 在线重建聚簇索引，期间不阻塞读写，
+        // 自增字段必须是某个索引的第一列，所以同时添加 F_increment
+        std::string sql = va_format(
+                " ALTER TABLE %s "
+                " DROP PRIMARY KEY, "
+                " ADD PRIMARY KEY (`F_metric`, `F_timestamp`, `F_tag`, `F_entity_idx`, `F_increment_id`), "
+                " ADD KEY `F_increment` (`F_increment_id`), "
+                " DROP KEY `F_index`, "
+                " ALGORITHM=INPLACE, LOCK=NONE; ",
+                name.c_str());
+
+        if (dry_run) {
+            output.push_back(sql);
+            continue;
+        }
+
+        log_notice("migrate %s to schema v2 ...", name.c_str());
+        if (conn->sqlconn_execute_update(sql) < 0) {
+            log_err("migrate %s failed: %s", name.c_str(), sql.c_str());
+            output.push_back("migrate " + name + " failed");
+            ++ failed;
+            continue;
+        }
+
+        output.push_back("migrate " + name + " ok");
+    }
+
+    return failed == 0 ? 0 : -1;
+}
+
+
+int StoreSql::explain_select(const std::string& service, const std::string& metric,
+                             std::vector<std::string>& output) {
+
+    sql_conn_ptr conn;
+    sql_pool_ptr_->request_scoped_conn(conn);
+    if (!conn) {
+        log_err("request sql conn failed!");
+        return -1;
+    }
+
+    struct {
+        enum GroupType groupby;
+        const char*    desc;
+    } groups[] = {
+        { GroupType::kGroupNone,         "groupby none" },
+        { GroupType::kGroupbyTimestamp,  "groupby timestamp" },
+        { GroupType::kGroupbyTag,        "groupby tag" },
+        { GroupType::kGroupbyEntity,     "groupby entity" },
+        { GroupType::kGroupbyTimestampTag, "groupby timestamp,tag" },
+        { GroupType::kGroupbyTagEntity,  "groupby tag,entity" },
+    };
+
+    int failed = 0;
+    for (size_t i=0; i<sizeof(groups)/sizeof(groups[0]); ++i) {
+        for (int with_entity = 0; with_entity < 2; ++with_entity) {
+
+            event_cond_t cond {};
+            cond.service = service;
+            cond.metric = metric;
+            cond.tm_interval = 60;
+            cond.groupby = groups[i].groupby;
+            if (with_entity) {
+                cond.entity_idx = "1";
+            }
+
+            time_t real_start_time = 0;
+            std::string sql = "EXPLAIN " + build_sql(cond, 0, real_start_time);
+
+            shared_result_ptr result;
+            result.reset(conn->sqlconn_execute_query(sql));
+            if (!result || !result->next()) {
+                log_err("Failed to explain: %s", sql.c_str());
+                ++ failed;
+                continue;
+            }
+
+            std::string type  = result->getString("type");
+            std::string key   = result->getString("key");
+            std::string rows  = result->getString("rows");
+            std::string extra = result->getString("Extra");
+
+            // 期望按照主键的 (F_metric, F_timestamp) 前缀范围扫描
+            bool ok = (key == "PRIMARY" && type == "range");
+            if (!ok) {
+                ++ failed;
+            }
+
+            std::stringstream ss;
+            ss << (ok ? "[OK]   " : "[FAIL] ") << groups[i].desc
+               << (with_entity ? " with entity_idx" : "")
+               << ": type " << type << ", key " << key << ", rows " << rows << ", extra " << extra;
+            output.push_back(ss.str());
+        }
+    }
+
+    return failed == 0 ? 0 : -1;
+}
@@ -9,22 +9,50 @@
 #ifndef __BUSINESS_STORE_SQL_H__
 #define __BUSINESS_STORE_SQL_H__
 
+#include <mutex>
+#include <set>
+
 #include <Connect/SqlConn.h>
 
 #include <Business/StoreIf.h>
 
 class StoreSql: public StoreIf {
 public:
+    StoreSql():
+        sql_pool_ptr_(),
+        database_(),
+        table_prefix_(),
+        batch_max_rows_(500),
+        batch_max_bytes_(1024 * 1024),
+        table_lock_(),
+        known_tables_(),
+        create_lock_(),
+        precreate_days_(3) {
+    }
 
     bool init(const libconfig::Config& conf) override;
     int insert_ev_stat(const event_insert_t& stat) override;
+    int insert_ev_stats(const std::vector<event_insert_t>& stats) override;
     int select_ev_stat(const event_cond_t& cond, event_select_t& stat, time_t linger_hint) override;
 
     int select_metrics(const std::string& service, std::vector<std::string>& metrics) override;
     int select_services(std::vector<std::string>& services) override;
 
+    // 已有分表在线迁移到表结构 v2，dry_run 只输出需要执行的 DDL
+    int migrate_tables(bool dry_run, std::vector<std::string>& output);
+
+    // 对各种分组方式的查询执行 EXPLAIN，检查是否走主键范围扫描
+    int explain_select(const std::string& service, const std::string& metric,
+                       std::vector<std::string>& output);
+
 private:
     int insert_ev_stat(tzrpc::sql_conn_ptr &conn, const event_insert_t& stat);
+
+    // 同一个分表的多行数据，拼接成 INSERT ... VALUES (...),(...) 写入
+    int insert_ev_rows(tzrpc::sql_conn_ptr &conn,
+                       const std::string& service, const std::string& suffix,
+                       const std::vector<const event_insert_t*>& rows);
+    std::string table_name(const std::string& service, const std::string& suffix) const;
     int select_ev_stat(tzrpc::sql_conn_ptr& conn, const event_cond_t& cond, event_select_t& stat,
                        time_t linger_hint);
 
@@ -33,6 +61,19 @@ private:
     int create_table(tzrpc::sql_conn_ptr& conn,
                      const std::string& database, const std::string& prefix,
                      const std::string& service, const std::string& suffix);
+
+    // 分表的结构版本，1: 自增主键 2: (F_metric, F_timestamp, ...) 聚簇主键
+    int table_schema_version(tzrpc::sql_conn_ptr& conn, const std::string& service, const std::string& suffix);
+
+    // 已经存在的分表缓存，写入路径上不再需要 DDL 或者失败重试
+    int  load_known_tables(tzrpc::sql_conn_ptr& conn);
+    bool is_table_known(const std::string& service, const std::string& suffix);
+    void forget_table(const std::string& service, const std::string& suffix);
+    int  ensure_table(tzrpc::sql_conn_ptr& conn, const std::string& service, const std::string& suffix);
+
+    // 定时提前创建下个月的分表
+    void precreate_run();
+
     std::string build_sql(const event_cond_t& cond, time_t linger_hint, time_t& start_time);
 
     // 数据库连接
@@ -40,6 +81,18 @@ private:
 
     std::string database_;
     std::string table_prefix_;
+
+    // 批量写入单条语句的最大行数和长度，长度需要小于服务端 max_allowed_packet
+    size_t batch_max_rows_;
+    size_t batch_max_bytes_;
+
+    std::mutex table_lock_;
+    // (service, suffix)
+    std::set<std::pair<std::string, std::string>> known_tables_;
+
+    // 串行化建表，避免并发的写入同时执行 DDL
+    std::mutex create_lock_;
+    int precreate_days_;     // 月底前多少天开始创建下个月的分表
 };
 
 #endif // __BUSINESS_STORE_SQL_H__
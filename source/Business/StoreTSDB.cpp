@@ -0,0 +1,816 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <tuple>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <dirent.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <Utils/Log.h>
+#include <Utils/Timer.h>
+
+#include <Business/Sort.h>
+#include <Business/StoreTSDB.h>
+
+using namespace tzrpc;
+
+static const char kBlockMagic[4] = { 'H', 'T', 'S', 'B' };
+// 版本1的序列键用#拼接，字段中包含#的序列无法解析，只读兼容
+static const uint16_t kBlockVersionJoined = 1;
+static const uint16_t kBlockVersion = 2;
+
+// TSDBBlock
+
+std::shared_ptr<TSDBBlock> TSDBBlock::open(const std::string& path) {
+
+    std::shared_ptr<TSDBBlock> block;
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        log_err("open block file %s failed.", path.c_str());
+        return block;
+    }
+
+    struct stat sb;
+    if (::fstat(fd, &sb) != 0 ||
+        static_cast<size_t>(sb.st_size) < sizeof(tsdb_block_header_t) + sizeof(tsdb_block_trailer_t)) {
+        log_err("invalid block file %s.", path.c_str());
+        ::close(fd);
+        return block;
+    }
+
+    void* addr = ::mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        log_err("mmap block file %s failed.", path.c_str());
+        return block;
+    }
+
+    block = std::make_shared<TSDBBlock>();
+    block->path_ = path;
+    block->data_ = static_cast<const char*>(addr);
+    block->size_ = sb.st_size;
+
+    tsdb_block_header_t header {};
+    tsdb_block_trailer_t trailer {};
+    ::memcpy(&header, block->data_, sizeof(header));
+    ::memcpy(&trailer, block->data_ + block->size_ - sizeof(trailer), sizeof(trailer));
+
+    uint64_t index_offset = be64toh(trailer.index_offset);
+    if (::memcmp(header.magic, kBlockMagic, 4) != 0 || ::memcmp(trailer.magic, kBlockMagic, 4) != 0 ||
+        (be16toh(header.version) != kBlockVersion && be16toh(header.version) != kBlockVersionJoined) ||
+        index_offset < sizeof(header) || index_offset > block->size_ - sizeof(trailer)) {
+        log_err("block file %s check failed.", path.c_str());
+        block.reset();  // munmap in destructor
+        return block;
+    }
+
+    block->start_ = static_cast<int64_t>(be64toh(header.start));
+    block->span_  = static_cast<int64_t>(be64toh(header.span));
+
+    // 加载序列索引
+    const char* ptr   = block->data_ + index_offset;
+    const char* limit = block->data_ + block->size_ - sizeof(trailer);
+    uint64_t series_count = 0;
+    if (!tsdb::Varint::get(ptr, limit, series_count)) {
+        log_err("block file %s index broken.", path.c_str());
+        block.reset();
+        return block;
+    }
+
+    const bool joined_key = be16toh(header.version) == kBlockVersionJoined;
+    std::vector<std::string> vec {};
+    for (uint64_t i=0; i<series_count; ++i) {
+
+        uint64_t key_len = 0;
+        uint64_t step = 0, count = 0, min_ts = 0, max_ts = 0, offset = 0, length = 0;
+        if (!tsdb::Varint::get(ptr, limit, key_len) || key_len > static_cast<uint64_t>(limit - ptr)) {
+            log_err("block file %s index broken at %lu.", path.c_str(), i);
+            block.reset();
+            return block;
+        }
+
+        std::string key(ptr, key_len);
+        ptr += key_len;
+
+        if (!tsdb::Varint::get(ptr, limit, step)   || !tsdb::Varint::get(ptr, limit, count)  ||
+            !tsdb::Varint::get(ptr, limit, min_ts) || !tsdb::Varint::get(ptr, limit, max_ts) ||
+            !tsdb::Varint::get(ptr, limit, offset) || !tsdb::Varint::get(ptr, limit, length) ||
+            offset + length > index_offset) {
+            log_err("block file %s index broken at %lu.", path.c_str(), i);
+            block.reset();
+            return block;
+        }
+
+        tsdb_series_ref_t ref {};
+        if (joined_key) {
+            // metric#tag#entity_idx
+            boost::split(vec, key, boost::is_any_of("#"));
+            if (vec.size() != 3 || vec[0].empty()) {
+                log_err("problem series key in %s: %s", path.c_str(), key.c_str());
+                continue;
+            }
+            ref.metric     = vec[0];
+            ref.tag        = vec[1];
+            ref.entity_idx = vec[2];
+        } else if (!tsdb::SeriesKey::decode(key, ref.metric, ref.tag, ref.entity_idx) || ref.metric.empty()) {
+            log_err("problem series key in %s at %lu", path.c_str(), i);
+            continue;
+        }
+
+        ref.step   = static_cast<uint8_t>(step);
+        ref.count  = static_cast<uint32_t>(count);
+        ref.min_ts = tsdb::Varint::unzigzag(min_ts);
+        ref.max_ts = tsdb::Varint::unzigzag(max_ts);
+        ref.offset = offset;
+        ref.length = length;
+
+        block->series_[ref.metric].push_back(ref);
+    }
+
+    log_debug("load block %s, start %ld, span %ld, series %lu",
+              path.c_str(), block->start_, block->span_, series_count);
+    return block;
+}
+
+TSDBBlock::~TSDBBlock() {
+    if (data_) {
+        ::munmap(const_cast<char*>(data_), size_);
+        data_ = NULL;
+    }
+}
+
+
+// StoreTSDB
+
+bool StoreTSDB::init(const libconfig::Config& conf) {
+
+    if (!conf.lookupValue("rpc.business.tsdb.filepath", filepath_) ||
+        !conf.lookupValue("rpc.business.tsdb.table_prefix", table_prefix_) ||
+        filepath_.empty() || table_prefix_.empty() )
+    {
+        log_err("Error, get tsdb configure value error");
+        return false;
+    }
+
+    conf.lookupValue("rpc.business.tsdb.block_span", block_span_);
+    conf.lookupValue("rpc.business.tsdb.seal_delay", seal_delay_);
+    if (block_span_ <= 0 || seal_delay_ < 0) {
+        log_err("invalid tsdb block_span %d, seal_delay %d", block_span_, seal_delay_);
+        return false;
+    }
+
+    // check dest exist?
+    if (::access(filepath_.c_str(), W_OK) != 0) {
+        log_err("access filepath_ %s failed.", filepath_.c_str());
+        return false;
+    }
+
+    // 加载已经存在的块文件
+    DIR *d = NULL;
+    struct dirent* d_item = NULL;
+    struct stat sb;
+
+    if (!(d = opendir(filepath_.c_str()))) {
+        log_err("opendir for %s failed.",  filepath_.c_str());
+        return false;
+    }
+
+    std::string prefix = table_prefix_ + "__";
+    std::vector<std::string> services {};
+    while ( (d_item = readdir(d)) != NULL ) {
+
+        std::string t_name = d_item->d_name;
+        std::string fullfile = filepath_ + "/" + t_name;
+        if (t_name.size() > prefix.size() && t_name.compare(0, prefix.size(), prefix) == 0 &&
+            stat(fullfile.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode)) {
+            services.push_back(t_name.substr(prefix.size()));
+        }
+    }
+    closedir(d);
+
+    for (size_t i=0; i<services.size(); ++i) {
+        if (load_service(services[i], filepath_ + "/" + prefix + services[i]) != 0) {
+            log_err("load tsdb service %s failed.", services[i].c_str());
+            return false;
+        }
+    }
+
+    if (!Timer::instance().add_timer(std::bind(&StoreTSDB::seal_run, this), 5 * 1000, true)) {
+        log_err("add seal_run failed.");
+        return false;
+    }
+
+    log_notice("tsdb storage initialized with filepath: %s, table_prefix: %s, block_span: %d, services: %lu",
+               filepath_.c_str(), table_prefix_.c_str(), block_span_, services.size());
+    return true;
+}
+
+
+int StoreTSDB::load_service(const std::string& service, const std::string& dirpath) {
+
+    auto svc = std::make_shared<service_t>();
+    svc->dirpath_ = dirpath;
+
+    DIR *d = NULL;
+    struct dirent* d_item = NULL;
+
+    if (!(d = opendir(dirpath.c_str()))) {
+        log_err("opendir for %s failed.",  dirpath.c_str());
+        return -1;
+    }
+
+    std::vector<std::string> files {};
+    while ( (d_item = readdir(d)) != NULL ) {
+        std::string t_name = d_item->d_name;
+        if (t_name.size() > 4 && t_name.compare(t_name.size() - 4, 4, ".blk") == 0) {
+            files.push_back(dirpath + "/" + t_name);
+        }
+    }
+    closedir(d);
+
+    for (size_t i=0; i<files.size(); ++i) {
+        auto block = TSDBBlock::open(files[i]);
+        if (!block) {
+            log_err("skip broken block file %s", files[i].c_str());
+            continue;
+        }
+        svc->blocks_.push_back(block);
+    }
+
+    std::lock_guard<std::mutex> lock(lock_);
+    services_[service] = svc;
+    return 0;
+}
+
+
+std::shared_ptr<StoreTSDB::service_t> StoreTSDB::get_service(const std::string& service, bool create) {
+
+    std::lock_guard<std::mutex> lock(lock_);
+
+    auto iter = services_.find(service);
+    if (iter != services_.end()) {
+        return iter->second;
+    }
+
+    if (!create) {
+        return std::shared_ptr<service_t>();
+    }
+
+    std::string dirpath = filepath_ + "/" + table_prefix_ + "__" + service;
+    if (::mkdir(dirpath.c_str(), 0755) != 0 && errno != EEXIST) {
+        log_err("create tsdb dir %s failed.", dirpath.c_str());
+        return std::shared_ptr<service_t>();
+    }
+
+    auto svc = std::make_shared<service_t>();
+    svc->dirpath_ = dirpath;
+    services_[service] = svc;
+
+    log_notice("create tsdb service %s at %s", service.c_str(), dirpath.c_str());
+    return svc;
+}
+
+
+int StoreTSDB::insert_ev_stat(const event_insert_t& stat) {
+
+    if (stat.service.empty() || stat.metric.empty() || stat.timestamp == 0) {
+        log_err("error check error!");
+        return -1;
+    }
+
+    std::string tag = stat.tag;
+    if (tag.empty()) {
+        tag = "T";
+    }
+
+    auto svc = get_service(stat.service, true);
+    if (!svc) {
+        log_err("get tsdb service %s failed.", stat.service.c_str());
+        return -1;
+    }
+
+    tsdb::point_t pt {};
+    pt.timestamp = stat.timestamp;
+    pt.count     = stat.count;
+    pt.value_sum = stat.value_sum;
+    pt.value_avg = stat.value_avg;
+    pt.value_min = stat.value_min;
+    pt.value_max = stat.value_max;
+    pt.value_p10 = stat.value_p10;
+    pt.value_p50 = stat.value_p50;
+    pt.value_p90 = stat.value_p90;
+
+    time_t block_start = stat.timestamp - stat.timestamp % block_span_;
+    std::string key = tsdb::SeriesKey::encode(stat.metric, tag, stat.entity_idx);
+
+    std::lock_guard<std::mutex> lock(svc->lock_);
+
+    auto& head = svc->heads_[block_start];
+    if (!head) {
+        head = std::make_shared<head_block_t>();
+        head->start_ = block_start;
+    }
+
+    auto iter = head->series_.find(key);
+    if (iter == head->series_.end()) {
+        head_series_t series {};
+        series.metric = stat.metric;
+        series.tag    = tag;
+        series.entity_idx = stat.entity_idx;
+        series.step   = stat.step;
+        series.min_ts = stat.timestamp;
+        series.max_ts = stat.timestamp;
+        iter = head->series_.insert(std::make_pair(key, series)).first;
+    }
+
+    iter->second.min_ts = std::min(iter->second.min_ts, stat.timestamp);
+    iter->second.max_ts = std::max(iter->second.max_ts, stat.timestamp);
+    iter->second.encoder.append(pt);
+
+    return 0;
+}
+
+
+// 先写临时文件并且落盘，rename 之后再同步目录，
+// 否则掉电之后可能留下一个空的块文件
+static bool write_file_sync(const std::string& dirpath, const std::string& tmp_file,
+                            const std::string& filename, const std::string& data) {
+
+    int fd = ::open(tmp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_err("open tmp file %s failed: %s", tmp_file.c_str(), strerror(errno));
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t ret = ::write(fd, data.c_str() + written, data.size() - written);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_err("write tmp file %s failed: %s", tmp_file.c_str(), strerror(errno));
+            ::close(fd);
+            ::unlink(tmp_file.c_str());
+            return false;
+        }
+        written += ret;
+    }
+
+    if (::fsync(fd) != 0) {
+        log_err("fsync tmp file %s failed: %s", tmp_file.c_str(), strerror(errno));
+        ::close(fd);
+        ::unlink(tmp_file.c_str());
+        return false;
+    }
+    ::close(fd);
+
+    if (::rename(tmp_file.c_str(), filename.c_str()) != 0) {
+        log_err("rename %s to %s failed: %s", tmp_file.c_str(), filename.c_str(), strerror(errno));
+        ::unlink(tmp_file.c_str());
+        return false;
+    }
+
+    int dir_fd = ::open(dirpath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0 || ::fsync(dir_fd) != 0) {
+        log_err("fsync directory %s failed: %s", dirpath.c_str(), strerror(errno));
+        if (dir_fd >= 0) {
+            ::close(dir_fd);
+        }
+        return false;
+    }
+    ::close(dir_fd);
+
+    return true;
+}
+
+std::shared_ptr<TSDBBlock> StoreTSDB::seal_head(const std::string& dirpath, const head_block_t& head) {
+
+    std::string data;
+    tsdb_block_header_t header {};
+    ::memcpy(header.magic, kBlockMagic, 4);
+    header.version = htobe16(kBlockVersion);
+    header.start = htobe64(head.start_);
+    header.span  = htobe64(block_span_);
+    data.append(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::string index;
+    tsdb::Varint::put(index, head.series_.size());
+    for (auto iter = head.series_.begin(); iter != head.series_.end(); ++iter) {
+
+        uint64_t offset = data.size();
+        iter->second.encoder.serialize(data);
+
+        tsdb::Varint::put(index, iter->first.size());
+        index.append(iter->first);
+        tsdb::Varint::put(index, iter->second.step);
+        tsdb::Varint::put(index, iter->second.encoder.count());
+        tsdb::Varint::put(index, tsdb::Varint::zigzag(iter->second.min_ts));
+        tsdb::Varint::put(index, tsdb::Varint::zigzag(iter->second.max_ts));
+        tsdb::Varint::put(index, offset);
+        tsdb::Varint::put(index, data.size() - offset);
+    }
+
+    tsdb_block_trailer_t trailer {};
+    trailer.index_offset = htobe64(data.size());
+    ::memcpy(trailer.magic, kBlockMagic, 4);
+    data.append(index);
+    data.append(reinterpret_cast<const char*>(&trailer), sizeof(trailer));
+
+    // 迟到的数据会产生同一个时间块的多个文件，序号避免覆盖，调用者持有 seal_lock_
+    char filename[PATH_MAX] {};
+    time_t seal_time = ::time(NULL);
+    for (int seq = 0; ; ++seq) {
+        snprintf(filename, PATH_MAX, "%s/%ld_%ld_%d.blk", dirpath.c_str(), head.start_, seal_time, seq);
+        if (::access(filename, F_OK) != 0) {
+            break;
+        }
+    }
+    std::string tmp_file = std::string(filename) + ".tmp";
+
+    if (!write_file_sync(dirpath, tmp_file, filename, data)) {
+        log_err("write block file %s failed.", filename);
+        return std::shared_ptr<TSDBBlock>();
+    }
+
+    auto block = TSDBBlock::open(filename);
+    if (!block) {
+        log_err("reopen sealed block %s failed.", filename);
+        return block;
+    }
+
+    log_notice("seal block %s, series %lu, size %lu", filename, head.series_.size(), data.size());
+    return block;
+}
+
+void StoreTSDB::seal_run() {
+    seal_heads(::time(NULL) - block_span_ - seal_delay_);
+}
+
+void StoreTSDB::stop_graceful() {
+
+    log_notice("seal all tsdb heads before exit ...");
+    seal_heads(std::numeric_limits<time_t>::max());
+}
+
+void StoreTSDB::seal_heads(time_t expire) {
+
+    std::lock_guard<std::mutex> seal_lock(seal_lock_);
+
+    std::vector<std::shared_ptr<service_t>> services;
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        for (auto iter = services_.begin(); iter != services_.end(); ++iter) {
+            services.push_back(iter->second);
+        }
+    }
+
+    for (size_t i=0; i<services.size(); ++i) {
+
+        auto& svc = services[i];
+
+        // 摘下过期的 head，连同之前落盘失败的一起处理
+        std::vector<std::pair<time_t, std::shared_ptr<head_block_t>>> sealing;
+        {
+            std::lock_guard<std::mutex> lock(svc->lock_);
+
+            auto& heads = svc->heads_;
+            while (!heads.empty() && heads.begin()->first <= expire) {
+                svc->sealing_.insert(*heads.begin());
+                heads.erase(heads.begin());
+            }
+
+            sealing.assign(svc->sealing_.begin(), svc->sealing_.end());
+        }
+
+        for (size_t j=0; j<sealing.size(); ++j) {
+
+            // 摘下的 head 不会再被修改，不持有锁写文件
+            auto block = seal_head(svc->dirpath_, *sealing[j].second);
+            if (!block) {
+                log_err("seal head block %ld at %s failed, retry later.",
+                        sealing[j].first, svc->dirpath_.c_str());
+                continue;
+            }
+
+            // 在同一个锁内换成块文件，查询不会看到数据缺失或者重复
+            std::lock_guard<std::mutex> lock(svc->lock_);
+            svc->blocks_.push_back(block);
+
+            auto range = svc->sealing_.equal_range(sealing[j].first);
+            for (auto iter = range.first; iter != range.second; ++iter) {
+                if (iter->second == sealing[j].second) {
+                    svc->sealing_.erase(iter);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+
+int StoreTSDB::scan_points(const event_cond_t& cond, time_t lower, time_t upper,
+                           std::vector<tsdb_item_t>& items) {
+
+    auto svc = get_service(cond.service, false);
+    if (!svc) {
+        log_debug("tsdb service %s not found.", cond.service.c_str());
+        return 0;
+    }
+
+    std::vector<std::shared_ptr<TSDBBlock>> blocks;
+    std::vector<tsdb::point_t> points;
+
+    // head的数据在锁内直接从编码器的列缓冲区解码，块文件只读，可以在锁外解码
+    {
+        std::lock_guard<std::mutex> lock(svc->lock_);
+        blocks = svc->blocks_;
+
+        // 长度前缀保证只匹配这个 metric 的序列
+        std::string metric_prefix = tsdb::SeriesKey::prefix(cond.metric);
+
+        // 正在写入的和正在落盘的 head
+        std::vector<std::shared_ptr<head_block_t>> heads;
+        for (auto iter = svc->heads_.begin(); iter != svc->heads_.end(); ++iter) {
+            heads.push_back(iter->second);
+        }
+        for (auto iter = svc->sealing_.begin(); iter != svc->sealing_.end(); ++iter) {
+            heads.push_back(iter->second);
+        }
+
+        for (size_t k=0; k<heads.size(); ++k) {
+
+            if (heads[k]->start_ > upper || heads[k]->start_ + block_span_ <= lower) {
+                continue;
+            }
+
+            auto& series = heads[k]->series_;
+            for (auto it = series.lower_bound(metric_prefix);
+                 it != series.end() && it->first.compare(0, metric_prefix.size(), metric_prefix) == 0; ++it) {
+
+                if (!cond.tag.empty() && it->second.tag != cond.tag)
+                    continue;
+
+                if (!cond.entity_idx.empty() && it->second.entity_idx != cond.entity_idx)
+                    continue;
+
+                if (it->second.min_ts > upper || it->second.max_ts < lower)
+                    continue;
+
+                points.clear();
+                if (!it->second.encoder.decode(points)) {
+                    log_err("decode head series %s#%s#%s failed.",
+                            it->second.metric.c_str(), it->second.tag.c_str(), it->second.entity_idx.c_str());
+                    continue;
+                }
+
+                for (size_t i=0; i<points.size(); ++i) {
+                    if (points[i].timestamp >= lower && points[i].timestamp <= upper) {
+                        items.push_back(tsdb_item_t { it->second.tag, it->second.entity_idx, points[i] });
+                    }
+                }
+            }
+        }
+    }
+
+    for (size_t i=0; i<blocks.size(); ++i) {
+
+        if (!blocks[i]->overlap(lower, upper)) {
+            continue;
+        }
+
+        const std::vector<tsdb_series_ref_t>* refs = blocks[i]->find_metric(cond.metric);
+        if (!refs) {
+            continue;
+        }
+
+        for (auto it = refs->begin(); it != refs->end(); ++it) {
+
+            if (!cond.tag.empty() && it->tag != cond.tag)
+                continue;
+
+            if (!cond.entity_idx.empty() && it->entity_idx != cond.entity_idx)
+                continue;
+
+            if (it->min_ts > upper || it->max_ts < lower)
+                continue;
+
+            points.clear();
+            if (!blocks[i]->decode(*it, points)) {
+                log_err("decode series %s#%s#%s in %s failed.",
+                        it->metric.c_str(), it->tag.c_str(), it->entity_idx.c_str(), blocks[i]->path_.c_str());
+                continue;
+            }
+
+            for (size_t j=0; j<points.size(); ++j) {
+                if (points[j].timestamp >= lower && points[j].timestamp <= upper) {
+                    items.push_back(tsdb_item_t { it->tag, it->entity_idx, points[j] });
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+
+static void collect_group(const std::vector<event_info_t>& infos, event_info_t& collect) {
+
+    collect.value_min = std::numeric_limits<int32_t>::max();
+    collect.value_max = std::numeric_limits<int32_t>::min();
+
+    for (size_t i=0; i<infos.size(); ++i) {
+        collect.count     += infos[i].count;
+        collect.value_sum += infos[i].value_sum;
+        collect.value_p10 += infos[i].value_p10;
+        collect.value_p50 += infos[i].value_p50;
+        collect.value_p90 += infos[i].value_p90;
+
+        if (infos[i].value_min < collect.value_min) {
+            collect.value_min = infos[i].value_min;
+        }
+
+        if (infos[i].value_max > collect.value_max) {
+            collect.value_max = infos[i].value_max;
+        }
+    }
+
+    if (collect.count > 0) {
+        collect.value_avg = collect.value_sum / collect.count;
+        collect.value_p10 = collect.value_p10 / infos.size();
+        collect.value_p50 = collect.value_p50 / infos.size();
+        collect.value_p90 = collect.value_p90 / infos.size();
+    } else {
+        // avoid display confusing value.
+        collect.value_min = 0;
+        collect.value_max = 0;
+    }
+}
+
+// group summary
+int StoreTSDB::select_ev_stat(const event_cond_t& cond, event_select_t& stat, time_t linger_hint) {
+
+    if (cond.service.empty()) {
+        log_err("error check error!");
+        return -1;
+    }
+
+    if (cond.tm_start > 0) {
+        stat.timestamp = std::min(::time(NULL) - linger_hint, cond.tm_start);
+    } else {
+        stat.timestamp = ::time(NULL) - linger_hint;
+    }
+
+    stat.service = cond.service;
+    stat.tm_interval = cond.tm_interval;
+    stat.metric = cond.metric;
+    stat.entity_idx = cond.entity_idx;
+    stat.tag = cond.tag;
+
+    time_t upper = stat.timestamp;
+    time_t lower = 0;
+    if (stat.tm_interval > 0) {
+        lower = stat.timestamp - cond.tm_interval;
+    }
+
+    std::vector<tsdb_item_t> items;
+    if (scan_points(cond, lower, upper, items) != 0) {
+        log_err("scan points for %s %s failed.", cond.service.c_str(), cond.metric.c_str());
+        return -1;
+    }
+
+    // 聚合信息
+    // key: (timestamp, tag, entity_idx)，不参与分组的维度为默认值，所有分组方式一次完成
+    typedef std::tuple<time_t, std::string, std::string> group_key_t;
+    std::map<group_key_t, std::vector<event_info_t>> infos_by_group {};
+    std::vector<event_info_t> infos_all {};
+
+    bool by_timestamp = groupby_has_timestamp(cond.groupby);
+    bool by_tag = groupby_has_tag(cond.groupby);
+    bool by_entity = groupby_has_entity(cond.groupby);
+
+    for (size_t i=0; i<items.size(); ++i) {
+
+        const tsdb::point_t& pt = items[i].point;
+
+        event_info_t item {};
+        item.timestamp = pt.timestamp;
+        item.tag       = items[i].tag;
+        item.count     = pt.count;
+        item.value_sum = pt.value_sum;
+        item.value_avg = pt.value_avg;
+        item.value_min = pt.value_min;
+        item.value_max = pt.value_max;
+        item.value_p10 = pt.value_p10;
+        item.value_p50 = pt.value_p50;
+        item.value_p90 = pt.value_p90;
+
+        if (cond.groupby != GroupType::kGroupNone) {
+            group_key_t key(by_timestamp ? cond.bucket_of(item.timestamp) : 0,
+                            by_tag ? item.tag : std::string(),
+                            by_entity ? items[i].entity_idx : std::string());
+            infos_by_group[key].push_back(item);
+        }
+
+        infos_all.emplace_back(item);
+    }
+
+    stat.summary = {};
+    collect_group(infos_all, stat.summary);
+
+    if (cond.groupby == GroupType::kGroupNone) {
+        return 0;
+    }
+
+    for (auto iter = infos_by_group.begin(); iter != infos_by_group.end(); ++iter) {
+        event_info_t collect {};
+        collect_group(iter->second, collect);
+        collect.timestamp  = std::get<0>(iter->first);
+        collect.tag        = std::get<1>(iter->first);
+        collect.entity_idx = std::get<2>(iter->first);
+        stat.info.emplace_back(collect);
+    }
+
+    // 是否对结果进行排序
+    if (cond.orderby == OrderByType::kOrderByNone || cond.limit == 0) {
+        log_debug("order by %d, orders %d, limit %d, will not sort in server side",
+                  static_cast<int32_t>(cond.orderby), static_cast<int32_t>(cond.orders), cond.limit);
+        return 0;
+    }
+
+    if (stat.info.empty()) {
+        log_debug("detail info empty, do not need to sort.");
+        return 0;
+    }
+
+    Sort::do_sort(stat.info, cond.orderby, cond.orders, cond.limit);
+
+    return 0;
+}
+
+
+int StoreTSDB::select_metrics(const std::string& service, std::vector<std::string>& metrics) {
+
+    if (service.empty()) {
+        log_err("select_metrics, service can not be empty!");
+        return -1;
+    }
+
+    metrics.clear();
+    auto svc = get_service(service, false);
+    if (!svc) {
+        return 0;
+    }
+
+    std::set<std::string> unique_metrics;
+
+    std::lock_guard<std::mutex> lock(svc->lock_);
+    for (auto iter = svc->heads_.begin(); iter != svc->heads_.end(); ++iter) {
+        for (auto it = iter->second->series_.begin(); it != iter->second->series_.end(); ++it) {
+            unique_metrics.insert(it->second.metric);
+        }
+    }
+
+    for (auto iter = svc->sealing_.begin(); iter != svc->sealing_.end(); ++iter) {
+        for (auto it = iter->second->series_.begin(); it != iter->second->series_.end(); ++it) {
+            unique_metrics.insert(it->second.metric);
+        }
+    }
+
+    for (size_t i=0; i<svc->blocks_.size(); ++i) {
+        svc->blocks_[i]->metrics(unique_metrics);
+    }
+
+    metrics.assign(unique_metrics.cbegin(),  unique_metrics.cend());
+    return 0;
+}
+
+
+int StoreTSDB::select_services(std::vector<std::string>& services) {
+
+    std::lock_guard<std::mutex> lock(lock_);
+
+    services.clear();
+    for (auto iter = services_.begin(); iter != services_.end(); ++iter) {
+        services.emplace_back(iter->first);
+    }
+
+    return 0;
+}
@@ -0,0 +1,211 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+
+#ifndef __BUSINESS_STORE_TSDB_H__
+#define __BUSINESS_STORE_TSDB_H__
+
+#include <Business/StoreIf.h>
+
+#include <mutex>
+#include <memory>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <Business/TSDBCodec.h>
+
+// tsdb 存储设计思路
+//
+// 序列: service 下的 (metric, tag, entity_idx)，键的编码见 tsdb::SeriesKey
+// 按照 block_span 对时间进行分块，当前块的数据在内存中按列压缩追加(head)，
+// 块时间过去 seal_delay 之后落盘为不可变的块文件，通过mmap提供查询
+//
+//     filepath/table_prefix__service/<block_start>_<seal_time>_<seq>.blk
+//
+// 落盘的时候先把 head 摘下放入 sealing_，之后的写入进入新的 head，文件在锁外写入，
+// 完成之后再换成块文件，落盘不会阻塞同一个 service 的写入
+//
+// 块文件格式:
+//     tsdb_block_header_t
+//     series data ...               (SeriesEncoder::serialize)
+//     series index                  (varint count, [key, step, count, min_ts, max_ts, offset, length] ...)
+//                                   key 在版本1中为 metric#tag#entity_idx，版本2为 SeriesKey
+//     tsdb_block_trailer_t
+//
+// 注意: head 数据只存在于内存，进程异常退出会丢失尚未落盘的块；
+// 正常停止的时候所有的 head (包括还没有结束的时间块)都会落盘，重启之后同一个时间块的数据写入新的块文件
+
+
+// packed存储，网络字节序
+struct tsdb_block_header_t {
+    char    magic[4];   // "HTSB"
+    uint16_t version;
+    uint16_t rev;
+    int64_t start;
+    int64_t span;
+} __attribute__ ((packed)) ;
+
+struct tsdb_block_trailer_t {
+    uint64_t index_offset;
+    char    magic[4];   // "HTSB"
+} __attribute__ ((packed)) ;
+
+
+// 块内单个序列的索引信息
+struct tsdb_series_ref_t {
+    std::string metric;
+    std::string tag;
+    std::string entity_idx;
+    uint8_t  step;
+    uint32_t count;
+    time_t   min_ts;
+    time_t   max_ts;
+    uint64_t offset;
+    uint64_t length;
+};
+
+// 查询扫描出来的数据点
+struct tsdb_item_t {
+    std::string tag;
+    std::string entity_idx;
+    tsdb::point_t point;
+};
+
+
+// 不可变的块文件，mmap只读
+class TSDBBlock {
+
+public:
+    static std::shared_ptr<TSDBBlock> open(const std::string& path);
+
+    TSDBBlock():
+        path_(),
+        start_(0),
+        span_(0),
+        data_(NULL),
+        size_(0),
+        series_() {
+    }
+
+    ~TSDBBlock();
+
+    // 禁止拷贝
+    TSDBBlock(const TSDBBlock&) = delete;
+    TSDBBlock& operator=(const TSDBBlock&) = delete;
+
+    bool overlap(time_t lower, time_t upper) const {
+        return start_ <= upper && start_ + span_ > lower;
+    }
+
+    const std::vector<tsdb_series_ref_t>* find_metric(const std::string& metric) const {
+        auto iter = series_.find(metric);
+        return iter == series_.end() ? NULL : &iter->second;
+    }
+
+    void metrics(std::set<std::string>& metrics) const {
+        for (auto iter = series_.begin(); iter != series_.end(); ++iter) {
+            metrics.insert(iter->first);
+        }
+    }
+
+    bool decode(const tsdb_series_ref_t& ref, std::vector<tsdb::point_t>& points) const {
+        return tsdb::SeriesDecoder::decode(data_ + ref.offset, ref.length, points);
+    }
+
+    std::string path_;
+    time_t start_;
+    time_t span_;
+
+private:
+    const char* data_;
+    size_t size_;
+
+    // key: metric
+    std::map<std::string, std::vector<tsdb_series_ref_t>> series_;
+};
+
+
+class StoreTSDB: public StoreIf {
+
+public:
+    StoreTSDB():
+        lock_(),
+        seal_lock_(),
+        services_(),
+        filepath_(),
+        table_prefix_(),
+        block_span_(7200),
+        seal_delay_(60) {
+    }
+
+public:
+
+    bool init(const libconfig::Config& conf) override;
+
+    int insert_ev_stat(const event_insert_t& stat) override;
+    int select_ev_stat(const event_cond_t& cond, event_select_t& stat, time_t linger_hint) override;
+
+    void stop_graceful() override;
+
+    int select_metrics(const std::string& service, std::vector<std::string>& metrics) override;
+    int select_services(std::vector<std::string>& services) override;
+
+private:
+
+    // 内存中正在写入的块
+    struct head_series_t {
+        std::string metric;
+        std::string tag;
+        std::string entity_idx;
+        uint8_t  step;
+        time_t   min_ts;
+        time_t   max_ts;
+        tsdb::SeriesEncoder encoder;
+    };
+
+    struct head_block_t {
+        time_t start_;
+        // key: SeriesKey::encode(metric, tag, entity_idx)
+        std::map<std::string, head_series_t> series_;
+    };
+
+    struct service_t {
+        std::mutex lock_;
+        std::string dirpath_;
+        std::map<time_t, std::shared_ptr<head_block_t>> heads_;
+        // 已经摘下正在落盘的 head，不再修改，查询仍然可见
+        std::multimap<time_t, std::shared_ptr<head_block_t>> sealing_;
+        std::vector<std::shared_ptr<TSDBBlock>> blocks_;
+    };
+
+    std::shared_ptr<service_t> get_service(const std::string& service, bool create);
+
+    int load_service(const std::string& service, const std::string& dirpath);
+
+    // 扫描 [lower, upper] 时间范围内满足条件的数据点
+    int scan_points(const event_cond_t& cond, time_t lower, time_t upper,
+                    std::vector<tsdb_item_t>& items);
+
+    // 定时把过期的head落盘
+    void seal_run();
+    // 把开始时间不超过 expire 的 head 落盘
+    void seal_heads(time_t expire);
+    std::shared_ptr<TSDBBlock> seal_head(const std::string& dirpath, const head_block_t& head);
+
+    std::mutex lock_;
+    std::mutex seal_lock_;  // 同一时间只有一个落盘过程
+    // key: service
+    std::map<std::string, std::shared_ptr<service_t>> services_;
+
+    std::string filepath_;
+    std::string table_prefix_;
+    int block_span_;
+    int seal_delay_;
+};
+
+#endif // __BUSINESS_STORE_TSDB_H__
@@ -0,0 +1,351 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <sys/time.h>
+
+#include <sstream>
+#include <map>
+
+#include <Utils/Log.h>
+
+#include <Scaffold/ConfHelper.h>
+#include <Scaffold/Status.h>
+
+#include <Business/EventCatalog.h>
+#include <Business/StoreWriter.h>
+
+using namespace tzrpc;
+
+static int64_t now_ms() {
+    struct timeval tv {};
+    ::gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+
+std::string WriterHistogram::str() const {
+
+    std::stringstream ss;
+    ss << "count " << count_ << ", avg " << (count_ ? sum_ / count_ : 0) << ", max " << max_ << ", [";
+    for (size_t i=0; i<buckets_.size(); ++i) {
+        if (i < bounds_.size()) {
+            ss << "<=" << bounds_[i] << ":" << buckets_[i] << " ";
+        } else {
+            ss << ">" << bounds_.back() << ":" << buckets_[i];
+        }
+    }
+    ss << "]";
+
+    return ss.str();
+}
+
+
+bool StoreWriter::init(const libconfig::Config& conf) {
+
+    if (!store_) {
+        log_err("store %s not initialized.", store_type_.c_str());
+        return false;
+    }
+
+    int value_i = 0;
+    if (conf.lookupValue("rpc.business.writer.thread_number", value_i) && value_i > 0) {
+        thread_number_ = value_i;
+    }
+
+    if (conf.lookupValue("rpc.business.writer.queue_size", value_i) && value_i > 0) {
+        queue_size_ = value_i;
+    }
+
+    if (conf.lookupValue("rpc.business.writer.group_commit_rows", value_i) && value_i > 0) {
+        group_commit_rows_ = value_i;
+    }
+
+    log_info("store writer for %s, thread_number %d, queue_size %lu, group_commit_rows %lu",
+             store_type_.c_str(), thread_number_, queue_size_, group_commit_rows_);
+
+    if (!writer_threads_.init_threads(
+            std::bind(&StoreWriter::writer_run, this, std::placeholders::_1), thread_number_)) {
+        log_err("writer_run init task failed!");
+        return false;
+    }
+    writer_threads_.start_threads();
+
+    Status::instance().register_status_callback(
+                "StoreWriter_" + store_type_,
+                std::bind(&StoreWriter::module_status, shared_from_this(),
+                          std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+
+    return true;
+}
+
+
+int StoreWriter::submit(const std::vector<event_insert_t>& stats) {
+
+    if (stats.empty()) {
+        return 0;
+    }
+
+    batch_t batch {};
+    batch.stats_ = stats;
+
+    bool blocked = false;
+    int64_t start_ms = now_ms();
+
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        while (!stopping_ && queue_.size() >= queue_size_) {
+            blocked = true;
+            space_notify_.wait(lock);
+        }
+
+        // 停止之后写线程可能已经退出，不能再入队
+        if (stopping_) {
+            log_err("store writer %s is stopping, drop %lu rows.", store_type_.c_str(), stats.size());
+            return -1;
+        }
+
+        batch.enqueue_ms_ = now_ms();
+        queue_.push_back(std::move(batch));
+        if (queue_.size() > queue_max_depth_) {
+            queue_max_depth_ = queue_.size();
+        }
+    }
+    item_notify_.notify_one();
+
+    std::lock_guard<std::mutex> lock(stat_lock_);
+    ++ submit_count_;
+    if (blocked) {
+        ++ submit_blocked_;
+        submit_blocked_ms_ += now_ms() - start_ms;
+    }
+
+    return 0;
+}
+
+
+void StoreWriter::stop_graceful() {
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        stopping_ = true;
+    }
+
+    // 唤醒阻塞在队列满上的提交者
+    space_notify_.notify_all();
+    item_notify_.notify_all();
+
+    writer_threads_.graceful_stop_threads();
+
+    // 队列中的批次都已经写入
+    store_->stop_graceful();
+}
+
+void StoreWriter::join() {
+    writer_threads_.join_threads();
+}
+
+bool StoreWriter::pop_group(std::vector<event_insert_t>& group, std::vector<int64_t>& enqueue_ms, bool wait) {
+
+    std::unique_lock<std::mutex> lock(lock_);
+
+    if (queue_.empty() && !wait) {
+        return false;
+    }
+
+    // 超时返回以便检查线程状态
+    if (queue_.empty() &&
+        !item_notify_.wait_for(lock, std::chrono::seconds(1), [this] { return !queue_.empty(); })) {
+        return false;
+    }
+
+    // 至少取一个批次，之后的批次在不超过行数限制的情况下合并
+    do {
+        batch_t& batch = queue_.front();
+        if (!group.empty() && group.size() + batch.stats_.size() > group_commit_rows_) {
+            break;
+        }
+
+        group.insert(group.end(), batch.stats_.begin(), batch.stats_.end());
+        enqueue_ms.push_back(batch.enqueue_ms_);
+        queue_.pop_front();
+
+    } while (!queue_.empty());
+
+    lock.unlock();
+    space_notify_.notify_all();
+
+    return true;
+}
+
+void StoreWriter::write_group(const std::vector<event_insert_t>& group, const std::vector<int64_t>& enqueue_ms) {
+
+    int64_t start_ms = now_ms();
+    int ret = store_->insert_ev_stats(group);
+    int64_t end_ms = now_ms();
+
+    if (ret != 0) {
+        log_err("store writer %s write %d rows from %d batches failed!",
+                store_type_.c_str(), static_cast<int>(group.size()), static_cast<int>(enqueue_ms.size()));
+    } else {
+        // 增量更新服务指标目录
+        EventCatalog::instance().touch(store_type_, group);
+    }
+
+    std::lock_guard<std::mutex> lock(stat_lock_);
+    ++ write_count_;
+    if (ret != 0) {
+        ++ write_failed_;
+    }
+    write_rows_ += group.size();
+    batch_rows_.add(group.size());
+    write_latency_ms_.add(end_ms - start_ms);
+    for (size_t i=0; i<enqueue_ms.size(); ++i) {
+        queue_wait_ms_.add(start_ms - enqueue_ms[i]);
+    }
+}
+
+void StoreWriter::writer_run(ThreadObjPtr ptr) {
+
+    log_alert("store writer %s thread %#lx about to loop ...", store_type_.c_str(), (long)pthread_self());
+
+    while (true) {
+
+        if (unlikely(ptr->status_ == ThreadStatus::kTerminating)) {
+            log_err("thread %#lx is about to terminating...", (long)pthread_self());
+            break;
+        }
+
+        // 线程启动
+        if (unlikely(ptr->status_ == ThreadStatus::kSuspend)) {
+            ::usleep(1*1000*1000);
+            continue;
+        }
+
+        std::vector<event_insert_t> group {};
+        std::vector<int64_t> enqueue_ms {};
+        if (!pop_group(group, enqueue_ms, true)) {
+            continue;
+        }
+
+        write_group(group, enqueue_ms);
+    }
+
+    // 已经入队的批次是聚合完成的数据，退出之前全部写入
+    size_t drained = 0;
+    while (true) {
+
+        std::vector<event_insert_t> group {};
+        std::vector<int64_t> enqueue_ms {};
+        if (!pop_group(group, enqueue_ms, false)) {
+            break;
+        }
+
+        write_group(group, enqueue_ms);
+        drained += group.size();
+    }
+
+    if (drained > 0) {
+        log_notice("store writer %s drained %lu rows before exit.", store_type_.c_str(), drained);
+    }
+
+    ptr->status_ = ThreadStatus::kDead;
+    log_info("store writer thread %#lx is about to terminate ... ", (long)pthread_self());
+
+    return;
+}
+
+
+int StoreWriter::module_status(std::string& module, std::string& name, std::string& val) {
+
+    module = "heracles";
+    name   = "StoreWriter_" + store_type_;
+
+    std::stringstream ss;
+
+    ss << "\t" << "store_type: " << store_type_ << std::endl;
+    ss << "\t" << "thread_number: " << writer_threads_.get_pool_size() << std::endl;
+    ss << "\t" << "queue_size(maxium): " << queue_size_ << std::endl;
+    ss << "\t" << "group_commit_rows: " << group_commit_rows_ << std::endl;
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        ss << "\t" << "current_queue_depth: " << queue_.size() << std::endl;
+        ss << "\t" << "max_queue_depth: " << queue_max_depth_ << std::endl;
+    }
+
+    std::lock_guard<std::mutex> lock(stat_lock_);
+    ss << "\t" << "submit_count: " << submit_count_ << std::endl;
+    ss << "\t" << "submit_blocked(backpressure): " << submit_blocked_
+       << ", blocked_ms " << submit_blocked_ms_ << std::endl;
+    ss << "\t" << "write_count: " << write_count_ << ", failed " << write_failed_
+       << ", rows " << write_rows_ << std::endl;
+    ss << "\t" << "batch_rows: " << batch_rows_.str() << std::endl;
+    ss << "\t" << "queue_wait_ms: " << queue_wait_ms_.str() << std::endl;
+    ss << "\t" << "write_latency_ms: " << write_latency_ms_.str() << std::endl;
+
+    val = ss.str();
+    return 0;
+}
+
+
+std::mutex writer_init_lock_;
+
+// key: storeType
+static std::map<std::string, std::shared_ptr<StoreWriter>> writers_ {};
+
+std::shared_ptr<StoreWriter> StoreWriterFactory(const std::string& storeType) {
+
+    static std::shared_ptr<StoreWriter> NULLPTR {};
+
+    std::lock_guard<std::mutex> lock(writer_init_lock_);
+
+    auto iter = writers_.find(storeType);
+    if (iter != writers_.end()) {
+        return iter->second;
+    }
+
+    auto conf_ptr = ConfHelper::instance().get_conf();
+    if (!conf_ptr) {
+        log_err("ConfHelper not initialized, please check your initialize order.");
+        return NULLPTR;
+    }
+
+    auto store = StoreFactory(storeType);
+    if (!store) {
+        log_err("store implement %s not OK!", storeType.c_str());
+        return NULLPTR;
+    }
+
+    auto writer = std::make_shared<StoreWriter>(storeType, store);
+    if (!writer || !writer->init(*conf_ptr)) {
+        log_err("create and initialize store writer for %s failed.", storeType.c_str());
+        return NULLPTR;
+    }
+
+    log_debug("create and initialized StoreWriter for %s OK!", storeType.c_str());
+    writers_[storeType] = writer;
+    return writer;
+}
+
+
+// 退出的时候不会析构上面的静态对象(_exit)，需要显式停止
+void StoreWriterStopAll() {
+
+    std::lock_guard<std::mutex> lock(writer_init_lock_);
+    for (auto iter = writers_.begin(); iter != writers_.end(); ++iter) {
+        log_notice("about to stop store writer %s ...", iter->first.c_str());
+        iter->second->stop_graceful();
+    }
+}
+
+void StoreWriterJoinAll() {
+
+    std::lock_guard<std::mutex> lock(writer_init_lock_);
+    for (auto iter = writers_.begin(); iter != writers_.end(); ++iter) {
+        iter->second->join();
+    }
+}
@@ -0,0 +1,165 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+
+#ifndef __BUSINESS_STORE_WRITER_H__
+#define __BUSINESS_STORE_WRITER_H__
+
+#include <xtra_rhel.h>
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+#include <Utils/ThreadPool.h>
+
+#include <Business/StoreIf.h>
+
+// 存储写入阶段
+//
+// 每个存储一个实例，EventHandler 聚合完成的数据以批次的方式提交到有界队列，
+// 由独立的写线程写入存储，慢存储不会再直接卡住聚合线程。
+// 写线程每次把队列中已经积累的批次(可以来自不同的handler)合并成一次写入(group commit)，
+// 队列满的时候 submit 会阻塞，对聚合形成明确的反压。
+
+// 简单的分桶统计，bounds 为各个桶的上界(包含)，最后一个桶为溢出桶
+class WriterHistogram {
+
+public:
+    explicit WriterHistogram(const std::vector<uint64_t>& bounds):
+        bounds_(bounds),
+        buckets_(bounds.size() + 1),
+        count_(0),
+        sum_(0),
+        max_(0) {
+    }
+
+    void add(uint64_t val) {
+        size_t idx = 0;
+        while (idx < bounds_.size() && val > bounds_[idx]) {
+            ++ idx;
+        }
+        ++ buckets_[idx];
+        ++ count_;
+        sum_ += val;
+        if (val > max_) {
+            max_ = val;
+        }
+    }
+
+    std::string str() const;
+
+private:
+    std::vector<uint64_t> bounds_;
+    std::vector<uint64_t> buckets_;
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t max_;
+};
+
+
+class StoreWriter: public std::enable_shared_from_this<StoreWriter> {
+
+public:
+    StoreWriter(const std::string& store_type, std::shared_ptr<StoreIf> store):
+        store_type_(store_type),
+        store_(store),
+        thread_number_(2),
+        queue_size_(256),
+        group_commit_rows_(2000),
+        lock_(),
+        item_notify_(),
+        space_notify_(),
+        queue_(),
+        queue_max_depth_(0),
+        stopping_(false),
+        writer_threads_(),
+        stat_lock_(),
+        submit_count_(0),
+        submit_blocked_(0),
+        submit_blocked_ms_(0),
+        write_count_(0),
+        write_failed_(0),
+        write_rows_(0),
+        batch_rows_({ 1, 10, 50, 100, 500, 1000, 5000, 10000 }),
+        queue_wait_ms_({ 1, 5, 10, 50, 100, 500, 1000, 5000 }),
+        write_latency_ms_({ 1, 5, 10, 50, 100, 500, 1000, 5000 }) {
+    }
+
+    ~StoreWriter() {
+        // 写线程会使用下面的成员，需要先于成员析构停止
+        stop_graceful();
+    }
+
+    // 禁止拷贝
+    StoreWriter(const StoreWriter&) = delete;
+    StoreWriter& operator=(const StoreWriter&) = delete;
+
+    bool init(const libconfig::Config& conf);
+
+    // 提交一个待写入的批次，队列满的时候阻塞直到有空间，停止之后返回-1
+    int submit(const std::vector<event_insert_t>& stats);
+
+    // 不再接受新的批次，写线程把队列中剩余的批次写完之后退出
+    void stop_graceful();
+    void join();
+
+    int module_status(std::string& module, std::string& name, std::string& val);
+
+private:
+
+    struct batch_t {
+        std::vector<event_insert_t> stats_;
+        int64_t enqueue_ms_;
+    };
+
+    // 取出队列中已经积累的批次，合并的行数不超过 group_commit_rows_
+    // wait 为 false 的时候队列空直接返回
+    bool pop_group(std::vector<event_insert_t>& group, std::vector<int64_t>& enqueue_ms, bool wait);
+    void write_group(const std::vector<event_insert_t>& group, const std::vector<int64_t>& enqueue_ms);
+
+    void writer_run(tzrpc::ThreadObjPtr ptr);
+
+    std::string store_type_;
+    std::shared_ptr<StoreIf> store_;
+
+    int    thread_number_;
+    size_t queue_size_;          // 队列中最多的批次数目
+    size_t group_commit_rows_;   // 一次写入最多合并的行数
+
+    std::mutex lock_;
+    std::condition_variable item_notify_;
+    std::condition_variable space_notify_;
+    std::deque<batch_t> queue_;
+    size_t queue_max_depth_;
+    bool stopping_;
+
+    tzrpc::ThreadPool writer_threads_;
+
+    // 统计信息
+    std::mutex stat_lock_;
+    uint64_t submit_count_;
+    uint64_t submit_blocked_;
+    uint64_t submit_blocked_ms_;
+    uint64_t write_count_;
+    uint64_t write_failed_;
+    uint64_t write_rows_;
+    WriterHistogram batch_rows_;
+    WriterHistogram queue_wait_ms_;
+    WriterHistogram write_latency_ms_;
+};
+
+
+// 每种存储共享一个写入阶段
+std::shared_ptr<StoreWriter> StoreWriterFactory(const std::string& storeType);
+
+// 进程退出之前停止所有的写入阶段，已经入队的批次会先写入存储
+void StoreWriterStopAll();
+void StoreWriterJoinAll();
+
+
+#endif // __BUSINESS_STORE_WRITER_H__
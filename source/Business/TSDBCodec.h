@@ -0,0 +1,320 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+
+#ifndef __BUSINESS_TSDB_CODEC_H__
+#define __BUSINESS_TSDB_CODEC_H__
+
+#include <cstdint>
+#include <ctime>
+
+#include <string>
+#include <vector>
+
+// tsdb 单个序列(metric#tag#entity_idx)的列式压缩编码
+//
+// 时间戳列: 第一个点原值，之后采用 delta-of-delta，zigzag 后 varint 编码
+//           等间隔上报的时候每个点只占用1字节
+// 数值列:   每一列和前一个值做 XOR，结果 varint 编码
+//           变化不大的数值高位全部为0，只需要很少的字节
+//
+// 全部按字节对齐，这样正在写入的序列也可以直接解码查询
+
+namespace tsdb {
+
+struct point_t {
+    time_t  timestamp;
+    int32_t count;
+    int64_t value_sum;
+    int32_t value_avg;
+    int32_t value_min;
+    int32_t value_max;
+    int32_t value_p10;
+    int32_t value_p50;
+    int32_t value_p90;
+};
+
+// 数值列的数目
+static const size_t kValueColumns = 8;
+
+
+// 类静态函数可以直接将函数定义丢在头文件中
+struct Varint {
+
+    static void put(std::string& dst, uint64_t v) {
+        while (v >= 0x80) {
+            dst.push_back(static_cast<char>(v | 0x80));
+            v >>= 7;
+        }
+        dst.push_back(static_cast<char>(v));
+    }
+
+    static bool get(const char*& ptr, const char* limit, uint64_t& v) {
+        v = 0;
+        for (uint32_t shift = 0; shift <= 63 && ptr < limit; shift += 7) {
+            uint64_t byte = static_cast<uint8_t>(*ptr++);
+            v |= (byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static uint64_t zigzag(int64_t v) {
+        return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+    }
+
+    static int64_t unzigzag(uint64_t v) {
+        return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    }
+};
+
+
+// 序列的键: metric、tag、entity_idx 依次以 varint 长度为前缀拼接，字段中可以包含任意字符
+// 同一个 metric 的所有序列都以 prefix(metric) 开头，而且不会匹配到其他 metric 的序列
+struct SeriesKey {
+
+    static std::string prefix(const std::string& metric) {
+        std::string key;
+        Varint::put(key, metric.size());
+        key.append(metric);
+        return key;
+    }
+
+    static std::string encode(const std::string& metric, const std::string& tag, const std::string& entity_idx) {
+        std::string key = prefix(metric);
+        Varint::put(key, tag.size());
+        key.append(tag);
+        Varint::put(key, entity_idx.size());
+        key.append(entity_idx);
+        return key;
+    }
+
+    static bool decode(const std::string& key, std::string& metric, std::string& tag, std::string& entity_idx) {
+
+        const char* ptr   = key.c_str();
+        const char* limit = ptr + key.size();
+
+        std::string* fields[3] = { &metric, &tag, &entity_idx };
+        for (size_t i=0; i<3; ++i) {
+            uint64_t len = 0;
+            if (!Varint::get(ptr, limit, len) || len > static_cast<uint64_t>(limit - ptr)) {
+                return false;
+            }
+            fields[i]->assign(ptr, len);
+            ptr += len;
+        }
+
+        return ptr == limit;
+    }
+};
+
+
+class SeriesEncoder {
+
+public:
+    SeriesEncoder():
+        count_(0),
+        prev_ts_(0),
+        prev_delta_(0),
+        prev_vals_(),
+        ts_col_(),
+        val_cols_(kValueColumns) {
+    }
+
+    void append(const point_t& pt) {
+
+        if (count_ == 0) {
+            Varint::put(ts_col_, Varint::zigzag(pt.timestamp));
+        } else {
+            int64_t delta = pt.timestamp - prev_ts_;
+            Varint::put(ts_col_, Varint::zigzag(delta - prev_delta_));
+            prev_delta_ = delta;
+        }
+        prev_ts_ = pt.timestamp;
+
+        uint64_t vals[kValueColumns];
+        to_columns(pt, vals);
+        for (size_t i=0; i<kValueColumns; ++i) {
+            Varint::put(val_cols_[i], vals[i] ^ prev_vals_[i]);
+            prev_vals_[i] = vals[i];
+        }
+
+        ++ count_;
+    }
+
+    uint32_t count() const {
+        return count_;
+    }
+
+    size_t bytes() const {
+        size_t total = ts_col_.size();
+        for (size_t i=0; i<kValueColumns; ++i) {
+            total += val_cols_[i].size();
+        }
+        return total;
+    }
+
+    // 直接从列缓冲区解码，不需要先序列化，结果追加到 points
+    bool decode(std::vector<point_t>& points) const;
+
+    // 序列化格式: count, ts_len, ts_col, [val_len, val_col] * kValueColumns
+    void serialize(std::string& dst) const {
+        Varint::put(dst, count_);
+        Varint::put(dst, ts_col_.size());
+        dst.append(ts_col_);
+        for (size_t i=0; i<kValueColumns; ++i) {
+            Varint::put(dst, val_cols_[i].size());
+            dst.append(val_cols_[i]);
+        }
+    }
+
+    static void to_columns(const point_t& pt, uint64_t vals[kValueColumns]) {
+        vals[0] = static_cast<uint32_t>(pt.count);
+        vals[1] = static_cast<uint64_t>(pt.value_sum);
+        vals[2] = static_cast<uint32_t>(pt.value_avg);
+        vals[3] = static_cast<uint32_t>(pt.value_min);
+        vals[4] = static_cast<uint32_t>(pt.value_max);
+        vals[5] = static_cast<uint32_t>(pt.value_p10);
+        vals[6] = static_cast<uint32_t>(pt.value_p50);
+        vals[7] = static_cast<uint32_t>(pt.value_p90);
+    }
+
+    static void from_columns(const uint64_t vals[kValueColumns], point_t& pt) {
+        pt.count     = static_cast<int32_t>(vals[0]);
+        pt.value_sum = static_cast<int64_t>(vals[1]);
+        pt.value_avg = static_cast<int32_t>(vals[2]);
+        pt.value_min = static_cast<int32_t>(vals[3]);
+        pt.value_max = static_cast<int32_t>(vals[4]);
+        pt.value_p10 = static_cast<int32_t>(vals[5]);
+        pt.value_p50 = static_cast<int32_t>(vals[6]);
+        pt.value_p90 = static_cast<int32_t>(vals[7]);
+    }
+
+private:
+    uint32_t count_;
+    int64_t  prev_ts_;
+    int64_t  prev_delta_;
+    uint64_t prev_vals_[kValueColumns];
+
+    std::string ts_col_;
+    std::vector<std::string> val_cols_;
+};
+
+
+struct SeriesDecoder {
+
+    // 解码 SeriesEncoder::serialize 的输出，失败返回false
+    static bool decode(const char* data, size_t len, std::vector<point_t>& points) {
+
+        const char* ptr   = data;
+        const char* limit = data + len;
+
+        uint64_t count = 0;
+        uint64_t ts_len = 0;
+        if (!Varint::get(ptr, limit, count) || !Varint::get(ptr, limit, ts_len) ||
+            ts_len > static_cast<uint64_t>(limit - ptr)) {
+            return false;
+        }
+
+        const char* ts_col = ptr;
+        ptr += ts_len;
+
+        const char* val_cols[kValueColumns];
+        size_t val_lens[kValueColumns];
+        for (size_t c=0; c<kValueColumns; ++c) {
+
+            uint64_t col_len = 0;
+            if (!Varint::get(ptr, limit, col_len) || col_len > static_cast<uint64_t>(limit - ptr)) {
+                return false;
+            }
+
+            val_cols[c] = ptr;
+            val_lens[c] = col_len;
+            ptr += col_len;
+        }
+
+        return decode_columns(count, ts_col, ts_len, val_cols, val_lens, points);
+    }
+
+    // 按列解码，序列化的数据和编码器中的列缓冲区都通过这里
+    static bool decode_columns(uint64_t count, const char* ts_col, size_t ts_len,
+                               const char* const val_cols[kValueColumns], const size_t val_lens[kValueColumns],
+                               std::vector<point_t>& points) {
+
+        // 每个点在时间戳列中至少占一个字节，数目来自文件，分配之前需要校验
+        if (count > ts_len) {
+            return false;
+        }
+
+        size_t base = points.size();
+        points.resize(base + count);
+
+        // 时间戳列
+        const char* col = ts_col;
+        const char* col_limit = ts_col + ts_len;
+        int64_t prev_ts = 0;
+        int64_t prev_delta = 0;
+        for (uint64_t i=0; i<count; ++i) {
+            uint64_t v = 0;
+            if (!Varint::get(col, col_limit, v)) {
+                points.resize(base);
+                return false;
+            }
+
+            if (i == 0) {
+                prev_ts = Varint::unzigzag(v);
+            } else {
+                prev_delta += Varint::unzigzag(v);
+                prev_ts += prev_delta;
+            }
+            points[base + i].timestamp = prev_ts;
+        }
+
+        // 数值列
+        std::vector<uint64_t> vals(count * kValueColumns);
+        for (size_t c=0; c<kValueColumns; ++c) {
+
+            col = val_cols[c];
+            col_limit = val_cols[c] + val_lens[c];
+            uint64_t prev = 0;
+            for (uint64_t i=0; i<count; ++i) {
+                uint64_t v = 0;
+                if (!Varint::get(col, col_limit, v)) {
+                    points.resize(base);
+                    return false;
+                }
+                prev ^= v;
+                vals[i * kValueColumns + c] = prev;
+            }
+        }
+
+        for (uint64_t i=0; i<count; ++i) {
+            SeriesEncoder::from_columns(&vals[i * kValueColumns], points[base + i]);
+        }
+
+        return true;
+    }
+};
+
+
+inline bool SeriesEncoder::decode(std::vector<point_t>& points) const {
+
+    const char* val_cols[kValueColumns];
+    size_t val_lens[kValueColumns];
+    for (size_t c=0; c<kValueColumns; ++c) {
+        val_cols[c] = val_cols_[c].data();
+        val_lens[c] = val_cols_[c].size();
+    }
+
+    return SeriesDecoder::decode_columns(count_, ts_col_.data(), ts_col_.size(), val_cols, val_lens, points);
+}
+
+} // end namespace tsdb
+
+#endif // __BUSINESS_TSDB_CODEC_H__
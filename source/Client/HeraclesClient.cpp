@@ -28,9 +28,12 @@
 #include <Client/include/HeraclesClient.h>
 
 #include <Client/MonitorRpcClientHelper.h>
+#include <Client/UdpReportSender.h>
 
 #include <Client/LogClient.h>
 
+#include <Network/NetConn.h>
+
 #include <Business/Sort.h>
 
 namespace heracles_client {
@@ -43,10 +46,16 @@ struct HeraclesClientConf {
     int  report_queue_limit_;
     int  size_per_report_;
 
+    // 非0的时候上报通过UDP发送，不等待应答
+    int  udp_report_port_;
+    int  udp_datagram_size_;
+
     HeraclesClientConf():
         report_enabled_(true),
         report_queue_limit_(0),
-        size_per_report_(5000) {
+        size_per_report_(5000),
+        udp_report_port_(0),
+        udp_datagram_size_(1400) {
     }
 } __attribute__ ((aligned (4)));
 
@@ -65,6 +74,10 @@ private:
     int ping();
     int report_event(const std::string& metric, int64_t value, const std::string& tag);
     int select_stat(event_cond_t& cond, event_select_t& stat);
+    int select_stat_batch(std::vector<event_cond_t>& conds,
+                          std::vector<event_select_t>& stats, std::vector<int>& rets);
+    int select_stat_stream(event_cond_t& cond, int32_t chunk_rows,
+                           event_select_t& stat, const select_chunk_handler_t& handler);
 
     int known_metrics(const std::string& version, const std::string& service,
                       event_handler_conf_t& handler_conf, std::vector<std::string>& metrics);
@@ -85,6 +98,11 @@ private:
             return -1;
         }
 
+        // UDP 上报只管发送，丢失的数据不会重传
+        if (udp_sender_) {
+            return udp_sender_->send_report(*report_ptr) < 0 ? -1 : 0;
+        }
+
         if (!client_agent_) {
             log_err("MonitorRpcClientHelper not initialized, fatal!");
             return -1;
@@ -121,6 +139,7 @@ private:
     // 确保 service和entity_idx已经是定义良好的了
     HeraclesClientImpl(std::string service, std::string entity_idx) :
         client_agent_(),
+        udp_sender_(),
         thread_terminate_(false),
         thread_run_(),
         lock_(),
@@ -152,6 +171,7 @@ private:
 private:
 
     std::shared_ptr<MonitorRpcClientHelper> client_agent_;
+    std::unique_ptr<UdpReportSender> udp_sender_;
 
     // 默认开启一个提交，当发现待提交队列过长的时候，自动开辟future任务
     bool thread_terminate_;
@@ -230,11 +250,13 @@ bool HeraclesClientImpl::init(const libconfig::Setting& setting, CP_log_store_fu
     set_checkpoint_log_store_func(log_func);
     log_init(7);
 
+    // unix:///path 形式的本机地址不需要端口
     std::string serv_addr;
+    std::string unix_path;
     int serv_port = 0;
-    if (!setting.lookupValue("serv_addr", serv_addr) ||
-        !setting.lookupValue("serv_port", serv_port) ||
-        serv_addr.empty() || serv_port <= 0) {
+    setting.lookupValue("serv_port", serv_port);
+    if (!setting.lookupValue("serv_addr", serv_addr) || serv_addr.empty() ||
+        (serv_port <= 0 && !tzrpc::parse_unix_addr(serv_addr, unix_path))) {
         log_err("get rpc server addr config failed.");
         return false;
     }
@@ -261,6 +283,18 @@ bool HeraclesClientImpl::init(const libconfig::Setting& setting, CP_log_store_fu
         conf_.size_per_report_ = value_i;
     }
 
+    if (setting.lookupValue("udp_report_port", value_i) && value_i >= 0 && value_i <= 65535) {
+        log_notice("update udp_report_port from %d to %d",
+                   conf_.udp_report_port_, value_i );
+        conf_.udp_report_port_ = value_i;
+    }
+
+    if (setting.lookupValue("udp_datagram_size", value_i) && value_i > 0) {
+        log_notice("update udp_datagram_size from %d to %d",
+                   conf_.udp_datagram_size_, value_i );
+        conf_.udp_datagram_size_ = value_i;
+    }
+
     std::string service;
     std::string entity_idx;
     setting.lookupValue("service", service);
@@ -300,7 +334,9 @@ bool HeraclesClientImpl::init(const std::string& service, const std::string& ent
     monitor_addr_ = addr;
     monitor_port_ = port;
 
-    if (service_.empty() || monitor_addr_.empty() || monitor_port_ == 0) {
+    std::string unix_path;
+    if (service_.empty() || monitor_addr_.empty() ||
+        (monitor_port_ == 0 && !tzrpc::parse_unix_addr(monitor_addr_, unix_path))) {
         log_err("critical param error: service %s, addr %s, port %u",
                 service_.c_str(), monitor_addr_.c_str(), monitor_port_);
         return false;
@@ -317,6 +353,15 @@ bool HeraclesClientImpl::init(const std::string& service, const std::string& ent
         return false;
     }
 
+    // UDP 上报使用和RPC相同的服务端地址，所以不支持 unix:// 地址
+    if (conf_.udp_report_port_ != 0) {
+        udp_sender_.reset(new UdpReportSender(monitor_addr_, conf_.udp_report_port_, conf_.udp_datagram_size_));
+        if (!udp_sender_ || !udp_sender_->init()) {
+            log_err("init udp report sender to %s:%d failed.", monitor_addr_.c_str(), conf_.udp_report_port_);
+            return false;
+        }
+    }
+
     thread_run_.reset(new std::thread(std::bind(&HeraclesClientImpl::run, this)));
     if (!thread_run_){
         log_err("create run work thread failed! ");
@@ -390,6 +435,11 @@ int HeraclesClientImpl::module_status(std::string& module, std::string& name, st
     ss << "\t" << "size_per_report: " << conf_.size_per_report_ << std::endl;
     ss << "\t" << "report_queue_limit: " << conf_.report_queue_limit_ << std::endl;
     ss << "\t" << "current_queue: " << submit_queue_.SIZE() << std::endl;
+    if (udp_sender_) {
+        ss << "\t" << "udp_report_port: " << conf_.udp_report_port_
+           << ", udp_send_count: " << udp_sender_->send_count()
+           << ", udp_drop_count: " << udp_sender_->drop_count() << std::endl;
+    }
 
     val = ss.str();
 
@@ -503,6 +553,62 @@ int HeraclesClientImpl::select_stat(event_cond_t& cond, event_select_t& stat) {
     return 0;
 }
 
+int HeraclesClientImpl::select_stat_stream(event_cond_t& cond, int32_t chunk_rows,
+                                           event_select_t& stat, const select_chunk_handler_t& handler) {
+
+    if (!client_agent_) {
+        log_err("MonitorRpcClientHelper not initialized, fatal!");
+        return -1;
+    }
+
+    if (cond.service.empty()) {
+        cond.service = service_;
+    }
+
+    auto code = client_agent_->rpc_event_select_stream(cond, chunk_rows, stat, handler);
+    if (code != 0) {
+        log_err("event stream select return code: %d", code);
+        return code;
+    }
+
+    log_debug("event stream select ok.");
+    return 0;
+}
+
+int HeraclesClientImpl::select_stat_batch(std::vector<event_cond_t>& conds,
+                                          std::vector<event_select_t>& stats, std::vector<int>& rets) {
+
+    if (!client_agent_) {
+        log_err("MonitorRpcClientHelper not initialized, fatal!");
+        return -1;
+    }
+
+    for (auto iter = conds.begin(); iter != conds.end(); ++iter) {
+        if (iter->service.empty()) {
+            iter->service = service_;
+        }
+    }
+
+    auto code = client_agent_->rpc_event_select_batch(conds, stats, rets);
+    if (code != 0) {
+        log_err("event batch select return code: %d", code);
+        return code;
+    }
+
+    // 和 select_stat 一样，服务端没有限制条数的结果在客户端排序
+    for (size_t i=0; i<conds.size(); ++i) {
+        if (rets[i] == 0 &&
+            conds[i].orderby != OrderByType::kOrderByNone &&
+            conds[i].limit == 0 &&
+            !stats[i].info.empty()) {
+            Sort::do_sort(stats[i].info, conds[i].orderby, conds[i].orders);
+        }
+    }
+
+    log_debug("event batch select ok.");
+    return 0;
+}
+
 
 int HeraclesClientImpl::known_metrics(const std::string& version, const std::string& service,
                                      event_handler_conf_t& handler_conf, std::vector<std::string>& metrics) {
@@ -644,6 +750,35 @@ int HeraclesClient::select_stat(event_cond_t& cond, event_select_t& stat) {
 }
 
 
+int HeraclesClient::select_stat_batch(std::vector<event_cond_t>& conds,
+                                      std::vector<event_select_t>& stats, std::vector<int>& rets) {
+
+    if (unlikely(!HeraclesClientImpl::instance().already_initialized_)) {
+        log_err("HeraclesClientImpl not initialized...");
+        return -1;
+    }
+
+    return HeraclesClientImpl::instance().select_stat_batch(conds, stats, rets);
+}
+
+
+int HeraclesClient::select_stat_stream(event_cond_t& cond, int32_t chunk_rows,
+                                       event_select_t& stat, const select_chunk_handler_t& handler) {
+
+    if (unlikely(!HeraclesClientImpl::instance().already_initialized_)) {
+        log_err("HeraclesClientImpl not initialized...");
+        return -1;
+    }
+
+    if (chunk_rows <= 0) {
+        log_err("invalid chunk_rows param: %d", chunk_rows);
+        return -1;
+    }
+
+    return HeraclesClientImpl::instance().select_stat_stream(cond, chunk_rows, stat, handler);
+}
+
+
 int HeraclesClient::select_stat(const std::string& metric, int64_t& count, int64_t& avg, time_t tm_intervel) {
 
     if (unlikely(!HeraclesClientImpl::instance().already_initialized_)) {
@@ -713,6 +848,24 @@ int HeraclesClient::select_stat_groupby_tag(const std::string& metric,
     return HeraclesClientImpl::instance().select_stat(cond, stat);
 }
 
+int HeraclesClient::select_stat_groupby_entity(const std::string& metric,
+                                              event_select_t& stat, time_t tm_intervel) {
+
+    if (unlikely(!HeraclesClientImpl::instance().already_initialized_)) {
+        log_err("HeraclesClientImpl not initialized...");
+        return -1;
+    }
+
+    event_cond_t cond {};
+
+    cond.version =  "1.0.0";
+    cond.metric = metric;
+    cond.tm_interval = tm_intervel;
+    cond.groupby = GroupType::kGroupbyEntity;
+
+    return HeraclesClientImpl::instance().select_stat(cond, stat);
+}
+
 int HeraclesClient::select_stat_groupby_time(const std::string& metric,
                                             event_select_t& stat, time_t tm_intervel) {
 
@@ -752,6 +905,31 @@ int HeraclesClient::select_stat_groupby_time(const std::string& metric, const st
 }
 
 
+int HeraclesClient::select_stat_groupby_bucket(const std::string& metric, int32_t bucket_seconds,
+                                              event_select_t& stat, time_t tm_intervel) {
+
+    if (unlikely(!HeraclesClientImpl::instance().already_initialized_)) {
+        log_err("HeraclesClientImpl not initialized...");
+        return -1;
+    }
+
+    if (bucket_seconds < 0) {
+        log_err("invalid bucket_seconds param: %d", bucket_seconds);
+        return -1;
+    }
+
+    event_cond_t cond {};
+
+    cond.version =  "1.0.0";
+    cond.metric = metric;
+    cond.tm_interval = tm_intervel;
+    cond.groupby = GroupType::kGroupbyTimestamp;
+    cond.bucket_seconds = bucket_seconds;
+
+    return HeraclesClientImpl::instance().select_stat(cond, stat);
+}
+
+
 int HeraclesClient::select_stat_groupby_tag_ordered (const std::string& metric, const order_cond_t& order,
                                                     event_select_t& stat, time_t tm_intervel) {
 
@@ -20,8 +20,17 @@ namespace heracles_client {
 
 int MonitorRpcClientHelper::rpc_ping() {
 
+    if (!rpc_client_) {
+        rpc_client_.reset(new RpcClient(ip_, port_));
+        if (!rpc_client_) {
+            log_err("create rpc client failed.");
+            return -1;
+        }
+    }
+
     tzrpc::MonitorTask::MonitorReadOps::Request request;
     request.mutable_ping()->set_msg("ping");
+    request.mutable_ping()->set_compress(rpc_client_->compress_offer());
 
     std::string mar_str;
     if(!tzrpc::ProtoBuf::marshalling_to_string(request, &mar_str)) {
@@ -29,14 +38,6 @@ int MonitorRpcClientHelper::rpc_ping() {
         return -1;
     }
 
-    if (!rpc_client_) {
-        rpc_client_.reset(new RpcClient(ip_, port_));
-        if (!rpc_client_) {
-            log_err("create rpc client failed.");
-            return -1;
-        }
-    }
-
     std::string response_str;
     auto status = rpc_client_->call_RPC(tzrpc::ServiceID::MONITOR_TASK_SERVICE,
                                         tzrpc::MonitorTask::OpCode::CMD_READ_EVENT,
@@ -68,6 +69,8 @@ int MonitorRpcClientHelper::rpc_ping() {
     log_debug("ping test return: %s",  rsp_str.c_str());
 
     if (rsp_str == "[[[pong]]]") {
+        // 旧版本的服务端不返回 compress，此时不压缩
+        rpc_client_->set_compress(response.ping().compress());
         return 0;
     }
 
@@ -144,6 +147,90 @@ int MonitorRpcClientHelper::rpc_event_submit(const event_report_t& report) {
 }
 
 
+static void fill_select_request(const event_cond_t& cond,
+                                tzrpc::MonitorTask::MonitorReadOps::Request::ev_select_t* select) {
+
+    select->set_version(cond.version);
+    select->set_service(cond.service);
+    select->set_metric(cond.metric);
+
+    select->set_tm_interval(cond.tm_interval);
+    select->set_tm_start(cond.tm_start);
+    select->set_entity_idx(cond.entity_idx);
+    select->set_tag(cond.tag);
+
+    select->set_groupby(static_cast<int32_t>(cond.groupby));
+    select->set_orderby(static_cast<int32_t>(cond.orderby));
+    select->set_orders(static_cast<int32_t>(cond.orders));
+    select->set_limit(static_cast<int32_t>(cond.limit));
+    select->set_bucket_seconds(cond.bucket_seconds);
+}
+
+static void parse_select_info(const event_cond_t& cond,
+                              const tzrpc::MonitorTask::MonitorReadOps::Response::ev_select_t& select,
+                              std::vector<event_info_t>& info) {
+
+    int size = select.info_size();
+    info.clear();
+    info.reserve(size);
+
+    for (int i=0; i<size; ++i) {
+
+        event_info_t item {};
+        auto p_info = select.info(i);
+        if (groupby_has_timestamp(cond.groupby)) {
+            item.timestamp = p_info.timestamp();
+        }
+        if (groupby_has_tag(cond.groupby)) {
+            item.tag = p_info.tag();
+        }
+        if (groupby_has_entity(cond.groupby)) {
+            item.entity_idx = p_info.entity_idx();
+        }
+
+        item.count = p_info.count();
+        item.value_sum = p_info.value_sum();
+        item.value_avg = p_info.value_avg();
+        item.value_min = p_info.value_min();
+        item.value_max = p_info.value_max();
+        item.value_p10 = p_info.value_p10();
+        item.value_p50 = p_info.value_p50();
+        item.value_p90 = p_info.value_p90();
+
+        info.push_back(item);
+    }
+}
+
+static void parse_select_response(const event_cond_t& cond,
+                                  const tzrpc::MonitorTask::MonitorReadOps::Response::ev_select_t& select,
+                                  event_select_t& resp_info) {
+
+    // TODO 校验提交返回参数
+
+    resp_info.version = select.version();
+    resp_info.service = select.service();
+    resp_info.timestamp = select.timestamp();
+    resp_info.metric = select.metric();
+    resp_info.tm_interval = select.tm_interval();
+    resp_info.entity_idx = select.entity_idx();
+    resp_info.tag = select.tag();
+
+    resp_info.summary.count = select.summary().count();
+    resp_info.summary.value_sum = select.summary().value_sum();
+    resp_info.summary.value_avg = select.summary().value_avg();
+    resp_info.summary.value_min = select.summary().value_min();
+    resp_info.summary.value_max = select.summary().value_max();
+    resp_info.summary.value_p10 = select.summary().value_p10();
+    resp_info.summary.value_p50 = select.summary().value_p50();
+    resp_info.summary.value_p90 = select.summary().value_p90();
+
+
+    // 含有GroupBy条件，需要对结果的info字段进行整理赋值
+    if (cond.groupby != GroupType::kGroupNone) {
+        parse_select_info(cond, select, resp_info.info);
+    }
+}
+
 int MonitorRpcClientHelper::rpc_event_select(const event_cond_t& cond, event_select_t& resp_info) {
 
     if (cond.version.empty() || cond.service.empty() ||
@@ -153,20 +240,72 @@ int MonitorRpcClientHelper::rpc_event_select(const event_cond_t& cond, event_sel
     }
 
     tzrpc::MonitorTask::MonitorReadOps::Request request;
-    request.mutable_select()->set_version(cond.version);
-    request.mutable_select()->set_service(cond.service);
-    request.mutable_select()->set_metric(cond.metric);
+    fill_select_request(cond, request.mutable_select());
+
+    std::string mar_str;
+    if(!tzrpc::ProtoBuf::marshalling_to_string(request, &mar_str)) {
+        log_err("marshalling message failed.");
+        return -1;
+    }
 
-    request.mutable_select()->set_tm_interval(cond.tm_interval);
-    request.mutable_select()->set_tm_start(cond.tm_start);
-    request.mutable_select()->set_entity_idx(cond.entity_idx);
-    request.mutable_select()->set_tag(cond.tag);
+    if (!rpc_client_) {
+        rpc_client_.reset(new RpcClient(ip_, port_));
+        if (!rpc_client_) {
+            log_err("create rpc client failed.");
+            return -1;
+        }
+    }
 
-    request.mutable_select()->set_groupby(static_cast<int32_t>(cond.groupby));
-    request.mutable_select()->set_orderby(static_cast<int32_t>(cond.orderby));
-    request.mutable_select()->set_orders(static_cast<int32_t>(cond.orders));
-    request.mutable_select()->set_limit(static_cast<int32_t>(cond.limit));
+    std::string response_str;
+    auto status = rpc_client_->call_RPC(tzrpc::ServiceID::MONITOR_TASK_SERVICE,
+                                        tzrpc::MonitorTask::OpCode::CMD_READ_EVENT,
+                                        mar_str, response_str);
 
+    if (status != RpcClientStatus::OK) {
+        log_err("rpc call return code %d", static_cast<uint8_t>(status) );
+        return -1;
+    }
+
+    tzrpc::MonitorTask::MonitorReadOps::Response response;
+    if(!tzrpc::ProtoBuf::unmarshalling_from_string(response_str, &response)) {
+        log_err("unmarshalling message failed.");
+        return -1;
+    }
+
+    if (!response.has_code() || response.code() != 0) {
+        log_err("response return failed.");
+        if (response.has_code() && response.has_desc()) {
+            log_err("error info: %d %s", response.code(), response.desc().c_str());
+        }
+
+        return -1;
+    }
+
+    parse_select_response(cond, response.select(), resp_info);
+
+    return 0;
+}
+
+int MonitorRpcClientHelper::rpc_event_select_batch(const std::vector<event_cond_t>& conds,
+                                                   std::vector<event_select_t>& resp_infos, std::vector<int>& rets) {
+
+    if (conds.empty()) {
+        log_err("batch select param check error!");
+        return -1;
+    }
+
+    tzrpc::MonitorTask::MonitorReadOps::Request request;
+    for (size_t i=0; i<conds.size(); ++i) {
+
+        const event_cond_t& cond = conds[i];
+        if (cond.version.empty() || cond.service.empty() ||
+            cond.metric.empty()  || cond.tm_interval < 0) {
+            log_err("select param check error at %d!", static_cast<int>(i));
+            return -1;
+        }
+
+        fill_select_request(cond, request.add_batch_select());
+    }
 
     std::string mar_str;
     if(!tzrpc::ProtoBuf::marshalling_to_string(request, &mar_str)) {
@@ -207,62 +346,105 @@ int MonitorRpcClientHelper::rpc_event_select(const event_cond_t& cond, event_sel
         return -1;
     }
 
-    // TODO 校验提交返回参数
+    if (response.batch_select_size() != static_cast<int>(conds.size())) {
+        log_err("batch select response size mismatch, expect %d, got %d",
+                static_cast<int>(conds.size()), response.batch_select_size());
+        return -1;
+    }
 
-    resp_info.version = response.select().version();
-    resp_info.service = response.select().service();
-    resp_info.timestamp = response.select().timestamp();
-    resp_info.metric = response.select().metric();
-    resp_info.tm_interval = response.select().tm_interval();
-    resp_info.entity_idx = response.select().entity_idx();
-    resp_info.tag = response.select().tag();
+    resp_infos.resize(conds.size());
+    rets.resize(conds.size());
+    for (size_t i=0; i<conds.size(); ++i) {
+        auto& item = response.batch_select(static_cast<int>(i));
+        rets[i] = item.code();
+        if (rets[i] == 0) {
+            parse_select_response(conds[i], item.select(), resp_infos[i]);
+        }
+    }
 
-    resp_info.summary.count = response.select().summary().count();
-    resp_info.summary.value_sum = response.select().summary().value_sum();
-    resp_info.summary.value_avg = response.select().summary().value_avg();
-    resp_info.summary.value_min = response.select().summary().value_min();
-    resp_info.summary.value_max = response.select().summary().value_max();
-    resp_info.summary.value_p10 = response.select().summary().value_p10();
-    resp_info.summary.value_p50 = response.select().summary().value_p50();
-    resp_info.summary.value_p90 = response.select().summary().value_p90();
+    return 0;
+}
 
+int MonitorRpcClientHelper::rpc_event_select_stream(const event_cond_t& cond, int32_t chunk_rows,
+                                                    event_select_t& resp_info, const select_chunk_handler_t& handler) {
 
-    // 含有GroupBy条件，需要对结果的info字段进行整理赋值
-    if (cond.groupby != GroupType::kGroupNone) {
+    if (cond.version.empty() || cond.service.empty() ||
+        cond.metric.empty()  || cond.tm_interval < 0 || chunk_rows <= 0) {
+        log_err("stream select param check error!");
+        return -1;
+    }
 
-        int size = response.select().info_size();
-        std::vector<event_info_t> info;
+    tzrpc::MonitorTask::MonitorReadOps::Request request;
+    fill_select_request(cond, request.mutable_select());
+    request.mutable_select()->set_stream_rows(chunk_rows);
 
-        for (int i=0; i<size; ++i) {
+    std::string mar_str;
+    if(!tzrpc::ProtoBuf::marshalling_to_string(request, &mar_str)) {
+        log_err("marshalling message failed.");
+        return -1;
+    }
 
-            event_info_t item {};
-            auto p_info = response.select().info(i);
-            if (cond.groupby == GroupType::kGroupbyTimestamp) {
-                item.timestamp = p_info.timestamp();
-                item.tag = "";
-            } else if (cond.groupby == GroupType::kGroupbyTag) {
-                item.timestamp = 0;
-                item.tag = p_info.tag();
+    if (!rpc_client_) {
+        rpc_client_.reset(new RpcClient(ip_, port_));
+        if (!rpc_client_) {
+            log_err("create rpc client failed.");
+            return -1;
+        }
+    }
+
+    int32_t expect_idx = 0;
+    int code = 0;
+    std::vector<event_info_t> rows;
+
+    auto status = rpc_client_->call_RPC_stream(tzrpc::ServiceID::MONITOR_TASK_SERVICE,
+                                               tzrpc::MonitorTask::OpCode::CMD_READ_EVENT, mar_str,
+        [&](const std::string& response_str) -> bool {
+
+            tzrpc::MonitorTask::MonitorReadOps::Response response;
+            if(!tzrpc::ProtoBuf::unmarshalling_from_string(response_str, &response)) {
+                log_err("unmarshalling message failed.");
+                code = -1;
+                return false;
             }
 
-            item.count = p_info.count();
-            item.value_sum = p_info.value_sum();
-            item.value_avg = p_info.value_avg();
-            item.value_min = p_info.value_min();
-            item.value_max = p_info.value_max();
-            item.value_p10 = p_info.value_p10();
-            item.value_p50 = p_info.value_p50();
-            item.value_p90 = p_info.value_p90();
+            if (!response.has_code() || response.code() != 0) {
+                log_err("response return failed.");
+                if (response.has_code() && response.has_desc()) {
+                    log_err("error info: %d %s", response.code(), response.desc().c_str());
+                }
+                code = -1;
+                return false;
+            }
 
-            info.push_back(item);
-        }
+            // 服务端查询失败的时候返回的是普通的响应
+            if (!response.has_chunk_idx() || response.chunk_idx() != expect_idx) {
+                log_err("stream chunk sequence error, expect %d", expect_idx);
+                code = -1;
+                return false;
+            }
 
-        // collect it
-        resp_info.info = std::move(info);
-    }
+            // 汇总信息在扫描结束之后才能确定，由最后一个响应携带
+            if (expect_idx ++ == 0 || response.select().has_summary()) {
+                parse_select_response(cond, response.select(), resp_info);
+                rows.swap(resp_info.info);
+                resp_info.info.clear();
+            } else {
+                parse_select_info(cond, response.select(), rows);
+            }
 
+            if (!handler(rows)) {
+                code = 1;  // 调用者主动放弃
+                return false;
+            }
+            return true;
+        });
 
-    return 0;
+    if (status != RpcClientStatus::OK) {
+        log_err("rpc call return code %d", static_cast<uint8_t>(status) );
+        return -1;
+    }
+
+    return code < 0 ? -1 : 0;
 }
 
 int MonitorRpcClientHelper::rpc_known_metrics(const std::string& version, const std::string& service,
@@ -37,6 +37,10 @@ public:
 
     int rpc_event_submit(const event_report_t& report);
     int rpc_event_select(const event_cond_t& cond, event_select_t& resp_info);
+    int rpc_event_select_stream(const event_cond_t& cond, int32_t chunk_rows,
+                                event_select_t& resp_info, const select_chunk_handler_t& handler);
+    int rpc_event_select_batch(const std::vector<event_cond_t>& conds,
+                               std::vector<event_select_t>& resp_infos, std::vector<int>& rets);
 
     int rpc_known_metrics(const std::string& version, const std::string& service,
                           event_handler_conf_t& handler_conf, std::vector<std::string>& metrics);
@@ -5,6 +5,9 @@
  *
  */
 
+#include <Core/Compress.h>
+#include <Network/NetConn.h>
+
 #include <Client/IoService.h>
 #include <Client/RpcClientImpl.h>
 #include <Client/RpcClient.h>
@@ -92,10 +95,12 @@ bool RpcClient::init(const std::string& cfgFile, CP_log_store_func_t log_func) {
 
 bool RpcClient::init(const libconfig::Setting& setting, CP_log_store_func_t log_func) {
 
+    // unix:///path 形式的本机地址不需要端口
+    std::string unix_path;
+    setting.lookupValue("serv_port", client_setting_.serv_port_);
     if (!setting.lookupValue("serv_addr", client_setting_.serv_addr_) ||
-        !setting.lookupValue("serv_port", client_setting_.serv_port_) ||
         client_setting_.serv_addr_.empty() ||
-        client_setting_.serv_port_ <= 0)
+        (client_setting_.serv_port_ <= 0 && !tzrpc::parse_unix_addr(client_setting_.serv_addr_, unix_path)))
     {
         log_err("get rpc server addr config failed.");
         return false;
@@ -113,6 +118,8 @@ bool RpcClient::init(const libconfig::Setting& setting, CP_log_store_func_t log_
         return false;
     }
 
+    setting.lookupValue("compress_threshold", client_setting_.compress_threshold_);
+
     if (setting.lookupValue("log_level", client_setting_.log_level_) &&
         client_setting_.log_level_ > 7) {
         log_err("invalid log_level: %u", client_setting_.log_level_);
@@ -144,4 +151,34 @@ RpcClientStatus RpcClient::call_RPC(uint16_t service_id, uint16_t opcode,
     return impl_->call_RPC(service_id, opcode, payload, respload, timeout_sec);
 }
 
+RpcClientStatus RpcClient::call_RPC_stream(uint16_t service_id, uint16_t opcode,
+                                           const std::string& payload, const RpcChunkHandler& handler,
+                                           uint32_t timeout_sec) {
+    if (!initialized_ || !impl_) {
+        log_err("RpcClientImpl not initialized, please check.");
+        return RpcClientStatus::NETWORK_BEFORE_ERROR;
+    }
+
+    return impl_->call_RPC_stream(service_id, opcode, payload, handler, timeout_sec);
+}
+
+uint32_t RpcClient::compress_offer() const {
+
+    if (client_setting_.compress_threshold_ == 0) {
+        return tzrpc::kCompressNone;
+    }
+
+    return tzrpc::kCompressSupported;
+}
+
+void RpcClient::set_compress(uint32_t codec) {
+
+    if (!initialized_ || !impl_) {
+        log_err("RpcClientImpl not initialized, please check.");
+        return;
+    }
+
+    impl_->set_compress(codec & compress_offer());
+}
+
 } // end namespace heracles_client
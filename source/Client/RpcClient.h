@@ -13,6 +13,7 @@
 
 #include <memory>
 #include <string>
+#include <functional>
 
 #include <Client/RpcClientStatus.h>
 
@@ -27,12 +28,16 @@ void set_checkpoint_log_store_func(CP_log_store_func_t func);
 
 struct RpcClientSetting {
 
+    // 可以是 "unix:///path/to/sock" 形式的本机套接字地址，此时 serv_port_ 被忽略
     std::string serv_addr_;
     uint32_t    serv_port_;
 
     uint32_t    send_max_msg_size_;
     uint32_t    recv_max_msg_size_;
 
+    // 和服务端协商压缩之后，超过这个长度的请求消息才压缩，0为不压缩
+    uint32_t    compress_threshold_;
+
     uint32_t    log_level_;
 
     RpcClientSetting():
@@ -40,11 +45,15 @@ struct RpcClientSetting {
         serv_port_(),
         send_max_msg_size_(0),
         recv_max_msg_size_(0),
+        compress_threshold_(4096),
         log_level_(7) {
     }
 
 } __attribute__ ((aligned (4)));
 
+// 流式响应的处理函数，每收到一个响应消息调用一次，返回false表示放弃后续的响应
+typedef std::function<bool(const std::string& respload)> RpcChunkHandler;
+
 // class forward
 class RpcClientImpl;
 
@@ -71,6 +80,16 @@ public:
                              const std::string& payload, std::string& respload,
                              uint32_t timeout_sec);
 
+    // 流式响应，服务端的多个响应消息依次交给 handler 处理
+    RpcClientStatus call_RPC_stream(uint16_t service_id, uint16_t opcode,
+                                    const std::string& payload, const RpcChunkHandler& handler,
+                                    uint32_t timeout_sec = 0);
+
+    // 压缩协商: 业务的 ping 请求带上 compress_offer() 提供的算法掩码，
+    // 服务端选中的算法通过 set_compress 设置之后，超过阈值的请求消息被压缩
+    uint32_t compress_offer() const;
+    void set_compress(uint32_t codec);
+
 private:
 
     bool init(const std::string& addr, uint16_t port, CP_log_store_func_t log_func);
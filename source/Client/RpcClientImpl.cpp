@@ -6,8 +6,10 @@
  */
 
 
+#include <deque>
 
 #include <Core/Message.h>
+#include <Core/Compress.h>
 
 #include <RPC/RpcRequestMessage.h>
 #include <RPC/RpcResponseMessage.h>
@@ -26,6 +28,29 @@ using tzrpc::kRpcHeaderMagic;
 
 namespace heracles_client {
 
+struct RpcClientImpl::rpc_call_t {
+
+    rpc_call_t(uint32_t request_id, uint16_t service_id, uint16_t opcode,
+               const std::shared_ptr<TcpConnSync>& conn):
+        request_id_(request_id),
+        service_id_(service_id),
+        opcode_(opcode),
+        conn_(conn),
+        responses_(),
+        failed_(false),
+        done_(false) {
+    }
+
+    uint32_t request_id_;
+    uint16_t service_id_;
+    uint16_t opcode_;
+
+    std::shared_ptr<TcpConnSync> conn_;         // 发送请求的连接
+    std::deque<RpcResponseMessage> responses_;  // 已经收到还没有处理的响应
+    bool failed_;                               // 连接出错，不会再有响应
+    bool done_;                                 // 最后一个响应已经处理
+};
+
 
 RpcClientImpl::~RpcClientImpl() {
 
@@ -38,121 +63,285 @@ RpcClientImpl::~RpcClientImpl() {
     }
 }
 
-bool RpcClientImpl::send_rpc_message(const RpcRequestMessage& rpc_request_message) {
-    Message net_msg(rpc_request_message.net_str());
-    return conn_->send_net_message(net_msg);
-}
+bool RpcClientImpl::has_pending_calls(const std::shared_ptr<TcpConnSync>& conn) const {
 
-bool RpcClientImpl::recv_rpc_message(Message& net_message) {
-    return conn_->recv_net_message(net_message);
+    for (auto iter = pending_calls_.begin(); iter != pending_calls_.end(); ++iter) {
+        if (iter->second->conn_ == conn) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
-void RpcClientImpl::set_rpc_call_timeout(uint32_t sec) {
+RpcClientStatus RpcClientImpl::send_request(uint16_t service_id, uint16_t opcode,
+                                            const std::string& payload, const deadline_t* deadline,
+                                            std::shared_ptr<rpc_call_t>& call) {
+
+    std::shared_ptr<TcpConnSync> conn;
+
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+
+        // 还不知道服务端是否回传请求编号的时候，连接上只能有一个在途请求
+        while (conn_ && mux_state_ != MuxState::kEnabled && has_pending_calls(conn_)) {
+
+            if (deadline && std::chrono::steady_clock::now() >= *deadline) {
+                log_err("wait for previous rpc_call timeout, service %u opcode %u", service_id, opcode);
+                return RpcClientStatus::RPC_CALL_TIMEOUT;
+            }
+
+            if (deadline) {
+                cond_.wait_until(lock, *deadline);
+            } else {
+                cond_.wait(lock);
+            }
+        }
+
+        if (!conn_) {
+
+            boost::system::error_code ec;
+            std::shared_ptr<tzrpc::ConnSocket> socket_ptr
+                    = std::make_shared<tzrpc::ConnSocket>(IoService::instance().get_io_service());
+
+            // 本机的服务优先使用 AF_UNIX 套接字，省去 TCP 协议栈的开销
+            std::string unix_path;
+            if (tzrpc::parse_unix_addr(client_setting_.serv_addr_, unix_path)) {
+                socket_ptr->connect(boost::asio::local::stream_protocol::endpoint(unix_path), ec);
+            } else {
+                socket_ptr->connect(boost::asio::ip::tcp::endpoint(
+                                        boost::asio::ip::address::from_string(client_setting_.serv_addr_), client_setting_.serv_port_), ec);
+            }
+
+            if (ec) {
+                log_err("connect to %s:%u failed with {%d} %s.",
+                        client_setting_.serv_addr_.c_str(), client_setting_.serv_port_,
+                        ec.value(), ec.message().c_str() );
+                return RpcClientStatus::NETWORK_CONNECT_ERROR;
+
+            }
+
+            conn_.reset(new TcpConnSync(socket_ptr, IoService::instance().get_io_service(), client_setting_));
+            if (!conn_) {
+                log_err("create socket %s:%u failed.",
+                        client_setting_.serv_addr_.c_str(), client_setting_.serv_port_);
+                return RpcClientStatus::NETWORK_BEFORE_ERROR;
+            }
+            mux_state_ = MuxState::kUnknown;
+        }
+
+        // 0 保留给不带请求编号的响应
+        if (++ next_request_id_ == 0) {
+            ++ next_request_id_;
+        }
+
+        conn = conn_;
+        call = std::make_shared<rpc_call_t>(next_request_id_, service_id, opcode, conn);
+        pending_calls_[call->request_id_] = call;
+    }
+
+    // 构建请求包
+    RpcRequestMessage rpc_request_message(service_id, opcode, payload);
+    rpc_request_message.set_request_id(call->request_id_);
+    Message net_msg(rpc_request_message.net_str());
+
+    // 小消息压缩的收益很小，只压缩超过阈值的消息
+    uint32_t codec = compress_;
+    {
+        // 新的连接上还没有协商过
+        std::lock_guard<std::mutex> lock(lock_);
+        if (compress_conn_.lock() != conn) {
+            codec = tzrpc::kCompressNone;
+        }
+    }
 
-    if (sec == 0) {
-        return;
+    if (codec != tzrpc::kCompressNone && client_setting_.compress_threshold_ != 0 &&
+        net_msg.payload_.size() >= client_setting_.compress_threshold_) {
+        std::string compressed;
+        if (tzrpc::compress_message(codec, net_msg.payload_.data(), net_msg.payload_.size(), compressed)) {
+            net_msg.payload_.swap(compressed);
+            net_msg.header_.length = net_msg.payload_.size();
+            net_msg.header_.rev1 = codec;
+        }
     }
 
-    boost::system::error_code ignore_ec;
-    if (rpc_call_timer_) {
-        rpc_call_timer_->cancel(ignore_ec);
-    } else {
-        rpc_call_timer_.reset(new steady_timer(IoService::instance().get_io_service()));
+    // 发送请求报文
+    bool ret = false;
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        ret = conn->send_net_message(net_msg);
     }
 
-    SAFE_ASSERT( sec > 0 );
-    was_timeout_ = false;
-    rpc_call_timer_->expires_from_now(seconds(sec));
-    rpc_call_timer_->async_wait(std::bind(&RpcClientImpl::rpc_call_timeout, shared_from_this(),
-                                           std::placeholders::_1));
+    if (!ret) {
+        std::lock_guard<std::mutex> lock(lock_);
+        fail_connection(conn);
+        pending_calls_.erase(call->request_id_);
+        cond_.notify_all();
+        return RpcClientStatus::NETWORK_SEND_ERROR;
+    }
+
+    return RpcClientStatus::OK;
 }
 
-void RpcClientImpl::rpc_call_timeout(const boost::system::error_code& ec) {
+int RpcClientImpl::read_and_dispatch(std::shared_ptr<TcpConnSync> conn, const deadline_t* deadline) {
 
-    if (ec == 0){
-        log_info("rpc_call_timeout called, call start at %lu", time_start_);
-        was_timeout_ = true;
-        conn_->shutdown_and_close_socket();
-    } else if ( ec == boost::asio::error::operation_aborted) {
-        // normal cancel
-    } else {
-        log_err("unknown and won't handle error_code: {%d} %s", ec.value(), ec.message().c_str());
+    int timeout_ms = -1;
+    if (deadline) {
+        auto now = std::chrono::steady_clock::now();
+        timeout_ms = *deadline > now ?
+            std::chrono::duration_cast<std::chrono::milliseconds>(*deadline - now).count() + 1 : 0;
     }
-}
 
-RpcClientStatus RpcClientImpl::call_RPC(uint16_t service_id, uint16_t opcode,
-                                        const std::string& payload, std::string& respload,
-                                        uint32_t timeout_sec) {
+    int ret = conn->wait_readable(timeout_ms);
+    if (ret <= 0) {
+        return ret;
+    }
 
-    std::lock_guard<std::mutex> lock(call_mutex_);
+    // 接收报文
+    Message net_message;
+    if (!conn->recv_net_message(net_message)) {
+        return -1;
+    }
 
-    if (!conn_) {
+    // 解析报文，格式错误之后连接上的数据已经不可信
+    RpcResponseMessage rpc_response_message;
+    if (!RpcResponseMessageParse(net_message.payload_, rpc_response_message)) {
+        log_err("parse rpc_response_message failed.");
+        return -1;
+    }
 
-        boost::system::error_code ec;
-        std::shared_ptr<boost::asio::ip::tcp::socket> socket_ptr
-                = std::make_shared<boost::asio::ip::tcp::socket>(IoService::instance().get_io_service());
+    std::lock_guard<std::mutex> lock(lock_);
 
-        socket_ptr->connect(boost::asio::ip::tcp::endpoint(
-                                boost::asio::ip::address::from_string(client_setting_.serv_addr_), client_setting_.serv_port_), ec);
-        if (ec) {
-            log_err("connect to %s:%u failed with {%d} %s.",
-                    client_setting_.serv_addr_.c_str(), client_setting_.serv_port_,
-                    ec.value(), ec.message().c_str() );
-            return RpcClientStatus::NETWORK_CONNECT_ERROR;
+    uint32_t request_id = rpc_response_message.request_id();
+    if (request_id == 0) {
 
+        // 旧版本的服务端，这个连接上的请求串行执行，响应属于唯一的在途请求
+        if (conn == conn_ && mux_state_ != MuxState::kDisabled) {
+            log_notice("server does not echo request id, disable multiplexing on this connection.");
+            mux_state_ = MuxState::kDisabled;
         }
 
-        conn_.reset(new TcpConnSync(socket_ptr, IoService::instance().get_io_service(), client_setting_));
-        if (!conn_) {
-            log_err("create socket %s:%u failed.",
-                    client_setting_.serv_addr_.c_str(), client_setting_.serv_port_);
-            return RpcClientStatus::NETWORK_BEFORE_ERROR;
+        std::shared_ptr<rpc_call_t> target;
+        for (auto iter = pending_calls_.begin(); iter != pending_calls_.end(); ++iter) {
+            if (iter->second->conn_ != conn) {
+                continue;
+            }
+            if (target) {
+                log_err("ambiguous response without request id: %s", rpc_response_message.header_.dump().c_str());
+                return -1;
+            }
+            target = iter->second;
         }
-    }
 
-    time_start_ = ::time(NULL);
+        if (!target) {
+            log_info("drop response for finished request: %s", rpc_response_message.header_.dump().c_str());
+            return 1;
+        }
 
-    // 构建请求包
-    RpcRequestMessage rpc_request_message(service_id, opcode, payload);
+        target->responses_.push_back(std::move(rpc_response_message));
+        return 1;
+    }
 
-    if (timeout_sec > 0) {
-        set_rpc_call_timeout(timeout_sec);
+    if (conn == conn_ && mux_state_ == MuxState::kUnknown) {
+        mux_state_ = MuxState::kEnabled;
     }
 
-    // 发送请求报文
-    if(!send_rpc_message(rpc_request_message)){
-        conn_.reset();
-        if (was_timeout_) {
-            log_err("rpc_call was timeout with %d sec, start before %lu",
-                    timeout_sec, (::time(NULL) - time_start_));
-            return RpcClientStatus::RPC_CALL_TIMEOUT;
+    auto iter = pending_calls_.find(request_id);
+    if (iter == pending_calls_.end()) {
+        // 超时或者放弃了的请求，后续到达的响应直接丢弃
+        log_info("drop response for finished request: %s", rpc_response_message.header_.dump().c_str());
+        return 1;
+    }
+
+    iter->second->responses_.push_back(std::move(rpc_response_message));
+    return 1;
+}
+
+void RpcClientImpl::fail_connection(const std::shared_ptr<TcpConnSync>& conn) {
+
+    for (auto iter = pending_calls_.begin(); iter != pending_calls_.end(); ++iter) {
+        if (iter->second->conn_ == conn) {
+            iter->second->failed_ = true;
         }
-        return RpcClientStatus::NETWORK_SEND_ERROR;
     }
 
-    // 接收报文
-    Message net_message;
-    if(!recv_rpc_message(net_message)){
+    conn->shutdown_and_close_socket();
+    if (conn_ == conn) {
         conn_.reset();
-        if (was_timeout_) {
-            log_err("rpc_call was timeout with %d sec, start before %lu",
-                    timeout_sec, (::time(NULL) - time_start_));
-            return RpcClientStatus::RPC_CALL_TIMEOUT;
-        }
-        return RpcClientStatus::NETWORK_RECV_ERROR;
     }
+}
+
+void RpcClientImpl::remove_call(const std::shared_ptr<rpc_call_t>& call) {
+
+    std::lock_guard<std::mutex> lock(lock_);
+    pending_calls_.erase(call->request_id_);
+
+    // 不回传请求编号的时候，剩余的响应无法和之后的请求区分，只能放弃这个连接
+    if (!call->done_ && !call->failed_ && call->conn_ == conn_ && mux_state_ != MuxState::kEnabled) {
+        log_notice("rpc_call unfinished on connection without request id, close it.");
+        fail_connection(call->conn_);
+    }
+
+    // 等待发送的请求可以继续
+    cond_.notify_all();
+}
+
+RpcClientStatus RpcClientImpl::recv_response(const std::shared_ptr<rpc_call_t>& call, const deadline_t* deadline,
+                                             std::string& respload, bool& more) {
+
+    more = false;
 
-    // 解析报文
     RpcResponseMessage rpc_response_message;
-    if (!RpcResponseMessageParse(net_message.payload_, rpc_response_message)) {
-        return RpcClientStatus::RECV_FORMAT_ERROR;
+
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+
+        while (call->responses_.empty()) {
+
+            if (call->failed_) {
+                return RpcClientStatus::NETWORK_RECV_ERROR;
+            }
+
+            if (deadline && std::chrono::steady_clock::now() >= *deadline) {
+                log_err("rpc_call was timeout, service %u opcode %u request_id %u",
+                        call->service_id_, call->opcode_, call->request_id_);
+                return RpcClientStatus::RPC_CALL_TIMEOUT;
+            }
+
+            if (reading_) {
+                if (deadline) {
+                    cond_.wait_until(lock, *deadline);
+                } else {
+                    cond_.wait(lock);
+                }
+                continue;
+            }
+
+            // 当前没有读取者，由自己负责读取连接
+            reading_ = true;
+            lock.unlock();
+            int ret = read_and_dispatch(call->conn_, deadline);
+            lock.lock();
+            reading_ = false;
+
+            if (ret < 0) {
+                fail_connection(call->conn_);
+            }
+
+            // 唤醒收到了响应的调用者，同时让其他的等待者接替读取
+            cond_.notify_all();
+        }
+
+        rpc_response_message = std::move(call->responses_.front());
+        call->responses_.pop_front();
+        call->done_ = !rpc_response_message.has_more();
     }
 
     // 返回参数校验
     if (rpc_response_message.header_.magic != kRpcHeaderMagic ||
          // rpc_response_message.header_.version != kRpcHeaderVersion ||
-        rpc_response_message.header_.service_id != service_id ||
-        rpc_response_message.header_.opcode != opcode ) {
+        rpc_response_message.header_.service_id != call->service_id_ ||
+        rpc_response_message.header_.opcode != call->opcode_ ) {
         log_err("rpc_response_message header check error: %s", rpc_response_message.header_.dump().c_str());
         return RpcClientStatus::RECV_FORMAT_ERROR;
     }
@@ -163,9 +352,67 @@ RpcClientStatus RpcClientImpl::call_RPC(uint16_t service_id, uint16_t opcode,
         return static_cast<RpcClientStatus>(static_cast<uint8_t>(rpc_response_message.header_.status));
     }
 
-    respload = rpc_response_message.payload_;
+    more = rpc_response_message.has_more();
+    respload.swap(rpc_response_message.payload_);
     return RpcClientStatus::OK;
 }
 
+RpcClientStatus RpcClientImpl::call_RPC(uint16_t service_id, uint16_t opcode,
+                                        const std::string& payload, std::string& respload,
+                                        uint32_t timeout_sec) {
+
+    deadline_t deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout_sec);
+
+    std::shared_ptr<rpc_call_t> call;
+    RpcClientStatus status = send_request(service_id, opcode, payload, timeout_sec > 0 ? &deadline : NULL, call);
+    if (status != RpcClientStatus::OK) {
+        return status;
+    }
+
+    bool more = false;
+    status = recv_response(call, timeout_sec > 0 ? &deadline : NULL, respload, more);
+    remove_call(call);
+
+    if (status == RpcClientStatus::OK && more) {
+        // 非流式的调用不应该收到流式的响应，剩余的响应在到达的时候被丢弃
+        log_err("unexpected stream response for service %u opcode %u", service_id, opcode);
+        return RpcClientStatus::RECV_FORMAT_ERROR;
+    }
+
+    return status;
+}
+
+RpcClientStatus RpcClientImpl::call_RPC_stream(uint16_t service_id, uint16_t opcode,
+                                               const std::string& payload, const RpcChunkHandler& handler,
+                                               uint32_t timeout_sec) {
+
+    deadline_t deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout_sec);
+
+    std::shared_ptr<rpc_call_t> call;
+    RpcClientStatus status = send_request(service_id, opcode, payload, timeout_sec > 0 ? &deadline : NULL, call);
+    if (status != RpcClientStatus::OK) {
+        return status;
+    }
+
+    bool more = false;
+    do {
+
+        std::string respload;
+        status = recv_response(call, timeout_sec > 0 ? &deadline : NULL, respload, more);
+        if (status != RpcClientStatus::OK) {
+            break;
+        }
+
+        // 放弃剩余的响应，之后到达的响应被丢弃，连接可以继续使用
+        if (!handler(respload)) {
+            break;
+        }
+
+    } while (more);
+
+    remove_call(call);
+    return status;
+}
+
 
 } // end namespace heracles_client
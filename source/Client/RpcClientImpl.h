@@ -8,21 +8,17 @@
 #ifndef __RPC_CLIENT_IMPL_H__
 #define __RPC_CLIENT_IMPL_H__
 
-#include <boost/asio/steady_timer.hpp>
-using boost::asio::steady_timer;
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 
 #include <Client/LogClient.h>
 #include <Client/RpcClientStatus.h>
 #include <Client/RpcClient.h>
 
-namespace tzrpc {
-
-class RpcRequestMessage;
-class RpcResponseMessage;
-class Message;
-
-}
-
 namespace heracles_client {
 
 class TcpConnSync;
@@ -33,15 +29,31 @@ class TcpConnSync;
 //
 //////////////////////////
 
+// 同一个连接上可以同时有多个在途的请求，请求编号通过 RpcRequestHeader::rev1 传递，
+// 服务端在 RpcResponseHeader::rev2 中原样返回，响应可以乱序到达。
+//
+// 发送的时候只对写操作加锁；接收不使用单独的线程，等待响应的调用者中
+// 同时只有一个负责读取连接，读到的响应按照请求编号放到对应的在途请求中
+// 并唤醒等待者，自己的响应到达或者超时之后把读取的任务交给其他的等待者。
+//
+// 旧版本的服务端不回传请求编号(rev2 为0)，所以新建的连接上先只发送一个请求，
+// 第一个响应带有请求编号之后才允许多个在途请求；否则这个连接上的请求串行执行，
+// 编号为0的响应交给唯一的在途请求，请求没有完整收到响应就结束的时候关闭连接。
+
 class RpcClientImpl: public std::enable_shared_from_this<RpcClientImpl> {
 public:
     RpcClientImpl(const RpcClientSetting& client_setting):
         client_setting_(client_setting),
-        call_mutex_(),
-        time_start_(0),
-        was_timeout_(false),
-        rpc_call_timer_(),
-        conn_() {
+        lock_(),
+        cond_(),
+        pending_calls_(),
+        next_request_id_(0),
+        reading_(false),
+        conn_(),
+        mux_state_(MuxState::kUnknown),
+        send_mutex_(),
+        compress_(0),
+        compress_conn_() {
     }
 
     ~RpcClientImpl();
@@ -54,26 +66,67 @@ public:
                              const std::string& payload, std::string& respload,
                              uint32_t timeout_sec);
 
+    RpcClientStatus call_RPC_stream(uint16_t service_id, uint16_t opcode,
+                                    const std::string& payload, const RpcChunkHandler& handler,
+                                    uint32_t timeout_sec);
+
+    // 协商只对当前的连接有效，重新连接之后需要再次协商
+    void set_compress(uint32_t codec) {
+        std::lock_guard<std::mutex> lock(lock_);
+        compress_ = codec;
+        compress_conn_ = conn_;
+    }
+
 private:
-    bool send_rpc_message(const tzrpc::RpcRequestMessage& rpc_request_message);
-    bool recv_rpc_message(tzrpc::Message& net_message);
 
-    RpcClientSetting client_setting_;
+    typedef std::chrono::steady_clock::time_point deadline_t;
+
+    // 当前连接上服务端是否回传请求编号
+    enum class MuxState : uint8_t {
+        kUnknown  = 0,
+        kEnabled  = 1,
+        kDisabled = 2,
+    };
+
+    // 一个在途的请求，定义在实现文件中
+    struct rpc_call_t;
+
+    // 连接(必要的时候新建)、登记并发送请求
+    RpcClientStatus send_request(uint16_t service_id, uint16_t opcode,
+                                 const std::string& payload, const deadline_t* deadline,
+                                 std::shared_ptr<rpc_call_t>& call);
+    // 等待并校验一个响应消息，more 返回是否还有后续的流式响应
+    RpcClientStatus recv_response(const std::shared_ptr<rpc_call_t>& call, const deadline_t* deadline,
+                                  std::string& respload, bool& more);
+    // 请求结束，之后收到的属于该请求的响应直接丢弃
+    void remove_call(const std::shared_ptr<rpc_call_t>& call);
+    // 连接上是否有在途的请求，需要持有 lock_
+    bool has_pending_calls(const std::shared_ptr<TcpConnSync>& conn) const;
+
+    // 读取一个响应消息并交给对应的在途请求，调用的时候不持有 lock_
+    int read_and_dispatch(std::shared_ptr<TcpConnSync> conn, const deadline_t* deadline);
+    // 连接出错，该连接上所有的在途请求失败，需要持有 lock_
+    void fail_connection(const std::shared_ptr<TcpConnSync>& conn);
 
-    // 确保不会客户端多线程调用，导致底层的连接串话
-    std::mutex call_mutex_;
+    RpcClientSetting client_setting_;
 
-    //
-    // rpc调用超时相关的配置
-    //
-    time_t time_start_;        // 请求创建的时间
-    bool was_timeout_;
-    std::unique_ptr<steady_timer> rpc_call_timer_;
-    void set_rpc_call_timeout(uint32_t msec);
-    void rpc_call_timeout(const boost::system::error_code& ec);
+    // 保护在途请求表、读取者标志和连接
+    std::mutex lock_;
+    std::condition_variable cond_;
+    std::map<uint32_t, std::shared_ptr<rpc_call_t>> pending_calls_;
+    uint32_t next_request_id_;
+    bool reading_;              // 是否已经有调用者在读取连接
 
     // 请求到达后按照需求自动创建
     std::shared_ptr<TcpConnSync> conn_;
+    MuxState mux_state_;        // 新建连接的时候重置
+
+    // 多个线程的请求报文不能交错写入连接
+    std::mutex send_mutex_;
+
+    // 协商的请求压缩算法，服务端只接受该连接上协商过的压缩消息
+    std::atomic<uint32_t> compress_;
+    std::weak_ptr<TcpConnSync> compress_conn_;
 };
 
 
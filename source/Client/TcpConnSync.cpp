@@ -5,11 +5,15 @@
  *
  */
 
+#include <poll.h>
+
 #include <thread>
 #include <functional>
 
 #include <boost/algorithm/string.hpp>
 
+#include <Core/Compress.h>
+
 #include <Client/LogClient.h>
 
 #include <Client/RpcClient.h>
@@ -21,9 +25,10 @@ using tzrpc::Header;
 using tzrpc::kHeaderMagic;
 using tzrpc::kHeaderVersion;
 using tzrpc::kFixedIoBufferSize;
+using tzrpc::kMaxIoPrepareSize;
 using tzrpc::ShutdownType;
 
-TcpConnSync::TcpConnSync(std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+TcpConnSync::TcpConnSync(ConnSocketPtr socket,
                          boost::asio::io_service& io_service,
                          RpcClientSetting& client_setting):
     NetConn(socket),
@@ -89,12 +94,60 @@ int TcpConnSync::parse_msg_body(Message& msg) {
     recv_bound_.buffer_.consume(msg_str, recv_bound_.header_.length);
 
     msg.header_ = recv_bound_.header_;
-    msg.payload_ = msg_str;
 
+    // 服务端协商之后压缩的响应，解压之后的长度同样受 recv_max_msg_size 限制
+    if (recv_bound_.header_.rev1 != tzrpc::kCompressNone) {
+        // 没有提供压缩能力的时候服务端不会压缩响应
+        if (client_setting_.compress_threshold_ == 0 ||
+            (recv_bound_.header_.rev1 & ~tzrpc::kCompressSupported) != 0) {
+            log_err("unexpected compressed message, codec %0x", recv_bound_.header_.rev1);
+            return -1;
+        }
+        if (!tzrpc::uncompress_message(recv_bound_.header_.rev1, msg_str.data(), msg_str.size(),
+                                       client_setting_.recv_max_msg_size_, msg.payload_)) {
+            log_err("uncompress message failed, codec %0x, len %lu",
+                    recv_bound_.header_.rev1, msg_str.size());
+            return -1;
+        }
+        msg.header_.rev1 = tzrpc::kCompressNone;
+        msg.header_.length = msg.payload_.size();
+        return 0;
+    }
+
+    msg.payload_.swap(msg_str);
     return 0;
 }
 
 
+int TcpConnSync::wait_readable(int timeout_ms) {
+
+    if (get_conn_stat() != ConnStat::kWorking) {
+        log_err("socket status error: %d", get_conn_stat());
+        return -1;
+    }
+
+    // 缓冲区中已经有之前多读的数据，后续的部分很快就会到达
+    if (recv_bound_.buffer_.get_length() > 0) {
+        return 1;
+    }
+
+    struct pollfd pfd {};
+    pfd.fd = socket_->native_handle();
+    pfd.events = POLLIN;
+
+    int ret = 0;
+    do {
+        ret = ::poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0) {
+        log_err("poll socket failed: %d", errno);
+        return -1;
+    }
+
+    return ret > 0 ? 1 : 0;
+}
+
 bool TcpConnSync::do_read(Message& msg) {
 
     if (get_conn_stat() != ConnStat::kWorking) {
@@ -107,7 +160,7 @@ bool TcpConnSync::do_read(Message& msg) {
         uint32_t bytes_read = recv_bound_.buffer_.get_length();
         boost::system::error_code ec;
         size_t bytes_transferred
-                = boost::asio::read(*socket_, boost::asio::buffer(recv_bound_.io_block_, kFixedIoBufferSize),
+                = boost::asio::read(*socket_, boost::asio::buffer(recv_bound_.buffer_.prepare(kFixedIoBufferSize), kFixedIoBufferSize),
                                     boost::asio::transfer_at_least(sizeof(Header) - bytes_read),
                                     ec );
 
@@ -116,8 +169,7 @@ bool TcpConnSync::do_read(Message& msg) {
             return false;
         }
 
-        std::string str(recv_bound_.io_block_, bytes_transferred);
-        recv_bound_.buffer_.append_internal(str);
+        recv_bound_.buffer_.commit(bytes_transferred);
 
     }
 
@@ -139,12 +191,14 @@ bool TcpConnSync::do_read_msg(Message& msg) {
 
     while (recv_bound_.buffer_.get_length() < recv_bound_.header_.length) {
 
-        uint32_t to_read = std::min((uint32_t)(recv_bound_.header_.length - recv_bound_.buffer_.get_length()),
-                                    (uint32_t)(kFixedIoBufferSize));
+        // 按照消息剩余的长度直接读入缓冲区，单次预留的空间有上限
+        uint32_t to_read = recv_bound_.header_.length - recv_bound_.buffer_.get_length();
+        uint32_t to_prepare = std::min(std::max(to_read, (uint32_t)(kFixedIoBufferSize)), kMaxIoPrepareSize);
+        to_read = std::min(to_read, to_prepare);
 
         boost::system::error_code ec;
         size_t bytes_transferred
-                = boost::asio::read(*socket_, boost::asio::buffer(recv_bound_.io_block_, kFixedIoBufferSize),
+                = boost::asio::read(*socket_, boost::asio::buffer(recv_bound_.buffer_.prepare(to_prepare), to_prepare),
                                     boost::asio::transfer_at_least(to_read),
                                     ec);
 
@@ -153,8 +207,7 @@ bool TcpConnSync::do_read_msg(Message& msg) {
             return false;
         }
 
-        std::string str(recv_bound_.io_block_, bytes_transferred);
-        recv_bound_.buffer_.append_internal(str);
+        recv_bound_.buffer_.commit(bytes_transferred);
     }
 
     if (parse_msg_body(msg) == 0) {
@@ -18,6 +18,7 @@ using tzrpc::Message;
 using tzrpc::NetConn;
 using tzrpc::IOBound;
 using tzrpc::ConnStat;
+using tzrpc::ConnSocketPtr;
 class RpcClientSetting;
 
 class TcpConnSync : public NetConn,
@@ -28,7 +29,7 @@ class TcpConnSync : public NetConn,
 public:
 
     /// Construct a connection with the given socket.
-    explicit TcpConnSync(std::shared_ptr<boost::asio::ip::tcp::socket> socket,
+    explicit TcpConnSync(ConnSocketPtr socket,
                          boost::asio::io_service& io_service,
                          RpcClientSetting& client_setting);
     virtual ~TcpConnSync();
@@ -41,6 +42,10 @@ public:
         return do_read(msg);
     }
 
+    // 等待连接上有消息可读，timeout_ms < 0 表示一直等待
+    // 返回 1 可读，0 超时，-1 出错
+    int wait_readable(int timeout_ms);
+
     bool send_net_message(const Message& msg) {
         if (client_setting_.send_max_msg_size_ != 0 &&
             msg.header_.length > client_setting_.send_max_msg_size_) {
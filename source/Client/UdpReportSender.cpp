@@ -0,0 +1,178 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <google/protobuf/io/coded_stream.h>
+
+#include <Client/LogClient.h>
+
+#include <Client/Common.h>
+#include <Client/MonitorTask.pb.h>
+#include <Client/UdpReportSender.h>
+
+namespace heracles_client {
+
+using tzrpc::UdpReportHeader;
+using tzrpc::kUdpReportMagic;
+using tzrpc::kUdpReportVersion;
+using tzrpc::kUdpReportMaxSize;
+
+UdpReportSender::~UdpReportSender() {
+    if (socket_fd_ >= 0) {
+        ::close(socket_fd_);
+        socket_fd_ = -1;
+    }
+}
+
+bool UdpReportSender::init() {
+
+    if (datagram_size_ < sizeof(UdpReportHeader) + 128 || datagram_size_ > kUdpReportMaxSize) {
+        log_err("invalid udp datagram size %lu", datagram_size_);
+        return false;
+    }
+
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port_);
+    if (port_ == 0 || ::inet_pton(AF_INET, ip_.c_str(), &addr.sin_addr) != 1) {
+        log_err("invalid udp report addr %s:%u", ip_.c_str(), port_);
+        return false;
+    }
+
+    int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_err("create udp socket failed: %s", strerror(errno));
+        return false;
+    }
+
+    // connect 之后发送不需要每次携带地址
+    if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        log_err("connect udp socket to %s:%u failed: %s", ip_.c_str(), port_, strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    socket_fd_ = fd;
+    return true;
+}
+
+int UdpReportSender::send_report(const event_report_t& report) {
+
+    if (socket_fd_ < 0) {
+        log_err("udp socket not initialized.");
+        return -1;
+    }
+
+    UdpReportHeader header {};
+    header.magic   = htobe16(kUdpReportMagic);
+    header.version = kUdpReportVersion;
+
+    const size_t limit = datagram_size_ - sizeof(header);
+
+    tzrpc::MonitorTask::MonitorWriteOps::Request::ev_report_t pb_report;
+    pb_report.set_version(report.version);
+    pb_report.set_timestamp(report.timestamp);
+    pb_report.set_service(report.service);
+    pb_report.set_entity_idx(report.entity_idx);
+
+    const size_t base_size = pb_report.ByteSize();
+    size_t current_size = base_size;
+
+    // 每个数据报都是一个完整的上报，接收端独立解析
+    size_t count = 0;
+    datagrams_.clear();
+    std::vector<size_t> event_counts;     // 每个数据报中的事件数目
+    auto flush = [&]() {
+        event_counts.push_back(pb_report.data_size());
+        datagrams_.emplace_back(reinterpret_cast<const char*>(&header), sizeof(header));
+        pb_report.AppendToString(&datagrams_.back());
+        pb_report.clear_data();
+        current_size = base_size;
+    };
+
+    for (auto iter = report.data.cbegin(); iter != report.data.cend(); ++iter) {
+
+        tzrpc::MonitorTask::MonitorWriteOps::Request::ev_data_t item;
+        item.set_msgid(iter->msgid);
+        item.set_metric(iter->metric);
+        item.set_value(iter->value);
+        item.set_tag(iter->tag);
+
+        // repeated 字段的 tag + 长度 + 内容
+        size_t item_size = item.ByteSize();
+        item_size += 1 + google::protobuf::io::CodedOutputStream::VarintSize32(item_size);
+
+        if (base_size + item_size > limit) {
+            log_err("event %s too large for udp datagram, dropped.", iter->metric.c_str());
+            ++ drop_count_;
+            continue;
+        }
+
+        if (current_size + item_size > limit) {
+            flush();
+        }
+
+        pb_report.add_data()->Swap(&item);
+        current_size += item_size;
+        ++ count;
+    }
+
+    if (pb_report.data_size() > 0) {
+        flush();
+    }
+
+    if (datagrams_.empty()) {
+        return 0;
+    }
+
+    std::vector<struct iovec>   iovs(datagrams_.size());
+    std::vector<struct mmsghdr> msgs(datagrams_.size());
+    for (size_t i=0; i<datagrams_.size(); ++i) {
+        iovs[i].iov_base = const_cast<char*>(datagrams_[i].data());
+        iovs[i].iov_len  = datagrams_[i].size();
+        msgs[i].msg_hdr.msg_iov    = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // 一次系统调用发送整个批次，不阻塞，发送不出去的部分直接丢弃
+    int sent = 0;
+    do {
+        sent = ::sendmmsg(socket_fd_, &msgs[0], msgs.size(), MSG_DONTWAIT);
+    } while (sent < 0 && errno == EINTR);
+
+    if (sent < 0) {
+        log_err("udp sendmmsg failed: %s", strerror(errno));
+        drop_count_ += count;
+        return -1;
+    }
+
+    if (static_cast<size_t>(sent) < msgs.size()) {
+        log_err("udp send %d of %lu datagrams, the others dropped.", sent, msgs.size());
+
+        size_t dropped = 0;
+        for (size_t i=sent; i<event_counts.size(); ++i) {
+            dropped += event_counts[i];
+        }
+
+        drop_count_ += dropped;
+        count -= dropped;
+    }
+
+    send_count_ += count;
+    return static_cast<int>(count);
+}
+
+} // end namespace heracles_client
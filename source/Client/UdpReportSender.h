@@ -0,0 +1,69 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+
+#ifndef __UDP_REPORT_SENDER_H__
+#define __UDP_REPORT_SENDER_H__
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <Client/include/EventTypes.h>
+
+namespace heracles_client {
+
+// UDP 上报的发送
+//
+// 非阻塞的UDP套接字，不等待应答也不重传，每次上报按照数据报尺寸拆分之后
+// 通过一次 sendmmsg 调用发送出去，发送缓冲区满的时候直接丢弃。
+// 只在提交线程中使用，不是线程安全的。
+
+class UdpReportSender {
+public:
+
+    UdpReportSender(const std::string& ip, uint16_t port, size_t datagram_size):
+        ip_(ip),
+        port_(port),
+        datagram_size_(datagram_size),
+        socket_fd_(-1),
+        datagrams_(),
+        send_count_(0),
+        drop_count_(0) {
+    }
+
+    ~UdpReportSender();
+
+    // 禁止拷贝
+    UdpReportSender(const UdpReportSender&) = delete;
+    UdpReportSender& operator=(const UdpReportSender&) = delete;
+
+    bool init();
+
+    // 返回发送出去的事件数目，出错返回-1
+    int send_report(const event_report_t& report);
+
+    uint64_t send_count() const { return send_count_; }
+    uint64_t drop_count() const { return drop_count_; }
+
+private:
+    std::string ip_;
+    uint16_t    port_;
+    size_t      datagram_size_;
+
+    int socket_fd_;
+
+    std::vector<std::string> datagrams_;
+
+    // 按照事件计数
+    std::atomic<uint64_t> send_count_;
+    std::atomic<uint64_t> drop_count_;
+};
+
+} // end namespace heracles_client
+
+#endif // __UDP_REPORT_SENDER_H__
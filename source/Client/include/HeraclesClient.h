@@ -48,6 +48,7 @@ public:
     HeraclesClient& operator=(const HeraclesClient&) = delete;
 
     // 用存量的cfg进行更新，必须确保cfgFile_已经初始化了
+    // addr 可以是 "unix:///path/to/sock" 形式的本机套接字地址，此时 port 被忽略
     bool init();
     bool init(const std::string& cfgFile, CP_log_store_func_t log_func);
     bool init(const libconfig::Setting& setting, CP_log_store_func_t log_func);
@@ -58,6 +59,7 @@ public:
 
     int ping();
 
+    // 配置了 udp_report_port 的时候，后台线程通过UDP批量发送上报，不等待应答
     int report_event(const std::string& metric, int64_t value, std::string tag = "T");
 
     // 常用便捷接口
@@ -65,8 +67,11 @@ public:
     int select_stat(const std::string& metric, const std::string& tag, int64_t& count, int64_t& avg, time_t tm_intervel = 60);
 
     int select_stat_groupby_tag(const std::string& metric, event_select_t& stat, time_t tm_intervel = 60);
+    int select_stat_groupby_entity(const std::string& metric, event_select_t& stat, time_t tm_intervel = 60);
     int select_stat_groupby_time(const std::string& metric, event_select_t& stat, time_t tm_intervel = 60);
     int select_stat_groupby_time(const std::string& metric, const std::string& tag, event_select_t& stat, time_t tm_intervel = 60);
+    // 长时间范围的查询，服务端把结果合并到 bucket_seconds 的时间桶中
+    int select_stat_groupby_bucket(const std::string& metric, int32_t bucket_seconds, event_select_t& stat, time_t tm_intervel = 3600);
 
     int select_stat_groupby_tag_ordered(const std::string& metric, const order_cond_t& order, event_select_t& stat, time_t tm_intervel = 60);
     int select_stat_groupby_time_ordered(const std::string& metric, const order_cond_t& order, event_select_t& stat, time_t tm_intervel = 60);
@@ -76,6 +81,15 @@ public:
     // 最底层的接口，可以做更加精细化的查询
     int select_stat(event_cond_t& cond, event_select_t& stat);
 
+    // 批量查询，一次请求返回所有结果，rets[i] 为单个查询的返回码
+    int select_stat_batch(std::vector<event_cond_t>& conds,
+                          std::vector<event_select_t>& stats, std::vector<int>& rets);
+
+    // 流式查询，结果按照最多 chunk_rows 条分块返回并交给 handler 处理，
+    // stat 只返回汇总等信息(调用返回之后才有效)，info 不再保存完整结果；服务端没有限制条数时也不在客户端排序
+    int select_stat_stream(event_cond_t& cond, int32_t chunk_rows,
+                           event_select_t& stat, const select_chunk_handler_t& handler);
+
     // 查询所有已经上报的metrics, service == ""就默认是自己的service
     int known_metrics(event_handler_conf_t& handler_conf, std::vector<std::string>& metrics, std::string service = "");
     int known_services(std::vector<std::string>& services);
@@ -11,11 +11,10 @@
 
 #include <xtra_rhel.h>
 
-#include <set>
 #include <deque>
-#include <numeric>
-
-#include <boost/circular_buffer.hpp>
+#include <atomic>
+#include <sstream>
+#include <algorithm>
 
 #include <condition_variable>
 #include <chrono>
@@ -27,18 +26,6 @@
 
 namespace tzrpc {
 
-template <typename T>
-struct conn_ptr_compare {
-public:
-    typedef std::shared_ptr<T> ConnPtr;
-
-    bool operator() (const ConnPtr& lhs,
-                     const ConnPtr& rhs) const {
-        return (lhs.get() < rhs.get());
-    }
-};
-
-
 struct ConnStat {
 
     uint32_t start_;             // touch
@@ -48,11 +35,8 @@ struct ConnStat {
     }
 
     bool expire(uint32_t linger) {
-
-        time_t elapse = ::time(NULL) - start_;
-        ignore_unused(elapse);
-
-        return static_cast<uint32_t>(::time(NULL) & 0xFFFFFFFFL) > linger;
+        uint32_t now = static_cast<uint32_t>(::time(NULL) & 0xFFFFFFFFL);
+        return now - start_ > linger;
     }
 
     ConnStat():
@@ -63,44 +47,101 @@ struct ConnStat {
 
 
 struct ConnPoolStat {
-    uint32_t acquired_count_;    // 总请求计数
-    uint32_t acquired_success_;  // 成功请求的数量
 
-    void incr_count() {
-        ++ acquired_count_;
+    // 获取连接等待时间的分桶上界(us)，最后一个桶为溢出桶
+    enum { kWaitBuckets = 7 };
+
+    std::atomic<uint64_t> acquired_count_;    // 总请求计数
+    std::atomic<uint64_t> acquired_success_;  // 成功请求的数量
+    std::atomic<uint64_t> acquired_timeout_;  // 等待超时的数量
+    std::atomic<uint64_t> acquired_waited_;   // 需要排队等待的数量
+    std::atomic<uint64_t> affinity_hit_;      // 命中线程上次使用的连接
+    std::atomic<uint64_t> handoff_count_;     // 归还时直接移交给等待者
+    std::atomic<uint64_t> conn_created_;
+    std::atomic<uint64_t> conn_dropped_;
+
+    std::atomic<uint64_t> wait_us_[kWaitBuckets];
+    std::atomic<uint64_t> wait_us_sum_;
+    std::atomic<uint64_t> wait_us_max_;
+
+    static uint64_t wait_bound(size_t idx) {
+        static const uint64_t bounds[kWaitBuckets - 1] = { 10, 100, 1000, 10000, 100000, 1000000 };
+        return bounds[idx];
+    }
+
+    void add_wait(uint64_t us) {
+        size_t idx = 0;
+        while (idx < kWaitBuckets - 1 && us > wait_bound(idx)) {
+            ++ idx;
+        }
+        ++ wait_us_[idx];
+        wait_us_sum_ += us;
+
+        uint64_t curr = wait_us_max_.load();
+        while (us > curr && !wait_us_max_.compare_exchange_weak(curr, us)) {
+            // curr 已经被更新，重试
+        }
     }
 
-    void incr_success() {
-        ++ acquired_success_;
+    std::string wait_str() const {
+        std::stringstream ss;
+        uint64_t count = acquired_count_.load();
+        ss << "avg " << (count ? wait_us_sum_.load() / count : 0) << "us, max " << wait_us_max_.load() << "us, [";
+        for (size_t i=0; i<kWaitBuckets; ++i) {
+            if (i < kWaitBuckets - 1) {
+                ss << "<=" << wait_bound(i) << ":" << wait_us_[i].load() << " ";
+            } else {
+                ss << ">" << wait_bound(i - 1) << ":" << wait_us_[i].load();
+            }
+        }
+        ss << "]";
+        return ss.str();
     }
 
     ConnPoolStat():
         acquired_count_(0),
-        acquired_success_(0) {
+        acquired_success_(0),
+        acquired_timeout_(0),
+        acquired_waited_(0),
+        affinity_hit_(0),
+        handoff_count_(0),
+        conn_created_(0),
+        conn_dropped_(0),
+        wait_us_sum_(0),
+        wait_us_max_(0) {
+        for (size_t i=0; i<kWaitBuckets; ++i) {
+            wait_us_[i] = 0;
+        }
     }
-}  __attribute__ ((aligned (4)));
+};
 
 
+// 连接池
+//
+// 每个连接占用一个固定的槽位，获取和归还只是槽位状态的 CAS，不再需要全局锁；
+// 线程优先从上次使用的槽位开始查找，连接和线程之间有比较好的亲和性。
+// 没有可用连接的时候等待者按照先后排队，归还的连接直接移交给队首的一个等待者，
+// 而不是唤醒所有的等待线程。
 template <typename T, typename Helper>
 class ConnPool: public std::enable_shared_from_this<ConnPool<T, Helper> >
 {
 public:
     typedef std::shared_ptr<T> ConnPtr;
     typedef std::weak_ptr<T>   ConnWeakPtr;
-    typedef std::set<ConnPtr, conn_ptr_compare<T> > ConnContainer;
 
 public:
     explicit ConnPool(std::string pool_name, size_t capacity, Helper helper,
-                      uint32_t linger_sec = 0):
+                      uint32_t linger_sec = 0, uint32_t acquire_timeout_ms = 0):
         pool_name_(pool_name), capacity_(capacity),
         helper_(helper),
-        conns_busy_(), conns_idle_(),
-        conn_notify_(), conn_notify_mutex_(),
+        slots_(new conn_slot_t[capacity]),
+        wait_mutex_(), waiters_(), waiting_count_(0),
         stat_(),
-        conn_trim_linger_(linger_sec) {
+        conn_trim_linger_(linger_sec),
+        acquire_timeout_ms_(acquire_timeout_ms) {
 
         SAFE_ASSERT(capacity_);
-        log_info( "ConnPool Maxium Capacity: %lu", capacity_ );
+        log_info( "ConnPool Maxium Capacity: %lu, acquire timeout %u ms", capacity_, acquire_timeout_ms_ );
         return;
     }
 
@@ -145,123 +186,256 @@ public:
     }
 
     // 由于会返回nullptr，所以不能返回引用
+    // 使用完之后需要调用 free_conn 归还
     ConnPtr request_conn() {
+        int idx = acquire_slot(acquire_timeout_ms_, true);
+        return idx < 0 ? ConnPtr() : slots_[idx].conn_;
+    }
+
+    // msec 为0的时候不等待
+    ConnPtr try_request_conn(size_t msec)  {
+        int idx = acquire_slot(msec, msec != 0);
+        return idx < 0 ? ConnPtr() : slots_[idx].conn_;
+    }
 
-        stat_.incr_count();
-        std::unique_lock<std::mutex> lock(conn_notify_mutex_);
+    bool request_scoped_conn(ConnPtr& scope_conn) {
+
+        // reset first, the old one may be returned to this pool
+        scope_conn.reset();
 
-        while (!do_check_available()) {
-            conn_notify_.wait(lock);
+        int idx = acquire_slot(acquire_timeout_ms_, true);
+        if (idx < 0) {
+            return false;
         }
 
-        return do_request_conn();
+        // 连接由槽位持有，这里只是归还槽位的句柄
+        scope_conn.reset(slots_[idx].conn_.get(),
+                         std::bind(&ConnPool::release_slot, this, idx));
+        return true;
     }
 
-    ConnPtr try_request_conn(size_t msec)  {
+    void free_conn(ConnPtr conn) {
 
-        ConnPtr conn;
-        stat_.incr_count();
-        std::unique_lock<std::mutex> lock(conn_notify_mutex_);
+        for (size_t i=0; i<capacity_; ++i) {
+            if (slots_[i].conn_ == conn && slots_[i].state_ == kSlotBusy) {
+                release_slot(static_cast<int>(i));
+                return;
+            }
+        }
 
-        if (!do_check_available() && !msec)
-            return conn; // nullptr
+        log_err("conn %p not belongs to pool %s", conn.get(), pool_name_.c_str());
+    }
 
-        // timed_wait not work with 0
-        if(do_check_available() || conn_notify_.wait_for(lock, std::chrono::milliseconds(msec))) {
-            typename ConnContainer::iterator it;
-            return do_request_conn();
-        }
 
-        return conn;
+    size_t get_conn_capacity() const {
+        return capacity_;
     }
 
-    bool request_scoped_conn(ConnPtr& scope_conn) {
+private:
 
-        // reset first, all will stack at reset latter...
-        // probably recursive require conn_nofity_mutex problem
+    enum {
+        kSlotFree = 0,    // 没有建立连接，可以使用
+        kSlotIdle = 1,    // 连接空闲
+        kSlotBusy = 2,    // 被某个线程持有
+    };
 
-        stat_.incr_count();
-        scope_conn.reset();
-        std::unique_lock<std::mutex> lock(conn_notify_mutex_);
+    struct conn_slot_t {
+        std::atomic<int> state_;
+        ConnPtr conn_;     // 只有持有该槽位的线程可以修改
 
-        while (!do_check_available()) {
-            conn_notify_.wait(lock);
+        conn_slot_t():
+            state_(kSlotFree), conn_() {
         }
+    };
+
+    struct waiter_t {
+        int idx_;                          // 被移交的槽位
+        std::condition_variable notify_;
 
-        ConnPtr conn = do_request_conn();
-        if (conn) {
-            scope_conn.reset(conn.get(),
-                             std::bind(&ConnPool::free_conn,
-                             this, conn)); // 还是通过智能指针拷贝一份吧
-            return true;
+        waiter_t():
+            idx_(-1), notify_() {
         }
+    };
 
-        return false;
+    // 线程上次使用的槽位
+    static thread_local const void* hint_pool_;
+    static thread_local size_t hint_idx_;
+
+    static uint64_t now_us() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
     }
 
-    void free_conn(ConnPtr conn) {
+    // 无锁的查找可用槽位，优先已经建立连接的空闲槽位
+    int do_try_acquire() {
 
-        {
-            std::lock_guard<std::mutex> lock(conn_notify_mutex_);
+        size_t start = (hint_pool_ == this) ? hint_idx_ : 0;
 
-            // 如果健康，则将其丢回连接池中，否则直接丢弃
-            if (conn->is_health()) {
-                conns_idle_.push_back(conn);
-            } else {
-                log_err("connect not ok, drop it away");
+        for (size_t i=0; i<capacity_; ++i) {
+            size_t idx = (start + i) % capacity_;
+            int expect = kSlotIdle;
+            if (slots_[idx].state_.compare_exchange_strong(expect, kSlotBusy)) {
+                if (i == 0 && hint_pool_ == this) {
+                    ++ stat_.affinity_hit_;
+                }
+                return static_cast<int>(idx);
             }
+        }
 
-            conns_busy_.erase(conn);
+        for (size_t i=0; i<capacity_; ++i) {
+            int expect = kSlotFree;
+            if (slots_[i].state_.compare_exchange_strong(expect, kSlotBusy)) {
+                return static_cast<int>(i);
+            }
         }
 
-        conn_notify_.notify_all();
-        return;
+        return -1;
     }
 
+    // 排队等待其他线程归还，msec 为0表示一直等待
+    int do_wait_acquire(size_t msec) {
 
-    size_t get_conn_capacity() const {
-        return capacity_;
+        ++ stat_.acquired_waited_;
+
+        waiter_t w {};
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(msec);
+
+        std::unique_lock<std::mutex> lock(wait_mutex_);
+        waiters_.push_back(&w);
+        ++ waiting_count_;
+
+        while (true) {
+
+            // 登记之后再检查一次，避免和归还的线程错过
+            lock.unlock();
+            int idx = do_try_acquire();
+            lock.lock();
+
+            if (idx >= 0) {
+                if (w.idx_ < 0) {
+                    remove_waiter(&w);
+                    return idx;
+                }
+
+                // 同时被移交了一个槽位，归还多出来的
+                lock.unlock();
+                release_slot(idx);
+                return w.idx_;
+            }
+
+            // 定期醒来重新检查，即使丢失了通知也不会一直卡住
+            auto until = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+            if (msec && deadline < until) {
+                until = deadline;
+            }
+
+            w.notify_.wait_until(lock, until, [&w] { return w.idx_ >= 0; });
+            if (w.idx_ >= 0) {
+                return w.idx_;
+            }
+
+            if (msec && std::chrono::steady_clock::now() >= deadline) {
+                remove_waiter(&w);
+                return -1;
+            }
+        }
     }
 
-private:
+    // 持锁被调用的 wait_mutex_
+    void remove_waiter(waiter_t* w) {
+        auto iter = std::find(waiters_.begin(), waiters_.end(), w);
+        if (iter != waiters_.end()) {
+            waiters_.erase(iter);
+            -- waiting_count_;
+        }
+    }
 
-    // 持锁被调用的 conn_notify_mutex_
-    ConnPtr do_request_conn() {
+    int acquire_slot(size_t msec, bool wait) {
 
-        ConnPtr conn;
+        ++ stat_.acquired_count_;
+        uint64_t start_us = now_us();
 
-        if (!conns_idle_.empty()){
-            conn = conns_idle_.front();
-            conns_idle_.pop_front();
-            conns_busy_.insert(conn);
-            stat_.incr_success();
-            return conn;
+        int idx = do_try_acquire();
+        if (idx < 0 && wait) {
+            idx = do_wait_acquire(msec);
         }
 
-        if ( (conns_idle_.size() + conns_busy_.size()) < capacity_) {
+        stat_.add_wait(now_us() - start_us);
 
-            ConnPtr new_conn = std::make_shared<T>(*this, helper_);
-            if (!new_conn){
-                log_err("creating new Conn failed!");
-                return new_conn;
+        if (idx < 0) {
+            if (wait) {
+                ++ stat_.acquired_timeout_;
+                log_err("acquire conn from %s timeout.", pool_name_.c_str());
             }
+            return -1;
+        }
 
-            if (!new_conn->init(reinterpret_cast<int64_t>(new_conn.get()))) {
-                log_err("init new Conn failed!");
-                new_conn.reset();
-                return new_conn;
+        // 移交过来的槽位可能还没有建立连接
+        conn_slot_t& slot = slots_[idx];
+        if (!slot.conn_) {
+
+            ConnPtr new_conn = std::make_shared<T>(*this, helper_);
+            if (!new_conn || !new_conn->init(reinterpret_cast<int64_t>(new_conn.get()))) {
+                log_err("creating and init new Conn failed!");
+                release_slot(idx);
+                return -1;
             }
 
-            conns_busy_.insert(new_conn);
-            stat_.incr_success();
-            return new_conn;
+            slot.conn_ = new_conn;
+            ++ stat_.conn_created_;
+        }
+
+        hint_pool_ = this;
+        hint_idx_  = idx;
+
+        ++ stat_.acquired_success_;
+        return idx;
+    }
+
+    void release_slot(int idx) {
+
+        conn_slot_t& slot = slots_[idx];
+
+        // 如果健康，则将其丢回连接池中，否则直接丢弃
+        int state = kSlotIdle;
+        if (slot.conn_ && slot.conn_->is_health()) {
+            slot.conn_->touch();
+        } else {
+            if (slot.conn_) {
+                log_err("connect not ok, drop it away");
+                ++ stat_.conn_dropped_;
+            }
+            slot.conn_.reset();
+            state = kSlotFree;
         }
 
-        return conn;
+        slot.state_ = state;
+        if (waiting_count_ > 0) {
+            do_handoff(idx, state);
+        }
     }
 
-    bool do_check_available() {
-        return (!conns_idle_.empty() || (conns_idle_.size() + conns_busy_.size()) < capacity_ );
+    // 把刚归还的槽位移交给最早的等待者
+    void do_handoff(int idx, int state) {
+
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        if (waiters_.empty()) {
+            return;
+        }
+
+        // 可能已经被其他线程拿走了，那么由那个线程归还的时候再移交
+        int expect = state;
+        if (!slots_[idx].state_.compare_exchange_strong(expect, kSlotBusy)) {
+            return;
+        }
+
+        waiter_t* w = waiters_.front();
+        waiters_.pop_front();
+        -- waiting_count_;
+
+        w->idx_ = idx;
+        w->notify_.notify_one();
+        ++ stat_.handoff_count_;
     }
 
 
@@ -272,54 +446,36 @@ private:
     // 各种连接类型的配置信息会放在这个模板类型中
     const Helper helper_;
 
-    // 正在被使用的连接
-    std::set<ConnPtr, conn_ptr_compare<T> > conns_busy_;
-    std::deque<ConnPtr> conns_idle_;
+    std::unique_ptr<conn_slot_t[]> slots_;
 
-    // If the lock is std::unique_lock, std::condition_variable may provide better performance.
-    // http://en.cppreference.com/w/cpp/thread/condition_variable
-    std::condition_variable conn_notify_;
-    std::mutex conn_notify_mutex_;
+    std::mutex wait_mutex_;
+    std::deque<waiter_t*> waiters_;
+    std::atomic<int> waiting_count_;
 
     ConnPoolStat stat_;
     const uint32_t conn_trim_linger_;    // 连接闲置该时长之后会被自动删除
+    const uint32_t acquire_timeout_ms_;  // 获取连接最长等待时间，0表示一直等待
 
 private:
     void do_conn_linger_trim() {
 
-        struct timeval start_time {};
-        ::gettimeofday(&start_time, NULL);
-
-        std::lock_guard<std::mutex> lock(conn_notify_mutex_);
-
-        if (conns_idle_.empty()){
-            return;
-        }
-
         int count = 0;
         int trim_count = 0;
 
-        for (auto iter = conns_idle_.begin(); iter != conns_idle_.end(); ) {
+        for (size_t i=0; i<capacity_; ++i) {
 
-            ++ count;
+            int expect = kSlotIdle;
+            if (!slots_[i].state_.compare_exchange_strong(expect, kSlotBusy)) {
+                continue;
+            }
 
-            // gettimeofday的秒和time的秒是一样的
-            if ((*iter)->expire(conn_trim_linger_)) {
-                iter = conns_idle_.erase(iter);
+            ++ count;
+            if (slots_[i].conn_->expire(conn_trim_linger_)) {
+                slots_[i].conn_.reset();
                 ++ trim_count;
-            } else {
-                ++ iter;
             }
 
-            if ((count % 20) == 0) {  // 不能卡顿太长时间
-                struct timeval now;
-                ::gettimeofday(&now, NULL);
-                int64_t elapse_ms = ( 1000000 * ( now.tv_sec - start_time.tv_sec ) + now.tv_usec - start_time.tv_usec ) / 1000;
-                if (elapse_ms > 20) {
-                    log_notice("too long elapse time: %ld ms, break now", elapse_ms);
-                    break;
-                }
-            }
+            release_slot(static_cast<int>(i));
         }
 
         if (trim_count) {
@@ -334,17 +490,33 @@ private:
         module = "ConnPool";
         name = pool_name_;
 
+        size_t busy = 0;
+        size_t idle = 0;
+        for (size_t i=0; i<capacity_; ++i) {
+            int state = slots_[i].state_;
+            if (state == kSlotBusy) {
+                ++ busy;
+            } else if (state == kSlotIdle) {
+                ++ idle;
+            }
+        }
+
         std::stringstream ss;
 
         ss << "\t" << "capacity: " << capacity_ << std::endl;
         ss << "\t" << "acquire_count: " << stat_.acquired_count_ << std::endl;
         ss << "\t" << "acquire_success:" << stat_.acquired_success_ << std::endl;
-
-        {
-            std::lock_guard<std::mutex> lock(conn_notify_mutex_);
-            ss << "\t" << "current_busy:" << conns_busy_.size() << std::endl;
-            ss << "\t" << "current_idle:" << conns_idle_.size() << std::endl;
-        }
+        ss << "\t" << "acquire_timeout:" << stat_.acquired_timeout_
+           << " (timeout " << acquire_timeout_ms_ << "ms)" << std::endl;
+        ss << "\t" << "acquire_waited:" << stat_.acquired_waited_
+           << ", handoff " << stat_.handoff_count_ << std::endl;
+        ss << "\t" << "affinity_hit:" << stat_.affinity_hit_ << std::endl;
+        ss << "\t" << "acquire_wait_us: " << stat_.wait_str() << std::endl;
+        ss << "\t" << "conn_created:" << stat_.conn_created_
+           << ", dropped " << stat_.conn_dropped_ << std::endl;
+        ss << "\t" << "current_busy:" << busy << std::endl;
+        ss << "\t" << "current_idle:" << idle << std::endl;
+        ss << "\t" << "current_waiting:" << waiting_count_ << std::endl;
 
         val = ss.str();
 
@@ -353,6 +525,12 @@ private:
 
 };
 
+template <typename T, typename Helper>
+thread_local const void* ConnPool<T, Helper>::hint_pool_ = NULL;
+
+template <typename T, typename Helper>
+thread_local size_t ConnPool<T, Helper>::hint_idx_ = 0;
+
 } // end namespace tzrpc
 
 #endif  // _CONNECT_POOL_H_
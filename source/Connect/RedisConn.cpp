@@ -6,6 +6,8 @@
  */
 
 
+#include <cstring>
+
 #include <boost/lexical_cast.hpp>
 
 #include <Connect/RedisConn.h>
@@ -315,6 +317,124 @@ redisReply_ptr RedisConn::Eval(const std::string& script,
 }
 
 
+redisReply_ptr RedisConn::EvalSha(const std::string& sha,
+                                  const std::vector<std::string>& keys,
+                                  const std::vector<std::string>& args, bool* noscript) {
+
+    redisReply_ptr reply {};
+    if (noscript) {
+        *noscript = false;
+    }
+
+    if(sha.empty() || !CHECK_N_RECONNECT()) {
+        return reply; // empty
+    }
+
+    std::vector<const char*> argvs;
+    argvs.reserve(1 + 1 + 1 + keys.size() + args.size());
+    argvs.push_back("EVALSHA");
+    argvs.push_back(sha.c_str());
+    std::string str_keysnum = local_convert_to_string(keys.size());
+    argvs.push_back(str_keysnum.c_str());
+
+    for(size_t index = 0; index < keys.size(); index ++) {
+        argvs.push_back(keys[index].c_str());
+    }
+
+    for(size_t index = 0; index < args.size(); index ++) {
+        argvs.push_back(args[index].c_str());
+    }
+
+    reply.reset( (redisReply*)redisCommandArgv(context_.get(), static_cast<int>(argvs.size()), &argvs[0], NULL), freeReplyObject);
+    if (!reply) {
+        if (context_ && context_->err) {
+            log_err("evalsha failed supply context_ info: %s", context_->errstr);
+        } else {
+            log_err("evalsha failed with empty reply.");
+        }
+        return reply;
+    }
+
+    // 服务端重启或者 SCRIPT FLUSH 之后脚本会丢失，调用者需要回退到 EVAL
+    if(reply->type == REDIS_REPLY_ERROR ) {
+        log_notice("evalsha %s failed with error: %s", sha.c_str(), reply->str ? reply->str : "");
+        if (noscript && reply->str && ::strncmp(reply->str, "NOSCRIPT", 8) == 0) {
+            *noscript = true;
+        }
+        reply.reset();
+    }
+
+    return reply;
+}
+
+
+bool RedisConn::Pipeline(const std::vector<std::vector<std::string>>& cmds,
+                         std::vector<redisReply_ptr>& replies) {
+
+    replies.clear();
+    if (cmds.empty()) {
+        return true;
+    }
+
+    if(!CHECK_N_RECONNECT())
+        return false;
+
+    // 只是追加到输出缓冲区，并不会有网络操作
+    std::vector<const char*> argv;
+    std::vector<size_t> argvlen;
+    for (size_t i = 0; i < cmds.size(); ++i) {
+
+        argv.clear();
+        argvlen.clear();
+        for (auto it = cmds[i].begin(); it != cmds[i].end(); ++it) {
+            argv.push_back(it->c_str());
+            argvlen.push_back(it->size());
+        }
+
+        if (argv.empty() ||
+            redisAppendCommandArgv(context_.get(), static_cast<int>(argv.size()), &argv[0], &argvlen[0]) != REDIS_OK) {
+            log_err("pipeline append command %lu failed.", i);
+
+            // 已经追加的命令无法撤回，连接状态已经不确定，直接废弃该连接
+            context_.reset();
+            return false;
+        }
+    }
+
+    // 第一次 redisGetReply 会把缓冲区的命令全部发送出去
+    bool all_ok = true;
+    replies.reserve(cmds.size());
+    for (size_t i = 0; i < cmds.size(); ++i) {
+
+        void* r = NULL;
+        if (redisGetReply(context_.get(), &r) != REDIS_OK || !r) {
+            if (context_ && context_->err) {
+                log_err("pipeline get reply %lu failed supply context_ info: %s", i, context_->errstr);
+            } else {
+                log_err("pipeline get reply %lu failed with empty reply.", i);
+            }
+
+            // 应答和命令已经对应不上了，连接不可再用
+            context_.reset();
+            replies.clear();
+            return false;
+        }
+
+        redisReply_ptr reply(static_cast<redisReply*>(r), freeReplyObject);
+        if (reply->type == REDIS_REPLY_ERROR) {
+            log_err("pipeline command %lu %s failed with error: %s",
+                    i, cmds[i][0].c_str(), reply->str ? reply->str : "");
+            reply.reset();
+            all_ok = false;
+        }
+
+        replies.push_back(reply);
+    }
+
+    return all_ok;
+}
+
+
 RedisConn::operator bool() {
     return !!context_;
 }
@@ -73,6 +73,14 @@ public:
 
     redisReply_ptr Eval(const std::string& script, const std::vector<std::string>& keys,
                         const std::vector<std::string>& args);
+    // 脚本不在服务端缓存的时候 noscript 置为 true，其他错误保持 false
+    redisReply_ptr EvalSha(const std::string& sha, const std::vector<std::string>& keys,
+                           const std::vector<std::string>& args, bool* noscript = NULL);
+
+    // 管道批量执行，所有命令一次发送之后再依次读取应答，减少网络往返
+    // replies 和 cmds 一一对应，错误应答的位置为空，全部成功才返回true
+    bool Pipeline(const std::vector<std::vector<std::string>>& cmds,
+                  std::vector<redisReply_ptr>& replies);
 
     operator bool();
 
@@ -8,13 +8,19 @@
 
 #include <sstream>
 
+#include <mysql_connection.h>
+
 #include <Connect/SqlConn.h>
 
 namespace tzrpc {
 
+// 单个连接最多缓存的预处理语句，服务端 max_prepared_stmt_count 是全局限制
+static const size_t kMaxPreparedStmts = 128;
+
 SqlConn::SqlConn(ConnPool<SqlConn, SqlConnPoolHelper>& pool, const SqlConnPoolHelper& helper):
     driver_(),
     stmt_(),
+    prepared_stmts_(),
     pool_(pool),
     helper_(helper) {
 }
@@ -69,8 +75,9 @@ bool SqlConn::init(int64_t conn_uuid) {
 SqlConn::~SqlConn() {
 
     /* reset to fore delete, actually not need */
-    conn_.reset();
+    prepared_stmts_.clear();
     stmt_.reset();
+    conn_.reset();
 
     log_info("Destroy Sql Connection OK!");
 }
@@ -168,5 +175,100 @@ int SqlConn::sqlconn_execute_update(const string& sql) {
 }
 
 
+bool SqlConn::sqlconn_escape_string(const string& str, string& escaped) {
+
+    try {
+
+        if(!conn_->isValid()) {
+            log_err("Invalid connect, do re-connect...");
+            conn_->reconnect();
+        }
+
+        // 多字节字符集下(比如GBK)手工转义可能被绕过，需要使用连接当前的字符集
+        sql::mysql::MySQL_Connection* mysql_conn = dynamic_cast<sql::mysql::MySQL_Connection*>(conn_.get());
+        if (!mysql_conn) {
+            log_err("not a mysql connection, can not escape string.");
+            return false;
+        }
+
+        escaped = mysql_conn->escapeString(str);
+        return true;
+
+    } catch (sql::SQLException &e) {
+
+        std::stringstream output;
+        output << "# ERR: " << e.what() << endl;
+        output << " (MySQL error code: " << e.getErrorCode() << endl;
+        output << ", SQLState: " << e.getSQLState() << " )" << endl;
+        log_err("%s", output.str().c_str());
+
+    }
+
+    return false;
+}
+
+
+sql::PreparedStatement* SqlConn::get_prepared_statement(const string& sql) {
+
+    if(!conn_->isValid()) {
+        log_err("Invalid connect, do re-connect...");
+        prepared_stmts_.clear();
+        conn_->reconnect();
+    }
+
+    auto iter = prepared_stmts_.find(sql);
+    if (iter != prepared_stmts_.end()) {
+        return iter->second.get();
+    }
+
+    if (prepared_stmts_.size() >= kMaxPreparedStmts) {
+        log_notice("prepared statements exceed %lu, clear all.", kMaxPreparedStmts);
+        prepared_stmts_.clear();
+    }
+
+    // 失败的时候抛出异常，由调用者处理
+    std::unique_ptr<sql::PreparedStatement> stmt(conn_->prepareStatement(sql));
+    sql::PreparedStatement* ptr = stmt.get();
+    prepared_stmts_[sql] = std::move(stmt);
+
+    return ptr;
+}
+
+int SqlConn::sqlconn_execute_prepared_update(const string& sql,
+                                             const std::function<void(sql::PreparedStatement&)>& binder) {
+
+    // 其他接口重连之后缓存的语句句柄会失效，这种情况重新prepare一次
+    for (int retry = 0; retry < 2; ++retry) {
+
+        try {
+
+            sql::PreparedStatement* stmt = get_prepared_statement(sql);
+            stmt->clearParameters();
+            binder(*stmt);
+            return stmt->executeUpdate();
+
+        } catch (sql::SQLException &e) {
+
+            // 表结构变化、表不存在等情况下语句需要重新prepare
+            prepared_stmts_.erase(sql);
+
+            std::stringstream output;
+            output << " STMT: " << sql << endl;
+            output << "# ERR: " << e.what() << endl;
+            output << " (MySQL error code: " << e.getErrorCode() << endl;
+            output << ", SQLState: " << e.getSQLState() << " )" << endl;
+            log_err("%s", output.str().c_str());
+
+            // ER_UNKNOWN_STMT_HANDLER, CR_SERVER_GONE_ERROR, CR_SERVER_LOST
+            int code = e.getErrorCode();
+            if (code != 1243 && code != 2006 && code != 2013) {
+                break;
+            }
+        }
+    }
+
+    return -1;
+}
+
 
 } // end namespace tzrpc
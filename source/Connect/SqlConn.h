@@ -10,6 +10,8 @@
 #define __CONNECT_SQL_CONN_H__
 
 #include <vector>
+#include <map>
+#include <functional>
 
 #if __cplusplus >= 201103L
 #include <type_traits>
@@ -22,6 +24,7 @@
 #include <cppconn/exception.h>
 #include <cppconn/resultset.h>
 #include <cppconn/statement.h>
+#include <cppconn/prepared_statement.h>
 
 #include <Connect/ConnPool.h>
 
@@ -185,6 +188,14 @@ public:
     sql::ResultSet* sqlconn_execute_query(const string& sql);
     int sqlconn_execute_update(const string& sql);
 
+    // 服务端预处理语句，按照sql文本缓存在连接上，只需要prepare一次
+    // binder 负责绑定参数，返回影响的行数，出错返回-1
+    int sqlconn_execute_prepared_update(const string& sql,
+                                        const std::function<void(sql::PreparedStatement&)>& binder);
+
+    // 按照连接的字符集转义拼接到sql文本中的字符串(mysql_real_escape_string)
+    bool sqlconn_escape_string(const string& str, string& escaped);
+
     // 常用操作
     template <typename T>
     bool sqlconn_execute_query_value(const string& sql, T& val);
@@ -203,6 +214,10 @@ private:
     std::unique_ptr<sql::Connection> conn_;
     std::unique_ptr<sql::Statement> stmt_;
 
+    // key: sql，重连之后预处理语句失效，需要清空
+    std::map<std::string, std::unique_ptr<sql::PreparedStatement>> prepared_stmts_;
+    sql::PreparedStatement* get_prepared_statement(const string& sql);
+
     // may be used in future
     ConnPool<SqlConn, SqlConnPoolHelper>& pool_;
     const SqlConnPoolHelper helper_;
@@ -9,8 +9,11 @@
 #define __CORE_BUFFER_H__
 
 #include <cstdint>
+#include <cstring>
 #include <string>
+#include <vector>
 #include <memory>
+#include <algorithm>
 
 #include <xtra_rhel.h>
 
@@ -18,27 +21,39 @@
 
 namespace tzrpc {
 
+// 连续的收发缓冲区
+//
+//     [0, read_idx_)           已经消费的数据
+//     [read_idx_, write_idx_)  有效数据
+//     [write_idx_, size)       可写空间
+//
+// consume 只移动读游标，没有数据的时候游标归零；写空间不够的时候，
+// 如果前面已经消费的空间足够并且需要移动的数据不多于已消费的数据，就把数据移动到开头，
+// 否则按倍数扩容，所以每个字节的平均拷贝开销是常数。
+// socket 可以通过 prepare/commit 直接读入可写空间，不再经过中间缓存。
+
 class Buffer {
 
 public:
     // 构造函数
 
     Buffer():
-        data_ ({}) {
+        data_ ({}),
+        read_idx_(0),
+        write_idx_(0) {
     }
 
     explicit Buffer(const std::string& data):
-        data_(data.begin(), data.end()) {
+        data_(data.begin(), data.end()),
+        read_idx_(0),
+        write_idx_(data.size()) {
     }
 
     explicit Buffer(const Message& msg):
-        data_({}) {
-        Header header = msg.header_;
-        header.to_net_endian();
-
-        std::string header_str(reinterpret_cast<char*>(&header), sizeof(Header));
-        append_internal(header_str);
-        append_internal(msg.payload_);
+        data_({}),
+        read_idx_(0),
+        write_idx_(0) {
+        append(msg);
     }
 
     ~Buffer() {}
@@ -49,51 +64,64 @@ public:
 
     // used internally, user should prefer Message
     uint32_t append_internal(const std::string& data) {
-        std::copy(data.begin(), data.end(), std::back_inserter(data_));
-        return static_cast<uint32_t>(data_.size());
+        return append_internal(data.c_str(), static_cast<uint32_t>(data.size()));
     }
 
+    uint32_t append_internal(const char* data, uint32_t sz) {
+        if (sz > 0) {
+            ::memcpy(prepare(sz), data, sz);
+            commit(sz);
+        }
+        return get_length();
+    }
 
     uint32_t append(const Message& msg) {
         Header header = msg.header_;
         header.to_net_endian();
 
-        std::string header_str(reinterpret_cast<char*>(&header), sizeof(Header));
-        append_internal(header_str);
+        append_internal(reinterpret_cast<const char*>(&header), sizeof(Header));
         append_internal(msg.payload_);
-        return static_cast<uint32_t>(data_.size());
+        return get_length();
+    }
+
+    // 返回至少 sz 字节的可写空间，写入之后调用 commit 确认实际写入的长度
+    // 两次调用之间不能有其他的写入操作
+    char* prepare(uint32_t sz) {
+        ensure_writable(sz);
+        return data_.data() + write_idx_;
+    }
+
+    void commit(uint32_t sz) {
+        SAFE_ASSERT(write_idx_ + sz <= data_.size());
+        write_idx_ += std::min<size_t>(sz, data_.size() - write_idx_);
+    }
+
+    uint32_t writable() const {
+        return static_cast<uint32_t>(data_.size() - write_idx_);
     }
 
     // 从队列的开头取出若干个(最多sz)字符，返回实际得到的字符数
     bool consume(std::string& store, uint32_t sz) {
 
-        if (sz == 0 || data_.empty()) {
+        if (sz == 0 || get_length() == 0) {
             return false;
         }
 
-        // 全部取走
-        if (sz >= data_.size()) {
-            store = std::string(data_.begin(), data_.end());
-            data_.clear();
-            return true;
-        }
-
-        // 部分数据
-        std::vector<char> remain(data_.begin() + sz, data_.end());    // 剩余的数据
-        store = std::string(data_.begin(), data_.begin() + sz);    // 要取的数据
-
-        data_.swap(remain);
+        uint32_t len = std::min(sz, get_length());
+        store.assign(data_.data() + read_idx_, len);
+        front_erase(len);
         return true;
     }
 
-    // 调用者需要保证至少能够容纳 sz 数据，拷贝的同时原始数据不会改动
+    // 调用者需要保证至少能够容纳 sz 数据
     bool consume(char* store, uint32_t sz) {
 
-        if (!store || sz == 0 || data_.empty()) {
+        if (!store || sz == 0 || get_length() == 0) {
             return false;
         }
 
-        ::memcpy(store, data_.data(), sz );
+        uint32_t len = std::min(sz, get_length());
+        ::memcpy(store, data_.data() + read_idx_, len);
 
         // 之前的设计思路:
         // 先将send_bound_中的数据拷贝到io_block_中进行发送，然后根据传输的结果
@@ -103,36 +131,71 @@ public:
         // 实际上再boost::asio中是通过transfer_exactly发送的，如果返回时没有发送
         // 这么多数据，那么应该是网络层出现问题了，此时就直接socket错误返回了，不再
         // 考虑发送量小于请求量这种部分发送的情形了。
-        front_erase(sz);
+        front_erase(len);
         return true;
     }
 
     void front_erase(uint32_t sz) {
 
-        if (sz >= data_.size()) {
-            data_.clear();
+        if (sz >= get_length()) {
+            read_idx_ = write_idx_ = 0;
+
+            // 大消息之后不长期占用内存
+            if (data_.size() > kBufferShrinkSize) {
+                std::vector<char>().swap(data_);
+            }
             return;
         }
 
-        std::vector<char> remain(data_.begin() + sz, data_.end());    // 剩余的数据
-        data_.swap(remain);
+        read_idx_ += sz;
     }
 
     // 访问成员数据
     char* get_data() {
-        if (data_.empty()) {
+        if (get_length() == 0) {
             return static_cast<char *>(nullptr);
         }
-        return static_cast<char *>(data_.data());
+        return static_cast<char *>(data_.data() + read_idx_);
     }
 
-    uint32_t get_length() {
-        return static_cast<uint32_t>(data_.size());
+    uint32_t get_length() const {
+        return static_cast<uint32_t>(write_idx_ - read_idx_);
     }
 
 private:
 
+    const static size_t kBufferShrinkSize = 256 * 1024;
+
+    void ensure_writable(uint32_t sz) {
+
+        if (data_.size() - write_idx_ >= sz) {
+            return;
+        }
+
+        size_t len = write_idx_ - read_idx_;
+
+        // 移动的数据不多于已经消费的数据，移动的开销可以均摊
+        if (data_.size() - len >= sz && read_idx_ >= len) {
+            ::memmove(data_.data(), data_.data() + read_idx_, len);
+            read_idx_  = 0;
+            write_idx_ = len;
+            return;
+        }
+
+        size_t capacity = std::max(data_.size() * 2, len + sz);
+        std::vector<char> data(capacity);
+        if (len > 0) {
+            ::memcpy(data.data(), data_.data() + read_idx_, len);
+        }
+
+        data_.swap(data);
+        read_idx_  = 0;
+        write_idx_ = len;
+    }
+
     std::vector<char> data_;
+    size_t read_idx_;
+    size_t write_idx_;
 };
 
 } // end namespace tzrpc
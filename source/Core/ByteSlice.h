@@ -0,0 +1,95 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __CORE_BYTE_SLICE_H__
+#define __CORE_BYTE_SLICE_H__
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <memory>
+#include <algorithm>
+
+namespace tzrpc {
+
+// 引用计数的只读字节片段
+//
+// 一个请求体从接收缓冲区取出一次之后，后续的头部解析、RPC分发、反序列化
+// 都只在同一块内存上移动 offset/length，不再拷贝数据。
+// 所有的片段共享底层的存储，最后一个片段释放的时候内存才被释放。
+
+class ByteSlice {
+
+public:
+    ByteSlice():
+        store_(),
+        offset_(0),
+        length_(0) {
+    }
+
+    explicit ByteSlice(std::shared_ptr<const std::string> store):
+        store_(store),
+        offset_(0),
+        length_(store ? store->size() : 0) {
+    }
+
+    // 接管 data 的内容，不拷贝数据
+    static ByteSlice take(std::string& data) {
+        auto store = std::make_shared<std::string>();
+        store->swap(data);
+        return ByteSlice(store);
+    }
+
+    const char* data() const {
+        return store_ ? store_->data() + offset_ : nullptr;
+    }
+
+    size_t size() const {
+        return length_;
+    }
+
+    bool empty() const {
+        return length_ == 0;
+    }
+
+    // 截取 [off, off + len) 的子片段，超出范围的部分被截断
+    ByteSlice sub(size_t off, size_t len = std::string::npos) const {
+        ByteSlice slice;
+        off = std::min(off, length_);
+        slice.store_  = store_;
+        slice.offset_ = offset_ + off;
+        slice.length_ = std::min(len, length_ - off);
+        return slice;
+    }
+
+    // 调用者需要保证至少能够容纳 sz 数据
+    bool copy_to(char* store, size_t sz) const {
+        if (!store || sz > length_) {
+            return false;
+        }
+
+        ::memcpy(store, data(), sz);
+        return true;
+    }
+
+    // 需要 std::string 的场合才会产生拷贝
+    std::string str() const {
+        if (length_ == 0) {
+            return std::string();
+        }
+        return std::string(data(), length_);
+    }
+
+private:
+    std::shared_ptr<const std::string> store_;
+    size_t offset_;
+    size_t length_;
+};
+
+} // end namespace tzrpc
+
+#endif // __CORE_BYTE_SLICE_H__
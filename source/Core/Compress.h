@@ -0,0 +1,77 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __CORE_COMPRESS_H__
+#define __CORE_COMPRESS_H__
+
+#include <snappy.h>
+
+#include <cstdint>
+#include <string>
+
+// 网络消息的压缩
+//
+// 压缩算法记录在 Header::rev1 中，对整个消息体(RPC头部和负载)压缩；
+// 双方通过 ping 交换各自支持的算法掩码，协商之后发送方只对超过阈值的消息压缩，
+// 接收方根据每个消息的标志解压，所以不压缩的消息和旧版本的对端都可以正常处理。
+// 接收方只接受本连接上协商过的算法，解压之后的长度总是受 kUncompressMaxSize 限制。
+
+namespace tzrpc {
+
+const static uint32_t kCompressNone     = 0x00;
+const static uint32_t kCompressSnappy   = 0x01;
+
+// 本端支持的算法掩码
+const static uint32_t kCompressSupported = kCompressSnappy;
+
+// 解压之后长度的硬性上限，很小的压缩数据可以声明很大的解压长度
+const static size_t kUncompressMaxSize = 64 * 1024 * 1024;
+
+// 从对方提供的算法掩码中选择一个本端支持的算法
+static inline uint32_t compress_select(uint32_t offered) {
+
+    if (offered & kCompressSnappy) {
+        return kCompressSnappy;
+    }
+
+    return kCompressNone;
+}
+
+static inline bool compress_message(uint32_t codec, const char* data, size_t len, std::string& out) {
+
+    if (codec == kCompressSnappy) {
+        snappy::Compress(data, len, &out);
+        return true;
+    }
+
+    return false;
+}
+
+// max_len 限制解压之后的长度，为0或者超过 kUncompressMaxSize 的时候使用 kUncompressMaxSize
+static inline bool uncompress_message(uint32_t codec, const char* data, size_t len,
+                                      size_t max_len, std::string& out) {
+
+    if (max_len == 0 || max_len > kUncompressMaxSize) {
+        max_len = kUncompressMaxSize;
+    }
+
+    if (codec == kCompressSnappy) {
+
+        size_t result_len = 0;
+        if (!snappy::GetUncompressedLength(data, len, &result_len) || result_len > max_len) {
+            return false;
+        }
+
+        return snappy::Uncompress(data, len, &out);
+    }
+
+    return false;
+}
+
+} // end namespace tzrpc
+
+#endif // __CORE_COMPRESS_H__
@@ -27,13 +27,13 @@ struct Header {
     uint16_t version;       // "1"
     uint32_t length;        // playload length ( NOT include header)
 
-    uint32_t rev1;          // 当前保留空间，后续升级使用
-    uint32_t rev2;
+    uint32_t rev1;          // 消息体使用的压缩算法 kCompressXXX，0表示没有压缩
+    uint32_t rev2;          // 当前保留空间，后续升级使用
 
     std::string dump() const {
         char msg[64] {};
-        snprintf(msg, sizeof(msg), "mgc:%0x, ver:%0x, len:%u",
-                 magic, version, length);
+        snprintf(msg, sizeof(msg), "mgc:%0x, ver:%0x, len:%u, cmp:%0x",
+                 magic, version, length, rev1);
         return msg;
     }
 
@@ -42,12 +42,14 @@ struct Header {
         magic   = be16toh(magic);
         version = be16toh(version);
         length  = be32toh(length);
+        rev1    = be32toh(rev1);
     }
 
     void to_net_endian() {
         magic   = htobe16(magic);
         version = htobe16(version);
         length  = htobe32(length);
+        rev1    = htobe32(rev1);
     }
 
 } __attribute__ ((__packed__));
@@ -0,0 +1,270 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __CORE_OBJECT_POOL_H__
+#define __CORE_OBJECT_POOL_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+
+namespace tzrpc {
+
+// 请求处理路径上的对象池
+//
+// 每个线程有一个本地缓存，分配和归还都不需要加锁；
+// 对象通常在IO线程创建、在Executor线程释放，所以本地缓存满了之后成批归还到全局仓库，
+// 本地缓存空了之后再成批从全局仓库领取，锁的开销被均摊到一批对象上。
+//
+//   FreeList<Policy>   空闲指针的管理，Policy::destroy 负责真正释放超出容量的对象，
+//                      Policy::size 返回对象占用的内存，本地缓存和仓库同时按照个数和字节数限制
+//   PoolAllocator<T>   单个对象的内存块复用，用于 allocate_shared 和 shared_ptr 的控制块
+//   ObjectPool<T>      构造好的对象复用，保留 std::string 等对象内部已经分配的空间
+
+template <typename Policy>
+class FreeList {
+
+public:
+    static void* get() {
+
+        local_t& local = local_cache();
+        if (local.items_.empty()) {
+            depot_t& depot = depot_instance();
+            std::lock_guard<std::mutex> lock(depot.lock_);
+            size_t count = depot.items_.size();
+            if (count > kBatchSize) {
+                count = kBatchSize;
+            }
+            for (size_t i = depot.items_.size() - count; i < depot.items_.size(); ++i) {
+                size_t bytes = Policy::size(depot.items_[i]);
+                depot.bytes_ -= bytes;
+                local.bytes_ += bytes;
+            }
+            local.items_.insert(local.items_.end(), depot.items_.end() - count, depot.items_.end());
+            depot.items_.resize(depot.items_.size() - count);
+        }
+
+        if (local.items_.empty()) {
+            return nullptr;
+        }
+
+        void* ptr = local.items_.back();
+        local.items_.pop_back();
+        local.bytes_ -= Policy::size(ptr);
+        return ptr;
+    }
+
+    static void put(void* ptr) {
+
+        local_t& local = local_cache();
+        size_t bytes = Policy::size(ptr);
+        while (!local.items_.empty() &&
+               (local.items_.size() >= kLocalSize || local.bytes_ + bytes > kLocalBytes)) {
+            flush(local, kBatchSize);
+        }
+
+        local.items_.push_back(ptr);
+        local.bytes_ += bytes;
+    }
+
+    // 仓库中缓存的对象占用的内存
+    static size_t depot_bytes() {
+        depot_t& depot = depot_instance();
+        std::lock_guard<std::mutex> lock(depot.lock_);
+        return depot.bytes_;
+    }
+
+private:
+
+    const static size_t kLocalSize = 256;
+    const static size_t kBatchSize = 64;
+    const static size_t kDepotSize = 16 * 1024;
+
+    // 对象可能持有很大的缓冲区，只按照个数限制的话池子会长期占用大量内存
+    const static size_t kLocalBytes = 4 * 1024 * 1024;
+    const static size_t kDepotBytes = 64 * 1024 * 1024;
+
+    // 线程退出的时候本地缓存全部归还到仓库
+    struct local_t {
+        local_t(): items_(), bytes_(0) { items_.reserve(kLocalSize); }
+        ~local_t() { flush(*this, items_.size()); }
+        std::vector<void*> items_;
+        size_t bytes_;
+    };
+
+    struct depot_t {
+        depot_t(): lock_(), items_(), bytes_(0) { items_.reserve(kDepotSize); }
+        std::mutex lock_;
+        std::vector<void*> items_;
+        size_t bytes_;
+    };
+
+    static local_t& local_cache() {
+        static thread_local local_t local;
+        return local;
+    }
+
+    static depot_t& depot_instance() {
+        static depot_t depot;
+        return depot;
+    }
+
+    // 把本地缓存末尾的 count 个对象归还到仓库，仓库满了就直接释放
+    static void flush(local_t& local, size_t count) {
+
+        std::vector<void*>& items = local.items_;
+        count = std::min(count, items.size());
+        std::vector<void*>::iterator first = items.end() - count;
+
+        {
+            depot_t& depot = depot_instance();
+            std::lock_guard<std::mutex> lock(depot.lock_);
+            while (first != items.end() && depot.items_.size() < kDepotSize) {
+                size_t bytes = Policy::size(*first);
+                if (depot.bytes_ + bytes > kDepotBytes) {
+                    break;
+                }
+                depot.items_.push_back(*first++);
+                depot.bytes_ += bytes;
+                local.bytes_ -= bytes;
+            }
+        }
+
+        for (std::vector<void*>::iterator iter = first; iter != items.end(); ++iter) {
+            local.bytes_ -= Policy::size(*iter);
+            Policy::destroy(*iter);
+        }
+
+        items.resize(items.size() - count);
+    }
+};
+
+
+// 相同大小的内存块共用一个空闲链表
+template <size_t BlockSize>
+struct BlockPolicy {
+    static void destroy(void* ptr) {
+        ::operator delete(ptr);
+    }
+    static size_t size(void*) {
+        return BlockSize;
+    }
+};
+
+template <typename T>
+class PoolAllocator {
+
+public:
+    typedef T           value_type;
+    typedef T*          pointer;
+    typedef const T*    const_pointer;
+    typedef T&          reference;
+    typedef const T&    const_reference;
+    typedef size_t      size_type;
+    typedef ptrdiff_t   difference_type;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U> other;
+    };
+
+    PoolAllocator() {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        if (n == 1) {
+            void* ptr = FreeList<BlockPolicy<sizeof(T)>>::get();
+            if (ptr) {
+                return static_cast<T*>(ptr);
+            }
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) {
+        if (n == 1) {
+            FreeList<BlockPolicy<sizeof(T)>>::put(ptr);
+            return;
+        }
+        ::operator delete(ptr);
+    }
+};
+
+template <typename T, typename U>
+inline bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) {
+    return true;
+}
+
+template <typename T, typename U>
+inline bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) {
+    return false;
+}
+
+
+// 对象归还到池中之前的清理，返回 false 表示对象不再复用直接释放
+// heap_size 返回对象内部额外持有的内存，用于池子的容量统计
+template <typename T>
+struct PoolTraits {
+    static bool reset(T&) {
+        return true;
+    }
+    static size_t heap_size(const T&) {
+        return 0;
+    }
+};
+
+// 大消息的缓冲区不长期占用内存
+template <>
+struct PoolTraits<std::string> {
+    static bool reset(std::string& obj) {
+        obj.clear();
+        return obj.capacity() <= 64 * 1024;
+    }
+    static size_t heap_size(const std::string& obj) {
+        return obj.capacity();
+    }
+};
+
+template <typename T>
+class ObjectPool {
+
+public:
+    // 返回的对象可能是复用的，其内容已经被 PoolTraits<T>::reset 清理过
+    static std::shared_ptr<T> acquire() {
+        T* ptr = static_cast<T*>(FreeList<ObjectPool<T>>::get());
+        if (!ptr) {
+            ptr = new T();
+        }
+        return std::shared_ptr<T>(ptr, &ObjectPool<T>::recycle, PoolAllocator<T>());
+    }
+
+    static void destroy(void* ptr) {
+        delete static_cast<T*>(ptr);
+    }
+
+    static size_t size(void* ptr) {
+        return sizeof(T) + PoolTraits<T>::heap_size(*static_cast<T*>(ptr));
+    }
+
+private:
+    static void recycle(T* ptr) {
+        if (!PoolTraits<T>::reset(*ptr)) {
+            delete ptr;
+            return;
+        }
+        FreeList<ObjectPool<T>>::put(ptr);
+    }
+};
+
+} // end namespace tzrpc
+
+#endif // __CORE_OBJECT_POOL_H__
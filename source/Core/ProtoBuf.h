@@ -117,6 +117,18 @@ public:
         return true;
     }
 
+    // 直接从连续内存反序列化，请求体不需要先拷贝成 std::string
+    static bool unmarshalling_from_array(const char* data, size_t len, google::protobuf::Message* protoBuf) {
+
+        google::protobuf::LogSilencer _;
+
+        if (!protoBuf->ParseFromArray(data, static_cast<int>(len))) {
+            return false;
+        }
+
+        return true;
+    }
+
     static bool marshalling_to_string(const google::protobuf::Message& from, std::string* str ) {
 
         google::protobuf::LogSilencer _;
@@ -13,9 +13,28 @@
 #include <Core/Message.h>
 
 #include <boost/asio.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
 
 namespace tzrpc {
 
+// 连接使用协议无关的流式套接字，同样的消息格式可以承载在 TCP 和 AF_UNIX 上
+typedef boost::asio::generic::stream_protocol::socket   ConnSocket;
+typedef std::shared_ptr<ConnSocket>                      ConnSocketPtr;
+
+// "unix:///path/to/sock" 形式的地址表示本机的 AF_UNIX 流式套接字
+const static char kUnixAddrPrefix[] = "unix://";
+
+static inline bool parse_unix_addr(const std::string& addr, std::string& path) {
+
+    const size_t prefix_len = sizeof(kUnixAddrPrefix) - 1;
+    if (addr.compare(0, prefix_len, kUnixAddrPrefix) != 0) {
+        return false;
+    }
+
+    path = addr.substr(prefix_len);
+    return !path.empty();
+}
+
 enum class ConnStat : uint8_t {
     kWorking = 1,
     kPending,
@@ -34,7 +53,7 @@ class NetConn {
 public:
 
     /// Construct a connection with the given socket.
-    explicit NetConn(std::shared_ptr<boost::asio::ip::tcp::socket> sock) :
+    explicit NetConn(ConnSocketPtr sock) :
         conn_stat_(ConnStat::kPending),
         socket_(sock) {
         // 默认是阻塞类型的socket，异步调用的时候自行设置
@@ -69,6 +88,11 @@ public:
 
         boost::system::error_code ignore_ec;
 
+        // AF_UNIX 套接字没有这个选项
+        if (is_local_socket()) {
+            return false;
+        }
+
         boost::asio::ip::tcp::no_delay nodelay(set_value);
         socket_->set_option(nodelay, ignore_ec);
         boost::asio::ip::tcp::no_delay option;
@@ -89,6 +113,11 @@ public:
         return (option.value() == set_value);
     }
 
+    bool is_local_socket() {
+        boost::system::error_code ignore_ec;
+        return socket_->local_endpoint(ignore_ec).protocol().family() == AF_UNIX;
+    }
+
     void sock_shutdown_and_close(enum ShutdownType s) {
 
         std::lock_guard<std::mutex> lock(conn_mutex_);
@@ -138,13 +167,17 @@ private:
     enum ConnStat conn_stat_;
 
 protected:
-    std::shared_ptr<boost::asio::ip::tcp::socket> socket_;
+    ConnSocketPtr socket_;
 };
 
 
 
 const static uint32_t kFixedIoBufferSize = 2048;
 
+// 读消息体的时候单次预留的最大空间，头部中的长度来自对端，不能据此一次性分配，
+// 缓冲区随着实际到达的数据增长
+const static uint32_t kMaxIoPrepareSize = 256 * 1024;
+
 struct IOBound {
     IOBound() :
         io_block_({ }),
@@ -152,7 +185,7 @@ struct IOBound {
         buffer_() {
     }
 
-    char io_block_[kFixedIoBufferSize];    // 读写操作的固定缓存
+    char io_block_[kFixedIoBufferSize];    // 写操作的固定缓存，读操作直接读入 buffer_
     Header header_;                 // 如果 > sizeof(Header), head转换成host order
     Buffer buffer_;                 // 已经传输字节
 };
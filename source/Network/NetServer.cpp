@@ -7,6 +7,18 @@
 
 #include <xtra_rhel.h>
 
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <thread>
+
 #include <Network/NetServer.h>
 #include <Network/TcpConnAsync.h>
 
@@ -32,6 +44,21 @@ bool NetConf::load_conf(const libconfig::Config& conf) {
         return false;
     }
 
+    conf.lookupValue("rpc.network.bind_unix_path", bind_unix_path_);
+
+    // 八进制的字符串，例如 "0660"
+    std::string unix_mode;
+    conf.lookupValue("rpc.network.bind_unix_mode", unix_mode);
+    if (!unix_mode.empty()) {
+        char* end = NULL;
+        long mode = ::strtol(unix_mode.c_str(), &end, 8);
+        if (*end != '\0' || mode <= 0 || mode > 0777) {
+            log_err("invalid rpc.network.bind_unix_mode %s", unix_mode.c_str());
+            return false;
+        }
+        bind_unix_mode_ = static_cast<int32_t>(mode);
+    }
+
     std::string ip_list;
     conf.lookupValue("rpc.network.safe_ip", ip_list);
     if (!ip_list.empty()) {
@@ -66,6 +93,14 @@ bool NetConf::load_conf(const libconfig::Config& conf) {
         return false;
     }
 
+    conf.lookupValue("rpc.network.io_service_per_thread", io_service_per_thread_);
+    conf.lookupValue("rpc.network.reuse_port", reuse_port_);
+    conf.lookupValue("rpc.network.cpu_affinity", cpu_affinity_);
+    if (io_service_per_thread_ && io_thread_number_ <= 0) {
+        log_err( "io_service_per_thread require io_thread_pool_size > 0, but get %d", io_thread_number_);
+        return false;
+    }
+
     conf.lookupValue("rpc.network.ops_cancel_time_out", ops_cancel_time_out_);
     if (ops_cancel_time_out_ < 0){
         log_err("invalid rpc.network.ops_cancel_time_out %d.", ops_cancel_time_out_);
@@ -103,6 +138,18 @@ bool NetConf::load_conf(const libconfig::Config& conf) {
         return false;
     }
 
+    conf.lookupValue("rpc.network.compress_threshold", compress_threshold_);
+    if (compress_threshold_ < 0) {
+        log_err("invalid rpc.network.compress_threshold %d.", compress_threshold_);
+        return false;
+    }
+
+    conf.lookupValue("rpc.network.send_pending_budget", send_pending_budget_);
+    if (send_pending_budget_ < 0) {
+        log_err("invalid rpc.network.send_pending_budget %d.", send_pending_budget_);
+        return false;
+    }
+
     log_debug("NetConf parse conf OK!");
     return true;
 }
@@ -161,6 +208,26 @@ bool NetServer::init() {
               conf_.service_enabled_ ? "true" : "false",
               conf_.service_speed_);
 
+    // 独立io_service模式下每个IO线程一个io_service，io_service_ 作为第0个
+    if (conf_.io_service_per_thread_) {
+        for (int i=1; i<conf_.io_thread_number_; ++i) {
+            io_service_extra_.emplace_back(new boost::asio::io_service());
+        }
+
+        for (size_t i=0; i<io_service_count(); ++i) {
+            io_service_work_.emplace_back(new boost::asio::io_service::work(io_service_at(i)));
+        }
+    }
+
+    for (size_t i=0; i<io_service_count(); ++i) {
+        wheels_.emplace_back(new TimingWheel<TcpConnAsync>(::time(NULL)));
+        wheel_timers_.emplace_back(new steady_timer(io_service_at(i)));
+    }
+
+    log_alert("io_thread_number %d, io_service_count %d, reuse_port: %s, cpu_affinity: %s",
+              conf_.io_thread_number_, static_cast<int>(io_service_count()),
+              conf_.reuse_port_ ? "true" : "false", conf_.cpu_affinity_ ? "true" : "false");
+
     if (!io_service_threads_.init_threads(
         std::bind(&NetServer::io_service_run, this, std::placeholders::_1),
         conf_.io_thread_number_)) {
@@ -183,17 +250,184 @@ bool NetServer::init() {
     return true;
 }
 
+void NetServer::service() {
+
+    // 线程池开始工作
+    io_service_threads_.start_threads();
+
+    for (size_t i=0; i<wheel_timers_.size(); ++i) {
+        wheel_timers_[i]->expires_from_now(seconds(1));
+        wheel_timers_[i]->async_wait(
+                std::bind(&NetServer::wheel_tick_handler, this, std::placeholders::_1, i));
+    }
+
+    // SO_REUSEPORT 只在独立io_service模式下有意义，每个io_service侦听同一个端口
+    size_t acceptor_count = (conf_.io_service_per_thread_ && conf_.reuse_port_) ? io_service_count() : 1;
+
+    for (size_t i=0; i<acceptor_count; ++i) {
+
+        std::unique_ptr<boost::asio::ip::tcp::acceptor> acceptor(
+                new boost::asio::ip::tcp::acceptor(io_service_at(i)));
+        acceptor->open(ep_.protocol());
+
+        acceptor->set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+        if (acceptor_count > 1) {
+            typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+            acceptor->set_option(reuse_port(true));
+        }
+
+        acceptor->bind(ep_);
+        acceptor->listen(boost::asio::socket_base::max_connections);
+
+        acceptors_.emplace_back(std::move(acceptor));
+        do_accept(i);
+    }
+
+    // 本机侦听失败不影响TCP服务
+    if (!conf_.bind_unix_path_.empty() && !start_local_acceptor()) {
+        log_err("local listen on %s disabled.", conf_.bind_unix_path_.c_str());
+    }
+}
+
+// 之前的进程遗留的套接字文件会导致 bind 失败，只有确认没有进程在侦听的套接字才删除
+static bool remove_stale_socket(const std::string& path) {
+
+    struct stat st {};
+    if (::lstat(path.c_str(), &st) != 0) {
+        return errno == ENOENT;
+    }
+
+    if (!S_ISSOCK(st.st_mode)) {
+        log_err("%s exists and is not a socket.", path.c_str());
+        return false;
+    }
+
+    struct sockaddr_un addr {};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        log_err("unix socket path too long: %s", path.c_str());
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    ::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_err("create probe socket failed: %s", strerror(errno));
+        return false;
+    }
+
+    int ret = ::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    int err = errno;
+    ::close(fd);
+
+    if (ret == 0) {
+        log_err("%s is in use by another running instance.", path.c_str());
+        return false;
+    }
+
+    if (err != ECONNREFUSED) {
+        log_err("probe %s failed: %s", path.c_str(), strerror(err));
+        return false;
+    }
+
+    log_notice("remove stale unix socket %s", path.c_str());
+    return ::unlink(path.c_str()) == 0 || errno == ENOENT;
+}
+
+bool NetServer::start_local_acceptor() {
+
+    const std::string& path = conf_.bind_unix_path_;
+    if (!remove_stale_socket(path)) {
+        return false;
+    }
+
+    boost::system::error_code ec;
+    boost::asio::local::stream_protocol::endpoint local_ep(path);
+    std::unique_ptr<boost::asio::local::stream_protocol::acceptor> acceptor(
+            new boost::asio::local::stream_protocol::acceptor(io_service_));
+
+    acceptor->open(local_ep.protocol(), ec);
+    if (ec) {
+        log_err("open local acceptor failed: %s", ec.message().c_str());
+        return false;
+    }
+
+    acceptor->bind(local_ep, ec);
+    if (ec) {
+        log_err("bind local acceptor %s failed: %s", path.c_str(), ec.message().c_str());
+        return false;
+    }
+
+    // 记录自己创建的文件，不依赖进程的 umask 设置权限
+    struct stat st {};
+    if (::lstat(path.c_str(), &st) != 0 ||
+        ::chmod(path.c_str(), conf_.bind_unix_mode_) != 0) {
+        log_err("stat or chmod %s to %o failed: %s", path.c_str(), conf_.bind_unix_mode_, strerror(errno));
+        ::unlink(path.c_str());
+        return false;
+    }
+
+    acceptor->listen(boost::asio::socket_base::max_connections, ec);
+    if (ec) {
+        log_err("listen local acceptor %s failed: %s", path.c_str(), ec.message().c_str());
+        ::unlink(path.c_str());
+        return false;
+    }
+
+    local_acceptor_.swap(acceptor);
+    local_dev_ = st.st_dev;
+    local_ino_ = st.st_ino;
+
+    log_alert("create local listen endpoint for %s, mode %o", path.c_str(), conf_.bind_unix_mode_);
+    do_local_accept();
+    return true;
+}
+
+void NetServer::stop_local_acceptor() {
+
+    if (!local_acceptor_) {
+        return;
+    }
+
+    boost::system::error_code ignore_ec;
+    local_acceptor_->close(ignore_ec);
+
+    // 滚动重启的时候新的实例可能已经重新创建了这个路径，只删除自己创建的文件
+    struct stat st {};
+    if (::lstat(conf_.bind_unix_path_.c_str(), &st) == 0 &&
+        st.st_dev == local_dev_ && st.st_ino == local_ino_) {
+        ::unlink(conf_.bind_unix_path_.c_str());
+    }
+}
+
 // accept stuffs
-void NetServer::do_accept() {
+void NetServer::do_accept(size_t idx) {
+
+    // 多个侦听的时候连接留在侦听所在的io_service，否则轮询分配
+    size_t loop = idx;
+    if (acceptors_.size() == 1) {
+        loop = next_io_service_++ % io_service_count();
+    }
 
-    SocketPtr sock_ptr(new boost::asio::ip::tcp::socket(io_service_));
-    acceptor_->async_accept(*sock_ptr,
+    SocketPtr sock_ptr(new ConnSocket(io_service_at(loop)));
+    acceptors_[idx]->async_accept(*sock_ptr,
                        std::bind(&NetServer::accept_handler, this,
-                                   std::placeholders::_1, sock_ptr));
+                                   std::placeholders::_1, sock_ptr, idx, loop));
 }
 
+// 本机的连接同样轮询分配到各个io_service
+void NetServer::do_local_accept() {
 
-void NetServer::accept_handler(const boost::system::error_code& ec, SocketPtr sock_ptr) {
+    size_t loop = next_io_service_++ % io_service_count();
+
+    SocketPtr sock_ptr(new ConnSocket(io_service_at(loop)));
+    local_acceptor_->async_accept(*sock_ptr,
+                       std::bind(&NetServer::accept_handler, this,
+                                   std::placeholders::_1, sock_ptr, kLocalAcceptor, loop));
+}
+
+
+void NetServer::accept_handler(const boost::system::error_code& ec, SocketPtr sock_ptr, size_t idx, size_t loop) {
 
     do {
 
@@ -203,22 +437,37 @@ void NetServer::accept_handler(const boost::system::error_code& ec, SocketPtr so
         }
 
         boost::system::error_code ignore_ec;
-        auto remote = sock_ptr->remote_endpoint(ignore_ec);
-        if (ignore_ec) {
-            log_err("get remote info failed:%d, %s", ignore_ec.value(), ignore_ec.message().c_str());
-            break;
-        }
 
-        std::string remote_ip = remote.address().to_string(ignore_ec);
-        log_debug("remote Client Info: %s:%d", remote_ip.c_str(), remote.port());
+        // 本机的 AF_UNIX 连接不检查 safe_ip，访问权限由套接字文件控制
+        if (idx != kLocalAcceptor) {
 
+            auto remote = sock_ptr->remote_endpoint(ignore_ec);
+            if (ignore_ec) {
+                log_err("get remote info failed:%d, %s", ignore_ec.value(), ignore_ec.message().c_str());
+                break;
+            }
 
-        if (!conf_.check_safe_ip(remote_ip)) {
-            log_err("check safe_ip failed for: %s", remote_ip.c_str());
+            boost::asio::ip::tcp::endpoint tcp_remote;
+            if (remote.size() > tcp_remote.capacity()) {
+                log_err("unexpected remote endpoint size: %lu", remote.size());
+                break;
+            }
+            ::memcpy(tcp_remote.data(), remote.data(), remote.size());
+            tcp_remote.resize(remote.size());
 
-            sock_ptr->shutdown(boost::asio::socket_base::shutdown_both, ignore_ec);
-            sock_ptr->close(ignore_ec);
-            break;
+            std::string remote_ip = tcp_remote.address().to_string(ignore_ec);
+            log_debug("remote Client Info: %s:%d", remote_ip.c_str(), tcp_remote.port());
+
+            if (!conf_.check_safe_ip(remote_ip)) {
+                log_err("check safe_ip failed for: %s", remote_ip.c_str());
+
+                sock_ptr->shutdown(boost::asio::socket_base::shutdown_both, ignore_ec);
+                sock_ptr->close(ignore_ec);
+                break;
+            }
+
+        } else {
+            log_debug("local Client connected on %s", conf_.bind_unix_path_.c_str());
         }
 
         if (!conf_.get_service_token()) {
@@ -239,18 +488,51 @@ void NetServer::accept_handler(const boost::system::error_code& ec, SocketPtr so
             break;
         }
 
-        TcpConnAsyncPtr new_conn = std::make_shared<TcpConnAsync>(sock_ptr, *this);
+        TcpConnAsyncPtr new_conn = std::make_shared<TcpConnAsync>(sock_ptr, *this, io_service_at(loop), *wheels_[loop]);
         new_conn->start();
 
     } while (0);
 
     // 再次启动接收异步请求
-    do_accept();
+    if (idx == kLocalAcceptor) {
+        do_local_accept();
+    } else {
+        do_accept(idx);
+    }
+}
+
+
+void NetServer::wheel_tick_handler(const boost::system::error_code& ec, size_t idx) {
+
+    if (ec) {
+        log_err("wheel timer error %d, %s", ec.value(), ec.message().c_str());
+        return;
+    }
+
+    wheels_[idx]->tick(::time(NULL));
+
+    wheel_timers_[idx]->expires_from_now(seconds(1));
+    wheel_timers_[idx]->async_wait(
+            std::bind(&NetServer::wheel_tick_handler, this, std::placeholders::_1, idx));
 }
 
 
 void NetServer::io_service_run(ThreadObjPtr ptr) {
 
+    // 独立io_service模式下每个线程领取一个固定的io_service
+    size_t loop = next_io_loop_++;
+    boost::asio::io_service& io_service = io_service_at(loop % io_service_count());
+
+    if (conf_.cpu_affinity_) {
+        unsigned cpu_count = std::max(std::thread::hardware_concurrency(), 1U);
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(loop % cpu_count, &cpu_set);
+        if (::pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
+            log_err("bind io_service thread %#lx to cpu %lu failed.", (long)pthread_self(), loop % cpu_count);
+        }
+    }
+
     while (true) {
 
         if (unlikely(ptr->status_ == ThreadStatus::kTerminating)) {
@@ -266,7 +548,7 @@ void NetServer::io_service_run(ThreadObjPtr ptr) {
 
         log_alert("io_service thread %#lx about to loop...", (long)pthread_self());
         boost::system::error_code ec;
-        io_service_.run(ec);
+        io_service.run(ec);
 
         if (ec){
             log_err("io_service stopped...");
@@ -291,8 +573,14 @@ int NetServer::module_status(std::string& module, std::string& name, std::string
 
     ss << "\t" << "instance_name: " << instance_name_ << std::endl;
     ss << "\t" << "service_addr: " << conf_.bind_addr_ << "@" << conf_.bind_port_ << std::endl;
+    ss << "\t" << "service_unix_path: " << conf_.bind_unix_path_ << std::endl;
     ss << "\t" << "backlog_size: " << conf_.backlog_size_ << std::endl;
     ss << "\t" << "io_thread_pool_size: " << conf_.io_thread_number_ << std::endl;
+    ss << "\t" << "io_service_per_thread: " << (conf_.io_service_per_thread_ ? "true" : "false")
+       << ", io_service_count: " << io_service_count()
+       << ", acceptor_count: " << acceptors_.size()
+       << ", reuse_port: " << (conf_.reuse_port_ ? "true" : "false")
+       << ", cpu_affinity: " << (conf_.cpu_affinity_ ? "true" : "false") << std::endl;
     ss << "\t" << "safe_ips: " ;
 
     {
@@ -311,6 +599,13 @@ int NetServer::module_status(std::string& module, std::string& name, std::string
     ss << "\t" << "service_concurrency: " << conf_.service_concurrency_ << std::endl;
     ss << "\t" << "session_cancel_time_out: " << conf_.session_cancel_time_out_ << std::endl;
     ss << "\t" << "ops_cancel_time_out: " << conf_.ops_cancel_time_out_ << std::endl;
+    ss << "\t" << "send_pending_budget: " << conf_.send_pending_budget_ << std::endl;
+
+    uint64_t expired = 0;
+    for (size_t i=0; i<wheels_.size(); ++i) {
+        expired += wheels_[i]->expired_count();
+    }
+    ss << "\t" << "deadline_expired: " << expired << std::endl;
 
     val = ss.str();
     return 0;
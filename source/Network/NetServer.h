@@ -8,12 +8,19 @@
 #ifndef __NETWORK_NET_SERVER_H__
 #define __NETWORK_NET_SERVER_H__
 
+#include <sys/types.h>
+
 #include <mutex>
+#include <atomic>
+#include <vector>
 #include <libconfig.h++>
 
 #include <Utils/Log.h>
 #include <Utils/ThreadPool.h>
 
+#include <Network/NetConn.h>
+#include <Network/TimingWheel.h>
+
 #include <boost/asio.hpp>
 #include <boost/asio/steady_timer.hpp>
 using boost::asio::steady_timer;
@@ -42,9 +49,20 @@ private:
     int32_t     send_max_msg_size_;         // 如果为0，则不限制
     int32_t     recv_max_msg_size_;         // 如果为0，则不限制
 
+    // 通过 ping 协商压缩之后，超过这个长度的响应消息才压缩，如果为0，则不压缩
+    int32_t     compress_threshold_;
+
+    // 每个连接发送队列中等待的字节数上限，流式响应超过之后等待写完再继续，如果为0，则不限制
+    int32_t     send_pending_budget_;
+
     std::string bind_addr_;
     int32_t     bind_port_;
 
+    // 同时侦听的 AF_UNIX 流式套接字路径，给同一台机器上的客户端使用，为空则不侦听
+    std::string bind_unix_path_;
+    // 套接字文件的访问权限，本机连接不检查 safe_ip，只依赖这个权限
+    int32_t     bind_unix_mode_;
+
     // 加载、更新配置的时候保护竞争状态
     // 这里保护主要是非atomic操作的string结构
     // 其他的数据结构都是4字节对其的，intel确保能够原子读取和更新
@@ -54,6 +72,13 @@ private:
     int32_t     backlog_size_;
     int32_t     io_thread_number_;
 
+    // 每个IO线程运行独立的io_service，连接固定在一个io_service上，不再需要strand
+    bool        io_service_per_thread_;
+    // 每个io_service一个SO_REUSEPORT侦听，由内核分配连接，否则轮询分配accept的连接
+    bool        reuse_port_;
+    // IO线程绑定到CPU
+    bool        cpu_affinity_;
+
     bool load_conf(std::shared_ptr<libconfig::Config> conf_ptr);
     bool load_conf(const libconfig::Config& conf);
 
@@ -108,19 +133,26 @@ private:
         ops_cancel_time_out_(0),
         send_max_msg_size_(0),
         recv_max_msg_size_(0),
+        compress_threshold_(0),
+        send_pending_budget_(4 * 1024 * 1024),
         bind_addr_(),
         bind_port_(0),
+        bind_unix_path_(),
+        bind_unix_mode_(0660),
         lock_(),
         safe_ip_(),
         backlog_size_(10),
-        io_thread_number_(1) {
+        io_thread_number_(1),
+        io_service_per_thread_(false),
+        reuse_port_(false),
+        cpu_affinity_(false) {
     }
 
 } __attribute__ ((aligned (4)));  // end class NetConf
 
 
 
-typedef std::shared_ptr<boost::asio::ip::tcp::socket>    SocketPtr;
+typedef ConnSocketPtr    SocketPtr;
 
 class NetServer {
 
@@ -132,7 +164,16 @@ public:
     explicit NetServer(const std::string& instance_name):
         instance_name_(instance_name),
         io_service_(),
-        acceptor_(),
+        io_service_extra_(),
+        io_service_work_(),
+        acceptors_(),
+        local_acceptor_(),
+        local_dev_(0),
+        local_ino_(0),
+        wheels_(),
+        wheel_timers_(),
+        next_io_service_(0),
+        next_io_loop_(0),
         conf_(),
         io_service_threads_() {
     }
@@ -143,21 +184,7 @@ public:
 
     bool init();
 
-    void service() {
-
-        // 线程池开始工作
-        io_service_threads_.start_threads();
-
-        acceptor_.reset( new boost::asio::ip::tcp::acceptor(io_service_) );
-        acceptor_->open(ep_.protocol());
-
-        acceptor_->set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-        acceptor_->bind(ep_);
-        acceptor_->listen(boost::asio::socket_base::max_connections);
-
-        do_accept();
-
-    }
+    void service();
 
 public:
 
@@ -176,11 +203,36 @@ public:
     int recv_max_msg_size() const {
         return conf_.recv_max_msg_size_;
     }
+
+    int compress_threshold() const {
+        return conf_.compress_threshold_;
+    }
+
+    int send_pending_budget() const {
+        return conf_.send_pending_budget_;
+    }
+
+    bool io_service_per_thread() const {
+        return conf_.io_service_per_thread_;
+    }
+
 private:
 
     // accept stuffs
-    void do_accept();
-    void accept_handler(const boost::system::error_code& ec, SocketPtr sock_ptr);
+    // idx 为 kLocalAcceptor 的是 AF_UNIX 的侦听
+    const static size_t kLocalAcceptor = static_cast<size_t>(-1);
+    void do_accept(size_t idx);
+    void do_local_accept();
+    void accept_handler(const boost::system::error_code& ec, SocketPtr sock_ptr, size_t idx, size_t loop);
+
+    size_t io_service_count() const {
+        return io_service_extra_.size() + 1;
+    }
+
+    // 第0个就是 io_service_，共享模式下只有这一个
+    boost::asio::io_service& io_service_at(size_t idx) {
+        return idx == 0 ? io_service_ : *io_service_extra_[idx - 1];
+    }
 
 private:
 
@@ -190,7 +242,28 @@ private:
     // 侦听地址信息
     boost::asio::io_service io_service_;
     boost::asio::ip::tcp::endpoint ep_;
-    std::unique_ptr<boost::asio::ip::tcp::acceptor> acceptor_;
+
+    // 独立io_service模式下额外的io_service，以及防止没有连接的时候退出 run 的 work
+    std::vector<std::unique_ptr<boost::asio::io_service>> io_service_extra_;
+    std::vector<std::unique_ptr<boost::asio::io_service::work>> io_service_work_;
+
+    // SO_REUSEPORT 模式下每个io_service一个，否则只有一个
+    std::vector<std::unique_ptr<boost::asio::ip::tcp::acceptor>> acceptors_;
+    std::unique_ptr<boost::asio::local::stream_protocol::acceptor> local_acceptor_;
+    // 自己创建的套接字文件，停止的时候只删除这个文件，不影响新实例重新创建的
+    dev_t local_dev_;
+    ino_t local_ino_;
+
+    bool start_local_acceptor();
+    void stop_local_acceptor();
+
+    // 每个io_service一个时间轮，检查该io_service上所有连接的读写和空闲超时
+    std::vector<std::unique_ptr<TimingWheel<TcpConnAsync>>> wheels_;
+    std::vector<std::unique_ptr<steady_timer>> wheel_timers_;
+    void wheel_tick_handler(const boost::system::error_code& ec, size_t idx);
+
+    std::atomic<uint32_t> next_io_service_;  // 轮询分配连接
+    std::atomic<uint32_t> next_io_loop_;     // IO线程领取自己的io_service
 
     NetConf conf_;
 
@@ -203,8 +276,13 @@ public:
 
         log_err("about to stop io_service... ");
 
-        io_service_.stop();
+        io_service_work_.clear();
+        for (size_t i=0; i<io_service_count(); ++i) {
+            io_service_at(i).stop();
+        }
         io_service_threads_.graceful_stop_threads();
+
+        stop_local_acceptor();
         return 0;
     }
 
@@ -213,6 +291,11 @@ public:
         return 0;
     }
 
+    // 其他的接入方式(例如UDP上报)共用同一个白名单
+    bool check_safe_ip(const std::string& ip) {
+        return conf_.check_safe_ip(ip);
+    }
+
     int module_runtime(const libconfig::Config& conf);
     int module_status(std::string& module, std::string& name, std::string& val);
 
@@ -13,6 +13,8 @@
 #include <boost/asio.hpp>
 #include <boost/algorithm/string.hpp>
 
+#include <Core/Compress.h>
+
 #include <Network/NetServer.h>
 #include <Network/TcpConnAsync.h>
 
@@ -23,18 +25,37 @@ namespace tzrpc {
 
 boost::atomic<int32_t> TcpConnAsync::current_concurrency_(0);
 
-TcpConnAsync::TcpConnAsync(std::shared_ptr<boost::asio::ip::tcp::socket> socket,
-                           NetServer& server):
+TcpConnAsync::TcpConnAsync(ConnSocketPtr socket,
+                           NetServer& server, boost::asio::io_service& io_service,
+                           ConnTimingWheel& wheel):
     NetConn(socket),
     was_cancelled_(false),
     ops_cancel_mutex_(),
-    ops_cancel_timer_(),
+    wheel_(wheel),
+    wheel_hook_(),
+    read_deadline_(0),
+    write_deadline_(0),
+    compress_(kCompressNone),
     server_(server),
-    strand_(std::make_shared<boost::asio::io_service::strand>(server.io_service_)) {
+    io_service_(io_service),
+    strand_(),
+    send_mutex_(),
+    send_pending_(),
+    send_inflight_(),
+    send_spare_(),
+    send_buffers_(),
+    writing_(false),
+    send_pending_bytes_(0),
+    send_space_() {
 
     set_tcp_nodelay(true);
     set_tcp_nonblocking(true);
 
+    // 独立io_service模式下只有一个线程执行这个连接的回调，不需要strand
+    if (!server_.io_service_per_thread()) {
+        strand_ = std::make_shared<boost::asio::io_service::strand>(io_service_);
+    }
+
     ++ current_concurrency_;
 }
 
@@ -107,14 +128,17 @@ bool TcpConnAsync::do_read() {
 
     uint32_t bytes_read = recv_bound_.buffer_.get_length();
     if (bytes_read < sizeof(Header)) {
-        set_ops_cancel_timeout();
-        async_read(*socket_, boost::asio::buffer(recv_bound_.io_block_, kFixedIoBufferSize),
-                   boost::asio::transfer_at_least(sizeof(Header) - bytes_read),
-                                 strand_->wrap(
-                                     std::bind(&TcpConnAsync::read_handler,
-                                         shared_from_this(),
-                                         std::placeholders::_1,
-                                         std::placeholders::_2)));
+        set_read_deadline(bytes_read == 0);
+        auto buffer = boost::asio::buffer(recv_bound_.buffer_.prepare(kFixedIoBufferSize), kFixedIoBufferSize);
+        auto handler = std::bind(&TcpConnAsync::read_handler, shared_from_this(),
+                                 std::placeholders::_1, std::placeholders::_2);
+        if (strand_) {
+            async_read(*socket_, buffer, boost::asio::transfer_at_least(sizeof(Header) - bytes_read),
+                       strand_->wrap(handler));
+        } else {
+            async_read(*socket_, buffer, boost::asio::transfer_at_least(sizeof(Header) - bytes_read),
+                       handler);
+        }
     } else {
         int ret = parse_header();
         if (ret == 0) {
@@ -135,7 +159,7 @@ bool TcpConnAsync::do_read() {
 
 void TcpConnAsync::read_handler(const boost::system::error_code& ec, std::size_t bytes_transferred) {
 
-    revoke_ops_cancel_timeout();
+    read_deadline_ = 0;
 
     if (ec) {
         handle_socket_ec(ec);
@@ -144,8 +168,7 @@ void TcpConnAsync::read_handler(const boost::system::error_code& ec, std::size_t
 
     SAFE_ASSERT(bytes_transferred > 0);
 
-    std::string str(recv_bound_.io_block_, bytes_transferred);
-    recv_bound_.buffer_.append_internal(str);
+    recv_bound_.buffer_.commit(bytes_transferred);
 
     if (recv_bound_.buffer_.get_length() < sizeof(Header)) {
         log_notice("unexpect read again!");
@@ -168,7 +191,7 @@ void TcpConnAsync::read_handler(const boost::system::error_code& ec, std::size_t
     }
 }
 
-int TcpConnAsync::parse_msg_body(Message& msg) {
+int TcpConnAsync::parse_msg_body(ByteSlice& body) {
 
     // need to read again!
     if (recv_bound_.buffer_.get_length() < recv_bound_.header_.length) {
@@ -179,12 +202,31 @@ int TcpConnAsync::parse_msg_body(Message& msg) {
 
     SAFE_ASSERT(recv_bound_.buffer_.get_length() >= recv_bound_.header_.length);
 
-    std::string msg_str;
-    recv_bound_.buffer_.consume(msg_str, recv_bound_.header_.length);
+    // 消息体只从接收缓冲区拷贝这一次，之后都通过 ByteSlice 共享
+    // 存储使用池中的 std::string，稳定状态下不需要重新分配
+    auto store = ObjectPool<std::string>::acquire();
+    recv_bound_.buffer_.consume(*store, recv_bound_.header_.length);
 
-    msg.header_ = recv_bound_.header_;
-    msg.payload_ = msg_str;
+    uint32_t codec = recv_bound_.header_.rev1;
+    if (codec == kCompressNone) {
+        body = ByteSlice(store);
+        return 0;
+    }
 
+    // 只接受这个连接上通过 ping 协商过的算法
+    if (codec != compress_) {
+        log_err("compressed message with codec %0x not negotiated, expect %0x", codec, compress_.load());
+        return -1;
+    }
+
+    // 解压到池中的另一个缓冲区，解压之后的长度同样受 recv_max_msg_size 限制
+    auto plain = ObjectPool<std::string>::acquire();
+    if (!uncompress_message(codec, store->data(), store->size(), server_.recv_max_msg_size(), *plain)) {
+        log_err("uncompress message failed, codec %0x, len %lu", codec, store->size());
+        return -1;
+    }
+
+    body = ByteSlice(plain);
     return 0;
 }
 
@@ -203,25 +245,30 @@ void TcpConnAsync::do_read_msg() {
     }
 
     if (recv_bound_.buffer_.get_length() < recv_bound_.header_.length) {
-        uint32_t to_read = std::min((uint32_t)(recv_bound_.header_.length - recv_bound_.buffer_.get_length()),
-                                    (uint32_t)(kFixedIoBufferSize));
-        set_ops_cancel_timeout();
-        async_read(*socket_, boost::asio::buffer(recv_bound_.io_block_, kFixedIoBufferSize),
-                       boost::asio::transfer_at_least(to_read),
-                                     strand_->wrap(
-                                         std::bind(&TcpConnAsync::read_msg_handler,
-                                             shared_from_this(),
-                                             std::placeholders::_1,
-                                             std::placeholders::_2)));
+
+        // 按照消息剩余的长度直接读入缓冲区，大消息不再分成许多小块读取
+        // 单次预留的空间有上限，避免对端声明一个很大的长度就让服务端分配内存
+        uint32_t to_read = recv_bound_.header_.length - recv_bound_.buffer_.get_length();
+        uint32_t to_prepare = std::min(std::max(to_read, (uint32_t)(kFixedIoBufferSize)), kMaxIoPrepareSize);
+        to_read = std::min(to_read, to_prepare);
+        set_read_deadline(false);
+        auto buffer = boost::asio::buffer(recv_bound_.buffer_.prepare(to_prepare), to_prepare);
+        auto handler = std::bind(&TcpConnAsync::read_msg_handler, shared_from_this(),
+                                 std::placeholders::_1, std::placeholders::_2);
+        if (strand_) {
+            async_read(*socket_, buffer, boost::asio::transfer_at_least(to_read), strand_->wrap(handler));
+        } else {
+            async_read(*socket_, buffer, boost::asio::transfer_at_least(to_read), handler);
+        }
     } else {
-        Message msg;
-        int ret = parse_msg_body(msg);
+        ByteSlice body;
+        int ret = parse_msg_body(body);
         if (ret == 0) {
 
             // 转发到RPC请求
-            log_debug("read_message: %s", msg.dump().c_str());
+            log_debug("read_message: %s, len: %lu", recv_bound_.header_.dump().c_str(), body.size());
             log_debug("read message finished, dispatch for RPC process.");
-            auto instance = std::make_shared<RpcInstance>(msg.payload_, shared_from_this(), msg.payload_.size());
+            auto instance = std::allocate_shared<RpcInstance>(PoolAllocator<RpcInstance>(), body, shared_from_this());
             Dispatcher::instance().handle_RPC(instance);
 
             do_read(); // read again for future
@@ -245,7 +292,7 @@ void TcpConnAsync::do_read_msg() {
 
 void TcpConnAsync::read_msg_handler(const boost::system::error_code& ec, size_t bytes_transferred) {
 
-    revoke_ops_cancel_timeout();
+    read_deadline_ = 0;
 
     if (ec) {
         handle_socket_ec(ec);
@@ -254,17 +301,16 @@ void TcpConnAsync::read_msg_handler(const boost::system::error_code& ec, size_t
 
     SAFE_ASSERT(bytes_transferred > 0);
 
-    std::string str(recv_bound_.io_block_, bytes_transferred);
-    recv_bound_.buffer_.append_internal(str);
+    recv_bound_.buffer_.commit(bytes_transferred);
 
-    Message msg;
-    int ret = parse_msg_body(msg);
+    ByteSlice body;
+    int ret = parse_msg_body(body);
     if (ret == 0) {
 
         // 转发到RPC请求
-        log_debug("read_message: %s", msg.dump().c_str());
+        log_debug("read_message: %s, len: %lu", recv_bound_.header_.dump().c_str(), body.size());
         log_debug("read message finished, dispatch for RPC process.");
-        auto instance = std::make_shared<RpcInstance>(msg.payload_, shared_from_this(), msg.payload_.size());
+        auto instance = std::allocate_shared<RpcInstance>(PoolAllocator<RpcInstance>(), body, shared_from_this());
         Dispatcher::instance().handle_RPC(instance);
 
         do_read();
@@ -283,22 +329,94 @@ void TcpConnAsync::read_msg_handler(const boost::system::error_code& ec, size_t
     }
 }
 
+uint32_t TcpConnAsync::negotiate_compress(uint32_t offered) {
+
+    uint32_t codec = kCompressNone;
+    if (server_.compress_threshold() > 0) {
+        codec = compress_select(offered);
+    }
+
+    compress_ = codec;
+    return codec;
+}
+
+uint32_t TcpConnAsync::compress_codec(size_t length) const {
+
+    int threshold = server_.compress_threshold();
+    if (threshold <= 0 || length < static_cast<size_t>(threshold)) {
+        return kCompressNone;
+    }
+
+    return compress_;
+}
+
 int TcpConnAsync::async_send_message(const Message& msg) {
 
+    Header header = msg.header_;
+    header.to_net_endian();
+
+    std::string head(reinterpret_cast<char*>(&header), sizeof(Header));
+    std::string payload = msg.payload_;
+    return async_send_message(head, payload);
+}
+
+int TcpConnAsync::async_send_message(std::string& head, std::string& payload) {
+
+    uint32_t length = head.size() + payload.size() - sizeof(Header);
     if (server_.send_max_msg_size() != 0 &&
-        msg.header_.length > server_.send_max_msg_size()) {
+        length > server_.send_max_msg_size()) {
         log_err("send_max_msg_size %d, but we will send %d",
-                static_cast<int>(server_.send_max_msg_size()), static_cast<int>(msg.header_.length));
+                static_cast<int>(server_.send_max_msg_size()), static_cast<int>(length));
         return -1;
     }
 
-    send_bound_.buffer_.append(msg);
-    do_write();
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        send_pending_bytes_ += head.size() + payload.size();
+        send_pending_.emplace_back();
+
+        // 优先使用已经发送完的缓冲区，交换之后调用者得到的是有容量的空缓冲区
+        if (!send_spare_.empty()) {
+            send_pending_.back().head_.swap(send_spare_.back().head_);
+            send_pending_.back().payload_.swap(send_spare_.back().payload_);
+            send_spare_.pop_back();
+        }
+
+        send_pending_.back().head_.swap(head);
+        send_pending_.back().payload_.swap(payload);
+    }
 
+    if (strand_) {
+        strand_->post(std::bind(&TcpConnAsync::do_write, shared_from_this()));
+    } else {
+        io_service_.post(std::bind(&TcpConnAsync::do_write, shared_from_this()));
+    }
     return 0;
 }
 
 
+bool TcpConnAsync::wait_send_budget() {
+
+    size_t budget = server_.send_pending_budget();
+    if (budget == 0) {
+        return true;
+    }
+
+    std::unique_lock<std::mutex> lock(send_mutex_);
+    while (send_pending_bytes_ > budget) {
+
+        // 写超时由时间轮检查，连接取消之后这里会退出
+        if (get_conn_stat() != ConnStat::kWorking || was_ops_cancelled()) {
+            log_err("connection broken while waiting send budget, pending %lu", send_pending_bytes_);
+            return false;
+        }
+
+        send_space_.wait_for(lock, std::chrono::seconds(1));
+    }
+
+    return true;
+}
+
 bool TcpConnAsync::do_write() {
 
     log_debug("strand write ... in thread %#lx", (long)pthread_self());
@@ -313,37 +431,85 @@ bool TcpConnAsync::do_write() {
         return false;
     }
 
-    if (send_bound_.buffer_.get_length() == 0) {
+    // 上一个写操作完成之后会再次触发
+    if (writing_) {
         return true;
     }
 
-    uint32_t to_write = std::min((uint32_t)(send_bound_.buffer_.get_length()),
-                                 (uint32_t)(kFixedIoBufferSize));
+    // 写操作进行期间排队的消息全部合并到这一次写操作中
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        if (send_pending_.empty()) {
+            return true;
+        }
 
-    send_bound_.buffer_.consume(send_bound_.io_block_, to_write);
+        SAFE_ASSERT(send_inflight_.empty());
+        size_t count = 0;
+        while (count < send_pending_.size() && count < kMaxCoalesceMessage) {
+            send_inflight_.emplace_back();
+            send_inflight_.back().head_.swap(send_pending_[count].head_);
+            send_inflight_.back().payload_.swap(send_pending_[count].payload_);
+            ++ count;
+        }
+        send_pending_.erase(send_pending_.begin(), send_pending_.begin() + count);
+    }
+
+    // 头部和消息体直接作为 const_buffer 序列发送，不再拷贝到中间缓存
+    send_buffers_.clear();
+    for (size_t i=0; i<send_inflight_.size(); ++i) {
+        send_buffers_.push_back(boost::asio::buffer(send_inflight_[i].head_));
+        if (!send_inflight_[i].payload_.empty()) {
+            send_buffers_.push_back(boost::asio::buffer(send_inflight_[i].payload_));
+        }
+    }
 
-    set_ops_cancel_timeout();
-    async_write(*socket_, boost::asio::buffer(send_bound_.io_block_, to_write),
-                    boost::asio::transfer_exactly(to_write),
-                              strand_->wrap(
-                                 std::bind(&TcpConnAsync::write_handler,
-                                     shared_from_this(),
-                                     std::placeholders::_1,
-                                     std::placeholders::_2)));
+    writing_ = true;
+    set_write_deadline();
+    auto handler = std::bind(&TcpConnAsync::write_handler, shared_from_this(),
+                             std::placeholders::_1, std::placeholders::_2);
+    if (strand_) {
+        async_write(*socket_, send_buffers_, strand_->wrap(handler));
+    } else {
+        async_write(*socket_, send_buffers_, handler);
+    }
     return true;
 }
 
 
 void TcpConnAsync::write_handler(const boost::system::error_code& ec, size_t bytes_transferred) {
 
-    revoke_ops_cancel_timeout();
+    write_deadline_ = 0;
+    writing_ = false;
+
+    // 发送完的缓冲区清空之后保留给后续的消息使用，太大的直接释放
+    {
+        std::lock_guard<std::mutex> lock(send_mutex_);
+        for (size_t i=0; i<send_inflight_.size(); ++i) {
+            send_pending_bytes_ -= send_inflight_[i].head_.size() + send_inflight_[i].payload_.size();
+        }
+
+        for (size_t i=0; i<send_inflight_.size() && send_spare_.size() < kMaxCoalesceMessage; ++i) {
+            if (send_inflight_[i].head_.capacity() > kMaxSpareCapacity ||
+                send_inflight_[i].payload_.capacity() > kMaxSpareCapacity) {
+                continue;
+            }
+
+            send_inflight_[i].head_.clear();
+            send_inflight_[i].payload_.clear();
+            send_spare_.emplace_back();
+            send_spare_.back().head_.swap(send_inflight_[i].head_);
+            send_spare_.back().payload_.swap(send_inflight_[i].payload_);
+        }
+    }
+    send_inflight_.clear();
+    send_space_.notify_all();
 
     if (ec) {
         handle_socket_ec(ec);
         return;
     }
 
-    // transfer_at_least 应该可以保证将需要的数据传输完，除非错误发生了
+    // async_write 保证将所有的数据传输完，除非错误发生了
     SAFE_ASSERT(bytes_transferred > 0);
 
     // 再次触发写，如果为空就直接返回
@@ -385,7 +551,7 @@ bool TcpConnAsync::handle_socket_ec(const boost::system::error_code& ec ) {
 
 
     if (close_socket || was_ops_cancelled()) {
-        revoke_ops_cancel_timeout();
+        revoke_deadline();
         ops_cancel();
         sock_shutdown_and_close(ShutdownType::kBoth);
     }
@@ -393,52 +559,58 @@ bool TcpConnAsync::handle_socket_ec(const boost::system::error_code& ec ) {
     return close_socket;
 }
 
-void TcpConnAsync::set_ops_cancel_timeout() {
+void TcpConnAsync::set_read_deadline(bool idle) {
 
-    std::lock_guard<std::mutex> lock(ops_cancel_mutex_);
-
-    if (server_.ops_cancel_time_out()  == 0) {
-        SAFE_ASSERT(!ops_cancel_timer_);
-        return;
-    }
+    int time_out = idle ? server_.session_cancel_time_out() : server_.ops_cancel_time_out();
+    read_deadline_ = (time_out > 0) ? ::time(NULL) + time_out : 0;
+    wheel_.touch(*this);
+}
 
-    // cancel the already timer first if any
-    boost::system::error_code ignore_ec;
-    if (ops_cancel_timer_) {
-        ops_cancel_timer_->cancel(ignore_ec);
-    } else {
-        ops_cancel_timer_.reset(new steady_timer(server_.io_service_));
-    }
+void TcpConnAsync::set_write_deadline() {
 
-    SAFE_ASSERT(server_.ops_cancel_time_out() );
-    ops_cancel_timer_->expires_from_now(seconds(server_.ops_cancel_time_out()));
-    ops_cancel_timer_->async_wait(std::bind(&TcpConnAsync::ops_cancel_timeout_call, shared_from_this(),
-                                            std::placeholders::_1));
-    return;
+    int time_out = server_.ops_cancel_time_out();
+    write_deadline_ = (time_out > 0) ? ::time(NULL) + time_out : 0;
+    wheel_.touch(*this);
 }
 
-void TcpConnAsync::revoke_ops_cancel_timeout() {
+void TcpConnAsync::revoke_deadline() {
+    read_deadline_  = 0;
+    write_deadline_ = 0;
+}
 
-    std::lock_guard<std::mutex> lock(ops_cancel_mutex_);
+time_t TcpConnAsync::deadline() const {
 
-    boost::system::error_code ignore_ec;
-    if (ops_cancel_timer_) {
-        ops_cancel_timer_->cancel(ignore_ec);
-        ops_cancel_timer_.reset();
+    time_t read_deadline  = read_deadline_;
+    time_t write_deadline = write_deadline_;
+    if (read_deadline == 0 || write_deadline == 0) {
+        return read_deadline + write_deadline;
     }
+    return std::min(read_deadline, write_deadline);
 }
 
-void TcpConnAsync::ops_cancel_timeout_call(const boost::system::error_code& ec) {
+void TcpConnAsync::expire() {
 
-    if (ec == 0){
-        log_info("ops_cancel_timeout_call called with timeout: %d", server_.ops_cancel_time_out() );
-        ops_cancel();
-        sock_shutdown_and_close(ShutdownType::kBoth);
-    } else if ( ec == boost::asio::error::operation_aborted) {
-        // normal cancel
+    // 和连接的其他回调串行执行
+    if (strand_) {
+        strand_->post(std::bind(&TcpConnAsync::do_expire, shared_from_this()));
     } else {
-        log_err("unknown and won't handle error_code: {%d} %s", ec.value(), ec.message().c_str());
+        io_service_.post(std::bind(&TcpConnAsync::do_expire, shared_from_this()));
+    }
+}
+
+void TcpConnAsync::do_expire() {
+
+    // 投递期间截止时间可能已经被更新了
+    time_t dl = deadline();
+    if (dl == 0 || dl > ::time(NULL)) {
+        return;
     }
+
+    log_info("connection deadline expired, ops_cancel_time_out: %d, session_cancel_time_out: %d",
+             server_.ops_cancel_time_out(), server_.session_cancel_time_out());
+    revoke_deadline();
+    ops_cancel();
+    sock_shutdown_and_close(ShutdownType::kBoth);
 }
 
 
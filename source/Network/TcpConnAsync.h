@@ -11,12 +11,18 @@
 
 #include <xtra_rhel.h>
 
+#include <vector>
+#include <condition_variable>
+
 #include <boost/asio.hpp>
 #include <boost/atomic/atomic.hpp>
 #include <boost/asio/steady_timer.hpp>
 using boost::asio::steady_timer;
 
+#include <Core/ByteSlice.h>
+#include <Core/ObjectPool.h>
 #include <Network/NetConn.h>
+#include <Network/TimingWheel.h>
 #include <Utils/Log.h>
 
 namespace tzrpc {
@@ -28,6 +34,8 @@ class TcpConnAsync;
 typedef std::shared_ptr<TcpConnAsync> TcpConnAsyncPtr;
 typedef std::weak_ptr<TcpConnAsync>   TcpConnAsyncWeakPtr;
 
+typedef TimingWheel<TcpConnAsync>     ConnTimingWheel;
+
 
 
 class TcpConnAsync: public NetConn,
@@ -39,7 +47,10 @@ public:
     static boost::atomic<int32_t> current_concurrency_;
 
     /// Construct a connection with the given socket.
-    TcpConnAsync(std::shared_ptr<boost::asio::ip::tcp::socket> socket, NetServer& server);
+    /// io_service 为连接所在的io_service，独立io_service模式下连接的所有回调都在这里执行
+    /// wheel 为同一个io_service上检查连接超时的时间轮
+    TcpConnAsync(ConnSocketPtr socket, NetServer& server,
+                 boost::asio::io_service& io_service, ConnTimingWheel& wheel);
     virtual ~TcpConnAsync();
 
     // 禁止拷贝
@@ -51,6 +62,26 @@ public:
 
     int async_send_message(const Message& msg);
 
+    // head 为网络字节序的消息头部(可以包含上层协议的头部)，payload 为消息体，
+    // 两者的内容被交换进发送队列，调用之后为空，发送的时候不再拷贝
+    int async_send_message(std::string& head, std::string& payload);
+
+    // 发送队列中等待的字节数超过 send_pending_budget 的时候阻塞，直到写操作完成腾出空间，
+    // 连接出错或者关闭返回 false。只能在 IO 线程之外(例如 Executor 线程)调用
+    bool wait_send_budget();
+
+    // 根据客户端 ping 中提供的压缩算法掩码协商响应使用的压缩算法，返回选中的算法
+    uint32_t negotiate_compress(uint32_t offered);
+    // 长度为 length 的响应消息应该使用的压缩算法，没有协商或者没有超过阈值的返回 kCompressNone
+    uint32_t compress_codec(size_t length) const;
+
+    // 时间轮使用的接口
+    time_t deadline() const;
+    void expire();
+    TimingWheelHook& wheel_hook() {
+        return wheel_hook_;
+    }
+
 private:
 
     virtual bool do_read() override;
@@ -63,10 +94,14 @@ private:
     void read_msg_handler(const boost::system::error_code& ec, std::size_t bytes_transferred);
 
     int parse_header();
-    int parse_msg_body(Message& msg);
+    int parse_msg_body(ByteSlice& body);
+
+    // 只记录截止时间，由时间轮统一检查，不再为每个IO操作创建定时器
+    // 等待新请求的时候使用 session_cancel_time_out，请求读取中和写操作使用 ops_cancel_time_out
+    void set_read_deadline(bool idle);
+    void set_write_deadline();
+    void revoke_deadline();
 
-    void set_ops_cancel_timeout();
-    void revoke_ops_cancel_timeout();
     bool was_ops_cancelled() {
         std::lock_guard<std::mutex> lock(ops_cancel_mutex_);
         return was_cancelled_;
@@ -79,7 +114,7 @@ private:
         was_cancelled_ = true;
         return was_cancelled_;
     }
-    void ops_cancel_timeout_call(const boost::system::error_code& ec);
+    void do_expire();
 
     // 是否Connection长连接
     bool keep_continue();
@@ -89,7 +124,14 @@ private:
 
     bool was_cancelled_;
     std::mutex ops_cancel_mutex_;
-    std::unique_ptr<steady_timer> ops_cancel_timer_;
+
+    ConnTimingWheel& wheel_;
+    TimingWheelHook wheel_hook_;
+    std::atomic<time_t> read_deadline_;     // 0表示没有
+    std::atomic<time_t> write_deadline_;
+
+    // 协商之后响应使用的压缩算法，请求消息总是按照每个消息的标志解压
+    std::atomic<uint32_t> compress_;
 
     // Of course, the handlers may still execute concurrently with other handlers that
     // were not dispatched through an boost::asio::strand, or were dispatched through
@@ -100,8 +142,10 @@ private:
     // is no possibility of concurrent execution of the handlers. This is an implicit strand.
 
     NetServer& server_;
+    boost::asio::io_service& io_service_;
 
     // Strand to ensure the connection's handlers are not called concurrently. ???
+    // 独立io_service模式下为空
     std::shared_ptr<boost::asio::io_service::strand> strand_;
 
 private:
@@ -111,7 +155,32 @@ private:
 
 
     IOBound recv_bound_;
-    IOBound send_bound_;
+
+    struct send_item_t {
+        std::string head_;
+        std::string payload_;
+    };
+
+    // 一次写操作最多合并的消息数目，也是保留的空闲缓冲区数目
+    const static size_t kMaxCoalesceMessage = 256;
+    // 超过这个容量的缓冲区发送完之后不再保留
+    const static size_t kMaxSpareCapacity = 64 * 1024;
+
+    // 响应可能由多个Executor线程提交(流式响应会连续提交多个)，
+    // send_pending_ 由 send_mutex_ 保护，写操作只在 strand 中发起，
+    // writing_ 保证同一时刻只有一个 async_write 在进行，
+    // 正在写的消息保存在 send_inflight_ 中直到写操作完成，
+    // 完成之后缓冲区进入 send_spare_，和后续提交的消息交换，避免每个响应分配内存
+    std::mutex send_mutex_;
+    std::vector<send_item_t> send_pending_;
+    std::vector<send_item_t> send_inflight_;
+    std::vector<send_item_t> send_spare_;
+    std::vector<boost::asio::const_buffer> send_buffers_;
+    bool writing_;
+
+    // send_pending_ 和 send_inflight_ 中的字节数，写操作完成之后通过 send_space_ 唤醒等待者
+    size_t send_pending_bytes_;
+    std::condition_variable send_space_;
 };
 
 
@@ -0,0 +1,151 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#ifndef __NETWORK_TIMING_WHEEL_H__
+#define __NETWORK_TIMING_WHEEL_H__
+
+#include <ctime>
+
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+
+namespace tzrpc {
+
+// 时间轮中的安排信息，由被管理的对象持有
+struct TimingWheelHook {
+
+    TimingWheelHook():
+        scheduled_(0) {
+    }
+
+    // 在时间轮中被安排检查的时间，0表示没有被安排
+    std::atomic<time_t> scheduled_;
+};
+
+
+// 粗粒度(1秒)的截止时间管理
+//
+// 对象自己记录截止时间，时间轮只在截止时间附近检查一次:
+// 截止时间被延后(最常见的情况)的时候 touch 只是读取比较，不需要加锁；
+// 检查的时候发现截止时间已经被延后，就重新放到对应的槽里面；
+// 只有截止时间被提前到已经安排的检查时间之前，才需要加锁放入更早的槽，
+// 之前的记录在检查的时候因为和 scheduled_ 不一致被丢弃。
+//
+// T 需要继承 std::enable_shared_from_this，并且提供
+//     time_t deadline() const;       最近的截止时间，0表示没有
+//     void expire();                 截止时间到达的处理
+//     TimingWheelHook& wheel_hook();
+
+template <typename T>
+class TimingWheel {
+
+public:
+    explicit TimingWheel(time_t now, size_t slot_count = 64):
+        lock_(),
+        slots_(slot_count),
+        next_tick_(now),
+        scratch_(),
+        expired_count_(0) {
+    }
+
+    // 禁止拷贝
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    // 对象的截止时间变化之后调用
+    void touch(T& item) {
+
+        time_t deadline = item.deadline();
+        if (deadline == 0 || !need_schedule(item.wheel_hook(), deadline)) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(lock_);
+        if (need_schedule(item.wheel_hook(), deadline)) {
+            schedule(item.shared_from_this(), deadline);
+        }
+    }
+
+    // 检查到 now 为止所有的槽，超时的对象在锁外调用 expire
+    void tick(time_t now) {
+
+        std::vector<std::shared_ptr<T>> expired;
+
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+
+            while (next_tick_ <= now) {
+
+                time_t current = next_tick_ ++;
+                scratch_.swap(slots_[current % slots_.size()]);
+
+                for (size_t i=0; i<scratch_.size(); ++i) {
+
+                    std::shared_ptr<T> item = scratch_[i].lock();
+                    if (!item || item->wheel_hook().scheduled_ != current) {
+                        continue;
+                    }
+
+                    time_t deadline = item->deadline();
+                    if (deadline == 0) {
+                        item->wheel_hook().scheduled_ = 0;
+                    } else if (deadline <= now) {
+                        item->wheel_hook().scheduled_ = 0;
+                        expired.push_back(item);
+                    } else {
+                        schedule(item, deadline);
+                    }
+                }
+
+                scratch_.clear();
+            }
+        }
+
+        expired_count_ += expired.size();
+        for (size_t i=0; i<expired.size(); ++i) {
+            expired[i]->expire();
+        }
+    }
+
+    uint64_t expired_count() const {
+        return expired_count_;
+    }
+
+private:
+
+    static bool need_schedule(TimingWheelHook& hook, time_t deadline) {
+        time_t scheduled = hook.scheduled_;
+        return scheduled == 0 || deadline < scheduled;
+    }
+
+    // 超出时间轮范围的先放到最后一个槽，到时候再重新安排
+    void schedule(const std::shared_ptr<T>& item, time_t deadline) {
+
+        time_t at = deadline;
+        if (at < next_tick_) {
+            at = next_tick_;
+        } else if (at >= next_tick_ + static_cast<time_t>(slots_.size())) {
+            at = next_tick_ + slots_.size() - 1;
+        }
+
+        item->wheel_hook().scheduled_ = at;
+        slots_[at % slots_.size()].push_back(item);
+    }
+
+    std::mutex lock_;
+    std::vector<std::vector<std::weak_ptr<T>>> slots_;
+    time_t next_tick_;      // 下一个需要检查的时间
+    std::vector<std::weak_ptr<T>> scratch_;
+
+    std::atomic<uint64_t> expired_count_;
+};
+
+} // end namespace tzrpc
+
+#endif // __NETWORK_TIMING_WHEEL_H__
@@ -8,6 +8,9 @@
 #ifndef __PROTOCOL_COMMON_H__
 #define __PROTOCOL_COMMON_H__
 
+#include <cstdint>
+#include <cstddef>
+
 namespace tzrpc {
 
 namespace ServiceID {
@@ -18,6 +21,19 @@ enum {
 
 }
 
+
+// UDP上报的数据报格式: UdpReportHeader + MonitorWriteOps::Request::ev_report_t 的序列化结果
+// 没有应答和重传，每个数据报独立解析，一次上报过大时由客户端拆分成多个数据报
+struct UdpReportHeader {
+    uint16_t magic;     // 网络字节序
+    uint8_t  version;
+    uint8_t  reserved;
+} __attribute__ ((packed));
+
+const static uint16_t kUdpReportMagic   = 0x4852;     // "HR"
+const static uint8_t  kUdpReportVersion = 0x01;
+const static size_t   kUdpReportMaxSize = 65507;      // IPv4 UDP 最大负载
+
 } // end namespace tzrpc
 
 
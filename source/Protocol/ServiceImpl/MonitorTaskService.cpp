@@ -23,6 +23,163 @@
 
 namespace tzrpc {
 
+// 查询请求参数的解析和校验，失败的时候desc返回错误描述
+static int parse_select_cond(const MonitorTask::MonitorReadOps::Request::ev_select_t& select,
+                             event_cond_t& cond, std::string& desc) {
+
+    cond.version = select.version();
+    cond.tm_interval = select.tm_interval();
+    cond.service = select.service();
+    cond.metric = select.metric();
+    cond.tm_start = select.tm_start();
+    cond.entity_idx = select.entity_idx();
+    cond.tag = select.tag();
+
+    if (select.groupby() < 0 ||
+        select.groupby() >= static_cast<int32_t>(GroupType::kGroupbyBoundary)) {
+        log_err("invalid groupby param: %d", select.groupby());
+        desc = "invalid groupby param.";
+        return -1;
+    }
+    cond.groupby = static_cast<enum GroupType>(select.groupby());
+
+    if (select.orderby() < 0 ||
+        select.orderby() >= static_cast<int32_t>(OrderByType::kOrderByBoundary)) {
+        log_err("invalid orderby param: %d", select.orderby());
+        desc = "invalid orderby param.";
+        return -1;
+    }
+    cond.orderby = static_cast<enum OrderByType>(select.orderby());
+
+    if (select.orders() < 0 ||
+        select.orders() >= static_cast<int32_t>(OrderType::kOrderBoundary)) {
+        log_err("invalid orders param: %d", select.orders());
+        desc = "invalid orders param.";
+        return -1;
+    }
+    cond.orders = static_cast<enum OrderType>(select.orders());
+    cond.limit = select.limit();
+
+    if (select.bucket_seconds() < 0) {
+        log_err("invalid bucket_seconds param: %d", select.bucket_seconds());
+        desc = "invalid bucket_seconds param.";
+        return -1;
+    }
+    cond.bucket_seconds = select.bucket_seconds();
+
+    return 0;
+}
+
+// 查询结果的公共字段，summary 为 false 的时候不携带汇总信息
+static void fill_select_header(const event_cond_t& cond, const event_select_t& stat,
+                               MonitorTask::MonitorReadOps::Response::ev_select_t* select, bool summary) {
+
+    select->set_version(cond.version);
+    select->set_service(stat.service);
+    select->set_timestamp(stat.timestamp);
+    select->set_metric(stat.metric);
+    select->set_tm_interval(stat.tm_interval);
+    select->set_tm_start(stat.timestamp);
+    select->set_entity_idx(stat.entity_idx);
+    select->set_tag(stat.tag);
+
+    if (summary) {
+        select->mutable_summary()->set_timestamp(stat.summary.timestamp);
+        select->mutable_summary()->set_tag(stat.summary.tag);
+        select->mutable_summary()->set_count(stat.summary.count);
+        select->mutable_summary()->set_value_sum(stat.summary.value_sum);
+        select->mutable_summary()->set_value_avg(stat.summary.value_avg);
+        select->mutable_summary()->set_value_min(stat.summary.value_min);
+        select->mutable_summary()->set_value_max(stat.summary.value_max);
+        select->mutable_summary()->set_value_p10(stat.summary.value_p10);
+        select->mutable_summary()->set_value_p50(stat.summary.value_p50);
+        select->mutable_summary()->set_value_p90(stat.summary.value_p90);
+    }
+}
+
+static void fill_select_info(const event_cond_t& cond, const std::vector<event_info_t>& info,
+                             MonitorTask::MonitorReadOps::Response::ev_select_t* select) {
+
+    for (auto iter = info.begin(); iter != info.end(); ++iter) {
+        auto item = select->add_info();
+
+        item->set_timestamp(iter->timestamp);
+        item->set_tag(iter->tag);
+        if (groupby_has_entity(cond.groupby)) {
+            item->set_entity_idx(iter->entity_idx);
+        }
+
+        item->set_count(iter->count);
+        item->set_value_sum(iter->value_sum);
+        item->set_value_avg(iter->value_avg);
+        item->set_value_min(iter->value_min);
+        item->set_value_max(iter->value_max);
+        item->set_value_p10(iter->value_p10);
+        item->set_value_p50(iter->value_p50);
+        item->set_value_p90(iter->value_p90);
+    }
+}
+
+static void fill_select_response(const event_cond_t& cond, const event_select_t& stat,
+                                 MonitorTask::MonitorReadOps::Response::ev_select_t* select) {
+    fill_select_header(cond, stat, select, true);
+    fill_select_info(cond, stat.info, select);
+}
+
+// 存储扫描的过程中每产生 stream_rows 条分组结果就序列化发送一块，服务端不再持有完整的结果
+// 连接上等待发送的数据超过 send_pending_budget 的时候扫描暂停，客户端读取慢的时候内存也是有界的
+// 汇总信息要扫描结束才能确定，由最后一块携带；查询中途失败的时候最后一块返回错误码
+static void reply_select_stream(std::shared_ptr<RpcInstance> rpc_instance,
+                                const event_cond_t& cond, int32_t stream_rows) {
+
+    static thread_local std::string response_str;
+
+    event_select_t stat {};
+    int32_t chunk_idx = 0;
+    size_t total = 0;
+
+    auto sink = [&](const std::vector<event_info_t>& rows) -> bool {
+
+        // 连接失效的时候终止扫描
+        if (!rpc_instance->wait_send_budget()) {
+            return false;
+        }
+
+        MonitorTask::MonitorReadOps::Response response;
+        response.set_code(0);
+        response.set_desc("OK");
+        response.set_chunk_idx(chunk_idx);
+        fill_select_header(cond, stat, response.mutable_select(), false);
+        fill_select_info(cond, rows, response.mutable_select());
+
+        ProtoBuf::marshalling_to_string(response, &response_str);
+        rpc_instance->reply_rpc_chunk(response_str, true);
+
+        total += rows.size();
+        ++ chunk_idx;
+        return true;
+    };
+
+    int ret = EventRepos::instance().get_event_stream(cond, stat, stream_rows, sink);
+
+    MonitorTask::MonitorReadOps::Response response;
+    response.set_chunk_idx(chunk_idx);
+    if (ret != 0) {
+        log_err("call stream select return: %d",  ret);
+        response.set_code(ret);
+        response.set_desc("get_event error");
+    } else {
+        response.set_code(0);
+        response.set_desc("OK");
+        fill_select_header(cond, stat, response.mutable_select(), true);
+    }
+
+    ProtoBuf::marshalling_to_string(response, &response_str);
+    rpc_instance->reply_rpc_chunk(response_str, false);
+
+    log_debug("stream select reply %d rows in %d chunks.", static_cast<int>(total), chunk_idx + 1);
+}
+
 bool MonitorTaskService::init() {
 
     auto conf_ptr = ConfHelper::instance().get_conf();
@@ -164,6 +321,30 @@ int MonitorTaskService::module_status(std::string& strModule, std::string& strKe
 }
 
 
+void MonitorTaskService::parse_report(const MonitorTask::MonitorWriteOps::Request::ev_report_t& pb_report,
+                                      event_report_t& report) {
+
+    report.version = pb_report.version();
+    report.timestamp = pb_report.timestamp();
+    report.service = pb_report.service();
+    report.entity_idx = pb_report.entity_idx();
+
+    int size = pb_report.data_size();
+    report.data.reserve(size);
+    for (int i=0; i<size; ++i) {
+        event_data_t item {};
+
+        const auto& p_data = pb_report.data(i);
+        item.msgid = p_data.msgid();
+        item.metric = p_data.metric();
+        item.tag = p_data.tag();
+        item.value = p_data.value();
+
+        report.data.emplace_back(std::move(item));
+    }
+}
+
+
 void MonitorTaskService::handle_RPC(std::shared_ptr<RpcInstance> rpc_instance) {
 
     using MonitorTask::OpCode;
@@ -203,109 +384,96 @@ void MonitorTaskService::read_ops_impl(std::shared_ptr<RpcInstance> rpc_instance
     do {
 
         // 消息体的unmarshal
-        MonitorTask::MonitorReadOps::Request request;
-        if (!ProtoBuf::unmarshalling_from_string(rpc_request_message.payload_, &request)) {
+        // 每个Executor线程复用请求对象，Clear 之后内部已经分配的字段可以继续使用
+        static thread_local MonitorTask::MonitorReadOps::Request request;
+        request.Clear();
+        const ByteSlice& payload = rpc_instance->get_request_payload();
+        if (!ProtoBuf::unmarshalling_from_array(payload.data(), payload.size(), &request)) {
             log_err("unmarshal request failed.");
             response.set_code(-1);
             response.set_desc("unmarshalling failed.");
             break;
         }
 
-        log_debug("ReadRequest: %s", ProtoBuf::dump(request).c_str());
+        if (log_enabled(LOG_DEBUG)) {
+            log_debug("ReadRequest: %s", ProtoBuf::dump(request).c_str());
+        }
 
         // 相同类目下的子RPC调用分发
         if (request.has_ping()) {
             log_debug("MonitorTask::MonitorReadOps::ping -> %s", request.ping().msg().c_str());
             response.mutable_ping()->set_msg("[[[pong]]]");
+            // 客户端提供了支持的压缩算法，协商这个连接上响应的压缩
+            if (request.ping().has_compress()) {
+                response.mutable_ping()->set_compress(rpc_instance->negotiate_compress(request.ping().compress()));
+            }
             break;
         } else if (request.has_select()) {
 
             event_cond_t cond {};
-
-            cond.version = request.select().version();
-            cond.tm_interval = request.select().tm_interval();
-            cond.service = request.select().service();
-            cond.metric = request.select().metric();
-            cond.tm_start = request.select().tm_start();
-            cond.entity_idx = request.select().entity_idx();
-            cond.tag = request.select().tag();
-
-            if (request.select().groupby() < 0 ||
-                request.select().groupby() >= static_cast<int32_t>(GroupType::kGroupbyBoundary)) {
-                log_err("invalid groupby param: %d", request.select().groupby());
+            std::string desc;
+            if (parse_select_cond(request.select(), cond, desc) != 0) {
                 response.set_code(-1);
-                response.set_desc("invalid groupby param.");
+                response.set_desc(desc);
                 break;
             }
-            cond.groupby = static_cast<enum GroupType>(request.select().groupby());
 
-            if (request.select().orderby() < 0 ||
-                request.select().orderby() >= static_cast<int32_t>(OrderByType::kOrderByBoundary)) {
-                log_err("invalid orderby param: %d", request.select().orderby());
-                response.set_code(-1);
-                response.set_desc("invalid orderby param.");
+            // 流式返回，结果在存储扫描的过程中逐块序列化发送，不再构造完整的响应
+            if (request.select().stream_rows() > 0) {
+                reply_select_stream(rpc_instance, cond, request.select().stream_rows());
+                return;
+            }
+
+            event_select_t stat {};
+            int ret = EventRepos::instance().get_event(cond, stat);
+            if (ret != 0) {
+                log_err("call select return: %d",  ret);
+                response.set_code(ret);
+                response.set_desc("get_event error");
                 break;
             }
-            cond.orderby = static_cast<enum OrderByType>(request.select().orderby());
 
-            if (request.select().orders() < 0 ||
-                request.select().orders() >= static_cast<int32_t>(OrderType::kOrderBoundary)) {
-                log_err("invalid orders param: %d", request.select().orders());
+            response.set_code(0);
+            response.set_desc("OK");
+            fill_select_response(cond, stat, response.mutable_select());
+
+            break;
+
+        } else if (request.batch_select_size() > 0) {
+
+            std::vector<event_cond_t> conds(request.batch_select_size());
+            std::string desc;
+            for (int i=0; i<request.batch_select_size(); ++i) {
+                if (parse_select_cond(request.batch_select(i), conds[i], desc) != 0) {
+                    break;
+                }
+            }
+
+            if (!desc.empty()) {
                 response.set_code(-1);
-                response.set_desc("invalid orders param.");
+                response.set_desc(desc);
                 break;
             }
-            cond.orders = static_cast<enum OrderType>(request.select().orders());
-            cond.limit = request.select().limit();
 
-
-            event_select_t stat {};
-            int ret = EventRepos::instance().get_event(cond, stat);
+            std::vector<event_select_t> stats;
+            std::vector<int> rets;
+            int ret = EventRepos::instance().get_events(conds, stats, rets);
             if (ret != 0) {
-                log_err("call select return: %d",  ret);
+                log_err("call batch select return: %d",  ret);
                 response.set_code(ret);
-                response.set_desc("get_event error");
-                return;
+                response.set_desc("get_events error");
+                break;
             }
 
             response.set_code(0);
             response.set_desc("OK");
 
-            response.mutable_select()->set_version(cond.version);
-            response.mutable_select()->set_service(stat.service);
-            response.mutable_select()->set_timestamp(stat.timestamp);
-            response.mutable_select()->set_metric(stat.metric);
-            response.mutable_select()->set_tm_interval(stat.tm_interval);
-            response.mutable_select()->set_tm_start(stat.timestamp);
-            response.mutable_select()->set_entity_idx(stat.entity_idx);
-            response.mutable_select()->set_tag(stat.tag);
-
-
-            response.mutable_select()->mutable_summary()->set_timestamp(stat.summary.timestamp);
-            response.mutable_select()->mutable_summary()->set_tag(stat.summary.tag);
-            response.mutable_select()->mutable_summary()->set_count(stat.summary.count);
-            response.mutable_select()->mutable_summary()->set_value_sum(stat.summary.value_sum);
-            response.mutable_select()->mutable_summary()->set_value_avg(stat.summary.value_avg);
-            response.mutable_select()->mutable_summary()->set_value_min(stat.summary.value_min);
-            response.mutable_select()->mutable_summary()->set_value_max(stat.summary.value_max);
-            response.mutable_select()->mutable_summary()->set_value_p10(stat.summary.value_p10);
-            response.mutable_select()->mutable_summary()->set_value_p50(stat.summary.value_p50);
-            response.mutable_select()->mutable_summary()->set_value_p90(stat.summary.value_p90);
-
-            for (auto iter = stat.info.begin(); iter != stat.info.end(); ++iter) {
-                auto item = response.mutable_select()->add_info();
-
-                item->set_timestamp(iter->timestamp);
-                item->set_tag(iter->tag);
-
-                item->set_count(iter->count);
-                item->set_value_sum(iter->value_sum);
-                item->set_value_avg(iter->value_avg);
-                item->set_value_min(iter->value_min);
-                item->set_value_max(iter->value_max);
-                item->set_value_p10(iter->value_p10);
-                item->set_value_p50(iter->value_p50);
-                item->set_value_p90(iter->value_p90);
+            for (size_t i=0; i<conds.size(); ++i) {
+                auto item = response.add_batch_select();
+                item->set_code(rets[i]);
+                if (rets[i] == 0) {
+                    fill_select_response(conds[i], stats[i], item->mutable_select());
+                }
             }
 
             break;
@@ -379,9 +547,11 @@ void MonitorTaskService::read_ops_impl(std::shared_ptr<RpcInstance> rpc_instance
 
     } while (0);
 
-    log_debug("ReadRequest: return\n%s", ProtoBuf::dump(response).c_str());
+    if (log_enabled(LOG_DEBUG)) {
+        log_debug("ReadRequest: return\n%s", ProtoBuf::dump(response).c_str());
+    }
 
-    std::string response_str;
+    static thread_local std::string response_str;
     ProtoBuf::marshalling_to_string(response, &response_str);
     rpc_instance->reply_rpc_message(response_str);
 }
@@ -396,44 +566,34 @@ void MonitorTaskService::write_ops_impl(std::shared_ptr<RpcInstance> rpc_instanc
         return;
     }
 
-    MonitorTask::MonitorWriteOps::Response response;
+    // 上报是最频繁的请求，请求和响应对象都在每个Executor线程中复用
+    static thread_local MonitorTask::MonitorWriteOps::Response response;
+    response.Clear();
     response.set_code(0);
     response.set_desc("OK");
 
     do {
 
         // 消息体的unmarshal
-        MonitorTask::MonitorWriteOps::Request request;
-        if (!ProtoBuf::unmarshalling_from_string(rpc_request_message.payload_, &request)) {
+        static thread_local MonitorTask::MonitorWriteOps::Request request;
+        request.Clear();
+        const ByteSlice& payload = rpc_instance->get_request_payload();
+        if (!ProtoBuf::unmarshalling_from_array(payload.data(), payload.size(), &request)) {
             log_err("unmarshal request failed.");
             response.set_code(-1);
             response.set_desc("unmarshalling failed");
             break;
         }
 
-        log_debug("WriteRequest: %s", ProtoBuf::dump(request).c_str());
+        if (log_enabled(LOG_DEBUG)) {
+            log_debug("WriteRequest: %s", ProtoBuf::dump(request).c_str());
+        }
 
         // 相同类目下的子RPC调用分发
         if (request.has_report()) {
 
             event_report_t report{};
-            report.version = request.report().version();
-            report.timestamp = request.report().timestamp();
-            report.service = request.report().service();
-            report.entity_idx = request.report().entity_idx();
-
-            int size = request.report().data_size();
-            for (int i=0; i<size; ++i) {
-                event_data_t item {};
-
-                auto p_data = request.report().data(i);
-                item.msgid = p_data.msgid();
-                item.metric = p_data.metric();
-                item.tag = p_data.tag();
-                item.value = p_data.value();
-
-                report.data.emplace_back(item);
-            }
+            parse_report(request.report(), report);
 
             auto ret = EventRepos::instance().add_event(report);
             if (ret != 0) {
@@ -452,9 +612,11 @@ void MonitorTaskService::write_ops_impl(std::shared_ptr<RpcInstance> rpc_instanc
 
     } while (0);
 
-    log_debug("WriteRequest: return\n%s", ProtoBuf::dump(response).c_str());
+    if (log_enabled(LOG_DEBUG)) {
+        log_debug("WriteRequest: return\n%s", ProtoBuf::dump(response).c_str());
+    }
 
-    std::string response_str;
+    static thread_local std::string response_str;
     ProtoBuf::marshalling_to_string(response, &response_str);
     rpc_instance->reply_rpc_message(response_str);
 }
@@ -15,6 +15,9 @@
 
 #include <Scaffold/ConfHelper.h>
 
+#include <Business/EventTypes.h>
+#include <Protocol/gen-cpp/MonitorTask.pb.h>
+
 #include "RpcServiceBase.h"
 
 
@@ -41,6 +44,10 @@ public:
 
     bool init();
 
+    // 上报消息转换成内部的事件结构，RPC和UDP上报共用
+    static void parse_report(const MonitorTask::MonitorWriteOps::Request::ev_report_t& pb_report,
+                             event_report_t& report);
+
 private:
     struct DetailExecutorConf {
 
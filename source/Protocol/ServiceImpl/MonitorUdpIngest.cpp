@@ -0,0 +1,305 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <sstream>
+#include <vector>
+
+#include <Utils/Log.h>
+
+#include <Core/ProtoBuf.h>
+
+#include <Business/EventTypes.h>
+#include <Business/EventRepos.h>
+
+#include <Scaffold/Status.h>
+
+#include <Protocol/Common.h>
+#include <Protocol/gen-cpp/MonitorTask.pb.h>
+
+#include "MonitorTaskService.h"
+#include "MonitorUdpIngest.h"
+
+namespace tzrpc {
+
+MonitorUdpIngest::~MonitorUdpIngest() {
+    if (socket_fd_ >= 0) {
+        ::close(socket_fd_);
+        socket_fd_ = -1;
+    }
+}
+
+bool MonitorUdpIngest::load_conf(const libconfig::Config& conf) {
+
+    conf.lookupValue("rpc.udp_ingest.bind_addr", bind_addr_);
+    conf.lookupValue("rpc.udp_ingest.bind_port", bind_port_);
+    if (bind_port_ < 0 || bind_port_ > 65535) {
+        log_err("invalid rpc.udp_ingest.bind_port %d", bind_port_);
+        return false;
+    }
+
+    conf.lookupValue("rpc.udp_ingest.thread_pool_size", thread_number_);
+    if (thread_number_ <= 0 || thread_number_ > 64) {
+        log_notice("invalid rpc.udp_ingest.thread_pool_size %d, reset to 1.", thread_number_);
+        thread_number_ = 1;
+    }
+
+    conf.lookupValue("rpc.udp_ingest.batch_size", batch_size_);
+    if (batch_size_ <= 0 || batch_size_ > 1024) {
+        log_notice("invalid rpc.udp_ingest.batch_size %d, reset to 32.", batch_size_);
+        batch_size_ = 32;
+    }
+
+    conf.lookupValue("rpc.udp_ingest.recv_buffer_size", recv_buffer_size_);
+    if (recv_buffer_size_ < 0) {
+        recv_buffer_size_ = 0;
+    }
+
+    return true;
+}
+
+bool MonitorUdpIngest::init() {
+
+    auto conf_ptr = ConfHelper::instance().get_conf();
+    if(!conf_ptr) {
+        log_err("ConfHelper not initialized? return conf_ptr empty!!!");
+        return false;
+    }
+
+    if (!load_conf(*conf_ptr)) {
+        log_err("Load udp_ingest conf failed!");
+        return false;
+    }
+
+    if (bind_port_ == 0) {
+        log_notice("rpc.udp_ingest.bind_port not set, udp ingest disabled.");
+        return true;
+    }
+
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(static_cast<uint16_t>(bind_port_));
+    if (::inet_pton(AF_INET, bind_addr_.c_str(), &addr.sin_addr) != 1) {
+        log_err("invalid rpc.udp_ingest.bind_addr %s", bind_addr_.c_str());
+        return false;
+    }
+
+    int fd = ::socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_err("create udp socket failed: %s", strerror(errno));
+        return false;
+    }
+
+    // 定时从阻塞中返回，以检查线程的状态
+    struct timeval tv {};
+    tv.tv_sec = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    if (recv_buffer_size_ > 0 &&
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &recv_buffer_size_, sizeof(recv_buffer_size_)) != 0) {
+        log_err("set udp SO_RCVBUF to %d failed: %s", recv_buffer_size_, strerror(errno));
+    }
+
+    if (::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        log_err("bind udp ingest %s:%d failed: %s", bind_addr_.c_str(), bind_port_, strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    socket_fd_ = fd;
+    log_alert("create udp ingest for %s:%d, thread_number %d, batch_size %d",
+              bind_addr_.c_str(), bind_port_, thread_number_, batch_size_);
+
+    if (!udp_threads_.init_threads(
+        std::bind(&MonitorUdpIngest::udp_run, this, std::placeholders::_1),
+        thread_number_)) {
+        log_err("MonitorUdpIngest::udp_run init task failed!");
+        return false;
+    }
+
+    // 系统状态展示相关的初始化
+    Status::instance().register_status_callback(
+            "MonitorUdpIngest",
+            std::bind(&MonitorUdpIngest::module_status, this,
+                      std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
+
+    return true;
+}
+
+void MonitorUdpIngest::service() {
+
+    if (enabled()) {
+        udp_threads_.start_threads();
+    }
+}
+
+int MonitorUdpIngest::stop_graceful() {
+
+    if (enabled()) {
+        log_err("about to stop udp ingest... ");
+        udp_threads_.graceful_stop_threads();
+    }
+
+    return 0;
+}
+
+int MonitorUdpIngest::join() {
+
+    if (enabled()) {
+        udp_threads_.join_threads();
+    }
+
+    return 0;
+}
+
+
+int MonitorUdpIngest::handle_datagram(const char* data, size_t len) {
+
+    if (len < sizeof(UdpReportHeader)) {
+        log_debug("udp datagram too short: %lu", len);
+        return -1;
+    }
+
+    UdpReportHeader header {};
+    ::memcpy(&header, data, sizeof(header));
+    if (be16toh(header.magic) != kUdpReportMagic || header.version != kUdpReportVersion) {
+        log_debug("udp datagram header check failed, magic %#x, version %u",
+                  be16toh(header.magic), header.version);
+        return -1;
+    }
+
+    // 每个接收线程复用上报对象
+    static thread_local MonitorTask::MonitorWriteOps::Request::ev_report_t pb_report;
+    pb_report.Clear();
+    if (!ProtoBuf::unmarshalling_from_array(data + sizeof(header), len - sizeof(header), &pb_report)) {
+        log_debug("unmarshal udp report failed.");
+        return -1;
+    }
+
+    event_report_t report {};
+    MonitorTaskService::parse_report(pb_report, report);
+
+    auto ret = EventRepos::instance().add_event(report);
+    if (ret != 0) {
+        log_err("add event failed with return: %d", ret);
+        return ret;
+    }
+
+    event_count_ += report.data.size();
+    return 0;
+}
+
+void MonitorUdpIngest::udp_run(ThreadObjPtr ptr) {
+
+    const size_t batch = batch_size_;
+    const size_t slot_size = kUdpReportMaxSize;
+
+    std::vector<char> buffer(batch * slot_size);
+    std::vector<struct iovec>  iovs(batch);
+    std::vector<struct mmsghdr> msgs(batch);
+    std::vector<struct sockaddr_in> addrs(batch);   // 数据报的来源地址
+
+    for (size_t i=0; i<batch; ++i) {
+        iovs[i].iov_base = &buffer[i * slot_size];
+        iovs[i].iov_len  = slot_size;
+        msgs[i].msg_hdr.msg_iov    = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name   = &addrs[i];
+    }
+
+    while (true) {
+
+        if (unlikely(ptr->status_ == ThreadStatus::kTerminating)) {
+            log_err("thread %#lx is about to terminating...", (long)pthread_self());
+            break;
+        }
+
+        // 线程启动
+        if (unlikely(ptr->status_ == ThreadStatus::kSuspend)) {
+            ::usleep(1*1000*1000);
+            continue;
+        }
+
+        // 内核会改写 msg_namelen，每次接收之前重置
+        for (size_t i=0; i<batch; ++i) {
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        }
+
+        // 阻塞等待第一个数据报，之后取走已经到达的，最多 batch 个
+        int count = ::recvmmsg(socket_fd_, &msgs[0], batch, MSG_WAITFORONE, NULL);
+        if (count < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                log_err("recvmmsg failed: %s", strerror(errno));
+                ::usleep(10*1000);
+            }
+            continue;
+        }
+
+        datagram_count_ += count;
+        for (int i=0; i<count; ++i) {
+
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                ++ drop_count_;
+                continue;
+            }
+
+            if (check_safe_ip_) {
+
+                char ip[INET_ADDRSTRLEN] {};
+                if (msgs[i].msg_hdr.msg_namelen < sizeof(struct sockaddr_in) ||
+                    !::inet_ntop(AF_INET, &addrs[i].sin_addr, ip, sizeof(ip))) {
+                    ++ reject_count_;
+                    continue;
+                }
+
+                if (!check_safe_ip_(ip)) {
+                    log_debug("check safe_ip failed for udp source: %s", ip);
+                    ++ reject_count_;
+                    continue;
+                }
+            }
+
+            if (handle_datagram(&buffer[i * slot_size], msgs[i].msg_len) != 0) {
+                ++ drop_count_;
+            }
+        }
+    }
+
+    ptr->status_ = ThreadStatus::kDead;
+    log_info("udp ingest thread %#lx is about to terminate ... ", (long)pthread_self());
+}
+
+
+int MonitorUdpIngest::module_status(std::string& module, std::string& name, std::string& val) {
+
+    module = "tzrpc";
+    name = "MonitorUdpIngest";
+
+    std::stringstream ss;
+
+    ss << "\t" << "instance_name: " << instance_name_ << std::endl;
+    ss << "\t" << "udp_addr: " << bind_addr_ << "@" << bind_port_ << std::endl;
+    ss << "\t" << "thread_pool_size: " << thread_number_ << ", batch_size: " << batch_size_ << std::endl;
+    ss << "\t" << "datagram_count: " << datagram_count_ << std::endl;
+    ss << "\t" << "event_count: " << event_count_ << std::endl;
+    ss << "\t" << "drop_count: " << drop_count_ << std::endl;
+    ss << "\t" << "reject_count: " << reject_count_ << std::endl;
+
+    val = ss.str();
+    return 0;
+}
+
+} // namespace tzrpc
@@ -0,0 +1,100 @@
+/*-
+ * Copyright (c) 2019 TAO Zhijiang<taozhijiang@gmail.com>
+ *
+ * Licensed under the BSD-3-Clause license, see LICENSE for full information.
+ *
+ */
+
+
+#ifndef __PROTOCOL_MONITOR_UDP_INGEST_H__
+#define __PROTOCOL_MONITOR_UDP_INGEST_H__
+
+#include <xtra_rhel.h>
+
+#include <atomic>
+#include <string>
+#include <functional>
+
+#include <Utils/ThreadPool.h>
+
+#include <Scaffold/ConfHelper.h>
+
+
+namespace tzrpc {
+
+// UDP 上报的接收
+//
+// 最热的调用路径不希望有连接状态和应答的等待，客户端把上报打包成数据报直接发送，
+// 这里的线程通过 recvmmsg 批量接收，解析之后直接调用 EventRepos::add_event，
+// 不经过 Executor 的任务队列。数据报丢失和格式错误的都只是计数，不做任何应答。
+// 来源地址和 TCP 连接一样检查 safe_ip 白名单，不在其中的数据报直接丢弃。
+
+typedef std::function<bool(const std::string& ip)> safe_ip_checker_t;
+
+class MonitorUdpIngest {
+
+public:
+    // check_safe_ip 和 NetServer 共用，配置更新之后同样生效
+    MonitorUdpIngest(const std::string& instance_name, const safe_ip_checker_t& check_safe_ip):
+        instance_name_(instance_name),
+        check_safe_ip_(check_safe_ip),
+        bind_addr_("0.0.0.0"),
+        bind_port_(0),
+        thread_number_(1),
+        batch_size_(32),
+        recv_buffer_size_(0),
+        socket_fd_(-1),
+        udp_threads_(),
+        datagram_count_(0),
+        event_count_(0),
+        drop_count_(0),
+        reject_count_(0) {
+    }
+
+    ~MonitorUdpIngest();
+
+    // 禁止拷贝
+    MonitorUdpIngest(const MonitorUdpIngest&) = delete;
+    MonitorUdpIngest& operator=(const MonitorUdpIngest&) = delete;
+
+    // 没有配置端口的时候不启用，enabled() 返回 false
+    bool init();
+    bool enabled() const {
+        return socket_fd_ >= 0;
+    }
+
+    void service();
+
+    int stop_graceful();
+    int join();
+
+    int module_status(std::string& module, std::string& name, std::string& val);
+
+private:
+    bool load_conf(const libconfig::Config& conf);
+
+    void udp_run(ThreadObjPtr ptr);
+    int handle_datagram(const char* data, size_t len);
+
+    const std::string instance_name_;
+    safe_ip_checker_t check_safe_ip_;
+
+    std::string bind_addr_;
+    int32_t     bind_port_;
+    int32_t     thread_number_;
+    int32_t     batch_size_;        // 每次 recvmmsg 最多接收的数据报
+    int32_t     recv_buffer_size_;  // SO_RCVBUF，0使用系统默认值
+
+    int socket_fd_;
+
+    ThreadPool udp_threads_;
+
+    std::atomic<uint64_t> datagram_count_;
+    std::atomic<uint64_t> event_count_;
+    std::atomic<uint64_t> drop_count_;
+    std::atomic<uint64_t> reject_count_;    // 不在 safe_ip 中的数据报
+};
+
+} // namespace tzrpc
+
+#endif // __PROTOCOL_MONITOR_UDP_INGEST_H__
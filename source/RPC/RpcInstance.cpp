@@ -6,23 +6,25 @@
  */
 
 
+#include <Core/Compress.h>
 #include <RPC/RpcInstance.h>
 
 namespace tzrpc {
 
 bool RpcInstance::validate_request() {
 
-    if (request_.get_length() < sizeof(RpcRequestHeader)) {
+    if (request_.size() < sizeof(RpcRequestHeader)) {
         return false;
     }
 
-    // 解析头部
-    std::string head_str;
+    // 直接在消息体上解析头部
     RpcRequestHeader header;
-    request_.consume(head_str, sizeof(RpcRequestHeader));
-    ::memcpy(reinterpret_cast<char*>(&header), head_str.c_str(), sizeof(RpcRequestHeader));
+    request_.copy_to(reinterpret_cast<char*>(&header), sizeof(RpcRequestHeader));
     header.from_net_endian();
 
+    // 校验失败的拒绝响应也需要带上请求编号
+    request_id_ = header.rev1;
+
     if (header.magic != kRpcHeaderMagic ||
         header.version != kRpcHeaderVersion ) {
         return false;
@@ -31,40 +33,62 @@ bool RpcInstance::validate_request() {
     service_id_ = header.service_id;
     opcode_ = header.opcode;
 
-    std::string msg_str;
-    request_.consume(msg_str, msg_size_ - sizeof(RpcRequestHeader));
-    if (msg_str.empty()) {
+    request_payload_ = request_.sub(sizeof(RpcRequestHeader));
+    if (request_payload_.empty()) {
         return false;
     }
 
     rpc_request_message_.header_ = header;
-    rpc_request_message_.payload_ = msg_str;
 
-    log_debug("validate/parse request_message for rpc_instance: %s", rpc_request_message_.dump().c_str());
+    log_debug("validate/parse request_message for rpc_instance: %s, payload_len: %lu",
+              rpc_request_message_.header_.dump().c_str(), request_payload_.size());
 
     return true;
 }
 
 
-void RpcInstance::reply_rpc_message(const std::string& msg) {
+void RpcInstance::reply_rpc_message(std::string& msg) {
+    reply_rpc_chunk(msg, false);
+}
+
+void RpcInstance::reply_rpc_chunk(std::string& msg, bool more) {
 
-    RpcResponseMessage rpc_response_message(service_id_, opcode_, msg);
-    Message net_msg(rpc_response_message.net_str());
+    // 只序列化头部，消息体直接交给发送队列
+    RpcResponseMessage rpc_response_message(service_id_, opcode_, std::string());
+    rpc_response_message.set_more(more);
+    send_response(rpc_response_message, msg);
+}
+
+void RpcInstance::reject(RpcResponseStatus status) {
+
+    RpcResponseMessage rpc_response_message(status);
+    std::string msg;
+    send_response(rpc_response_message, msg);
+}
+
+bool RpcInstance::wait_send_budget() {
 
     auto sock = full_socket_.lock();
     if (!sock) {
         log_err("socket already release before.");
-        return;
+        return false;
     }
 
-    sock->async_send_message(net_msg);
-    return;
+    return sock->wait_send_budget();
 }
 
-void RpcInstance::reject(RpcResponseStatus status) {
+uint32_t RpcInstance::negotiate_compress(uint32_t offered) {
 
-    RpcResponseMessage rpc_response_message(status);
-    Message net_msg(rpc_response_message.net_str());
+    auto sock = full_socket_.lock();
+    if (!sock) {
+        log_err("socket already release before.");
+        return kCompressNone;
+    }
+
+    return sock->negotiate_compress(offered);
+}
+
+void RpcInstance::send_response(const RpcResponseMessage& rpc_response_message, std::string& msg) {
 
     auto sock = full_socket_.lock();
     if (!sock) {
@@ -72,7 +96,52 @@ void RpcInstance::reject(RpcResponseStatus status) {
         return;
     }
 
-    sock->async_send_message(net_msg);
+    RpcResponseHeader rpc_header = rpc_response_message.header_;
+    rpc_header.rev2 = request_id_;
+    rpc_header.to_net_endian();
+
+    Header header {};
+    header.magic = kHeaderMagic;
+    header.version = kHeaderVersion;
+    header.length = sizeof(RpcResponseHeader) + msg.size();
+
+    // 发送队列交换回来的是空闲缓冲区，下次调用直接复用
+    static thread_local std::string head;
+
+    uint32_t codec = sock->compress_codec(header.length);
+    if (codec != kCompressNone) {
+
+        // 压缩整个消息体，压缩的结果直接写回 msg
+        static thread_local std::string plain;
+        plain.assign(reinterpret_cast<char*>(&rpc_header), sizeof(RpcResponseHeader));
+        plain.append(msg);
+
+        if (compress_message(codec, plain.data(), plain.size(), msg)) {
+            header.rev1 = codec;
+            header.length = msg.size();
+            header.to_net_endian();
+            head.assign(reinterpret_cast<char*>(&header), sizeof(Header));
+        } else {
+            log_err("compress response with codec %0x failed, send uncompressed.", codec);
+            header.to_net_endian();
+            head.assign(reinterpret_cast<char*>(&header), sizeof(Header));
+            msg.swap(plain);
+        }
+
+        // 大的响应不长期占用线程的内存
+        if (plain.capacity() > 64 * 1024) {
+            std::string().swap(plain);
+        }
+
+        sock->async_send_message(head, msg);
+        return;
+    }
+
+    header.to_net_endian();
+    head.assign(reinterpret_cast<char*>(&header), sizeof(Header));
+    head.append(reinterpret_cast<char*>(&rpc_header), sizeof(RpcResponseHeader));
+
+    sock->async_send_message(head, msg);
     return;
 }
 
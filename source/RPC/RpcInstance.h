@@ -10,7 +10,7 @@
 
 #include <memory>
 
-#include <Core/Buffer.h>
+#include <Core/ByteSlice.h>
 #include <Network/TcpConnAsync.h>
 
 #include <RPC/RpcRequestMessage.h>
@@ -20,26 +20,36 @@ namespace tzrpc {
 
 class RpcInstance {
 public:
-    RpcInstance(const std::string& str_request, std::shared_ptr<TcpConnAsync> socket, int msg_size):
+    // request 直接引用网络层取出的消息体，整个处理过程中不再拷贝
+    RpcInstance(const ByteSlice& request, std::shared_ptr<TcpConnAsync> socket):
         start_(::time(NULL)),
         full_socket_(socket),
-        request_(str_request),
+        request_(request),
         rpc_request_message_(),
-        response_(),
-        rpc_response_message_(),
-        msg_size_(msg_size),
+        request_payload_(),
         service_id_(-1),
-        opcode_(-1) {
+        opcode_(-1),
+        request_id_(0) {
     }
 
     bool validate_request();
 
-    void reply_rpc_message(const std::string& msg);
+    // msg 和发送队列中空闲的缓冲区交换，返回之后 msg 为空但是保留了容量，
+    // 调用者可以用线程局部的 std::string 序列化响应，稳定状态下不再分配内存
+    void reply_rpc_message(std::string& msg);
+    // 流式响应，more 表示后面还有响应消息，最后一个消息 more 为 false
+    void reply_rpc_chunk(std::string& msg, bool more);
     // 返回系统性的错误
     void reject(RpcResponseStatus status);
     // 返回业务相关的错误
     void return_biz_error();
 
+    // 流式响应在发送下一块之前调用，连接的发送队列超过预算的时候等待，连接已经失效返回 false
+    bool wait_send_budget();
+
+    // 和客户端协商这个连接上响应消息的压缩算法，返回选中的算法
+    uint32_t negotiate_compress(uint32_t offered);
+
 
     uint16_t get_service_id() {
         return service_id_;
@@ -49,26 +59,34 @@ public:
         return opcode_;
     }
 
+    uint32_t get_request_id() {
+        return request_id_;
+    }
+
+    // 只有头部被解析到这里，消息体通过 get_request_payload 访问
     RpcRequestMessage& get_rpc_request_message() {
         return rpc_request_message_;
     }
 
+    const ByteSlice& get_request_payload() const {
+        return request_payload_;
+    }
+
 private:
+    void send_response(const RpcResponseMessage& rpc_response_message, std::string& msg);
+
     time_t start_;  // 请求创建的时间
     std::weak_ptr<TcpConnAsync> full_socket_; // 可能socket提前在网络层已经释放了
 
-    Buffer request_;
+    ByteSlice request_;
     RpcRequestMessage rpc_request_message_;
-
-    Buffer response_;
-    RpcResponseMessage rpc_response_message_;
-
-    const int msg_size_;
+    ByteSlice request_payload_;
 
 private:
     // these detail info were extract from request
     uint16_t service_id_;
     uint16_t opcode_;
+    uint32_t request_id_;   // 响应中原样返回，客户端据此匹配乱序完成的请求
 };
 
 } // end namespace tzrpc
@@ -29,13 +29,13 @@ struct RpcRequestHeader {
     uint16_t service_id;
     uint16_t opcode;
 
-    uint32_t rev1;          // 当前保留空间，后续升级使用
-    uint32_t rev2;
+    uint32_t rev1;          // 请求编号，服务端在响应中原样返回，用于同一连接上的多个并发请求
+    uint32_t rev2;          // 当前保留空间，后续升级使用
 
     std::string dump() const {
-        char msg[64] {};
-        snprintf(msg, sizeof(msg), "rpc_request_header mgc:%0x, ver:%0x, sid:%0x, opd:%0x.",
-                 magic, version, service_id, opcode);
+        char msg[80] {};
+        snprintf(msg, sizeof(msg), "rpc_request_header mgc:%0x, ver:%0x, sid:%0x, opd:%0x, rid:%u.",
+                 magic, version, service_id, opcode, rev1);
         return msg;
     }
 
@@ -45,6 +45,7 @@ struct RpcRequestHeader {
         version = be16toh(version);
         service_id = be16toh(service_id);
         opcode  = be16toh(opcode);
+        rev1    = be32toh(rev1);
     }
 
     void to_net_endian() {
@@ -52,6 +53,7 @@ struct RpcRequestHeader {
         version = htobe16(version);
         service_id = htobe16(service_id);
         opcode  = htobe16(opcode);
+        rev1    = htobe32(rev1);
     }
 
 } __attribute__ ((__packed__));
@@ -76,6 +78,14 @@ struct RpcRequestMessage {
         header_.opcode = opcd;
     }
 
+    void set_request_id(uint32_t request_id) {
+        header_.rev1 = request_id;
+    }
+
+    uint32_t request_id() const {
+        return header_.rev1;
+    }
+
     std::string dump() const {
         std::string ret = "rpc_request_header: " + header_.dump();
         ret += ", rpc_request_message_len: " + convert_to_string(payload_.size());
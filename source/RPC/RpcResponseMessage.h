@@ -40,6 +40,10 @@ enum class RpcResponseStatus : uint8_t {
     SYSTEM_ERROR    = 5,
 };
 
+// rev1 作为标志位使用
+// 流式响应的时候一个请求对应多个响应消息，除最后一个之外都带有 kRpcFlagMore
+const static uint32_t kRpcFlagMore = 0x01;
+
 // Message已经能保证RPC的消息被完整的接收了，所以这边不需要保存msg的长度了
 struct RpcResponseHeader {
 
@@ -50,13 +54,13 @@ struct RpcResponseHeader {
     uint16_t service_id;
     uint16_t opcode;
 
-    uint32_t rev1;          // 当前保留空间，后续升级使用
-    uint32_t rev2;
+    uint32_t rev1;          // 标志位 kRpcFlagXXX
+    uint32_t rev2;          // 对应请求的编号 RpcRequestHeader::rev1
 
     std::string dump() const {
-        char msg[64] {};
-        snprintf(msg, sizeof(msg), "rpc_response_header mgc:%0x, ver:%0x, sid:%0x, opd:%0x",
-                 magic, version, service_id, opcode);
+        char msg[96] {};
+        snprintf(msg, sizeof(msg), "rpc_response_header mgc:%0x, ver:%0x, sid:%0x, opd:%0x, flg:%0x, rid:%u",
+                 magic, version, service_id, opcode, rev1, rev2);
         return msg;
     }
 
@@ -66,6 +70,8 @@ struct RpcResponseHeader {
         version = be16toh(version);
         service_id = be16toh(service_id);
         opcode  = be16toh(opcode);
+        rev1    = be32toh(rev1);
+        rev2    = be32toh(rev2);
     }
 
     void to_net_endian() {
@@ -73,6 +79,8 @@ struct RpcResponseHeader {
         version = htobe16(version);
         service_id = htobe16(service_id);
         opcode  = htobe16(opcode);
+        rev1    = htobe32(rev1);
+        rev2    = htobe32(rev2);
     }
 
 } __attribute__ ((__packed__));
@@ -106,6 +114,27 @@ struct RpcResponseMessage {
         header_.version = kRpcHeaderVersion;
     }
 
+    // 流式响应，后面还有属于同一个请求的响应消息
+    void set_more(bool more) {
+        if (more) {
+            header_.rev1 |= kRpcFlagMore;
+        } else {
+            header_.rev1 &= ~kRpcFlagMore;
+        }
+    }
+
+    bool has_more() const {
+        return (header_.rev1 & kRpcFlagMore) != 0;
+    }
+
+    void set_request_id(uint32_t request_id) {
+        header_.rev2 = request_id;
+    }
+
+    uint32_t request_id() const {
+        return header_.rev2;
+    }
+
     std::string dump() const {
         std::string ret = "rpc_response_header: " + header_.dump();
         ret += ", rpc_response_message_len: " + convert_to_string(payload_.size());
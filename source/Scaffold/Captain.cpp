@@ -22,8 +22,10 @@
 
 #include <Protocol/Common.h>
 #include <Protocol/ServiceImpl/MonitorTaskService.h>
+#include <Protocol/ServiceImpl/MonitorUdpIngest.h>
 
 #include <Business/EventRepos.h>
+#include <Business/StoreWriter.h>
 
 #include <Scaffold/ConfHelper.h>
 #include <Scaffold/Captain.h>
@@ -101,8 +103,19 @@ bool Captain::init(const std::string& cfgFile) {
         return false;
     }
 
+    // UDP 上报直接写入 EventRepos，需要在其初始化之后
+    // 和 TCP 连接使用同一个 safe_ip 白名单
+    udp_ingest_ptr_.reset(new MonitorUdpIngest("MonitorUdpIngest",
+                                               std::bind(&NetServer::check_safe_ip, net_server_ptr_,
+                                                         std::placeholders::_1)));
+    if (!udp_ingest_ptr_ || !udp_ingest_ptr_->init()) {
+        log_err("init MonitorUdpIngest failed!");
+        return false;
+    }
+
     // do real service
     net_server_ptr_->service();
+    udp_ingest_ptr_->service();
 
     log_info("Manager all initialized...");
     initialized_ = true;
@@ -114,6 +127,10 @@ bool Captain::init(const std::string& cfgFile) {
 bool Captain::service_graceful() {
 
     net_server_ptr_->io_service_stop_graceful();
+    udp_ingest_ptr_->stop_graceful();
+
+    // 接入都停止之后，把已经交给写入阶段的批次写完
+    StoreWriterStopAll();
     return true;
 }
 
@@ -125,6 +142,8 @@ void Captain::service_terminate() {
 bool Captain::service_joinall() {
 
     net_server_ptr_->io_service_join();
+    udp_ingest_ptr_->join();
+    StoreWriterJoinAll();
     return true;
 }
 
@@ -17,6 +17,7 @@ namespace tzrpc {
 
 
 class NetServer;
+class MonitorUdpIngest;
 
 class Captain {
 public:
@@ -44,6 +45,7 @@ private:
 public:
 
     std::shared_ptr<NetServer> net_server_ptr_;
+    std::shared_ptr<MonitorUdpIngest> udp_ingest_ptr_;
 };
 
 } // end namespace tzrpc
@@ -24,6 +24,8 @@ void set_checkpoint_log_store_func(CP_log_store_func_t func) {
     checkpoint_log_store_func_impl_ = func;
 }
 
+static int log_level_ = LOG_DEBUG;
+
 // The use of openlog() is optional; it will automatically be called by syslog() if necessary.
 bool log_init(int log_level) {
 
@@ -32,9 +34,14 @@ bool log_init(int log_level) {
 
     openlog(program_invocation_short_name, LOG_PID , LOG_LOCAL6);
     setlogmask (LOG_UPTO (log_level));
+    log_level_ = log_level;
     return true;
 }
 
+bool log_enabled(int priority) {
+    return priority <= log_level_;
+}
+
 void log_close() {
 
     log_notice("closing rsyslog...");
@@ -37,6 +37,9 @@ namespace tzrpc {
 
 bool log_init(int log_level);
 void log_close();
+
+// 调用者构造开销比较大的日志内容之前可以先检查级别
+bool log_enabled(int priority);
 void log_api(int priority, const char *file, int line, const char *func, const char *msg, ...)
     __attribute__((format(printf, 5, 6)));
 
@@ -6,6 +6,11 @@ using namespace ::testing;
 
 #include <Core/Message.h>
 #include <Core/Buffer.h>
+#include <Core/ByteSlice.h>
+#include <Core/Compress.h>
+
+#include <RPC/RpcRequestMessage.h>
+#include <RPC/RpcResponseMessage.h>
 
 using namespace tzrpc;
 
@@ -50,3 +55,168 @@ TEST(MessageBufferTest, BufferTest) {
     ASSERT_THAT(store1, Eq(str2));
     ASSERT_THAT(buff.get_length(), 0);
 }
+
+
+TEST(MessageBufferTest, BufferCursorTest) {
+
+    Buffer buff;
+    ASSERT_THAT(buff.get_length(), Eq(0));
+    ASSERT_TRUE(buff.get_data() == nullptr);
+
+    // 直接写入可写空间
+    char* ptr = buff.prepare(16);
+    ASSERT_THAT(buff.writable(), Ge(16));
+    ::memcpy(ptr, "0123456789", 10);
+    buff.commit(10);
+    ASSERT_THAT(buff.get_length(), Eq(10));
+
+    std::string store;
+    ASSERT_TRUE(buff.consume(store, 4));
+    ASSERT_THAT(store, Eq("0123"));
+    ASSERT_THAT(std::string(buff.get_data(), buff.get_length()), Eq("456789"));
+
+    // 交替的写入和消费，数据保持连续和有序
+    std::string expect = "456789";
+    for (int i=0; i<2000; ++i) {
+        std::string item = std::to_string(i) + ",";
+        buff.append_internal(item);
+        expect += item;
+
+        if (i % 3 == 0) {
+            ASSERT_TRUE(buff.consume(store, 5));
+            ASSERT_THAT(store, Eq(expect.substr(0, 5)));
+            expect.erase(0, 5);
+        }
+    }
+    ASSERT_THAT(std::string(buff.get_data(), buff.get_length()), Eq(expect));
+
+    char block[64] {};
+    ASSERT_TRUE(buff.consume(block, 8));
+    ASSERT_THAT(std::string(block, 8), Eq(expect.substr(0, 8)));
+
+    buff.front_erase(buff.get_length());
+    ASSERT_THAT(buff.get_length(), Eq(0));
+}
+
+
+TEST(MessageBufferTest, BufferMessageTest) {
+
+    Buffer buff;
+
+    // 连续追加多个消息，按照头部长度逐个解析
+    for (int i=0; i<100; ++i) {
+        tzrpc::Message msg(std::string(i * 100, 'a' + i % 26));
+        buff.append(msg);
+    }
+
+    for (int i=0; i<100; ++i) {
+        std::string head_str;
+        ASSERT_TRUE(buff.consume(head_str, sizeof(Header)));
+
+        Header head {};
+        ::memcpy(reinterpret_cast<char*>(&head), head_str.c_str(), sizeof(Header));
+        head.from_net_endian();
+        ASSERT_THAT(head.magic, Eq(kHeaderMagic));
+        ASSERT_THAT(head.length, Eq(i * 100));
+
+        std::string payload;
+        if (head.length > 0) {
+            ASSERT_TRUE(buff.consume(payload, head.length));
+        }
+        ASSERT_THAT(payload, Eq(std::string(i * 100, 'a' + i % 26)));
+    }
+
+    ASSERT_THAT(buff.get_length(), Eq(0));
+}
+
+
+TEST(MessageBufferTest, ByteSliceTest) {
+
+    std::string data = "0123456789abcdef";
+    const char* raw = data.data();
+    ByteSlice slice = ByteSlice::take(data);
+
+    // 接管数据不产生拷贝
+    ASSERT_TRUE(data.empty());
+    ASSERT_THAT(slice.data(), Eq(raw));
+    ASSERT_THAT(slice.size(), Eq(16));
+
+    ByteSlice sub = slice.sub(4, 6);
+    ASSERT_THAT(sub.data(), Eq(raw + 4));
+    ASSERT_THAT(sub.str(), Eq("456789"));
+    ASSERT_THAT(sub.sub(2).str(), Eq("6789"));
+
+    // 超出范围截断
+    ASSERT_THAT(slice.sub(10, 100).str(), Eq("abcdef"));
+    ASSERT_TRUE(slice.sub(100).empty());
+
+    char head[4] {};
+    ASSERT_TRUE(sub.copy_to(head, sizeof(head)));
+    ASSERT_THAT(std::string(head, 4), Eq("4567"));
+    ASSERT_FALSE(sub.copy_to(head, 100));
+
+    // 原始片段释放之后子片段仍然有效
+    slice = ByteSlice();
+    ASSERT_THAT(sub.str(), Eq("456789"));
+}
+
+TEST(MessageBufferTest, RpcRequestIdTest) {
+
+    RpcRequestMessage request(0x01, 0x02, "request");
+    request.set_request_id(0x01020304);
+
+    RpcRequestMessage parsed_request;
+    ASSERT_TRUE(RpcRequestMessageParse(request.net_str(), parsed_request));
+    ASSERT_THAT(parsed_request.request_id(), Eq(0x01020304));
+    ASSERT_THAT(parsed_request.payload_, Eq("request"));
+
+    // 请求编号和流式响应的标志位互不影响
+    RpcResponseMessage response(0x01, 0x02, "response");
+    response.set_more(true);
+    response.set_request_id(parsed_request.request_id());
+
+    RpcResponseMessage parsed_response;
+    ASSERT_TRUE(RpcResponseMessageParse(response.net_str(), parsed_response));
+    ASSERT_THAT(parsed_response.request_id(), Eq(0x01020304));
+    ASSERT_TRUE(parsed_response.has_more());
+    ASSERT_THAT(parsed_response.payload_, Eq("response"));
+}
+
+TEST(MessageBufferTest, CompressTest) {
+
+    std::string data;
+    for (int i=0; i<500; ++i) {
+        data += "metric_name_repeated_in_report,tag_repeated_in_report;";
+    }
+
+    std::string compressed;
+    ASSERT_TRUE(compress_message(kCompressSnappy, data.c_str(), data.size(), compressed));
+    ASSERT_THAT(compressed.size(), Lt(data.size()));
+
+    // 压缩标志在网络字节序转换之后保持不变
+    tzrpc::Message msg(compressed);
+    msg.header_.rev1 = kCompressSnappy;
+    Buffer buf(msg);
+
+    Header header;
+    std::string head_str;
+    buf.consume(head_str, sizeof(Header));
+    ::memcpy(reinterpret_cast<char*>(&header), head_str.c_str(), sizeof(Header));
+    header.from_net_endian();
+    ASSERT_THAT(header.rev1, Eq(kCompressSnappy));
+    ASSERT_THAT(header.length, Eq(compressed.size()));
+
+    std::string body;
+    buf.consume(body, header.length);
+
+    std::string plain;
+    ASSERT_TRUE(uncompress_message(header.rev1, body.c_str(), body.size(), 0, plain));
+    ASSERT_THAT(plain, Eq(data));
+
+    // 解压之后的长度超过限制，或者未知的压缩算法
+    ASSERT_FALSE(uncompress_message(header.rev1, body.c_str(), body.size(), data.size() - 1, plain));
+    ASSERT_FALSE(uncompress_message(0x80, body.c_str(), body.size(), 0, plain));
+
+    ASSERT_THAT(compress_select(kCompressSnappy | 0x80), Eq(kCompressSnappy));
+    ASSERT_THAT(compress_select(0x80), Eq(kCompressNone));
+}
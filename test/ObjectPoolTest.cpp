@@ -0,0 +1,193 @@
+#include <iostream>
+#include <string>
+#include <thread>
+#include <cstdlib>
+
+#include <gmock/gmock.h>
+using namespace ::testing;
+
+#include <Core/Buffer.h>
+#include <Core/ByteSlice.h>
+#include <Core/ObjectPool.h>
+#include <Core/ProtoBuf.h>
+
+#include <RPC/RpcRequestMessage.h>
+#include <Protocol/gen-cpp/MonitorTask.pb.h>
+
+using namespace tzrpc;
+
+// 只统计当前线程的内存分配次数，gtest 和其他线程的分配不影响结果
+static thread_local uint64_t alloc_count = 0;
+
+void* operator new(size_t sz) {
+    ++ alloc_count;
+    void* ptr = ::malloc(sz ? sz : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    ::free(ptr);
+}
+
+
+struct pooled_t {
+    int64_t value_[8];
+    std::string name_;
+};
+
+TEST(ObjectPoolTest, PoolAllocatorTest) {
+
+    for (int i=0; i<10; ++i) {
+        auto ptr = std::allocate_shared<pooled_t>(PoolAllocator<pooled_t>());
+        ptr->name_ = "short";
+    }
+
+    uint64_t count = alloc_count;
+    for (int i=0; i<1000; ++i) {
+        auto ptr = std::allocate_shared<pooled_t>(PoolAllocator<pooled_t>());
+        ptr->value_[0] = i;
+    }
+    ASSERT_THAT(alloc_count - count, Eq(0));
+}
+
+TEST(ObjectPoolTest, StringPoolTest) {
+
+    std::string data(4096, 'x');
+
+    {
+        auto store = ObjectPool<std::string>::acquire();
+        store->assign(data);
+    }
+
+    uint64_t count = alloc_count;
+    for (int i=0; i<1000; ++i) {
+        auto store = ObjectPool<std::string>::acquire();
+        ASSERT_TRUE(store->empty());
+        store->assign(data);
+
+        ByteSlice slice(store);
+        ByteSlice sub = slice.sub(16);
+        ASSERT_THAT(sub.size(), Eq(4096 - 16));
+    }
+    ASSERT_THAT(alloc_count - count, Eq(0));
+
+    // 大缓冲区不再放回池中
+    {
+        auto store = ObjectPool<std::string>::acquire();
+        store->assign(std::string(1024 * 1024, 'y'));
+    }
+    auto store = ObjectPool<std::string>::acquire();
+    ASSERT_THAT(store->capacity(), Lt(1024 * 1024));
+}
+
+// 池中缓存的对象按照字节数限制，不会因为大缓冲区长期占用内存
+TEST(ObjectPoolTest, StringBudgetTest) {
+
+    std::vector<std::shared_ptr<std::string>> stores;
+    for (int i=0; i<2048; ++i) {
+        auto store = ObjectPool<std::string>::acquire();
+        store->reserve(60 * 1024);
+        stores.push_back(store);
+    }
+
+    // 释放线程退出的时候本地缓存全部归还到仓库
+    std::thread release([&stores]() { stores.clear(); });
+    release.join();
+
+    ASSERT_THAT(FreeList<ObjectPool<std::string>>::depot_bytes(), Le(64 * 1024 * 1024));
+    ASSERT_THAT(FreeList<ObjectPool<std::string>>::depot_bytes(), Gt(0));
+}
+
+// 对象在一个线程中创建，在另外一个线程中释放
+TEST(ObjectPoolTest, CrossThreadTest) {
+
+    const int kRound = 20;
+    const int kCount = 500;
+
+    std::vector<std::shared_ptr<pooled_t>> objects;
+    objects.reserve(kCount);
+
+    uint64_t count = 0;
+    for (int r=0; r<kRound; ++r) {
+
+        uint64_t before = alloc_count;
+        for (int i=0; i<kCount; ++i) {
+            objects.push_back(std::allocate_shared<pooled_t>(PoolAllocator<pooled_t>()));
+        }
+        if (r == kRound - 1) {
+            count = alloc_count - before;
+        }
+
+        std::thread release([&objects]() { objects.clear(); });
+        release.join();
+    }
+
+    // 释放线程退出的时候本地缓存归还到仓库，之后的分配都从仓库领取
+    ASSERT_THAT(count, Eq(0));
+}
+
+// 上报请求的接收路径: 池中的缓冲区 -> ByteSlice -> 复用的 protobuf 对象 -> 复用的响应缓冲区
+TEST(ObjectPoolTest, RequestPathTest) {
+
+    MonitorTask::MonitorWriteOps::Request request;
+    auto report = request.mutable_report();
+    report->set_version("1.0.0");
+    report->set_timestamp(1550000000);
+    report->set_service("object_pool_test_service");
+    report->set_entity_idx("1");
+    for (int i=0; i<20; ++i) {
+        auto data = report->add_data();
+        data->set_msgid(i);
+        data->set_metric("object_pool_test_metric_" + std::to_string(i));
+        data->set_value(i * 100);
+        data->set_tag("object_pool_test_tag");
+    }
+
+    std::string payload;
+    ASSERT_TRUE(ProtoBuf::marshalling_to_string(request, &payload));
+    RpcRequestMessage rpc_request_message(0x01, 0x02, payload);
+    std::string wire = rpc_request_message.net_str();
+
+    Buffer recv;
+    MonitorTask::MonitorWriteOps::Request parsed;
+    MonitorTask::MonitorWriteOps::Response response;
+    std::string response_str;
+    std::string spare;
+
+    uint64_t count = 0;
+    for (int i=0; i<100; ++i) {
+
+        uint64_t before = alloc_count;
+
+        recv.append_internal(wire);
+        auto store = ObjectPool<std::string>::acquire();
+        recv.consume(*store, wire.size());
+
+        ByteSlice body(store);
+        RpcRequestHeader header;
+        ASSERT_TRUE(body.copy_to(reinterpret_cast<char*>(&header), sizeof(RpcRequestHeader)));
+        ByteSlice body_payload = body.sub(sizeof(RpcRequestHeader));
+
+        parsed.Clear();
+        ASSERT_TRUE(ProtoBuf::unmarshalling_from_array(body_payload.data(), body_payload.size(), &parsed));
+        ASSERT_THAT(parsed.report().data_size(), Eq(20));
+
+        response.Clear();
+        response.set_code(0);
+        response.set_desc("OK");
+        ASSERT_TRUE(ProtoBuf::marshalling_to_string(response, &response_str));
+
+        // 发送队列交换回来的空闲缓冲区
+        response_str.swap(spare);
+        response_str.clear();
+
+        if (i >= 10) {
+            count += alloc_count - before;
+        }
+    }
+
+    ASSERT_THAT(count, Eq(0));
+}
@@ -0,0 +1,92 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+#include <gmock/gmock.h>
+using namespace ::testing;
+
+#include <Business/Sort.h>
+
+
+static std::vector<event_info_t> make_infos(size_t count) {
+
+    std::vector<event_info_t> infos;
+    ::srandom(1);
+    for (size_t i=0; i<count; ++i) {
+        event_info_t info {};
+        info.timestamp = 1550000000 + i;
+        info.tag       = "tag_" + std::to_string(random() % 100);
+        info.count     = random() % 20;     // 大量重复的值
+        info.value_sum = random() % 100000;
+        info.value_avg = random() % 1000;
+        infos.push_back(info);
+    }
+    return infos;
+}
+
+
+TEST(SortTest, FullSortTest) {
+
+    std::vector<event_info_t> infos = make_infos(1000);
+
+    Sort::do_sort(infos, OrderByType::kOrderByCount, OrderType::kOrderDesc);
+    ASSERT_THAT(infos.size(), Eq(1000));
+    for (size_t i=1; i<infos.size(); ++i) {
+        ASSERT_THAT(infos[i-1].count, Ge(infos[i].count));
+
+        // 相同的值保持原来的顺序
+        if (infos[i-1].count == infos[i].count) {
+            ASSERT_THAT(infos[i-1].timestamp, Lt(infos[i].timestamp));
+        }
+    }
+
+    Sort::do_sort(infos, OrderByType::kOrderByTag, OrderType::kOrderAsc);
+    for (size_t i=1; i<infos.size(); ++i) {
+        ASSERT_THAT(infos[i-1].tag, Le(infos[i].tag));
+    }
+}
+
+
+TEST(SortTest, LimitSortTest) {
+
+    std::vector<event_info_t> expect = make_infos(5000);
+    Sort::do_sort(expect, OrderByType::kOrderBySum, OrderType::kOrderDesc);
+
+    // partial_sort 和 nth_element 两种路径
+    size_t limits[] = { 1, 10, 1024, 2000, 5000, 8000 };
+    for (size_t i=0; i<sizeof(limits)/sizeof(limits[0]); ++i) {
+
+        std::vector<event_info_t> infos = make_infos(5000);
+        Sort::do_sort(infos, OrderByType::kOrderBySum, OrderType::kOrderDesc, limits[i]);
+
+        ASSERT_THAT(infos.size(), Eq(std::min<size_t>(limits[i], 5000)));
+        for (size_t j=0; j<infos.size(); ++j) {
+            ASSERT_THAT(infos[j].value_sum, Eq(expect[j].value_sum));
+            ASSERT_THAT(infos[j].tag, Eq(expect[j].tag));
+        }
+    }
+}
+
+
+TEST(SortTest, TopKTest) {
+
+    std::vector<event_info_t> expect = make_infos(1000);
+    Sort::do_sort(expect, OrderByType::kOrderByAvg, OrderType::kOrderAsc, 20);
+
+    std::vector<event_info_t> infos = make_infos(1000);
+    TopK topk(OrderByType::kOrderByAvg, OrderType::kOrderAsc, 20);
+    ASSERT_TRUE(topk.valid());
+    for (size_t i=0; i<infos.size(); ++i) {
+        topk.push(infos[i]);
+    }
+
+    std::vector<event_info_t> result;
+    topk.collect(result);
+    ASSERT_THAT(result.size(), Eq(20));
+    for (size_t i=0; i<result.size(); ++i) {
+        ASSERT_THAT(result[i].value_avg, Eq(expect[i].value_avg));
+    }
+
+    TopK none(OrderByType::kOrderByNone, OrderType::kOrderAsc, 20);
+    ASSERT_FALSE(none.valid());
+}
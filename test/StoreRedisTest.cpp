@@ -0,0 +1,144 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <gmock/gmock.h>
+using namespace ::testing;
+
+#include <libconfig.h++>
+
+#include <Business/EventItem.h>
+#include <Business/StoreRedis.h>
+
+
+// 需要本地的 redis 服务，连接不上的时候跳过
+static bool redis_reachable() {
+
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(6379);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    bool ok = ::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0;
+    ::close(fd);
+    return ok;
+}
+
+#ifdef GTEST_SKIP
+#define SKIP_IF_NO_REDIS() \
+    if (!redis_reachable()) { GTEST_SKIP() << "redis 127.0.0.1:6379 unreachable"; }
+#else
+#define SKIP_IF_NO_REDIS() \
+    if (!redis_reachable()) { std::cout << "redis 127.0.0.1:6379 unreachable, skipped" << std::endl; return; }
+#endif
+
+static bool init_store(StoreRedis& store, int max_buckets_per_eval) {
+
+    // 每次使用不同的前缀，不受之前运行残留数据的影响
+    std::string conf_str =
+        "rpc = { business = { redis = { "
+        "host_addr = \"127.0.0.1\"; host_port = 6379; conn_pool_size = 2; "
+        "key_prefix = \"heracles_test_" + std::to_string(::time(NULL)) + "_" + std::to_string(::getpid()) + "\"; "
+        "bucket_span = 60; ttl = 3600; "
+        "max_buckets_per_eval = " + std::to_string(max_buckets_per_eval) + "; }; }; };";
+
+    libconfig::Config conf;
+    conf.readString(conf_str);
+    return store.init(conf);
+}
+
+static event_insert_t make_stat(time_t timestamp, const std::string& tag, int64_t value_sum) {
+
+    event_insert_t stat {};
+    stat.service    = "redis_test";
+    stat.metric     = "redis_test_metric";
+    stat.entity_idx = "1";
+    stat.tag        = tag;
+    stat.timestamp  = timestamp;
+    stat.count      = 1;
+    stat.value_sum  = value_sum;
+    stat.value_avg  = 10;
+    stat.value_min  = 10;
+    stat.value_max  = 10;
+    stat.value_p10  = 10;
+    stat.value_p50  = 10;
+    stat.value_p90  = 10;
+    return stat;
+}
+
+
+TEST(StoreRedisTest, AggregateAcrossChunksTest) {
+
+    SKIP_IF_NO_REDIS();
+
+    // 每次脚本只聚合一个桶，分组结果需要在本地合并
+    StoreRedis store;
+    ASSERT_TRUE(init_store(store, 1));
+
+    time_t now = ::time(NULL);
+    std::vector<event_insert_t> stats;
+    for (int i=0; i<10; ++i) {
+        stats.push_back(make_stat(now - 60 * i - 1, (i % 2) ? "A" : "B", 100 + i));
+    }
+    ASSERT_THAT(store.insert_ev_stats(stats), Eq(0));
+
+    event_cond_t cond {};
+    cond.service = "redis_test";
+    cond.metric  = "redis_test_metric";
+    cond.tm_interval = 1200;
+    cond.groupby = GroupType::kGroupbyTag;
+
+    event_select_t stat {};
+    ASSERT_THAT(store.select_ev_stat(cond, stat, 0), Eq(0));
+
+    ASSERT_THAT(stat.summary.count, Eq(10));
+    ASSERT_THAT(stat.summary.value_sum, Eq(1045));
+    ASSERT_THAT(stat.info.size(), Eq(2));
+    ASSERT_THAT(stat.info[0].tag, Eq("A"));
+    ASSERT_THAT(stat.info[0].count, Eq(5));
+    ASSERT_THAT(stat.info[0].value_sum, Eq(101 + 103 + 105 + 107 + 109));
+    ASSERT_THAT(stat.info[1].tag, Eq("B"));
+    ASSERT_THAT(stat.info[1].count, Eq(5));
+}
+
+TEST(StoreRedisTest, LargeSumPrecisionTest) {
+
+    SKIP_IF_NO_REDIS();
+
+    StoreRedis store;
+    ASSERT_TRUE(init_store(store, 12));
+
+    // 累加结果超过 2^53，double 无法精确表示
+    const int64_t large = (1LL << 53) + 1;
+
+    time_t now = ::time(NULL);
+    std::vector<event_insert_t> stats {
+        make_stat(now - 1, "T", large),
+        make_stat(now - 2, "T", large),
+        make_stat(now - 3, "T", -3),
+    };
+    ASSERT_THAT(store.insert_ev_stats(stats), Eq(0));
+
+    event_cond_t cond {};
+    cond.service = "redis_test";
+    cond.metric  = "redis_test_metric";
+    cond.tm_interval = 600;
+    cond.groupby = GroupType::kGroupNone;
+
+    event_select_t stat {};
+    ASSERT_THAT(store.select_ev_stat(cond, stat, 0), Eq(0));
+
+    ASSERT_THAT(stat.summary.count, Eq(3));
+    ASSERT_THAT(stat.summary.value_sum, Eq(large * 2 - 3));
+}
@@ -0,0 +1,125 @@
+#include <iostream>
+#include <string>
+#include <limits>
+
+#include <gmock/gmock.h>
+using namespace ::testing;
+
+#include <Business/TSDBCodec.h>
+
+using namespace tsdb;
+
+TEST(TSDBCodecTest, VarintTest) {
+
+    std::string buf;
+    Varint::put(buf, 0);
+    Varint::put(buf, 127);
+    Varint::put(buf, 128);
+    Varint::put(buf, std::numeric_limits<uint64_t>::max());
+    ASSERT_THAT(buf.size(), Eq(1 + 1 + 2 + 10));
+
+    const char* ptr = buf.c_str();
+    const char* limit = ptr + buf.size();
+    uint64_t v = 0;
+    ASSERT_TRUE(Varint::get(ptr, limit, v)); ASSERT_THAT(v, Eq(0));
+    ASSERT_TRUE(Varint::get(ptr, limit, v)); ASSERT_THAT(v, Eq(127));
+    ASSERT_TRUE(Varint::get(ptr, limit, v)); ASSERT_THAT(v, Eq(128));
+    ASSERT_TRUE(Varint::get(ptr, limit, v)); ASSERT_THAT(v, Eq(std::numeric_limits<uint64_t>::max()));
+    ASSERT_FALSE(Varint::get(ptr, limit, v));
+
+    ASSERT_THAT(Varint::unzigzag(Varint::zigzag(-1)), Eq(-1));
+    ASSERT_THAT(Varint::unzigzag(Varint::zigzag(-123456789)), Eq(-123456789));
+    ASSERT_THAT(Varint::zigzag(-1), Eq(1));
+}
+
+
+TEST(TSDBCodecTest, SeriesKeyTest) {
+
+    std::string metric, tag, entity_idx;
+
+    // 字段中的分隔符不影响解析
+    std::string key = SeriesKey::encode("a#b", "t#1", "");
+    ASSERT_TRUE(SeriesKey::decode(key, metric, tag, entity_idx));
+    ASSERT_THAT(metric, Eq("a#b"));
+    ASSERT_THAT(tag, Eq("t#1"));
+    ASSERT_THAT(entity_idx, Eq(""));
+
+    // metric 为 a 的前缀不会匹配 metric 为 a#b 的序列
+    std::string prefix = SeriesKey::prefix("a");
+    ASSERT_THAT(key.compare(0, prefix.size(), prefix), Ne(0));
+    ASSERT_THAT(SeriesKey::encode("a", "b", "c").compare(0, prefix.size(), prefix), Eq(0));
+
+    ASSERT_FALSE(SeriesKey::decode(key.substr(0, key.size() - 1), metric, tag, entity_idx));
+    ASSERT_FALSE(SeriesKey::decode(key + "x", metric, tag, entity_idx));
+}
+
+
+TEST(TSDBCodecTest, SeriesEncodeDecodeTest) {
+
+    SeriesEncoder encoder;
+    std::vector<point_t> expect;
+
+    time_t ts = 1550000000;
+    for (int i=0; i<1000; ++i) {
+        point_t pt {};
+        ts += (i % 17 == 0) ? 6 : 3;   // 偶尔的抖动
+        pt.timestamp = ts;
+        pt.count     = 100 + i % 5;
+        pt.value_sum = 123456789012LL + i;
+        pt.value_avg = 2000 + i % 3;
+        pt.value_min = -5;
+        pt.value_max = 4000 - i;
+        pt.value_p10 = 100;
+        pt.value_p50 = 2000;
+        pt.value_p90 = 3900;
+        encoder.append(pt);
+        expect.push_back(pt);
+    }
+
+    ASSERT_THAT(encoder.count(), Eq(1000));
+
+    // 压缩后的尺寸远小于原始结构
+    ASSERT_LT(encoder.bytes(), expect.size() * sizeof(point_t) / 4);
+
+    std::string data;
+    encoder.serialize(data);
+
+    std::vector<point_t> points;
+    ASSERT_TRUE(SeriesDecoder::decode(data.c_str(), data.size(), points));
+    ASSERT_THAT(points.size(), Eq(expect.size()));
+
+    for (size_t i=0; i<points.size(); ++i) {
+        ASSERT_THAT(points[i].timestamp, Eq(expect[i].timestamp));
+        ASSERT_THAT(points[i].count,     Eq(expect[i].count));
+        ASSERT_THAT(points[i].value_sum, Eq(expect[i].value_sum));
+        ASSERT_THAT(points[i].value_avg, Eq(expect[i].value_avg));
+        ASSERT_THAT(points[i].value_min, Eq(expect[i].value_min));
+        ASSERT_THAT(points[i].value_max, Eq(expect[i].value_max));
+        ASSERT_THAT(points[i].value_p10, Eq(expect[i].value_p10));
+        ASSERT_THAT(points[i].value_p50, Eq(expect[i].value_p50));
+        ASSERT_THAT(points[i].value_p90, Eq(expect[i].value_p90));
+    }
+
+    // 直接从编码器解码的结果和序列化之后解码的一致
+    std::vector<point_t> head_points;
+    ASSERT_TRUE(encoder.decode(head_points));
+    ASSERT_THAT(head_points.size(), Eq(points.size()));
+    for (size_t i=0; i<points.size(); ++i) {
+        ASSERT_THAT(head_points[i].timestamp, Eq(points[i].timestamp));
+        ASSERT_THAT(head_points[i].value_sum, Eq(points[i].value_sum));
+        ASSERT_THAT(head_points[i].value_p90, Eq(points[i].value_p90));
+    }
+
+    // 截断的数据不能解码
+    points.clear();
+    ASSERT_FALSE(SeriesDecoder::decode(data.c_str(), data.size() / 2, points));
+    ASSERT_TRUE(points.empty());
+
+    // 损坏的点数目在分配之前被拒绝
+    std::string broken;
+    Varint::put(broken, std::numeric_limits<uint64_t>::max() / 2);
+    Varint::put(broken, 4);
+    broken.append(4, '\0');
+    ASSERT_FALSE(SeriesDecoder::decode(broken.c_str(), broken.size(), points));
+    ASSERT_TRUE(points.empty());
+}
@@ -0,0 +1,129 @@
+#include <iostream>
+#include <string>
+
+#include <gmock/gmock.h>
+using namespace ::testing;
+
+#include <Network/TimingWheel.h>
+
+using namespace tzrpc;
+
+struct wheel_item_t: public std::enable_shared_from_this<wheel_item_t> {
+
+    wheel_item_t():
+        deadline_(0),
+        expired_(0),
+        hook_() {
+    }
+
+    time_t deadline() const {
+        return deadline_;
+    }
+
+    void expire() {
+        ++ expired_;
+    }
+
+    TimingWheelHook& wheel_hook() {
+        return hook_;
+    }
+
+    time_t deadline_;
+    int expired_;
+    TimingWheelHook hook_;
+};
+
+
+TEST(TimingWheelTest, ExpireTest) {
+
+    time_t now = 1550000000;
+    TimingWheel<wheel_item_t> wheel(now, 16);
+
+    auto item = std::make_shared<wheel_item_t>();
+    item->deadline_ = now + 5;
+    wheel.touch(*item);
+
+    wheel.tick(now + 4);
+    ASSERT_THAT(item->expired_, Eq(0));
+
+    wheel.tick(now + 5);
+    ASSERT_THAT(item->expired_, Eq(1));
+    ASSERT_THAT(wheel.expired_count(), Eq(1));
+
+    // 超时之后不再被检查
+    wheel.tick(now + 20);
+    ASSERT_THAT(item->expired_, Eq(1));
+}
+
+TEST(TimingWheelTest, ExtendTest) {
+
+    time_t now = 1550000000;
+    TimingWheel<wheel_item_t> wheel(now, 16);
+
+    auto item = std::make_shared<wheel_item_t>();
+    item->deadline_ = now + 5;
+    wheel.touch(*item);
+
+    // 延后截止时间，包括超出时间轮的范围
+    item->deadline_ = now + 40;
+    wheel.touch(*item);
+    ASSERT_THAT(item->hook_.scheduled_.load(), Eq(now + 5));
+
+    for (time_t t = now; t < now + 40; ++t) {
+        wheel.tick(t);
+        ASSERT_THAT(item->expired_, Eq(0));
+    }
+
+    wheel.tick(now + 40);
+    ASSERT_THAT(item->expired_, Eq(1));
+}
+
+TEST(TimingWheelTest, ShortenTest) {
+
+    time_t now = 1550000000;
+    TimingWheel<wheel_item_t> wheel(now, 16);
+
+    auto item = std::make_shared<wheel_item_t>();
+    item->deadline_ = now + 10;
+    wheel.touch(*item);
+
+    // 提前截止时间需要重新安排，旧的记录被丢弃
+    item->deadline_ = now + 3;
+    wheel.touch(*item);
+    ASSERT_THAT(item->hook_.scheduled_.load(), Eq(now + 3));
+
+    wheel.tick(now + 3);
+    ASSERT_THAT(item->expired_, Eq(1));
+
+    wheel.tick(now + 15);
+    ASSERT_THAT(item->expired_, Eq(1));
+}
+
+TEST(TimingWheelTest, RevokeTest) {
+
+    time_t now = 1550000000;
+    TimingWheel<wheel_item_t> wheel(now, 16);
+
+    auto item = std::make_shared<wheel_item_t>();
+    item->deadline_ = now + 2;
+    wheel.touch(*item);
+
+    item->deadline_ = 0;
+    wheel.tick(now + 10);
+    ASSERT_THAT(item->expired_, Eq(0));
+    ASSERT_THAT(item->hook_.scheduled_.load(), Eq(0));
+
+    // 重新设置之后继续管理
+    item->deadline_ = now + 12;
+    wheel.touch(*item);
+    wheel.tick(now + 12);
+    ASSERT_THAT(item->expired_, Eq(1));
+
+    // 对象释放之后的记录直接丢弃
+    auto other = std::make_shared<wheel_item_t>();
+    other->deadline_ = now + 14;
+    wheel.touch(*other);
+    other.reset();
+    wheel.tick(now + 20);
+    ASSERT_THAT(wheel.expired_count(), Eq(1));
+}
@@ -0,0 +1,92 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+
+#include <gmock/gmock.h>
+using namespace ::testing;
+
+#include <Core/ProtoBuf.h>
+#include <Protocol/Common.h>
+#include <Protocol/gen-cpp/MonitorTask.pb.h>
+
+#include <Client/UdpReportSender.h>
+
+using namespace tzrpc;
+
+
+TEST(UdpReportTest, SplitTest) {
+
+    // 本地回环上的接收端，端口由系统分配
+    int fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_THAT(fd, Ge(0));
+
+    struct sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_THAT(::bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)), Eq(0));
+
+    socklen_t addr_len = sizeof(addr);
+    ASSERT_THAT(::getsockname(fd, reinterpret_cast<struct sockaddr*>(&addr), &addr_len), Eq(0));
+
+    struct timeval tv {};
+    tv.tv_sec = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    heracles_client::UdpReportSender sender("127.0.0.1", ntohs(addr.sin_port), 512);
+    ASSERT_TRUE(sender.init());
+
+    event_report_t report {};
+    report.version = "1.0.0";
+    report.timestamp = 1550000000;
+    report.service = "udp_test";
+    report.entity_idx = "1";
+
+    for (int i=0; i<100; ++i) {
+        event_data_t item {};
+        item.msgid = i + 1;
+        item.metric = "udp_test_metric";
+        item.value = i;
+        item.tag = "T";
+        report.data.push_back(item);
+    }
+
+    // 单个数据报放不下，拆分之后一次发送
+    ASSERT_THAT(sender.send_report(report), Eq(100));
+    ASSERT_THAT(sender.send_count(), Eq(100));
+
+    int datagram = 0;
+    int64_t next_msgid = 1;
+    char buffer[kUdpReportMaxSize];
+    while (next_msgid <= 100) {
+
+        ssize_t len = ::recv(fd, buffer, sizeof(buffer), 0);
+        ASSERT_THAT(len, Gt(static_cast<ssize_t>(sizeof(UdpReportHeader))));
+        ASSERT_THAT(len, Le(512));
+        ++ datagram;
+
+        UdpReportHeader header {};
+        ::memcpy(&header, buffer, sizeof(header));
+        ASSERT_THAT(be16toh(header.magic), Eq(kUdpReportMagic));
+        ASSERT_THAT(header.version, Eq(kUdpReportVersion));
+
+        // 每个数据报都是完整的上报
+        MonitorTask::MonitorWriteOps::Request::ev_report_t pb_report;
+        ASSERT_TRUE(ProtoBuf::unmarshalling_from_array(buffer + sizeof(header), len - sizeof(header), &pb_report));
+        ASSERT_THAT(pb_report.service(), Eq("udp_test"));
+        ASSERT_THAT(pb_report.timestamp(), Eq(1550000000));
+
+        for (int i=0; i<pb_report.data_size(); ++i) {
+            ASSERT_THAT(pb_report.data(i).msgid(), Eq(next_msgid));
+            ASSERT_THAT(pb_report.data(i).value(), Eq(next_msgid - 1));
+            ++ next_msgid;
+        }
+    }
+
+    ASSERT_THAT(datagram, Gt(1));
+    ::close(fd);
+}